@@ -1,11 +1,21 @@
 #include <boost/filesystem/fstream.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/lexical_cast.hpp>
 
+#include <elle/assert.hh>
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
 #include <elle/serialize/PairSerializer.hxx>
 #include <elle/serialize/VectorSerializer.hxx>
 #include <elle/serialize/construct.hh>
 #include <elle/serialize/extract.hh>
 #include <elle/serialize/insert.hh>
 
+#include <reactor/scheduler.hh>
+
+#include <frete/Checksum.hh>
+#include <frete/Encoding.hh>
+
 #include <surface/gap/FilesystemTransferBufferer.hh>
 
 ELLE_LOG_COMPONENT("surface.gap.FilesystemTransferBufferer");
@@ -26,7 +36,15 @@ namespace surface
       _count(),
       _full_size(),
       _files(),
-      _key_code()
+      _key_code(),
+      _latency(default_latency()),
+      _index(),
+      _writer(false),
+      _index_size(0),
+      _segment_size(0),
+      _segment(),
+      _index_output(),
+      _reader()
     {
       try
       {
@@ -39,11 +57,13 @@ namespace surface
           >> this->_files;
         elle::serialize::from_file((this->_root / "key").string())
           >> this->_key_code;
+        this->_compressed = exists(this->_root / "compressed");
       }
       catch(...)
       {
         throw DataExhausted();
       }
+      this->_load(false);
     }
 
     FilesystemTransferBufferer::FilesystemTransferBufferer(
@@ -52,13 +72,22 @@ namespace surface
       FileCount count,
       FileSize full_size,
       std::vector<std::pair<std::string, FileSize>> const& files,
-      infinit::cryptography::Code const& key):
+      infinit::cryptography::Code const& key,
+      bool compressed):
       Super(transaction),
       _root(root / transaction.id),
       _count(count),
       _full_size(full_size),
       _files(files),
-      _key_code(key)
+      _key_code(key),
+      _latency(default_latency()),
+      _index(),
+      _writer(true),
+      _index_size(0),
+      _segment_size(0),
+      _segment(),
+      _index_output(),
+      _reader()
     {
       create_directories(this->_root);
       {
@@ -77,6 +106,31 @@ namespace surface
         elle::serialize::to_file((this->_root / "key").string())
           << key;
       }
+      this->_compressed = compressed;
+      if (compressed)
+      {
+        boost::filesystem::ofstream marker(this->_root / "compressed");
+      }
+      // Keep what a previous sender buffered, minus what it didn't finish
+      // writing.
+      this->_load(true);
+      this->_segment.open(this->_root / "segment",
+                          std::ios::binary | std::ios::app);
+      if (!this->_segment)
+        throw elle::Exception(
+          elle::sprintf("unable to open %s", this->_root / "segment"));
+    }
+
+    reactor::Duration
+    FilesystemTransferBufferer::default_latency()
+    {
+      std::string latency =
+        elle::os::getenv("INFINIT_FILEBUFFERER_LATENCY", "");
+      if (!latency.empty())
+        return boost::posix_time::milliseconds(
+          boost::lexical_cast<int>(latency));
+      else
+        return 20_ms;
     }
 
     /*------.
@@ -128,49 +182,178 @@ namespace surface
     void
     FilesystemTransferBufferer::put(FileID file,
                                     FileOffset offset,
-                                    FileSize size,
+                                    FileSize,
                                     elle::ConstWeakBuffer const& b)
     {
-      auto filename = this->_filename(file, offset);
-      boost::filesystem::ofstream output(filename);
-      output.write(reinterpret_cast<const char*>(b.contents()), b.size());
-      reactor::sleep(20_ms);
+      ELLE_ASSERT(this->_writer);
+      // The record, then its index entry, so that entries never refer to
+      // missing data.
+      unsigned char header[header_size];
+      frete::encoding::put_uint64(header, file);
+      frete::encoding::put_uint64(header + 8, offset);
+      frete::encoding::put_uint64(header + 16, b.size());
+      frete::encoding::put_uint64(header + 24, frete::checksum::update(0, b));
+      this->_segment.write(reinterpret_cast<char const*>(header), header_size);
+      this->_segment.write(reinterpret_cast<char const*>(b.contents()),
+                           b.size());
+      this->_segment.flush();
+      if (!this->_segment)
+        throw elle::Exception(
+          elle::sprintf("unable to write %s", this->_root / "segment"));
+      Location location{this->_segment_size + header_size, b.size()};
+      this->_segment_size = location.position + location.size;
+      this->_write_entry(file, offset, location);
+      this->_index[std::make_pair(file, offset)] = location;
+      if (this->_latency > reactor::Duration())
+        reactor::sleep(this->_latency);
     }
 
     elle::Buffer
     FilesystemTransferBufferer::get(FileID file,
                                     FileOffset offset)
     {
-      auto filename = this->_filename(file, offset);
-      boost::filesystem::ifstream input(filename);
-      input.seekg(0, std::ios::end);
-      std::ios::pos_type size = input.tellg();
-      if (size == std::ios::pos_type(-1))
+      auto key = std::make_pair(file, offset);
+      auto it = this->_index.find(key);
+      if (it == this->_index.end())
       {
-        ELLE_TRACE("Data exhausted on %s/%s at %s", file, offset, filename);
-        throw DataExhausted();
+        // The sender may have buffered it since.
+        this->_load(false);
+        it = this->_index.find(key);
+        if (it == this->_index.end())
+        {
+          ELLE_TRACE("Data exhausted on %s/%s", file, offset);
+          throw DataExhausted();
+        }
       }
-      elle::Buffer res(size);
-      input.seekg(0, std::ios::beg);
-      input.read(reinterpret_cast<char*>(res.mutable_contents()), size);
-      reactor::sleep(20_ms);
+      auto const& location = it->second;
+      if (!this->_reader.is_open())
+        this->_reader.open(this->_root / "segment", std::ios::binary);
+      this->_reader.clear();
+      this->_reader.seekg(location.position);
+      elle::Buffer res(location.size);
+      this->_reader.read(reinterpret_cast<char*>(res.mutable_contents()),
+                         location.size);
+      if (!this->_reader)
+        throw elle::Exception(
+          elle::sprintf("unable to read %s bytes at %s in %s",
+                        location.size, location.position,
+                        this->_root / "segment"));
+      if (this->_latency > reactor::Duration())
+        reactor::sleep(this->_latency);
       return res;
     }
 
-    boost::filesystem::path
-    FilesystemTransferBufferer::_filename(FileID file,
-                                          FileOffset offset)
+    void
+    FilesystemTransferBufferer::_load(bool repair)
+    {
+      auto index_path = this->_root / "index";
+      auto segment_path = this->_root / "segment";
+      FileSize segment_end =
+        exists(segment_path) ? file_size(segment_path) : 0;
+      if (exists(index_path))
+      {
+        boost::filesystem::ifstream input(index_path, std::ios::binary);
+        input.seekg(this->_index_size);
+        unsigned char entry[entry_size];
+        while (input.read(reinterpret_cast<char*>(entry), entry_size))
+        {
+          elle::ConstWeakBuffer data(entry, entry_size);
+          std::size_t position = 0;
+          auto file = frete::encoding::get_uint64(data, position);
+          auto offset = frete::encoding::get_uint64(data, position);
+          Location location{frete::encoding::get_uint64(data, position),
+                            frete::encoding::get_uint64(data, position)};
+          // Past the segment, the sender crashed before ending a repair.
+          if (location.position > segment_end ||
+              location.size > segment_end - location.position)
+            break;
+          this->_index[std::make_pair(file, offset)] = location;
+          this->_index_size += entry_size;
+          this->_segment_size = std::max(this->_segment_size,
+                                         location.position + location.size);
+        }
+        if (repair && file_size(index_path) != this->_index_size)
+        {
+          ELLE_WARN("%s: drop %s bytes of torn index",
+                    *this, file_size(index_path) - this->_index_size);
+          resize_file(index_path, this->_index_size);
+        }
+      }
+      // Index the complete records past the index.
+      int indexed = 0;
+      if (this->_segment_size + header_size <= segment_end)
+      {
+        boost::filesystem::ifstream input(segment_path, std::ios::binary);
+        input.seekg(this->_segment_size);
+        unsigned char header[header_size];
+        while (this->_segment_size + header_size <= segment_end &&
+               input.read(reinterpret_cast<char*>(header), header_size))
+        {
+          elle::ConstWeakBuffer fields(header, header_size);
+          std::size_t field = 0;
+          auto file = frete::encoding::get_uint64(fields, field);
+          auto offset = frete::encoding::get_uint64(fields, field);
+          FileSize size = frete::encoding::get_uint64(fields, field);
+          auto checksum = frete::encoding::get_uint64(fields, field);
+          FileOffset position = this->_segment_size + header_size;
+          if (size > segment_end - position)
+            break;
+          elle::Buffer data(size);
+          if (!input.read(reinterpret_cast<char*>(data.mutable_contents()),
+                          size) ||
+              frete::checksum::update(0, data) != checksum)
+            break;
+          Location location{position, size};
+          if (repair)
+            this->_write_entry(file, offset, location);
+          this->_index[std::make_pair(file, offset)] = location;
+          this->_segment_size = position + size;
+          ++indexed;
+        }
+      }
+      if (indexed > 0)
+        ELLE_TRACE("%s: indexed %s records past the index", *this, indexed);
+      if (repair && segment_end != this->_segment_size)
+      {
+        ELLE_WARN("%s: drop %s bytes of torn segment",
+                  *this, segment_end - this->_segment_size);
+        resize_file(segment_path, this->_segment_size);
+      }
+    }
+
+    void
+    FilesystemTransferBufferer::_write_entry(FileID file,
+                                             FileOffset offset,
+                                             Location const& location)
     {
-      auto dir = this->_root / std::to_string(file);
-      create_directory(dir);
-      return dir / boost::filesystem::path(
-        std::to_string(offset));
+      if (!this->_index_output.is_open())
+        this->_index_output.open(this->_root / "index",
+                                 std::ios::binary | std::ios::app);
+      unsigned char entry[entry_size];
+      frete::encoding::put_uint64(entry, file);
+      frete::encoding::put_uint64(entry + 8, offset);
+      frete::encoding::put_uint64(entry + 16, location.position);
+      frete::encoding::put_uint64(entry + 24, location.size);
+      this->_index_output.write(reinterpret_cast<char const*>(entry),
+                                entry_size);
+      this->_index_output.flush();
+      if (!this->_index_output)
+        throw elle::Exception(
+          elle::sprintf("unable to write %s", this->_root / "index"));
+      this->_index_size += entry_size;
     }
 
     TransferBufferer::List
     FilesystemTransferBufferer::list()
     {
-      return std::vector<std::pair<FileID, std::pair<FileSize, FileSize>>>();
+      this->_load(false);
+      List res;
+      res.reserve(this->_index.size());
+      for (auto const& chunk: this->_index)
+        res.emplace_back(chunk.first.first,
+                         std::make_pair(chunk.first.second,
+                                        chunk.second.size));
+      return res;
     }
 
     /*----------.
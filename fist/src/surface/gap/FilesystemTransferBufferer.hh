@@ -1,16 +1,32 @@
 #ifndef SURFACE_GAP_FILESYSTEM_TRANSFER_BUFFERER_HH
 # define SURFACE_GAP_FILESYSTEM_TRANSFER_BUFFERER_HH
 
+# include <cstdint>
+# include <map>
+
+# include <boost/filesystem/fstream.hpp>
 # include <boost/filesystem/path.hpp>
 
 # include <elle/attribute.hh>
 
+# include <reactor/duration.hh>
+
 # include <surface/gap/TransferBufferer.hh>
 
 namespace surface
 {
   namespace gap
   {
+    /// Buffer chunks in a local directory, for tests and relays.
+    ///
+    /// Chunks are appended to a single segment file as records holding
+    /// their file, offset, size and CRC32 before their data. An index file
+    /// maps each chunk to its record, one entry being appended once the
+    /// record is written. Either can be cut short by a crash: the sender
+    /// drops index entries past the segment and indexes the records past
+    /// the index again, truncating the segment at the first incomplete or
+    /// corrupted one. Recipients index complete records past the index too,
+    /// so they see all the sender wrote.
     class FilesystemTransferBufferer:
       public TransferBufferer
     {
@@ -35,7 +51,8 @@ namespace surface
                                  FileCount count,
                                  FileSize total_size,
                                  Files const& files,
-                                 infinit::cryptography::Code const& key);
+                                 infinit::cryptography::Code const& key,
+                                 bool compressed = false);
 # pragma clang diagnostic push
 # pragma clang diagnostic ignored "-Winconsistent-missing-override"
       ELLE_ATTRIBUTE_R(boost::filesystem::path, root);
@@ -44,6 +61,12 @@ namespace surface
       ELLE_ATTRIBUTE_R(Files, files);
       ELLE_ATTRIBUTE_R(infinit::cryptography::Code, key_code);
 # pragma clang diagnostic pop
+      /// Delay added to each put and get to behave like a remote store,
+      /// INFINIT_FILEBUFFERER_LATENCY milliseconds, 20 by default.
+      ELLE_ATTRIBUTE_RW(reactor::Duration, latency);
+      static
+      reactor::Duration
+      default_latency();
 
     /*------.
     | Frete |
@@ -94,10 +117,37 @@ namespace surface
       virtual
       void
       cleanup() override;
+
+    /*--------.
+    | Segment |
+    `--------*/
+    public:
+      /// Bytes of a record header and of an index entry.
+      static FileSize const header_size = 32;
+      static FileSize const entry_size = 32;
+      /// Where a chunk is stored in the segment.
+      struct Location
+      {
+        FileOffset position;
+        FileSize size;
+      };
+      typedef std::map<std::pair<FileID, FileOffset>, Location> Index;
+      ELLE_ATTRIBUTE_R(Index, index);
     private:
-      boost::filesystem::path
-      _filename(FileID file,
-                FileOffset offset);
+      /// Read the index entries added since last time, and the records past
+      /// them. The sender repairs the files on the way.
+      void
+      _load(bool repair);
+      /// Append an entry to the index file.
+      void
+      _write_entry(FileID file, FileOffset offset, Location const& location);
+      ELLE_ATTRIBUTE(bool, writer);
+      /// Bytes of the index file and of the segment indexed.
+      ELLE_ATTRIBUTE(FileSize, index_size);
+      ELLE_ATTRIBUTE(FileSize, segment_size);
+      ELLE_ATTRIBUTE(boost::filesystem::ofstream, segment);
+      ELLE_ATTRIBUTE(boost::filesystem::ofstream, index_output);
+      ELLE_ATTRIBUTE(boost::filesystem::ifstream, reader);
 
     /*----------.
     | Printable |
@@ -15,6 +15,10 @@
 #include <reactor/http/exceptions.hh>
 #include <reactor/network/exception.hh>
 
+#include <frete/BufferPool.hh>
+#include <frete/DiskWriter.hh>
+#include <frete/FileWriter.hh>
+
 #include <infinit/metrics/Reporter.hh>
 
 ELLE_LOG_COMPONENT("surface.gap.GhostReceiveMachine");
@@ -248,6 +252,9 @@ namespace surface
       }
 
       this->gap_status(gap_transaction_transferring);
+      auto& disk = *this->state().disk_writer();
+      // Writes queued and not known to be done.
+      std::deque<frete::DiskWriter::Ticket> pending;
       int attempt = 0;
       while (true)
       {
@@ -283,13 +290,17 @@ namespace surface
                 infinit::metrics::TransferMethodCloud,
                 0);
             }
+            // Resume after what the previous attempt wrote.
+            for (; !pending.empty(); pending.pop_front())
+              disk.wait(pending.front());
             boost::system::error_code erc;
             _previous_progress = boost::filesystem::file_size(_path, erc);
             if (erc)
               _previous_progress = 0;
             ELLE_TRACE("%s: resuming at %s", *this, _previous_progress);
             boost::filesystem::create_directories(_path.parent_path());
-            elle::system::FileHandle file(_path, elle::system::FileHandle::APPEND);
+            auto file = std::make_shared<frete::FileWriter>(_path);
+            auto offset = _previous_progress;
             using namespace reactor::http;
             Request::Configuration config
               = Request::Configuration(reactor::DurationOpt(), 60_sec);
@@ -297,12 +308,14 @@ namespace surface
             _request = elle::make_unique<Request>(url, Method::GET, config);
             _request->finalize();
             // Waiting for the status here will wait for full download.
-            static const int buffer_size = 16000;
-            elle::Buffer buffer(buffer_size);
+            // Read by slabs of the buffer pool.
+            static const int buffer_size = frete::BufferPool::slab_size;
             while (true)
             {
+              // The previous buffer may still be queued for writing.
+              auto buffer = this->state().buffer_pool()->buffer(buffer_size);
               ELLE_DUMP("%s: read", *this);
-              _request->read((char*)buffer.contents(), buffer_size);
+              _request->read((char*)buffer->contents(), buffer_size);
               int bytes_read = _request->gcount();
               ELLE_DUMP("%s: read %s,  progress %s", *this, bytes_read, progress());
               StatusCode s = _request->status();
@@ -310,16 +323,20 @@ namespace surface
                 && s != StatusCode::Partial_Content)
                  throw std::runtime_error( // Consider this as fatal.
                    elle::sprintf("HTTP error %s : %s",
-                                 s, buffer.string()));
+                                 s, buffer->string()));
               if (!bytes_read)
                 break;
-              buffer.size(bytes_read);
-              // Because writing on the disk is not asynchronous, it might block
-              // this thread (especially on Windows) if the filesystem is slow.
-              reactor::yield();
-              file.write(buffer);
+              buffer->size(bytes_read);
+              pending.push_back(disk.write(file, offset, buffer));
+              offset += bytes_read;
+              // Report failed writes as they complete.
+              for (; !pending.empty() && disk.done(pending.front());
+                   pending.pop_front())
+                disk.wait(pending.front());
               total_bytes_transfered += bytes_read;
             }
+            for (; !pending.empty(); pending.pop_front())
+              disk.wait(pending.front());
             exit_reason = infinit::metrics::TransferExitReasonFinished;
             break;
           }
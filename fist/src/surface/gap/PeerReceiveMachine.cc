@@ -18,8 +18,17 @@
 
 #include <common/common.hh>
 
+#include <frete/Bundle.hh>
+#include <frete/Checksum.hh>
+#include <frete/Compression.hh>
+#include <frete/CryptoPool.hh>
+#include <frete/Dedup.hh>
+#include <frete/DiskWriter.hh>
+#include <frete/FetchController.hh>
+#include <frete/FileWriter.hh>
 #include <frete/Frete.hh>
 #include <frete/RPCFrete.hh>
+#include <frete/SourceScheduler.hh>
 #include <frete/TransferSnapshot.hh>
 
 #include <papier/Identity.hh>
@@ -85,6 +94,127 @@ namespace surface
         return 8;
     }
 
+    /// Number of blocks requested at once from peers supporting it.
+    static
+    int
+    rpc_range_size()
+    {
+      std::string nr = elle::os::getenv("INFINIT_CHUNKS_PER_REQUEST", "");
+      if (!nr.empty())
+        return std::max(1, boost::lexical_cast<int>(nr));
+      else
+        return 4;
+    }
+
+    /// Number of concurrent requests to the cloud buffer fetched along
+    /// with the peer.
+    static
+    int
+    cloud_readers()
+    {
+      std::string nr = elle::os::getenv("INFINIT_CLOUD_READERS", "");
+      if (!nr.empty())
+        return std::max(1, boost::lexical_cast<int>(nr));
+      else
+        return 4;
+    }
+
+    // Whether range requests to a source return compressed chunks.
+    static
+    bool
+    compressed_chunks(frete::RPCFrete&)
+    {
+      return frete::compression::enabled();
+    }
+
+    static
+    bool
+    compressed_chunks(TransferBufferer& bufferer)
+    {
+      return bufferer.compressed();
+    }
+
+    // Whether blocks can be requested at any size. Cloud buffers store them
+    // by chunks of a fixed size.
+    static
+    bool
+    tunable_chunks(frete::RPCFrete&)
+    {
+      return true;
+    }
+
+    static
+    bool
+    tunable_chunks(TransferBufferer&)
+    {
+      return false;
+    }
+
+    // The source if it is a peer, for the requests only peers answer.
+    static
+    frete::RPCFrete*
+    peer_source(frete::RPCFrete& source)
+    {
+      return &source;
+    }
+
+    static
+    frete::RPCFrete*
+    peer_source(TransferBufferer&)
+    {
+      return nullptr;
+    }
+
+    /// Number of concurrent checksum jobs verifying resumed files.
+    static
+    int
+    verify_workers()
+    {
+      std::string nr = elle::os::getenv("INFINIT_VERIFY_WORKERS", "");
+      if (!nr.empty())
+        return std::max(1, boost::lexical_cast<int>(nr));
+      else
+        return 4;
+    }
+
+    // Compare received files with the sent ones once complete, unless
+    // INFINIT_NO_RECEIVED_VERIFICATION is set.
+    static
+    bool
+    verify_received()
+    {
+      return elle::os::getenv("INFINIT_NO_RECEIVED_VERIFICATION", "").empty();
+    }
+
+    // Receive the files of the transfer a page at a time, unless
+    // INFINIT_NO_PAGED_MANIFEST is set.
+    static
+    bool
+    paged_manifest()
+    {
+      return elle::os::getenv("INFINIT_NO_PAGED_MANIFEST", "").empty();
+    }
+
+    // Hash received files from the start, to deduplicate later transfers.
+    static
+    std::shared_ptr<frete::dedup::Hasher>
+    received_hasher(PeerReceiveMachine::FileSize position,
+                    PeerReceiveMachine::FileSize size)
+    {
+      if (position != 0 || size < frete::dedup::min_size() ||
+          !frete::dedup::enabled())
+        return nullptr;
+      return std::make_shared<frete::dedup::Hasher>();
+    }
+
+    // Write blocks in place as they arrive, from INFINIT_POSITIONAL_WRITES.
+    static
+    bool
+    positional_writes()
+    {
+      return !elle::os::getenv("INFINIT_POSITIONAL_WRITES", "").empty();
+    }
+
     static
     std::streamsize
     rpc_chunk_size()
@@ -108,25 +238,29 @@ namespace surface
       , PeerMachine(transaction, id, std::move(data), transaction.authority())
       , _frete_snapshot_path(this->transaction().snapshots_directory()
                              / "frete.snapshot")
+      , _frete_snapshot_journal(this->_frete_snapshot_path)
       , _snapshot(nullptr)
       , _completed(false)
       , _nothing_in_the_cloud(false)
       , _chunk_size(rpc_chunk_size())
+      , _files_info()
+      , _files_ready(0)
+      , _manifest_page()
+      , _manifest_fetching(false)
+      , _fetch_controller()
+      , _fetch_in_flight(0)
+      , _sources()
+      , _main_source(0)
+      , _cloud_source(-1)
+      , _cloud_readers(0)
+      , _positional(false)
     {
       try
       {
-        if (exists(this->_frete_snapshot_path))
-        {
-          elle::AtomicFile file(this->_frete_snapshot_path);
-          file.read() << [&] (elle::AtomicFile::Read& read)
-          {
-            elle::serialization::json::SerializerIn input(read.stream(), false);
-            this->_snapshot.reset(new frete::TransferSnapshot(input));
-          };
-          if (this->_snapshot->file_count())
-            ELLE_DEBUG("Reloaded snapshot, first file at %s",
-                       this->_snapshot->file(0).progress());
-        }
+        this->_snapshot = this->_frete_snapshot_journal.load();
+        if (this->_snapshot && this->_snapshot->file_count())
+          ELLE_DEBUG("Reloaded snapshot, first file at %s",
+                     this->_snapshot->file(0).progress());
       }
       catch (boost::filesystem::filesystem_error const&)
       {
@@ -292,6 +426,27 @@ namespace surface
     PeerReceiveMachine::_transfer_operation(frete::RPCFrete& frete)
     {
       ELLE_TRACE_SCOPE("%s: transfer operation", *this);
+      // Fetch what the sender buffered in the cloud along with the peer.
+      if (!this->_bufferer &&
+          this->data()->cloud_buffered &&
+          frete::SourceScheduler::enabled() &&
+          elle::os::getenv("INFINIT_NO_CLOUD_BUFFERING", "").empty())
+        try
+        {
+          this->_create_bufferer();
+        }
+        catch (TransferBufferer::DataExhausted const&)
+        {
+          ELLE_TRACE("%s: nothing in the cloud", *this);
+        }
+        catch (reactor::Terminate const&)
+        {
+          throw;
+        }
+        catch (elle::Exception const& e)
+        {
+          ELLE_WARN("%s: unable to open cloud buffer: %s", *this, e.what());
+        }
       elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
       {
         scope.run_background(
@@ -345,34 +500,7 @@ namespace surface
       });
       try
       {
-        ELLE_DEBUG("%s: create cloud bufferer", *this);
-        bool cloud_debug =
-          !elle::os::getenv("INFINIT_CLOUD_FILEBUFFERER", "").empty();
-        if (cloud_debug)
-        {
-          _bufferer.reset(
-            new FilesystemTransferBufferer(*this->data(),
-                                           "/tmp/infinit-buffering"));
-        }
-        else
-        {
-          auto get_credentials = [this] (bool first_time)
-            {
-              auto creds = this->_cloud_credentials(first_time);
-              auto awscreds = dynamic_cast<infinit::oracles::meta::CloudCredentialsAws*>(creds.get());
-              ELLE_ASSERT(awscreds);
-              return *static_cast<aws::Credentials*>(awscreds);
-            };
-          this->_bufferer.reset(
-            new S3TransferBufferer(
-              elle::make_unique<S3>(this->state(), get_credentials),
-              *this->data(),
-              std::bind(&PeerReceiveMachine::_report_s3_error,
-                        this,
-                        std::placeholders::_1,
-                        std::placeholders::_2)
-              ));
-        }
+        this->_create_bufferer();
         if (auto& mr = state().metrics_reporter())
         {
           auto now = boost::posix_time::microsec_clock::universal_time();
@@ -491,6 +619,13 @@ namespace surface
           this->_transfer_info = frete::Frete::TransferInfo{
             count, source.full_size(), files_info};
         }
+        else if (this->peer_version(source) >= elle::Version(0, 9, 44) &&
+                 paged_manifest() && peer_source(source))
+        {
+          // The files are received a page at a time.
+          this->_transfer_info = frete::Frete::TransferInfo{
+            source.count(), source.full_size(), {}};
+        }
         else
         {
           this->_transfer_info = source.transfer_info();
@@ -499,6 +634,92 @@ namespace surface
       return this->_transfer_info.get();
     }
 
+    PeerReceiveMachine::FileInfo
+    PeerReceiveMachine::_file_info(FileID index)
+    {
+      while (index >= this->_files_ready)
+        this->_fetch_manifest();
+      return this->_files_info[index];
+    }
+
+    void
+    PeerReceiveMachine::_fetch_manifest()
+    {
+      if (this->_manifest_fetching)
+      {
+        reactor::wait(this->_manifest_fetched);
+        return;
+      }
+      this->_manifest_fetching = true;
+      elle::SafeFinally fetched(
+        [this]
+        {
+          this->_manifest_fetching = false;
+          this->_manifest_fetched.signal();
+        });
+      this->_manifest_page();
+    }
+
+    template <typename Source>
+    void
+    PeerReceiveMachine::_fetch_manifest_page(
+      Source& source,
+      frete::RPCFrete* peer,
+      infinit::cryptography::SecretKey const* key)
+    {
+      auto const& info = this->transfer_info(source);
+      auto count = info.count();
+      FileID begin = this->_files_info.size();
+      // Recent peers leave the files out of the transfer info.
+      bool paged = peer && info.files_info().size() != count;
+      if (paged)
+      {
+        auto page = peer->files_info_page(
+          begin, frete::Frete::files_info_page_size);
+        if (page.empty())
+          throw elle::Exception(
+            elle::sprintf("manifest ends at %s of %s files", begin, count));
+        ELLE_DEBUG("%s: received %s files of the manifest from %s",
+                   *this, page.size(), begin);
+        this->_files_info.insert(this->_files_info.end(),
+                                 std::make_move_iterator(page.begin()),
+                                 std::make_move_iterator(page.end()));
+      }
+      else if (info.files_info().size() != count)
+        // The transfer info was cached from a paged peer, the cloud buffer
+        // has the whole manifest.
+        this->_files_info = source.files_info();
+      else
+        this->_files_info = info.files_info();
+      FileID end = this->_files_info.size();
+      if (end > count || (!paged && end != count))
+        throw elle::Exception(
+          elle::sprintf("manifest of %s files, expected %s", end, count));
+      if (peer && key)
+      {
+        if (frete::dedup::enabled())
+          this->_deduplicate(*peer, *key, begin, end);
+        if (frete::sparse::enabled())
+          this->_find_holes(*peer, *key, begin, end);
+      }
+      this->_files_ready = end;
+      if (end == count && peer && key && frete::dedup::enabled())
+      {
+        FileSize duplicate_size = 0;
+        for (auto const& duplicate: this->_duplicates)
+          duplicate_size += this->_files_info[duplicate.first].second;
+        ELLE_TRACE("%s: %s duplicates of %s bytes", *this,
+                   this->_duplicates.size(), duplicate_size);
+        if (auto& mr = this->state().metrics_reporter())
+          mr->transaction_deduplication(
+            this->transaction_id(),
+            count,
+            info.full_size(),
+            this->_duplicates.size(),
+            duplicate_size);
+      }
+    }
+
     void
     PeerReceiveMachine::get(frete::RPCFrete& frete,
                             std::string const& name_policy)
@@ -610,7 +831,7 @@ namespace surface
       auto clean_snpashot = [&] {
         try
         {
-          boost::filesystem::remove(this->_frete_snapshot_path);
+          this->_frete_snapshot_journal.remove();
         }
         catch (std::exception const&)
         {
@@ -621,6 +842,10 @@ namespace surface
 
       // Clear hypotetical blocks we fetched but did not process.
       this->_buffers.clear();
+      this->_writers.clear();
+      // Old peers are told the progress by the disk writer.
+      this->_positional =
+        positional_writes() && peer_version >= elle::Version(0, 8, 7);
       boost::filesystem::path output_path(this->state().output_dir());
       auto count = this->transfer_info(source).count();
 
@@ -646,22 +871,6 @@ namespace surface
       }
       ELLE_DEBUG("transfer snapshot: %s", *this->_snapshot);
 
-      FilesInfo files_info = source.files_info();
-      ELLE_ASSERT_GTE(files_info.size(), this->_snapshot->count());
-      // reconstruct directory name mapping data so that files in transfer
-      // but not yet in snapshot will reuse it
-      for (unsigned i = 0; i < this->_snapshot->file_count(); ++i)
-      {
-        // get asked/got relative path from output_path
-        boost::filesystem::path got = this->_snapshot->file(i).path();
-        boost::filesystem::path asked = files_info.at(i).first;
-        boost::filesystem::path got0 = *got.begin();
-        boost::filesystem::path asked0 = *asked.begin();
-        // add to the mapping even if its the same
-        ELLE_DEBUG("Adding entry to path map: %s -> %s", asked0, got0);
-        _root_component_mapping[asked0] = got0;
-      }
-
       // FIXME: gcc 4.7 don't recognize the move assignment, hence the
       // unique_ptr instead of key = SecretKey(...)
       std::unique_ptr<infinit::cryptography::SecretKey> key;
@@ -682,10 +891,69 @@ namespace surface
           break;
       }
 
+      // The files are looked for duplicates and holes as their page of the
+      // manifest is received.
+      this->_files_info.clear();
+      this->_files_ready = 0;
+      this->_duplicates.clear();
+      this->_dedup_sizes.clear();
+      this->_dedup_first.clear();
+      this->_holes.clear();
+      this->_manifest_page = std::bind(
+        &PeerReceiveMachine::_fetch_manifest_page<Source>,
+        this, std::ref(source),
+        peer_version >= elle::Version(0, 9, 44) ? peer_source(source) : nullptr,
+        encryption == EncryptionLevel_Strong ? key.get() : nullptr);
+      // reconstruct directory name mapping data so that files in transfer
+      // but not yet in snapshot will reuse it
+      for (unsigned i = 0; i < this->_snapshot->file_count(); ++i)
+      {
+        // get asked/got relative path from output_path
+        boost::filesystem::path got = this->_snapshot->file(i).path();
+        boost::filesystem::path asked = this->_file_info(i).first;
+        boost::filesystem::path got0 = *got.begin();
+        boost::filesystem::path asked0 = *asked.begin();
+        // add to the mapping even if its the same
+        ELLE_DEBUG("Adding entry to path map: %s -> %s", asked0, got0);
+        _root_component_mapping[asked0] = got0;
+      }
+      this->_verify_resumed(
+        encryption == EncryptionLevel_Strong &&
+        peer_version >= elle::Version(0, 9, 44) ?
+        peer_source(source) : nullptr,
+        key.get());
+
+      bool explicit_ack = peer_version >= elle::Version(0, 8, 9);
+      // Batch consecutive blocks in one request if the peer knows how.
+      int range =
+        explicit_ack && peer_version >= elle::Version(0, 9, 44) ?
+        rpc_range_size() : 0;
+      // Fetch what the sender buffered in the cloud along with the peer.
+      TransferBufferer* cloud =
+        encryption == EncryptionLevel_Strong && range > 0 &&
+        frete::SourceScheduler::enabled() && peer_source(source) ?
+        this->_bufferer.get() : nullptr;
+      // The pipeline starts as configured and is then tuned to the link.
+      // Cloud buffers store chunks of the transfer size only.
+      this->_fetch_controller.reset(
+        new frete::FetchController(
+          rpc_pipeline_size(), this->_chunk_size, range,
+          frete::FetchController::enabled() && tunable_chunks(source) &&
+          !cloud));
+      this->_fetch_in_flight = 0;
+      this->_sources.reset(
+        new frete::SourceScheduler(this->_fetch_controller->memory()));
+      this->_main_source =
+        this->_sources->add(peer_source(source) ? "peer" : "cloud");
+      this->_cloud_source = cloud ? this->_sources->add("cloud") : -1;
+      this->_cloud_readers = cloud ? cloud_readers() : 0;
       // Due to parallel fetcher threads, we might have empty files
       // in there. We still validate block in order, so there is no 'hole'.
       _fetch_current_file_index = 0;
-      bool things_to_do = _fetch_next_file(name_policy, files_info);
+      bool things_to_do = _fetch_next_file(name_policy);
+      // The writer starts at the first file to fetch, copy the duplicates
+      // before it now.
+      this->_copy_duplicates(things_to_do ? _fetch_current_file_index : count);
       if (!things_to_do)
         ELLE_TRACE("Nothing to do");
       if (things_to_do)
@@ -700,28 +968,63 @@ namespace surface
           // Have multiple reader threads, sharing read position
           // so we push stuff in order to 'buffers' (we are assuming a
           // synchronous singlethreaded RPC handler at the other end)
-          // The idea is to absorb 'gaps' in link availability.
-          // Counting 256k packet size and 10Mo/s, two pending requests
-          // 'buffers' for 1/20th of a second
-          static int num_reader = rpc_pipeline_size();
-          bool explicit_ack = peer_version >= elle::Version(0, 8, 9);
+          // The idea is to absorb 'gaps' in link availability. How many
+          // requests are actually in flight is up to the controller.
+          auto const& controller = *this->_fetch_controller;
+          int num_reader = frete::FetchController::enabled() ?
+            frete::FetchController::max_depth : controller.depth();
+          bool compressed = range > 0 && compressed_chunks(source);
+          // Small files are requested whole, many at a time.
+          frete::RPCFrete* bundles =
+            range > 0 && encryption == EncryptionLevel_Strong &&
+            frete::bundle::enabled() ? peer_source(source) : nullptr;
+          ELLE_TRACE("%s: request %s blocks at a time, compressed: %s, "
+                     "bundled: %s, cloud: %s",
+                     *this, std::max(range, 1), compressed, bundles != nullptr,
+                     cloud != nullptr);
           // Prevent unlimited ram buffering if a block fetcher gets stuck
-          this->_buffers.max_size(num_reader * 3);
+          this->_buffers.max_size(
+            (controller.depth() + this->_cloud_readers) *
+            (controller.blocks() + 2));
+          for (int i = 0; i < this->_cloud_readers; ++i)
+            scope.run_background(
+              elle::sprintf("cloud reader %s", i),
+              std::bind(&PeerReceiveMachine::_cloud_fetcher_thread,
+                        this, std::ref(*cloud), i, name_policy, range,
+                        compressed_chunks(*cloud), std::ref(*key)));
           for (int i = 0; i < num_reader; ++i)
               scope.run_background(
                 elle::sprintf("transfer reader %s", i),
                 std::bind(&PeerReceiveMachine::_fetcher_thread<Source>,
                           this, std::ref(source), i, name_policy, explicit_ack,
-                          encryption, this->_chunk_size, std::ref(*key),
-                          files_info));
+                          range, compressed, bundles, encryption,
+                          std::ref(*key)));
+          // Receive the rest of the manifest while fetching the first
+          // files.
           scope.run_background(
-            "receive writer",
-            std::bind(&PeerReceiveMachine::_disk_thread<Source>,
-                      this, std::ref(source),
-                      peer_version, this->_chunk_size));
+            "manifest",
+            [this, count]
+            {
+              while (this->_files_ready < count)
+                this->_fetch_manifest();
+            });
+          if (!this->_positional)
+            scope.run_background(
+              "receive writer",
+              std::bind(&PeerReceiveMachine::_disk_thread<Source>,
+                        this, std::ref(source), peer_version));
           try
           {
             reactor::wait(scope);
+            // Without the disk writer, duplicates are left to copy.
+            if (this->_positional)
+              this->_copy_duplicates(count);
+            this->_writers.clear();
+            if (encryption == EncryptionLevel_Strong &&
+                peer_version >= elle::Version(0, 9, 44) &&
+                verify_received())
+              if (auto peer = peer_source(source))
+                this->_verify_received(*peer, *key);
           }
           catch (boost::filesystem::filesystem_error const& e)
           {
@@ -732,6 +1035,20 @@ namespace surface
           clean_snpashot();
           ELLE_TRACE("finish_transfer exited cleanly");
         }; // scope
+        ELLE_TRACE("%s: fetched from %s", *this, *this->_sources);
+        if (auto s3 = dynamic_cast<S3TransferBufferer*>(this->_bufferer.get()))
+        {
+          auto stats = s3->take_read_stats();
+          ELLE_TRACE("%s: %s cloud requests, %s hedged, %s won by the hedge, "
+                     "%s reads split",
+                     *this, stats.requests, stats.hedged, stats.hedge_wins,
+                     stats.split);
+          if (stats.requests > 0)
+            if (auto& mr = this->state().metrics_reporter())
+              mr->transaction_cloud_reads(
+                this->transaction_id(), stats.requests, stats.hedged,
+                stats.hedge_wins, stats.split, stats.hedge_threshold);
+        }
         if (exception)
           return;
       }// if current_transfer
@@ -801,6 +1118,20 @@ namespace surface
       {
         throw;
       }
+      if (!tr.complete() &&
+          this->_duplicates.find(index) != this->_duplicates.end())
+      {
+        ELLE_DEBUG("%s: %s is a duplicate, nothing to fetch", *this, fullpath);
+        // Save the chosen name, the writer will copy it.
+        this->_save_frete_snapshot();
+        return FileSize(-1);
+      }
+      // Chunks are kept the size they were first received by.
+      this->_snapshot->file_chunks(
+        index,
+        !this->_positional ? 0 :
+        tr.chunk_size() ? tr.chunk_size() :
+        this->_fetch_controller->chunk_size());
       if (tr.complete())
       {
         ELLE_DEBUG("%s: transfer was marked as complete", *this);
@@ -812,6 +1143,37 @@ namespace surface
         }
         return FileSize(-1);
       }
+      if (this->_positional)
+      {
+        // Blocks land anywhere in the file: allocate it whole and let the
+        // fetchers skip the chunks already received.
+        auto writer = this->_writer(index);
+        auto size = tr.size();
+        auto holes = this->_holes.find(index);
+        if (holes == this->_holes.end())
+          reactor::background([&] { writer->preallocate(size); });
+        else
+        {
+          // Leave the holes unallocated and count the chunks lying in one
+          // as received.
+          reactor::background([&] { writer->extend(size); });
+          auto chunk_size = tr.chunk_size();
+          for (auto const& hole: holes->second)
+          {
+            auto offset =
+              (hole.first + chunk_size - 1) / chunk_size * chunk_size;
+            for (; offset < size; offset += chunk_size)
+            {
+              auto chunk = std::min(chunk_size, size - offset);
+              if (offset + chunk > hole.first + hole.second)
+                break;
+              this->_snapshot->file_chunk_received(index, offset, chunk);
+            }
+          }
+        }
+        this->_save_frete_snapshot();
+        return 0;
+      }
       if (boost::filesystem::exists(fullpath))
       {
         // Check size against snapshot data
@@ -858,19 +1220,15 @@ namespace surface
     };
 
     bool
-    PeerReceiveMachine::_fetch_next_file(
-      const std::string& name_policy,
-      FilesInfo const& infos)
+    PeerReceiveMachine::_fetch_next_file(const std::string& name_policy)
     {
       FileSize pos = 0;
       // switch to next file until we find one for which there is something to do
-      while (_fetch_current_file_index < infos.size())
+      while (_fetch_current_file_index < _snapshot->count())
       {
+        auto info = this->_file_info(_fetch_current_file_index);
         pos = this->_initialize_one(
-          _fetch_current_file_index,
-          infos.at(_fetch_current_file_index).first,
-          infos.at(_fetch_current_file_index).second,
-          name_policy);
+          _fetch_current_file_index, info.first, info.second, name_policy);
         if (pos != FileSize(-1))
           break;
         ++_fetch_current_file_index;
@@ -893,42 +1251,131 @@ namespace surface
       Source& source, int id,
       const std::string& name_policy,
       bool explicit_ack,
+      int range,
+      bool compressed,
+      frete::RPCFrete* bundles,
       EncryptionLevel encryption,
-      size_t chunk_size,
-      const infinit::cryptography::SecretKey& key,
-      FilesInfo const& files_info)
+      const infinit::cryptography::SecretKey& key)
     {
+      auto& controller = *this->_fetch_controller;
+      auto& sources = *this->_sources;
+      // Whether another source may give blocks back.
+      bool idle = false;
       while (true)
       {
-        if (_fetch_current_file_index == -1u)
+        if (idle)
         {
-          ELLE_DUMP("Thread %s has nothing to do, exiting", id);
-          break; // some other thread figured out this was over
+          reactor::wait(this->_fetch_slot);
+          idle = false;
         }
+        // Wait for the pipeline to have room for one more request, and for
+        // the peer to be due one along with the cloud buffer.
+        while (this->_fetch_in_flight >= controller.depth() ||
+               !sources.admit(this->_main_source,
+                              controller.chunk_size() * std::max(range, 1)))
+          reactor::wait(this->_fetch_slot);
+        ++this->_fetch_in_flight;
+        elle::SafeFinally release(
+          [this]
+          {
+            --this->_fetch_in_flight;
+            this->_fetch_slot.signal();
+          });
+        // Reserve the memory of the request before its blocks, so that the
+        // next block to write never waits for the budget held by later ones.
+        auto reservation = this->state().buffer_pool()->reserve(
+          std::max<FileSize>(
+            controller.chunk_size() * std::max(range, 1),
+            bundles ? frete::bundle::max_size() : 0));
         ELLE_DUMP("Reading buffer at %s/%s in mode %s",
           _fetch_current_file_index,
           _fetch_current_position,
+          range > 0 ? std::string("read_encrypt_range") :
           explicit_ack? std::string("read_encrypt_ack") :
            boost::lexical_cast<std::string>(encryption)
           );
-        if (_fetch_current_position >= _fetch_current_file_full_size)
+        // Reserve the next blocks, possibly spanning files, so that
+        // concurrent fetchers request different ones.
+        if (bundles)
         {
-          ELLE_DEBUG("Thread %s would read past end", id);
-          ++_fetch_current_file_index;
-          if (!_fetch_next_file(name_policy, files_info))
+          auto files = this->_fetch_bundle(name_policy);
+          if (!files.empty())
           {
-            // we're done
-            _fetch_current_file_index = -1;
-            break;
+            FileSize requested = 0;
+            for (auto file: files)
+              requested += this->_snapshot->file(file).size();
+            FileSize delivered = 0;
+            sources.start(this->_main_source, requested);
+            elle::SafeFinally account(
+              [&]
+              {
+                sources.end(this->_main_source, requested, delivered);
+              });
+            // This blocks, no shared state access past that point!
+            auto start = boost::posix_time::microsec_clock::universal_time();
+            auto code = bundles->encrypted_read_files(
+              files, this->_snapshot->progress(), compressed);
+            auto rtt =
+              boost::posix_time::microsec_clock::universal_time() - start;
+            auto payload = this->_decrypt_block(
+              key, code, frete::Frete::Position(files.front(), 0), compressed);
+            this->_fetch_sample(payload.size(), rtt);
+            delivered = requested;
+            this->_queue_bundle(files, payload, reservation);
+            continue;
           }
-
+        }
+        FileSize chunk_size = controller.chunk_size();
+        auto positions = this->_fetch_positions(
+          name_policy, std::max(range, 1), true, chunk_size);
+        if (positions.empty())
+        {
+          if (sources.pending(this->_main_source))
+          {
+            ELLE_DUMP("Thread %s waits for blocks given back", id);
+            idle = true;
+            continue;
+          }
+          ELLE_DUMP("Thread %s has nothing to do, exiting", id);
+          break;
+        }
+        FileSize requested = chunk_size * positions.size();
+        FileSize delivered = 0;
+        sources.start(this->_main_source, requested);
+        elle::SafeFinally account(
+          [&]
+          {
+            sources.end(this->_main_source, requested, delivered);
+          });
+        // This blocks, no shared state access past that point!
+        auto start = boost::posix_time::microsec_clock::universal_time();
+        if (range > 0)
+        {
+          auto codes = source.encrypted_read_range(
+            positions, chunk_size, this->_snapshot->progress(), compressed);
+          auto rtt = boost::posix_time::microsec_clock::universal_time() - start;
+          if (codes.size() != positions.size())
+            throw elle::Exception(
+              elle::sprintf("requested %s blocks, got %s",
+                            positions.size(), codes.size()));
+          std::vector<elle::Buffer> buffers;
+          FileSize bytes = 0;
+          for (unsigned i = 0; i < positions.size(); ++i)
+          {
+            buffers.push_back(
+              this->_decrypt_block(key, codes[i], positions[i], compressed));
+            bytes += buffers.back().size();
+          }
+          this->_fetch_sample(bytes, rtt);
+          delivered = bytes;
+          for (unsigned i = 0; i < positions.size(); ++i)
+            this->_queue_block(std::move(buffers[i]), positions[i], chunk_size,
+                               reservation);
+          continue;
         }
         // local cache for next block
-        FileSize local_position = _fetch_current_position;
-        FileID   local_index    = _fetch_current_file_index;
-        _fetch_current_position += chunk_size;
-
-        // This line blocks, no shared state access past that point!
+        FileSize local_position = positions.front().second;
+        FileID   local_index    = positions.front().first;
         // For some reasons this can't be rewritten cleanly: the compiler
         // burst into flames about deleted =(const&), thus ignoring
         // =(&&)  when writing code = f();
@@ -950,106 +1397,469 @@ namespace surface
           buffer = std::move(source.read(local_index, local_position, chunk_size).buffer());
           break;
         }
+        auto rtt = boost::posix_time::microsec_clock::universal_time() - start;
         if (encryption != EncryptionLevel_None)
+          buffer = this->_decrypt_block(key, code, positions.front(), false);
+        this->_fetch_sample(buffer.size(), rtt);
+        delivered = buffer.size();
+        this->_queue_block(std::move(buffer), positions.front(), chunk_size,
+                           reservation);
+      }
+      ELLE_DEBUG("reader %s exiting cleanly", id);
+    }
+
+    frete::Frete::Positions
+    PeerReceiveMachine::_fetch_positions(std::string const& name_policy,
+                                         int count,
+                                         bool take_back,
+                                         FileSize& chunk_size)
+    {
+      frete::Frete::Positions positions;
+      // Blocks given back are the earliest outstanding, and go alone since
+      // they are seldom consecutive.
+      if (take_back)
+        if (auto position = this->_sources->take_back())
         {
-          try
+          if (this->_positional)
+            chunk_size = this->_snapshot->file(position->first).chunk_size();
+          positions.push_back(*position);
+          return positions;
+        }
+      while (positions.size() < static_cast<unsigned>(count))
+      {
+        if (_fetch_current_file_index == -1u)
+          break; // some other thread figured out this was over
+        if (_fetch_current_position >= _fetch_current_file_full_size)
+        {
+          ELLE_DEBUG("%s: end of file %s", *this, _fetch_current_file_index);
+          ++_fetch_current_file_index;
+          if (!_fetch_next_file(name_policy))
           {
-            buffer = key.legacy_decrypt_buffer(code);
+            // we're done
+            _fetch_current_file_index = -1;
+            break;
           }
-          catch (infinit::cryptography::Error const& e)
+        }
+        if (!this->_positional)
+        {
+          // Holes are recreated by the writer.
+          if (auto hole = this->_hole(_fetch_current_file_index,
+                                      _fetch_current_position))
           {
-            ELLE_WARN("%s: decryption error on block %s/%s: %s", *this, local_index, local_position, e.what());
-            throw;
+            _fetch_current_position = hole->first + hole->second;
+            continue;
           }
-          ELLE_ASSERT_NO_OTHER_EXCEPTION
         }
-        ELLE_DUMP("Queuing buffer %s/%s size:%s. Writer waits for %s/%s",
-          local_index, local_position, buffer.size(),
-          _store_expected_file, _store_expected_position);
-        // Subtelty here: put will block us *after* the insert operation
-        // if queue is full, so we must notify the reader thread before the
-        // put
-         if (local_index == _store_expected_file
-          && local_position == _store_expected_position)
+        else
         {
-          ELLE_DUMP("Opening disk writer barrier at %s/%s", local_index, local_position);
-          _disk_writer_barrier.open();
+          // Chunks written in place are at fixed offsets.
+          auto const& file = this->_snapshot->file(_fetch_current_file_index);
+          if (positions.empty())
+            chunk_size = file.chunk_size();
+          else if (file.chunk_size() != chunk_size)
+            break;
+          if (file.chunk_received(_fetch_current_position))
+          {
+            _fetch_current_position += chunk_size;
+            continue;
+          }
         }
-        this->_buffers.put(
-          IndexedBuffer{std::move(buffer),
-                        local_position, local_index});
+        positions.emplace_back(_fetch_current_file_index,
+                               _fetch_current_position);
+        _fetch_current_position += chunk_size;
+      }
+      return positions;
+    }
+
+    void
+    PeerReceiveMachine::_cloud_fetcher_thread(
+      TransferBufferer& cloud, int id,
+      std::string const& name_policy,
+      int range,
+      bool compressed,
+      infinit::cryptography::SecretKey const& key)
+    {
+      auto& sources = *this->_sources;
+      FileSize request = this->_chunk_size * range;
+      while (sources.active(this->_cloud_source))
+      {
+        if (!sources.admit(this->_cloud_source, request))
+        {
+          reactor::wait(this->_fetch_slot);
+          continue;
+        }
+        auto reservation = this->state().buffer_pool()->reserve(request);
+        FileSize chunk_size = this->_chunk_size;
+        // Blocks given back are left to the peer.
+        auto positions =
+          this->_fetch_positions(name_policy, range, false, chunk_size);
+        if (positions.empty())
+          break;
+        // Cloud buffers store chunks of the transfer size only.
+        if (chunk_size != this->_chunk_size)
+        {
+          sources.give_back(positions);
+          sources.stop(this->_cloud_source);
+          break;
+        }
+        FileSize requested = chunk_size * positions.size();
+        FileSize delivered = 0;
+        sources.start(this->_cloud_source, requested);
+        elle::SafeFinally account(
+          [&]
+          {
+            sources.end(this->_cloud_source, requested, delivered);
+            this->_fetch_slot.signal();
+          });
+        std::vector<elle::Buffer> buffers;
+        try
+        {
+          // This blocks, no shared state access past that point!
+          auto codes = cloud.encrypted_read_range(
+            positions, chunk_size, this->_snapshot->progress(), compressed);
+          if (codes.size() != positions.size())
+            throw elle::Exception(
+              elle::sprintf("requested %s blocks, got %s",
+                            positions.size(), codes.size()));
+          for (unsigned i = 0; i < positions.size(); ++i)
+          {
+            buffers.push_back(
+              this->_decrypt_block(key, codes[i], positions[i], compressed));
+            delivered += buffers.back().size();
+          }
+        }
+        catch (reactor::Terminate const&)
+        {
+          throw;
+        }
+        catch (TransferBufferer::DataExhausted const&)
+        {
+          ELLE_TRACE("%s: cloud reader %s: cloud buffer exhausted at %s/%s",
+                     *this, id, positions.front().first,
+                     positions.front().second);
+          sources.give_back(positions);
+          sources.stop(this->_cloud_source);
+          break;
+        }
+        catch (elle::Exception const& e)
+        {
+          ELLE_WARN("%s: cloud reader %s: unable to fetch %s/%s: %s",
+                    *this, id, positions.front().first,
+                    positions.front().second, e.what());
+          sources.give_back(positions);
+          sources.stop(this->_cloud_source);
+          break;
+        }
+        for (unsigned i = 0; i < positions.size(); ++i)
+          this->_queue_block(std::move(buffers[i]), positions[i], chunk_size,
+                             reservation);
+      }
+      ELLE_DEBUG("cloud reader %s exiting cleanly", id);
+    }
+
+    std::vector<PeerReceiveMachine::FileID>
+    PeerReceiveMachine::_fetch_bundle(std::string const& name_policy)
+    {
+      std::vector<FileID> res;
+      FileSize size = 0;
+      while (res.size() < frete::bundle::max_files)
+      {
+        if (_fetch_current_file_index == -1u)
+          break;
+        if (_fetch_current_position >= _fetch_current_file_full_size)
+        {
+          ++_fetch_current_file_index;
+          if (!_fetch_next_file(name_policy))
+          {
+            _fetch_current_file_index = -1;
+            break;
+          }
+        }
+        // Leave partially received, big and sparse files to chunk requests.
+        // Files written in place must fit in one chunk.
+        auto const& file = this->_snapshot->file(_fetch_current_file_index);
+        if (_fetch_current_position != 0 ||
+            file.size() > frete::bundle::max_file_size() ||
+            this->_holes.find(_fetch_current_file_index) !=
+              this->_holes.end() ||
+            (this->_positional && file.size() > file.chunk_size()) ||
+            (!res.empty() && size + file.size() > frete::bundle::max_size()))
+          break;
+        res.push_back(_fetch_current_file_index);
+        size += file.size();
+        _fetch_current_position = file.size();
+      }
+      return res;
+    }
+
+    void
+    PeerReceiveMachine::_queue_bundle(std::vector<FileID> const& files,
+                                      elle::Buffer const& payload,
+                                      Reservation const& reservation)
+    {
+      auto contents = frete::bundle::unpack(payload);
+      if (contents.size() != files.size())
+        throw elle::Exception(
+          elle::sprintf("requested %s files, got %s",
+                        files.size(), contents.size()));
+      ELLE_DEBUG("%s: received %s files in %s bytes",
+                 *this, files.size(), payload.size());
+      auto queue = [&] (std::size_t i)
+        {
+          this->_queue_block(
+            elle::Buffer(contents[i].contents(), contents[i].size()),
+            frete::Frete::Position(files[i], 0),
+            this->_snapshot->file(files[i]).size(),
+            reservation);
+        };
+      if (!this->_positional)
+      {
+        for (std::size_t i = 0; i < files.size(); ++i)
+          queue(i);
+        return;
+      }
+      // Queue all the files to the disk writer before waiting for any.
+      elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+      {
+        for (std::size_t i = 0; i < files.size(); ++i)
+          scope.run_background(elle::sprintf("bundled file %s", files[i]),
+                               [&, i] { queue(i); });
+        reactor::wait(scope);
+      };
+    }
+
+    elle::Buffer
+    PeerReceiveMachine::_decrypt_block(
+      infinit::cryptography::SecretKey const& key,
+      infinit::cryptography::Code const& code,
+      frete::Frete::Position const& position,
+      bool compressed)
+    {
+      try
+      {
+        return this->state().crypto_pool()->decrypt(key, code, compressed);
+      }
+      catch (infinit::cryptography::Error const& e)
+      {
+        ELLE_WARN("%s: decryption error on block %s/%s: %s",
+                  *this, position.first, position.second, e.what());
+        throw;
+      }
+      ELLE_ASSERT_NO_OTHER_EXCEPTION
+    }
+
+    void
+    PeerReceiveMachine::_queue_block(elle::Buffer buffer,
+                                     frete::Frete::Position const& position,
+                                     FileSize size,
+                                     Reservation reservation)
+    {
+      auto const& file = this->_snapshot->file(position.first);
+      FileSize expected = std::min(size, file.size() - position.second);
+      if (buffer.size() != expected)
+        throw boost::filesystem::filesystem_error(
+          elle::sprintf("block at %s has %s bytes, expected %s",
+                        position.second, buffer.size(), expected),
+          _file_full_path(this->state().output_dir(), *this->_snapshot, file),
+          boost::system::errc::make_error_code(boost::system::errc::io_error));
+      // Blocks written in place are written before the reservation ends.
+      if (this->_positional)
+        return this->_write_block(std::move(buffer), position);
+      FileID local_index = position.first;
+      FileSize local_position = position.second;
+      ELLE_DUMP("Queuing buffer %s/%s size:%s. Writer waits for %s/%s",
+        local_index, local_position, buffer.size(),
+        _store_expected_file, _store_expected_position);
+      // Subtelty here: put will block us *after* the insert operation
+      // if queue is full, so we must notify the reader thread before the
+      // put
+      if (local_index == _store_expected_file
+          && local_position == _store_expected_position)
+      {
+        ELLE_DUMP("Opening disk writer barrier at %s/%s", local_index, local_position);
+        _disk_writer_barrier.open();
+      }
+      this->_buffers.put(
+        IndexedBuffer{std::move(buffer),
+                      local_position, local_index, std::move(reservation)});
+    }
+
+    std::shared_ptr<frete::FileWriter>
+    PeerReceiveMachine::_writer(FileID index)
+    {
+      auto it = this->_writers.find(index);
+      if (it != this->_writers.end())
+        return it->second;
+      auto path = _file_full_path(this->state().output_dir(),
+                                  *this->_snapshot,
+                                  this->_snapshot->file(index));
+      ELLE_TRACE("%s: write %s in place", *this, path);
+      auto res = std::make_shared<frete::FileWriter>(path);
+      this->_writers[index] = res;
+      return res;
+    }
+
+    void
+    PeerReceiveMachine::_write_block(elle::Buffer buffer,
+                                     frete::Frete::Position const& position)
+    {
+      FileID index = position.first;
+      FileSize offset = position.second;
+      // Hold the writer, it is closed once the file is complete.
+      auto writer = this->_writer(index);
+      ELLE_DUMP("%s: write %s bytes of file %s at %s",
+                *this, buffer.size(), index, offset);
+      auto data = std::make_shared<elle::Buffer const>(std::move(buffer));
+      auto& disk = *this->state().disk_writer();
+      disk.wait(disk.write(writer, offset, data));
+      if (this->_snapshot->file_chunk_received(index, offset, data->size()))
+        this->_frete_snapshot_journal.chunk(
+          *this->_snapshot, index, offset, data->size());
+      if (this->_snapshot->file(index).complete())
+      {
+        ELLE_TRACE("%s: %s is complete", *this, writer->path());
+        this->_writers.erase(index);
       }
-      ELLE_DEBUG("reader %s exiting cleanly", id);
     }
 
     template<typename Source>
     void
-    PeerReceiveMachine::_disk_thread(Source& source, elle::Version peer_version,
-                                     size_t chunk_size)
+    PeerReceiveMachine::_disk_thread(Source& source, elle::Version peer_version)
     {
       // somebody initialized our _store_expected_ state
       ELLE_TRACE_SCOPE("%s: start writing blocks to disk", *this);
+      auto& disk = *this->state().disk_writer();
+      // Blocks queued to the disk writer, recorded in the snapshot once
+      // written.
+      struct Written
+      {
+        frete::DiskWriter::Ticket ticket;
+        FileID file;
+        /// The data written, null for a hole of hole bytes.
+        std::shared_ptr<elle::Buffer const> data;
+        FileSize hole;
+        /// The memory budget of the data, given back once written.
+        Reservation reservation;
+        /// The hasher of a file received whole, on its last block, to
+        /// index once written.
+        std::shared_ptr<frete::dedup::Hasher> hasher;
+        boost::filesystem::path path;
+      };
+      reactor::Channel<Written> written;
+      frete::DiskWriter::Ticket last = 0;
       // Cached current transfer info to avoid refetching each time.
       // it should be there, but a logic error that gives us a
       // nothing-to-do-on-this-first-file state is possible and nonfatal
       // so do not use at
-      elle::system::FileHandle current_file_handle;
+      std::shared_ptr<frete::FileWriter> current_file;
       FileSize current_file_full_size;
       boost::filesystem::path current_file_full_path;
-      {
-        frete::TransferSnapshot::File& f = _snapshot->file(_store_expected_file);
-        current_file_full_size = f.size();
-        current_file_full_path = _file_full_path(this->state().output_dir(),
-                                                 *this->_snapshot, f);
-        ELLE_TRACE("%s will write to %s", *this, current_file_full_path);
-        current_file_handle = elle::system::FileHandle(current_file_full_path,
-                                                       elle::system::FileHandle::APPEND);
-      }
-      while (true)
-      {
-        ELLE_DUMP("%s waiting for block %s/%s", *this, _store_expected_file,
-          _store_expected_position);
-        reactor::wait(_disk_writer_barrier);
-        while (true)
-        { // we might have successive blocks ready in the pipe, and nobody
-          // will notify us of the ones after the top() one.
-          IndexedBuffer data = this->_buffers.get();
-          if (data.file_index == FileID(-1))
-          {
-            ELLE_DEBUG("%s: done writing blocks to disk", *this);
-            break;
-          }
-          const elle::Buffer& buffer = data.buffer;
-          ELLE_DUMP("%s: receiver got data for file %s at position %s with size %s, "
-                     "will write to %s",
-                     *this,
-                     data.file_index, data.start_position,
-                     data.buffer.size(),
-                     current_file_full_path);
-          // If this assert fails, packets were received out of order.
-          ELLE_ASSERT_EQ(_store_expected_file, data.file_index);
-          ELLE_ASSERT_EQ(_store_expected_position, data.start_position);
-
-          // Write the file.
-          ELLE_DUMP("content: %x (%sB)", buffer, buffer.size());
-          current_file_handle.write(buffer);
-          this->_snapshot->file_progress_increment(_store_expected_file, buffer.size());
-          // OLD clients need this RPC to update progress
-          if (peer_version < elle::Version(0, 8, 7))
-            source.set_progress(this->_snapshot->progress());
-          // Write snapshot state to file
-          ELLE_DUMP("%s: write down snapshot", *this)
-          {
-            ELLE_DUMP("%s: snapshot: %s", *this, *this->_snapshot);
-            this->_save_frete_snapshot();
-          }
-           _store_expected_position += buffer.size();
-           ELLE_ASSERT_EQ(_store_expected_position,
-                          _snapshot->file(_store_expected_file).progress());
-          if (buffer.size() < chunk_size
-            || _store_expected_position >= current_file_full_size)
+      // Received data is hashed by the disk writer thread.
+      std::shared_ptr<frete::dedup::Hasher> hasher;
+      auto open = [&] (frete::TransferSnapshot::File const& f)
+        {
+          current_file_full_size = f.size();
+          current_file_full_path = _file_full_path(this->state().output_dir(),
+                                                   *this->_snapshot, f);
+          ELLE_TRACE("%s will write to %s", *this, current_file_full_path);
+          current_file.reset();
+          // Sparse files are allocated as written, around their holes.
+          bool sparse =
+            this->_holes.find(f.file_id()) != this->_holes.end();
+          reactor::background(
+            [&]
+            {
+              current_file =
+                std::make_shared<frete::FileWriter>(current_file_full_path);
+              if (!sparse)
+                current_file->reserve(current_file_full_size);
+            });
+          hasher =
+            received_hasher(_store_expected_position, current_file_full_size);
+        };
+      // Move to the next data to write, skipping holes, copying duplicates
+      // and opening files. Return false once every file is written.
+      auto advance = [&] () -> bool
+        {
+          while (true)
           {
+            if (auto hole = this->_hole(_store_expected_file,
+                                        _store_expected_position))
+            {
+              auto end = hole->first + hole->second;
+              auto size = end - _store_expected_position;
+              ELLE_DEBUG("%s: skip hole of %s bytes at %s/%s", *this, size,
+                         _store_expected_file, _store_expected_position);
+              // Keep the file size its progress, and don't hash it whole.
+              auto file = current_file;
+              reactor::background([&] { file->extend(end); });
+              hasher.reset();
+              written.put(Written{last, _store_expected_file, nullptr, size,
+                                  nullptr, nullptr, current_file_full_path});
+              _store_expected_position = end;
+            }
             if (_store_expected_position != current_file_full_size)
+              // We need blocks for that one.
+              return true;
+            ++_store_expected_file;
+            if (_store_expected_file == _snapshot->count())
+            {
+              ELLE_TRACE("%s: writer thread is done", *this);
+              return false;
+            }
+            frete::TransferSnapshot::File& f =
+              _snapshot->file(_store_expected_file);
+            if (this->_duplicates.find(_store_expected_file) !=
+                this->_duplicates.end())
+            {
+              // The duplicate may be a file still being written. Errors are
+              // reported by the progress thread.
+              disk.flush(last);
+              this->_copy_duplicate(_store_expected_file);
+              _store_expected_position = current_file_full_size = f.size();
+              continue;
+            }
+            _store_expected_position = f.progress();
+            open(f);
+          }
+        };
+      auto write = [&]
+      {
+        open(_snapshot->file(_store_expected_file));
+        if (!advance())
+          return;
+        while (true)
+        {
+          ELLE_DUMP("%s waiting for block %s/%s", *this, _store_expected_file,
+            _store_expected_position);
+          reactor::wait(_disk_writer_barrier);
+          while (true)
+          { // we might have successive blocks ready in the pipe, and nobody
+            // will notify us of the ones after the top() one.
+            IndexedBuffer data = this->_buffers.get();
+            if (data.file_index == FileID(-1))
+            {
+              ELLE_DEBUG("%s: done writing blocks to disk", *this);
+              return;
+            }
+            ELLE_DUMP("%s: receiver got data for file %s at position %s with size %s, "
+                       "will write to %s",
+                       *this,
+                       data.file_index, data.start_position,
+                       data.buffer.size(),
+                       current_file_full_path);
+            // If this assert fails, packets were received out of order.
+            ELLE_ASSERT_EQ(_store_expected_file, data.file_index);
+            ELLE_ASSERT_EQ(_store_expected_position, data.start_position);
+
+            // Queue the write, the progress is recorded once written.
+            auto buffer =
+              std::make_shared<elle::Buffer const>(std::move(data.buffer));
+            ELLE_DUMP("content: %x (%sB)", *buffer, buffer->size());
+            last = disk.write(current_file, _store_expected_position, buffer,
+                              hasher);
+            _store_expected_position += buffer->size();
+            if (_store_expected_position > current_file_full_size)
             {
               ELLE_ERR("%s: end of transfer with unexpected size, "
                        "got %s, expected %s",
@@ -1062,59 +1872,551 @@ namespace surface
                 current_file_full_path,
                 boost::system::errc::make_error_code(boost::system::errc::io_error));
             }
-          }
+            std::shared_ptr<frete::dedup::Hasher> whole;
+            if (hasher && _store_expected_position == current_file_full_size)
+              whole = hasher;
+            written.put(Written{last, _store_expected_file, std::move(buffer),
+                                0, std::move(data.reservation),
+                                std::move(whole), current_file_full_path});
 
-          // Update our expected file if needed
-          while (_store_expected_position == current_file_full_size)
-          {
-            ++_store_expected_file;
-            if (_store_expected_file == _snapshot->count())
-            {
-              ELLE_TRACE("%s: writer thread is done", *this);
+            // Update our expected file if needed
+            if (!advance())
               return;
+            // Check next available data
+            if (this->_buffers.empty())
+            {
+              _disk_writer_barrier.close();
+              break; // break to outer while that will wait on barrier
             }
-            frete::TransferSnapshot::File& f = _snapshot->file(_store_expected_file);
-            _store_expected_position = f.progress();
-            current_file_full_size = f.size();
-            current_file_full_path = _file_full_path(this->state().output_dir(),
-                                                     *this->_snapshot, f);
-            current_file_handle = elle::system::FileHandle(current_file_full_path,
-                                                           elle::system::FileHandle::APPEND);
-            if (_store_expected_position != current_file_full_size)
+            const IndexedBuffer& next = this->_buffers.peek();
+            if (next.start_position != _store_expected_position
+               || next.file_index != _store_expected_file)
             {
-              // We need blocks for that one.
-              ELLE_TRACE("%s will write to %s", *this, current_file_full_path);
-              break;
+              _disk_writer_barrier.close();
+              break; // break to outer while that will wait on barrier
             }
-          }
-          // Check next available data
-          if (this->_buffers.empty())
-          {
-            _disk_writer_barrier.close();
-            break; // break to outer while that will wait on barrier
-          }
-          const IndexedBuffer& next = this->_buffers.peek();
-          if (next.start_position != _store_expected_position
-             || next.file_index != _store_expected_file)
+          } // inner while true
+        } // outer while true
+      };
+      elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+      {
+        scope.run_background(
+          "receive progress",
+          [&]
           {
-            _disk_writer_barrier.close();
-            break; // break to outer while that will wait on barrier
-          }
-        } // inner while true
-      } // outer while true
-      // No need to Finally the block below, it stops an other thread in
-      // the same scope
+            while (true)
+            {
+              Written block = written.get();
+              if (block.file == FileID(-1))
+                break;
+              disk.wait(block.ticket);
+              if (block.data)
+                this->_snapshot->file_progress_increment(block.file,
+                                                         *block.data);
+              else
+                this->_snapshot->file_progress_increment(block.file,
+                                                         block.hole);
+              // OLD clients need this RPC to update progress
+              if (peer_version < elle::Version(0, 8, 7))
+                source.set_progress(this->_snapshot->progress());
+              // Journal the progress
+              ELLE_DUMP("%s: snapshot: %s", *this, *this->_snapshot);
+              this->_save_frete_progress(block.file);
+              // Record the files received whole in the deduplication index.
+              if (block.hasher)
+                this->state().dedup_index()->add(block.hasher->digest(),
+                                                 block.path);
+            }
+          });
+        write();
+        written.put(
+          Written{0, FileID(-1), nullptr, 0, nullptr, nullptr, {}});
+        reactor::wait(scope);
+      };
+      if (frete::dedup::enabled())
+        this->state().dedup_index()->save();
     }
 
     void
-    PeerReceiveMachine::_save_frete_snapshot()
+    PeerReceiveMachine::_fetch_sample(FileSize bytes,
+                                      boost::posix_time::time_duration rtt)
     {
-      elle::AtomicFile file(this->_frete_snapshot_path.string());
-      file.write() << [&] (elle::AtomicFile::Write& write)
+      if (!frete::FetchController::enabled())
+        return;
+      auto& controller = *this->_fetch_controller;
+      if (!controller.sample(bytes, rtt))
+        return;
+      ELLE_TRACE("%s: fetch with %s", *this, controller);
+      this->_buffers.max_size(
+        (controller.depth() + this->_cloud_readers) * (controller.blocks() + 2));
+      this->_fetch_slot.signal();
+      if (auto& mr = this->state().metrics_reporter())
+        mr->transaction_transfer_tuning(
+          this->transaction_id(),
+          controller.depth(),
+          controller.chunk_size(),
+          controller.rtt().total_microseconds() / 1000000.f,
+          controller.goodput(),
+          controller.bdp());
+    }
+
+    void
+    PeerReceiveMachine::_deduplicate(frete::RPCFrete& source,
+                                     infinit::cryptography::SecretKey const& key,
+                                     FileID begin,
+                                     FileID end)
+    {
+      auto const& infos = this->_files_info;
+      auto const& index = *this->state().dedup_index();
+      auto min_size = frete::dedup::min_size();
+      // Only files sharing their size with another one may be duplicates.
+      std::unordered_map<FileSize, int> sizes;
+      for (auto i = begin; i < end; ++i)
+        if (infos[i].second >= min_size)
+          ++sizes[infos[i].second];
+      // The earlier files now sharing their size are only hashed for their
+      // duplicates to be found, they may be fetched already.
+      std::unordered_set<FileID> earlier;
+      std::vector<FileID> candidates;
+      for (auto const& size: sizes)
       {
-        elle::serialization::json::SerializerOut output(write.stream(), false);
-        this->_snapshot->serialize(output);
+        auto it = this->_dedup_sizes.find(size.first);
+        if (it != this->_dedup_sizes.end() && it->second)
+        {
+          earlier.insert(it->second.get());
+          candidates.push_back(it->second.get());
+          it->second = boost::none;
+        }
+      }
+      for (auto i = begin; i < end; ++i)
+      {
+        auto size = infos[i].second;
+        if (size < min_size)
+          continue;
+        if (sizes[size] > 1 || index.has_size(size) ||
+            this->_dedup_sizes.find(size) != this->_dedup_sizes.end())
+        {
+          candidates.push_back(i);
+          this->_dedup_sizes[size] = boost::none;
+        }
+        else
+          this->_dedup_sizes[size] = i;
+      }
+      if (candidates.empty())
+        return;
+      ELLE_TRACE_SCOPE("%s: look for duplicates among %s files",
+                       *this, candidates.size());
+      auto hashes = frete::dedup::unpack(
+        this->state().crypto_pool()->decrypt(
+          key, source.encrypted_file_hashes(candidates)));
+      if (hashes.size() != candidates.size())
+        throw elle::Exception(
+          elle::sprintf("requested %s hashes, got %s",
+                        candidates.size(), hashes.size()));
+      for (unsigned i = 0; i < candidates.size(); ++i)
+      {
+        auto const& hash = hashes[i];
+        if (hash.empty())
+          continue;
+        auto id = candidates[i];
+        if (earlier.find(id) != earlier.end())
+        {
+          this->_dedup_first.emplace(hash, id);
+          continue;
+        }
+        auto size = infos[id].second;
+        auto it = this->_dedup_first.find(hash);
+        if (it != this->_dedup_first.end())
+        {
+          ELLE_DEBUG("%s: file %s is a duplicate of %s", *this, id, it->second);
+          this->_duplicates[id] = Duplicate{it->second, {}};
+        }
+        else
+        {
+          this->_dedup_first.emplace(hash, id);
+          auto path = index.find(hash, size);
+          if (!path)
+            continue;
+          ELLE_DEBUG("%s: file %s was received at %s", *this, id, path.get());
+          this->_duplicates[id] = Duplicate{boost::none, path.get()};
+        }
+      }
+    }
+
+    bool
+    PeerReceiveMachine::_copy_duplicate(FileID index)
+    {
+      auto it = this->_duplicates.find(index);
+      if (it == this->_duplicates.end())
+        return false;
+      auto& file = this->_snapshot->file(index);
+      if (file.complete())
+        return true;
+      auto const& output_dir = this->state().output_dir();
+      auto destination = _file_full_path(output_dir, *this->_snapshot, file);
+      auto source = it->second.file ?
+        _file_full_path(output_dir, *this->_snapshot,
+                        this->_snapshot->file(it->second.file.get())) :
+        it->second.path;
+      ELLE_TRACE_SCOPE("%s: copy duplicate %s from %s",
+                       *this, destination, source);
+      auto size = file.size();
+      reactor::background(
+        [&]
+        {
+          frete::dedup::copy(source, destination, size);
+        });
+      this->_snapshot->file_progress_end(index);
+      this->_save_frete_snapshot();
+      return true;
+    }
+
+    void
+    PeerReceiveMachine::_copy_duplicates(FileID end)
+    {
+      for (auto const& duplicate: this->_duplicates)
+      {
+        if (duplicate.first >= end)
+          break;
+        this->_copy_duplicate(duplicate.first);
+      }
+    }
+
+    void
+    PeerReceiveMachine::_find_holes(frete::RPCFrete& source,
+                                    infinit::cryptography::SecretKey const& key,
+                                    FileID begin,
+                                    FileID end)
+    {
+      auto const& infos = this->_files_info;
+      // Only big files left to fetch are checked by the sender.
+      std::vector<FileID> candidates;
+      for (auto i = begin; i < end; ++i)
+      {
+        if (infos[i].second < frete::sparse::min_size ||
+            this->_duplicates.find(i) != this->_duplicates.end())
+          continue;
+        if (this->_snapshot->has(i) && this->_snapshot->file(i).complete())
+          continue;
+        candidates.push_back(i);
+      }
+      if (candidates.empty())
+        return;
+      ELLE_TRACE_SCOPE("%s: look for holes in %s files",
+                       *this, candidates.size());
+      auto holes = frete::sparse::unpack(
+        this->state().crypto_pool()->decrypt(
+          key, source.encrypted_file_holes(candidates)));
+      if (holes.size() != candidates.size())
+        throw elle::Exception(
+          elle::sprintf("requested %s holes, got %s",
+                        candidates.size(), holes.size()));
+      std::size_t sparse = 0;
+      FileSize hole_size = 0;
+      for (unsigned i = 0; i < candidates.size(); ++i)
+      {
+        if (holes[i].empty())
+          continue;
+        auto id = candidates[i];
+        auto size = infos[id].second;
+        FileSize previous = 0;
+        for (auto const& hole: holes[i])
+        {
+          if (hole.first < previous || hole.first > size || hole.second == 0 ||
+              hole.second > size - hole.first)
+            throw elle::Exception(
+              elle::sprintf("invalid hole at %s of %s bytes in file %s",
+                            hole.first, hole.second, id));
+          previous = hole.first + hole.second;
+          hole_size += hole.second;
+        }
+        ELLE_DEBUG("%s: file %s has %s holes", *this, id, holes[i].size());
+        this->_holes[id] = std::move(holes[i]);
+        ++sparse;
+      }
+      ELLE_TRACE("%s: %s sparse files with %s bytes of holes",
+                 *this, sparse, hole_size);
+    }
+
+    boost::optional<frete::sparse::Extent>
+    PeerReceiveMachine::_hole(FileID index, FileSize position) const
+    {
+      auto it = this->_holes.find(index);
+      if (it == this->_holes.end())
+        return boost::none;
+      return frete::sparse::find(it->second, position);
+    }
+
+    void
+    PeerReceiveMachine::_verify_resumed(
+      frete::RPCFrete* source,
+      infinit::cryptography::SecretKey const* key)
+    {
+      namespace checksum = frete::checksum;
+      struct Resumed
+      {
+        FileID id;
+        boost::filesystem::path path;
+        FileSize progress;
+        FileSize written;
+        checksum::Checksums checksums;
+      };
+      std::vector<Resumed> resumed;
+      for (auto const& file: this->_snapshot->files())
+      {
+        // Chunks received out of order carry no checksums.
+        if (file.progress() == 0 || file.complete() || file.chunk_size() ||
+            this->_duplicates.find(file.file_id()) != this->_duplicates.end())
+          continue;
+        auto path = _file_full_path(this->state().output_dir(),
+                                    *this->_snapshot, file);
+        boost::system::error_code error;
+        FileSize size = boost::filesystem::file_size(path, error);
+        resumed.push_back(
+          Resumed{file.file_id(), path, file.progress(),
+                  error ? 0 : std::min(size, file.progress()),
+                  checksum::Checksums(checksum::blocks(file.progress()))});
+      }
+      if (resumed.empty())
+        return;
+      ELLE_TRACE_SCOPE("%s: verify %s resumed files", *this, resumed.size());
+      // Checksum what was written, by spans of blocks in parallel.
+      static FileSize const span = 64 * checksum::block_size;
+      std::deque<std::pair<Resumed*, FileSize>> spans;
+      for (auto& file: resumed)
+        for (FileSize offset = 0; offset < file.written; offset += span)
+          spans.emplace_back(&file, offset);
+      elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+      {
+        for (int i = 0; i < verify_workers(); ++i)
+          scope.run_background(
+            elle::sprintf("verify %s", i),
+            [&]
+            {
+              while (!spans.empty())
+              {
+                auto& file = *spans.front().first;
+                auto offset = spans.front().second;
+                spans.pop_front();
+                auto size = std::min(span, file.written - offset);
+                checksum::Checksums checksums;
+                reactor::background(
+                  [&]
+                  {
+                    checksums = checksum::file(file.path, offset, size);
+                  });
+                std::copy(checksums.begin(), checksums.end(),
+                          file.checksums.begin() +
+                          offset / checksum::block_size);
+              }
+            });
+        reactor::wait(scope);
       };
+      for (auto& file: resumed)
+      {
+        auto const& recorded = this->_snapshot->file(file.id).checksums();
+        auto blocks = file.checksums.size();
+        // The source checksums prevail, then the ones recorded while writing.
+        // Without any, trust what was written.
+        boost::optional<checksum::Checksums> expected;
+        if (source)
+          expected = checksum::unpack(
+            this->state().crypto_pool()->decrypt(
+              *key, source->encrypted_file_checksums(file.id, file.progress)));
+        else if (recorded.size() == blocks)
+          expected = recorded;
+        FileSize verified = 0;
+        std::vector<FileSize> corrupted;
+        for (FileSize i = 0; i < blocks; ++i)
+        {
+          auto end = std::min((i + 1) * checksum::block_size, file.progress);
+          if (end <= file.written &&
+              (!expected ||
+               (i < expected->size() && (*expected)[i] == file.checksums[i])))
+            verified = i + 1;
+          else
+            corrupted.push_back(i);
+        }
+        // Blocks past the last valid one are fetched again as usual.
+        while (!corrupted.empty() && corrupted.back() >= verified)
+          corrupted.pop_back();
+        if (!corrupted.empty() && !source)
+        {
+          verified = corrupted.front();
+          corrupted.clear();
+        }
+        if (!corrupted.empty())
+        {
+          ELLE_WARN("%s: %s blocks of %s are corrupted, fetch them again",
+                    *this, corrupted.size(), file.path);
+          this->_repair(*source, *key, file.id, file.path,
+                        corrupted, expected.get());
+        }
+        auto progress =
+          std::min(verified * checksum::block_size, file.progress);
+        if (progress != file.progress)
+          ELLE_WARN("%s: %s is only valid up to %s of %s bytes",
+                    *this, file.path, progress, file.progress);
+        auto checksums = expected ? std::move(expected.get()) : file.checksums;
+        checksums.resize(checksum::blocks(progress));
+        this->_snapshot->file_progress_verified(
+          file.id, progress, std::move(checksums));
+      }
+      this->_save_frete_snapshot();
+    }
+
+    void
+    PeerReceiveMachine::_verify_received(
+      frete::RPCFrete& source,
+      infinit::cryptography::SecretKey const& key)
+    {
+      namespace checksum = frete::checksum;
+      struct Received
+      {
+        FileID id;
+        boost::filesystem::path path;
+        FileSize size;
+        checksum::Checksums checksums;
+      };
+      std::vector<Received> received;
+      for (auto const& file: this->_snapshot->files())
+      {
+        // Duplicates were copied locally, not transferred.
+        if (file.size() == 0 ||
+            this->_duplicates.find(file.file_id()) != this->_duplicates.end())
+          continue;
+        received.push_back(
+          Received{file.file_id(),
+                   _file_full_path(this->state().output_dir(),
+                                   *this->_snapshot, file),
+                   file.size(),
+                   file.checksums()});
+      }
+      if (received.empty())
+        return;
+      ELLE_TRACE_SCOPE("%s: verify %s received files", *this, received.size());
+      // Files written out of order have no checksums recorded, read them
+      // back.
+      std::deque<Received*> unrecorded;
+      for (auto& file: received)
+        if (file.checksums.size() != checksum::blocks(file.size))
+          unrecorded.push_back(&file);
+      elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+      {
+        for (int i = 0; i < verify_workers(); ++i)
+          scope.run_background(
+            elle::sprintf("checksum %s", i),
+            [&]
+            {
+              while (!unrecorded.empty())
+              {
+                auto& file = *unrecorded.front();
+                unrecorded.pop_front();
+                reactor::background(
+                  [&]
+                  {
+                    file.checksums = checksum::file(file.path, 0, file.size);
+                  });
+              }
+            });
+        reactor::wait(scope);
+      };
+      // Compare with what the sender read, a batch of files at a time.
+      std::size_t const batch = 1024;
+      for (std::size_t i = 0; i < received.size(); i += batch)
+      {
+        auto end = std::min(i + batch, received.size());
+        std::vector<FileID> files;
+        for (auto j = i; j < end; ++j)
+          files.push_back(received[j].id);
+        auto sent = checksum::unpack(
+          this->state().crypto_pool()->decrypt(
+            key, source.encrypted_sent_checksums(files)));
+        auto expected = sent.begin();
+        for (auto j = i; j < end; ++j)
+        {
+          auto& file = received[j];
+          auto blocks = checksum::blocks(file.size);
+          if (static_cast<FileSize>(sent.end() - expected) < blocks)
+            throw elle::Exception(
+              elle::sprintf("missing checksums for %s", file.path));
+          checksum::Checksums checksums(expected, expected + blocks);
+          expected += blocks;
+          std::vector<FileSize> corrupted;
+          for (FileSize block = 0; block < blocks; ++block)
+            if (block >= file.checksums.size() ||
+                file.checksums[block] != checksums[block])
+              corrupted.push_back(block);
+          if (corrupted.empty())
+            continue;
+          ELLE_WARN("%s: %s blocks of %s differ from the sent ones, "
+                    "fetch them again",
+                    *this, corrupted.size(), file.path);
+          this->_repair(source, key, file.id, file.path, corrupted, checksums);
+        }
+      }
+    }
+
+    void
+    PeerReceiveMachine::_repair(frete::RPCFrete& source,
+                                infinit::cryptography::SecretKey const& key,
+                                FileID id,
+                                boost::filesystem::path const& path,
+                                std::vector<FileSize> const& corrupted,
+                                std::vector<uint32_t> const& expected)
+    {
+      namespace checksum = frete::checksum;
+      boost::filesystem::fstream output(
+        path, std::ios::in | std::ios::out | std::ios::binary);
+      int const range = rpc_range_size();
+      for (unsigned i = 0; i < corrupted.size(); i += range)
+      {
+        frete::Frete::Positions positions;
+        for (unsigned j = i; j < corrupted.size() && j < i + range; ++j)
+          positions.emplace_back(id, corrupted[j] * checksum::block_size);
+        auto codes = source.encrypted_read_range(
+          positions, checksum::block_size,
+          this->_snapshot->progress(), false);
+        if (codes.size() != positions.size())
+          throw elle::Exception(
+            elle::sprintf("requested %s blocks, got %s",
+                          positions.size(), codes.size()));
+        for (unsigned j = 0; j < positions.size(); ++j)
+        {
+          auto block = corrupted[i + j];
+          auto buffer =
+            this->_decrypt_block(key, codes[j], positions[j], false);
+          if (checksum::update(0, buffer) != expected[block])
+            throw elle::Exception(
+              elle::sprintf("block %s of %s doesn't match its checksum",
+                            block, path));
+          reactor::background(
+            [&]
+            {
+              output.seekp(positions[j].second);
+              output.write(reinterpret_cast<char const*>(buffer.contents()),
+                           buffer.size());
+              output.flush();
+            });
+          if (!output)
+            throw boost::filesystem::filesystem_error(
+              "unable to repair corrupted block", path,
+              boost::system::errc::make_error_code(
+                boost::system::errc::io_error));
+        }
+      }
+    }
+
+    void
+    PeerReceiveMachine::_save_frete_snapshot()
+    {
+      this->_frete_snapshot_journal.save(*this->_snapshot);
+    }
+
+    void
+    PeerReceiveMachine::_save_frete_progress(FileID file)
+    {
+      this->_frete_snapshot_journal.progress(*this->_snapshot, file);
     }
 
     void
@@ -1127,6 +2429,39 @@ namespace surface
       // FIXME: cleanup raw cloud data
     }
 
+    void
+    PeerReceiveMachine::_create_bufferer()
+    {
+      ELLE_DEBUG("%s: create cloud bufferer", *this);
+      bool cloud_debug =
+        !elle::os::getenv("INFINIT_CLOUD_FILEBUFFERER", "").empty();
+      if (cloud_debug)
+      {
+        _bufferer.reset(
+          new FilesystemTransferBufferer(*this->data(),
+                                         "/tmp/infinit-buffering"));
+      }
+      else
+      {
+        auto get_credentials = [this] (bool first_time)
+          {
+            auto creds = this->_cloud_credentials(first_time);
+            auto awscreds = dynamic_cast<infinit::oracles::meta::CloudCredentialsAws*>(creds.get());
+            ELLE_ASSERT(awscreds);
+            return *static_cast<aws::Credentials*>(awscreds);
+          };
+        this->_bufferer.reset(
+          new S3TransferBufferer(
+            elle::make_unique<S3>(this->state(), get_credentials),
+            *this->data(),
+            std::bind(&PeerReceiveMachine::_report_s3_error,
+                      this,
+                      std::placeholders::_1,
+                      std::placeholders::_2)
+            ));
+      }
+    }
+
     void
     PeerReceiveMachine::_cloud_synchronize()
     {
@@ -1176,19 +2511,23 @@ namespace surface
       buffer = std::move(b.buffer);
       start_position = b.start_position;
       file_index = b.file_index;
+      reservation = std::move(b.reservation);
     }
 
     PeerReceiveMachine::IndexedBuffer::IndexedBuffer(elle::Buffer && b,
-                                                     FileSize pos, FileID index)
+                                                     FileSize pos, FileID index,
+                                                     Reservation reservation)
     : buffer(std::move(b))
     , start_position(pos)
     , file_index(index)
+    , reservation(std::move(reservation))
     {}
 
     PeerReceiveMachine::IndexedBuffer::IndexedBuffer(IndexedBuffer && b)
     : buffer(std::move(b.buffer))
     , start_position(b.start_position)
     , file_index(b.file_index)
+    , reservation(std::move(b.reservation))
     {}
   }
 }
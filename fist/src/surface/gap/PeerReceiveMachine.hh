@@ -1,10 +1,12 @@
 #ifndef SURFACE_GAP_PEER_RECEIVE_MACHINE_HH
 # define SURFACE_GAP_PEER_RECEIVE_MACHINE_HH
 
+# include <functional>
 # include <memory>
 # include <string>
 # include <unordered_set>
 
+# include <boost/date_time/posix_time/posix_time.hpp>
 # include <boost/filesystem.hpp>
 # include <boost/filesystem/fstream.hpp>
 
@@ -14,7 +16,12 @@
 # include <reactor/waitable.hh>
 # include <reactor/signal.hh>
 
+# include <frete/BufferPool.hh>
+# include <frete/Dedup.hh>
 # include <frete/Frete.hh>
+# include <frete/SnapshotJournal.hh>
+# include <frete/SourceScheduler.hh>
+# include <frete/Sparse.hh>
 # include <frete/fwd.hh>
 # include <oracles/src/infinit/oracles/PeerTransaction.hh>
 # include <surface/gap/PeerMachine.hh>
@@ -91,11 +98,16 @@ namespace surface
     `-----------------*/
     public:
       ELLE_ATTRIBUTE(boost::filesystem::path, frete_snapshot_path);
+      /// Progress is journaled, the whole snapshot only saved on changes.
+      ELLE_ATTRIBUTE(frete::SnapshotJournal, frete_snapshot_journal);
       ELLE_ATTRIBUTE_R(std::unique_ptr<frete::TransferSnapshot>, snapshot)
 
     protected:
       void
       _save_frete_snapshot();
+      /// Record the progress of a file.
+      void
+      _save_frete_progress(FileID file);
     private:
       std::unique_ptr<frete::RPCFrete>
       rpcs(infinit::protocol::ChanneledStream& channels) override;
@@ -143,17 +155,46 @@ namespace surface
       frete::Frete::TransferInfo const&
       transfer_info(Source& source);
       std::map<boost::filesystem::path, boost::filesystem::path> _root_component_mapping;
+      /* Manifest
+      */
+      /// The path and size of the files, received a page at a time from
+      /// recent peers while the first ones are fetched.
+      FilesInfo _files_info;
+      /// Files whose duplicates and holes are known, ready to be fetched.
+      FileID _files_ready;
+      /// Fetch the next page of the manifest and prepare its files.
+      std::function<void ()> _manifest_page;
+      /// Whether a page is being fetched.
+      bool _manifest_fetching;
+      /// Signaled when a page is fetched.
+      reactor::Signal _manifest_fetched;
+      /// The path and size of a file, waiting for it to be ready.
+      FileInfo
+      _file_info(FileID index);
+      /// Fetch the next page of the manifest, or wait for the one being
+      /// fetched.
+      void
+      _fetch_manifest();
+      template <typename Source>
+      void
+      _fetch_manifest_page(Source& source,
+                           frete::RPCFrete* peer,
+                           infinit::cryptography::SecretKey const* key);
       /* Transfer pipelining data
       */
       struct TransferData;
+      typedef std::shared_ptr<frete::BufferPool::Reservation> Reservation;
       struct IndexedBuffer
       {
-        IndexedBuffer(elle::Buffer&& buf, FileSize pos, FileID index);
+        IndexedBuffer(elle::Buffer&& buf, FileSize pos, FileID index,
+                      Reservation reservation);
         IndexedBuffer(IndexedBuffer&& b);
         void operator = (IndexedBuffer && b);
         elle::Buffer buffer;
         FileSize start_position;
         FileID file_index;
+        /// The memory budget held until the buffer is written.
+        Reservation reservation;
         // *REVERSED* since priority queu returns top(max) element
         bool operator <(const IndexedBuffer& b) const;
       };
@@ -181,24 +222,164 @@ namespace surface
       /** Switch fetcher data to next file, returns false if nothing else to do
       *   Fills all _fetcher state in
       */
-      bool _fetch_next_file(const std::string& name_policy,
-                            FilesInfo const& infos);
+      bool _fetch_next_file(const std::string& name_policy);
       template <typename Source>
       void _disk_thread(Source& source,
-                          elle::Version peer_version,
-                          size_t chunk_size);
+                          elle::Version peer_version);
       template <typename Source>
       void _fetcher_thread(Source& source, int id,
                            std::string const& name_policy,
                            bool explicit_ack,
+                           int range,
+                           bool compressed,
+                           frete::RPCFrete* bundles,
                            EncryptionLevel encryption,
-                           size_t chunk_size,
-                           infinit::cryptography::SecretKey const& key,
-                           FilesInfo const& infos
-                           );
+                           infinit::cryptography::SecretKey const& key);
+      /// Fetch blocks from the cloud buffer along with the peer, until it
+      /// misses one.
+      void _cloud_fetcher_thread(TransferBufferer& cloud, int id,
+                                 std::string const& name_policy,
+                                 int range,
+                                 bool compressed,
+                                 infinit::cryptography::SecretKey const& key);
+      /// Reserve the next count blocks to fetch, of chunk_size bytes unless
+      /// written in place, starting with one given back by another source
+      /// if take_back.
+      frete::Frete::Positions
+      _fetch_positions(std::string const& name_policy,
+                       int count,
+                       bool take_back,
+                       FileSize& chunk_size);
+      /// Reserve the next small files to fetch whole in one request, if
+      /// any.
+      std::vector<FileID>
+      _fetch_bundle(std::string const& name_policy);
+      /// Unpack fetched files and hand them to the disk writer or write
+      /// them in place.
+      void
+      _queue_bundle(std::vector<FileID> const& files,
+                    elle::Buffer const& payload,
+                    Reservation const& reservation);
+      elle::Buffer
+      _decrypt_block(infinit::cryptography::SecretKey const& key,
+                     infinit::cryptography::Code const& code,
+                     frete::Frete::Position const& position,
+                     bool compressed);
+      /// Check a fetched block has the size requested, up to the end of
+      /// its file, and hand it to the disk writer or write it in place.
+      void
+      _queue_block(elle::Buffer buffer,
+                   frete::Frete::Position const& position,
+                   FileSize size,
+                   Reservation reservation);
+
+      /* Pipeline tuning
+      */
+      /// Sizes the pipeline after the link while fetching.
+      std::unique_ptr<frete::FetchController> _fetch_controller;
+      /// Requests being fetched.
+      int _fetch_in_flight;
+      /// Signaled when a request completes or the depth changes.
+      reactor::Signal _fetch_slot;
+      /// Shares the requests among the peer and the cloud buffer.
+      std::unique_ptr<frete::SourceScheduler> _sources;
+      frete::SourceScheduler::Source _main_source;
+      /// The cloud buffer source, if fetched from.
+      frete::SourceScheduler::Source _cloud_source;
+      int _cloud_readers;
+      /// Measure a request and apply the controller decisions.
+      void
+      _fetch_sample(FileSize bytes, boost::posix_time::time_duration rtt);
+
+      /* Positional writes
+      */
+      /// Whether blocks are written at their offset as soon as they arrive
+      /// instead of in order by the disk writer.
+      bool _positional;
+      typedef std::unordered_map<FileID, std::shared_ptr<frete::FileWriter>>
+        Writers;
+      Writers _writers;
+      /// The writer of a file, opened on first use.
+      std::shared_ptr<frete::FileWriter>
+      _writer(FileID index);
+      /// Write a block at its offset and record it in the snapshot.
+      void
+      _write_block(elle::Buffer buffer, frete::Frete::Position const& position);
+
+      /* Deduplication
+      */
+      /// A file the recipient already has: an earlier one of the transfer,
+      /// or one received before at path.
+      struct Duplicate
+      {
+        boost::optional<FileID> file;
+        boost::filesystem::path path;
+      };
+      typedef std::map<FileID, Duplicate> Duplicates;
+      Duplicates _duplicates;
+      /// The sizes of the files of the manifest, with the only file of
+      /// that size if it wasn't hashed.
+      std::unordered_map<FileSize, boost::optional<FileID>> _dedup_sizes;
+      /// The first file of each hash.
+      std::unordered_map<frete::dedup::Hash, FileID> _dedup_first;
+      /// Ask the hashes of the files of the manifest from begin to end that
+      /// may be duplicates and match them.
+      void
+      _deduplicate(frete::RPCFrete& source,
+                   infinit::cryptography::SecretKey const& key,
+                   FileID begin,
+                   FileID end);
+      /// Copy a file if it is a duplicate, return whether it is one.
+      bool
+      _copy_duplicate(FileID index);
+      /// Copy the duplicates before end.
+      void
+      _copy_duplicates(FileID end);
+
+      /* Sparse files
+      */
+      typedef std::unordered_map<FileID, frete::sparse::Extents> Holes;
+      /// The holes of the files to fetch, neither fetched nor written.
+      Holes _holes;
+      /// Ask the holes of the big files left to fetch from begin to end.
+      void
+      _find_holes(frete::RPCFrete& source,
+                  infinit::cryptography::SecretKey const& key,
+                  FileID begin,
+                  FileID end);
+      /// The hole of a file containing position, if any.
+      boost::optional<frete::sparse::Extent>
+      _hole(FileID index, FileSize position) const;
+
+      /* Resume verification
+      */
+      /// Check the content written before resuming against the checksums
+      /// of the source if given, otherwise the ones recorded while writing.
+      /// Corrupted blocks are fetched again from the source if possible,
+      /// otherwise files are rewound to their verified prefix.
+      void
+      _verify_resumed(frete::RPCFrete* source,
+                      infinit::cryptography::SecretKey const* key);
+      /// Check the received files against the checksums of the data the
+      /// source sent, fetching the blocks that differ again.
+      void
+      _verify_received(frete::RPCFrete& source,
+                       infinit::cryptography::SecretKey const& key);
+      /// Fetch corrupted blocks of a file again and write them in place,
+      /// checking them against the expected checksums.
+      void
+      _repair(frete::RPCFrete& source,
+              infinit::cryptography::SecretKey const& key,
+              FileID id,
+              boost::filesystem::path const& path,
+              std::vector<FileSize> const& corrupted,
+              std::vector<uint32_t> const& expected);
 
       // Transfer bufferer for cloud operations
        std::unique_ptr<TransferBufferer> _bufferer;
+      /// Open the cloud buffer.
+      void
+      _create_bufferer();
     };
   }
 }
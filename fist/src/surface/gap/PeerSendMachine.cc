@@ -9,6 +9,9 @@
 #include <elle/os/file.hh>
 #include <elle/serialization/json.hh>
 
+#include <frete/BufferPool.hh>
+#include <frete/Compression.hh>
+#include <frete/DirectoryScan.hh>
 #include <frete/RPCFrete.hh>
 #include <frete/Frete.hh>
 #include <frete/TransferSnapshot.hh>
@@ -82,6 +85,7 @@ namespace surface
       , _rejected("rejected")
       , _ghost_uploaded("ghost uploaded")
       , _frete()
+      , _scan()
       , _wait_for_accept_state(
         this->_machine.state_make(
           "wait for accept",
@@ -418,15 +422,6 @@ namespace surface
     }
 
     typedef std::pair<frete::Frete::FileSize, frete::Frete::FileID> Position;
-    static frete::Frete::FileSize
-    progress_from(frete::Frete::FilesInfo const& infos, const Position& p)
-    {
-      frete::Frete::FileSize result = 0;
-      for (unsigned i=0; i<p.first; ++i)
-        result += infos[i].second;
-      result += p.second;
-      return result;
-    }
     static std::streamsize const chunk_size = 1 << 18;
 
 
@@ -465,8 +460,11 @@ namespace surface
       int64_t size = 0;
       try
       {
-        for (auto const& file: this->files())
-          size += elle::os::file::size(file);
+        this->_scan.reset(
+          new frete::DirectoryScan(
+            std::vector<boost::filesystem::path>(this->files().begin(),
+                                                 this->files().end())));
+        size = this->_scan->total_size();
       }
       catch (boost::filesystem::filesystem_error const& e)
       {
@@ -800,6 +798,19 @@ namespace surface
           auto& file = snapshot.file(file_id);
           files.push_back(std::make_pair(file.path(), file.size()));
         }
+        // Receivers prior to 0.9.44 can't read compressed chunks.
+        auto const& features = this->state().configuration().features;
+        auto cloud_compression = features.find("cloud_compression");
+        bool compress = frete::compression::enabled()
+          && cloud_compression != features.end()
+          && cloud_compression->second == "true";
+        ELLE_TRACE("%s: compress buffered chunks: %s", *this, compress);
+        // Older receivers only read chunks stored in their own object.
+        auto cloud_segments = features.find("cloud_segments");
+        frete::Frete::FileSize segment_size =
+          cloud_segments != features.end() && cloud_segments->second == "true"
+          ? S3TransferBufferer::default_segment_size()
+          : 0;
         bool cloud_debug =
           !elle::os::getenv("INFINIT_CLOUD_FILEBUFFERER", "").empty();
         std::unique_ptr<TransferBufferer> bufferer;
@@ -811,7 +822,8 @@ namespace surface
                                            snapshot.count(),
                                            snapshot.total_size(),
                                            files,
-                                           frete.key_code()));
+                                           frete.key_code(),
+                                           compress));
         }
         else
         {
@@ -833,7 +845,9 @@ namespace surface
               snapshot.count(),
               snapshot.total_size(),
               files,
-              frete.key_code()));
+              frete.key_code(),
+              compress,
+              segment_size));
         }
         if (auto& mr = state().metrics_reporter())
         {
@@ -851,6 +865,10 @@ namespace surface
         typedef frete::Frete::FileSize FileSize;
         typedef frete::Frete::FileID FileID;
         FileSize transfer_since_snapshot = 0;
+        // Chunks are only stored once flushed, don't flush segments much
+        // before they are full.
+        FileSize const snapshot_interval =
+          std::max<FileSize>(1000000, 4 * bufferer->segment_size());
         FileID current_file = FileID(-1);
         FileSize current_position = 0;
         FileSize current_file_size = 0;
@@ -863,6 +881,9 @@ namespace surface
         {
           while(true)
           {
+            // Hold the memory of the chunk until it is uploaded.
+            auto reservation =
+              this->state().buffer_pool()->reserve(chunk_size);
             while (current_position >= current_file_size)
             {
               ++current_file;
@@ -877,19 +898,26 @@ namespace surface
             FileSize local_file = current_file;
             FileSize local_position = current_position;
             current_position += chunk_size;
-            auto block = frete.encrypted_read_acknowledge(
-              local_file, local_position, chunk_size, acknowledge_position);
+            std::vector<infinit::cryptography::Code> blocks;
+            if (compress)
+              blocks = frete.encrypted_read_range(
+                frete::Frete::Positions{
+                  frete::Frete::Position(local_file, local_position)},
+                chunk_size, acknowledge_position, true);
+            else
+              blocks.push_back(frete.encrypted_read_acknowledge(
+                local_file, local_position, chunk_size, acknowledge_position));
             if (save_snapshot)
             {
               this->_save_frete_snapshot();
               save_snapshot = false;
             }
-            auto& buffer = block.buffer();
+            auto& buffer = blocks.front().buffer();
             bufferer->put(local_file, local_position, buffer.size(), buffer);
             transfer_since_snapshot += buffer.size();
             total_bytes_transfered += buffer.size();
             last_acknowledge_block[id] = std::make_pair(local_file, local_position);
-            if (transfer_since_snapshot >= 1000000)
+            if (transfer_since_snapshot >= snapshot_interval)
             {
               // Update acknowledge position
               // First find the smallest value in per-thread last_ack
@@ -905,7 +933,12 @@ namespace surface
                   else
                     return a.second < b.second;
                 });
-              acknowledge_position = progress_from(this->frete().files_info(), pmin);
+              transfer_since_snapshot = 0;
+              // Blocks up to pmin were put, make sure they are stored.
+              bufferer->flush();
+              acknowledge_position = std::max(
+                acknowledge_position,
+                snapshot.position(pmin.first, pmin.second));
               // need one call to read_acknowledge for save to have effect:async
               save_snapshot = true;
             }
@@ -918,6 +951,7 @@ namespace surface
                                  std::bind(pipeline_cloud_upload, i));
           scope.wait();
         };
+        bufferer->flush();
         // acknowledge last block and save snapshot
         frete.encrypted_read_acknowledge(0, 0, 0, this->frete().full_size());
         this->_save_frete_snapshot();
@@ -1000,6 +1034,17 @@ namespace surface
           this->transaction().snapshots_directory() / "mirror_files",
           this->files_mirrored());
          _fetch_peer_key(false);
+        this->_frete->handles(this->state().frete_handles());
+        this->_frete->crypto(this->state().crypto_pool());
+        auto const& features = this->state().configuration().features;
+        auto mapped_read = features.find("frete_mapped_read");
+        if ((mapped_read != features.end() && mapped_read->second == "true")
+            || !elle::os::getenv("INFINIT_FRETE_MAPPED_READ", "").empty())
+        {
+          ELLE_DEBUG("%s: read files through memory mappings", *this);
+          this->_frete->mapped_read(true);
+        }
+        elle::SafeFinally release_scan([this] { this->_scan.reset(); });
         if (this->_frete->count())
         {
           // Reloaded from snapshot. Not much to validate here, use previously
@@ -1010,8 +1055,12 @@ namespace surface
         else
         { // No snapshot yet, fill file list
           ELLE_DEBUG("%s: No snapshot loaded, populating files", *this);
-          for (std::string const& file: this->files())
-            this->_frete->add(file);
+          // Mirroring moved the files since they were scanned.
+          if (this->_scan && !this->files_mirrored())
+            this->_frete->add(*this->_scan);
+          else
+            for (std::string const& file: this->files())
+              this->_frete->add(file);
         }
       }
       return *this->_frete;
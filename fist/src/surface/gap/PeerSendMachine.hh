@@ -76,6 +76,9 @@ namespace surface
       ELLE_ATTRIBUTE_RX(reactor::Barrier, rejected);
       ELLE_ATTRIBUTE_RX(reactor::Barrier, ghost_uploaded);
       ELLE_ATTRIBUTE(std::unique_ptr<frete::Frete>, frete);
+      /// The files found when initializing the transaction, until handed to
+      /// the frete.
+      ELLE_ATTRIBUTE(std::unique_ptr<frete::DirectoryScan>, scan);
 
     /*-------.
     | States |
@@ -1,9 +1,15 @@
+#include <algorithm>
+#include <cctype>
+
 #include <boost/lexical_cast.hpp>
 
 #include <elle/json/json.hh>
 #include <elle/log.hh>
 #include <elle/format/base64.hh>
 #include <elle/containers.hh>
+#include <elle/finally.hh>
+#include <elle/os/environ.hh>
+#include <elle/With.hh>
 
 #include <elle/serialize/construct.hh>
 #include <elle/serialize/extract.hh>
@@ -11,8 +17,15 @@
 #include <elle/serialize/PairSerializer.hxx>
 #include <elle/serialize/VectorSerializer.hxx>
 
+#include <reactor/Barrier.hh>
+#include <reactor/Scope.hh>
+#include <reactor/lockable.hh>
+#include <reactor/scheduler.hh>
+
 #include <aws/Exceptions.hh>
 
+#include <frete/Encoding.hh>
+
 #include <surface/gap/S3TransferBufferer.hh>
 
 ELLE_LOG_COMPONENT("surface.gap.S3TransferBufferer");
@@ -38,6 +51,26 @@ namespace surface
       , _key_code()
       , _raw_file(false)
       , _s3_handler(std::move(s3))
+      , _manifest(false)
+      , _index()
+      , _segments()
+      , _segment()
+      , _segment_chunks()
+      , _segment_next(0)
+      , _stored()
+      , _uploading()
+      , _upload_failed(false)
+      , _uploaded()
+      , _manifest_mutex()
+      , _manifest_whole(0)
+      , _manifest_written(0)
+      , _manifest_next(0)
+      , _manifest_parts_written(0)
+      , _manifest_parts(64)
+      , _read_policy(default_read_policy())
+      , _read_stats{0, 0, 0, 0, 0}
+      , _latencies()
+      , _hedge_thresholds()
     {
       _s3_handler->on_error(on_error);
       try
@@ -55,6 +88,17 @@ namespace surface
         elle::serialize::from_string(elle::format::base64::decode(
           boost::any_cast<std::string>(
             meta_data["key_code"])).string()) >> this->_key_code;
+        // Absent from data buffered by older senders.
+        auto compressed = meta_data.find("compressed");
+        if (compressed != meta_data.end())
+          this->_compressed = boost::any_cast<bool>(compressed->second);
+        auto manifest = meta_data.find("manifest");
+        if (manifest != meta_data.end() &&
+            boost::any_cast<bool>(manifest->second))
+        {
+          this->_manifest = true;
+          this->_load_manifest();
+        }
       }
       catch (aws::FileNotFound const& e)
       {
@@ -75,6 +119,26 @@ namespace surface
       , _key_code()
       , _raw_file(true)
       , _s3_handler(std::move(s3))
+      , _manifest(false)
+      , _index()
+      , _segments()
+      , _segment()
+      , _segment_chunks()
+      , _segment_next(0)
+      , _stored()
+      , _uploading()
+      , _upload_failed(false)
+      , _uploaded()
+      , _manifest_mutex()
+      , _manifest_whole(0)
+      , _manifest_written(0)
+      , _manifest_next(0)
+      , _manifest_parts_written(0)
+      , _manifest_parts(64)
+      , _read_policy(default_read_policy())
+      , _read_stats{0, 0, 0, 0, 0}
+      , _latencies()
+      , _hedge_thresholds()
     {
       _s3_handler->on_error(on_error);
       // That file constraint is mostly for validation, we could
@@ -103,15 +167,47 @@ namespace surface
       FileCount count,
       FileSize total_size,
       Files const& files,
-      infinit::cryptography::Code const& key)
+      infinit::cryptography::Code const& key,
+      bool compressed,
+      FileSize segment_size)
       : Super(transaction)
       , _count(count)
       , _full_size(total_size)
       , _files(files)
       , _key_code(key)
+      , _raw_file(false)
       , _s3_handler(std::move(s3))
+      , _manifest(false)
+      , _index()
+      , _segments()
+      , _segment()
+      , _segment_chunks()
+      , _segment_next(0)
+      , _stored()
+      , _uploading()
+      , _upload_failed(false)
+      , _uploaded()
+      , _manifest_mutex()
+      , _manifest_whole(0)
+      , _manifest_written(0)
+      , _manifest_next(0)
+      , _manifest_parts_written(0)
+      , _manifest_parts(64)
+      , _read_policy(default_read_policy())
+      , _read_stats{0, 0, 0, 0, 0}
+      , _latencies()
+      , _hedge_thresholds()
     {
+      this->_compressed = compressed;
+      this->_segment_size = segment_size;
       _s3_handler->on_error(on_error);
+      // Resume after the chunks stored by a previous run, looking them up
+      // in the folder if it left no manifest.
+      if (!this->_load_manifest())
+        this->_recover_manifest();
+      this->_manifest = true;
+      ELLE_TRACE("%s: pack chunks in segments of %s bytes, %s already stored",
+                 *this, this->_segment_size, this->_index.size());
       // Write transfer meta-data to cloud.
       // We binary serialize stuff, then base64-encode to be valid json
       // string, and then json-serialize
@@ -125,6 +221,9 @@ namespace surface
       std::string key_str;
       elle::serialize::to_string(key_str) << this->_key_code;
       meta_data["key_code"] = elle::format::base64::encode(key_str).string();
+      if (this->_compressed)
+        meta_data["compressed"] = true;
+      meta_data["manifest"] = true;
       elle::Buffer buffer;
       std::ostream stream(buffer.ostreambuf());
       elle::json::write(stream, meta_data);
@@ -157,6 +256,53 @@ namespace surface
         return infinit::cryptography::Code(this->get(f, start));
       }
 
+      std::vector<infinit::cryptography::Code>
+      S3TransferBufferer::encrypted_read_range(
+        frete::Frete::Positions const& positions,
+        FileSize size,
+        FileSize progress,
+        bool)
+      {
+        this->set_progress(progress);
+        std::vector<infinit::cryptography::Code> res;
+        res.reserve(positions.size());
+        auto it = positions.begin();
+        while (it != positions.end())
+        {
+          auto location = this->_locate(it->first, it->second);
+          if (!location || location->segment == no_segment)
+          {
+            res.push_back(this->encrypted_read(it->first, it->second, size));
+            ++it;
+            continue;
+          }
+          // Read the following chunks packed right after along.
+          std::vector<FileSize> sizes{location->size};
+          auto end = location->position + location->size;
+          auto next = it + 1;
+          for (; next != positions.end(); ++next)
+          {
+            auto following = this->_locate(next->first, next->second);
+            if (!following ||
+                following->segment != location->segment ||
+                following->position != end)
+              break;
+            sizes.push_back(following->size);
+            end += following->size;
+          }
+          auto data = this->_get_segment(
+            location->segment, location->position, end - location->position);
+          FileOffset position = 0;
+          for (auto chunk: sizes)
+          {
+            res.emplace_back(elle::Buffer(data.contents() + position, chunk));
+            position += chunk;
+          }
+          it = next;
+        }
+        return res;
+      }
+
     /*----------.
     | Buffering |
     `----------*/
@@ -169,10 +315,20 @@ namespace surface
     {
       ELLE_DEBUG_SCOPE("%s: S3 put: %s (offset: %s, size: %s)",
                        *this, file, offset, size);
+      if (this->segment_size() > 0)
+      {
+        this->_segment_chunks.emplace_back(
+          file, std::make_pair(offset, b.size()));
+        this->_segment.append(b.contents(), b.size());
+        if (this->_segment.size() >= this->segment_size())
+          this->_flush_segment();
+        return;
+      }
       std::string s3_name = this->_make_s3_name(file, offset);
       try
       {
         this->_s3_handler->put_object(b, s3_name);
+        this->_stored.emplace_back(file, std::make_pair(offset, b.size()));
       }
       catch (aws::AWSException const& e)
       {
@@ -192,7 +348,11 @@ namespace surface
       try
       {
         elle::Buffer res;
-        res = this->_s3_handler->get_object_chunk(_files.at(file).first, offset, size);
+        // Don't split requests past the end of the file.
+        auto const& info = this->_files.at(file);
+        if (offset < info.second)
+          size = std::min(size, info.second - offset);
+        res = this->_read_range(info.first, offset, size);
         ELLE_ASSERT_GTE(size, res.size());
         return res;
       }
@@ -209,11 +369,26 @@ namespace surface
                             TransferBufferer::FileSize offset)
     {
       ELLE_DEBUG_SCOPE("%s: S3 get: %s (offset: %s)", *this, file, offset);
+      auto location = this->_locate(file, offset);
+      // The chunk may have been stored since the manifest was read.
+      if (!location && this->_manifest && this->_refresh_manifest())
+        location = this->_locate(file, offset);
+      if (location && location->segment != no_segment)
+        return this->_get_segment(
+          location->segment, location->position, location->size);
+      if (!location && this->_manifest)
+      {
+        ELLE_LOG("%s: block %s/%s not in the manifest", *this, file, offset);
+        throw DataExhausted();
+      }
       std::string s3_name = this->_make_s3_name(file, offset);
       try
       {
         elle::Buffer res;
-        res = this->_s3_handler->get_object(s3_name);
+        res = this->_hedged_read(
+          s3_name,
+          location ? location->size : 0,
+          [this, &s3_name] { return this->_s3_handler->get_object(s3_name); });
         return res;
         // XXX should clean up folder once transaction has been completed.
       }
@@ -240,6 +415,17 @@ namespace surface
     S3TransferBufferer::list()
     {
       ELLE_DEBUG_SCOPE("%s: S3 list", *this);
+      if (this->_manifest)
+      {
+        this->_refresh_manifest();
+        TransferBufferer::List res;
+        for (auto const& chunk: this->_index)
+          res.emplace_back(
+            chunk.first.first,
+            std::make_pair(chunk.first.second, chunk.second.size));
+        return res;
+      }
+      // Folders written by older senders have no manifest.
       try
       {
         TransferBufferer::List res;
@@ -249,6 +435,8 @@ namespace surface
         do
         {
           list = this->_s3_handler->list_remote_folder(marker);
+          if (list.empty())
+            break;
           marker = list.back().first;
           // If we're running a second+ time, it means that we'll get marker
           // element twice, so remove it.
@@ -312,6 +500,9 @@ namespace surface
       TransferBufferer::List res;
       for (auto const& item: list)
       {
+        // Skip the meta-data, the segments and the manifest.
+        if (item.first.empty() || !std::isdigit(item.first[0]))
+          continue;
         std::pair<FileOffset, FileSize> inner;
         inner = std::make_pair(this->_offset_from_s3_name(item.first),
                                boost::lexical_cast<FileSize>(item.second));
@@ -344,6 +535,503 @@ namespace surface
       }
     }
 
+    void
+    S3TransferBufferer::flush()
+    {
+      if (!this->_manifest)
+        return;
+      ELLE_TRACE_SCOPE("%s: flush", *this);
+      // Flushes write the manifest in turn.
+      reactor::Lock lock(this->_manifest_mutex);
+      if (this->segment_size() > 0)
+      {
+        this->_flush_segment();
+        auto last = this->_segment_next;
+        while (!this->_uploading.empty() && *this->_uploading.begin() < last)
+          reactor::wait(this->_uploaded);
+      }
+      if (this->_upload_failed)
+        throw elle::Exception(
+          elle::sprintf("%s: unable to upload segments", *this));
+      if (!this->_stored.empty())
+      {
+        List stored;
+        std::swap(stored, this->_stored);
+        this->_add_segment(no_segment, std::move(stored));
+      }
+      this->_write_manifest();
+    }
+
+    /*---------.
+    | Manifest |
+    `---------*/
+
+    S3TransferBufferer::FileSize
+    S3TransferBufferer::default_segment_size()
+    {
+      std::string size = elle::os::getenv("INFINIT_CLOUD_SEGMENT_SIZE", "");
+      if (!size.empty())
+        return boost::lexical_cast<FileSize>(size);
+      else
+        return 8 << 20;
+    }
+
+    elle::Buffer
+    S3TransferBufferer::pack_manifest(Segments::const_iterator begin,
+                                      Segments::const_iterator end)
+    {
+      // For each segment, its number, its number of chunks then their file,
+      // offset and size, in the order they are packed.
+      elle::Buffer res;
+      for (auto segment = begin; segment != end; ++segment)
+      {
+        frete::encoding::put_uint64(res, segment->first);
+        frete::encoding::put_uint64(res, segment->second.size());
+        for (auto const& chunk: segment->second)
+        {
+          frete::encoding::put_uint64(res, chunk.first);
+          frete::encoding::put_uint64(res, chunk.second.first);
+          frete::encoding::put_uint64(res, chunk.second.second);
+        }
+      }
+      return res;
+    }
+
+    S3TransferBufferer::Segments
+    S3TransferBufferer::unpack_manifest(elle::ConstWeakBuffer const& data)
+    {
+      std::size_t position = 0;
+      auto get = [&]
+        {
+          return frete::encoding::get_uint64(data, position);
+        };
+      Segments res;
+      while (position != data.size())
+      {
+        auto segment = get();
+        auto count = get();
+        frete::encoding::check_count(data, position, count, 24, "chunks");
+        List chunks;
+        chunks.reserve(count);
+        for (uint64_t i = 0; i < count; ++i)
+        {
+          auto file = get();
+          auto offset = get();
+          auto size = get();
+          chunks.emplace_back(file, std::make_pair(offset, size));
+        }
+        res.emplace_back(segment, std::move(chunks));
+      }
+      return res;
+    }
+
+    void
+    S3TransferBufferer::_flush_segment()
+    {
+      if (this->_segment_chunks.empty())
+        return;
+      auto segment = this->_segment_next++;
+      // Let other putters pack the next segment meanwhile.
+      elle::Buffer data(std::move(this->_segment));
+      this->_segment = elle::Buffer();
+      List chunks;
+      std::swap(chunks, this->_segment_chunks);
+      ELLE_DEBUG_SCOPE("%s: upload segment %s of %s chunks, %s bytes",
+                       *this, segment, chunks.size(), data.size());
+      this->_uploading.insert(segment);
+      elle::SafeFinally uploaded([&]
+        {
+          this->_uploading.erase(segment);
+          this->_uploaded.signal();
+        });
+      try
+      {
+        this->_s3_handler->put_object(data, this->_segment_name(segment));
+      }
+      catch (...)
+      {
+        // The chunks are lost, they must not be acknowledged by a flush.
+        this->_upload_failed = true;
+        ELLE_ERR("%s: unable to put segment %s: %s",
+                 *this, segment, elle::exception_string());
+        throw;
+      }
+      this->_add_segment(segment, std::move(chunks));
+    }
+
+    void
+    S3TransferBufferer::_write_manifest()
+    {
+      // Segments recorded while uploading are written by the next flush.
+      auto end = this->_segments.size();
+      if (this->_manifest_written == end)
+        return;
+      // Every flush writes a part, that recipients already reading the
+      // manifest follow.
+      {
+        ELLE_DEBUG_SCOPE("%s: write manifest part %s of %s segments",
+                         *this, this->_manifest_next,
+                         end - this->_manifest_written);
+        this->_s3_handler->put_object(
+          pack_manifest(this->_segments.begin() + this->_manifest_written,
+                        this->_segments.begin() + end),
+          this->_manifest_part_name(this->_manifest_next));
+        ++this->_manifest_next;
+        ++this->_manifest_parts_written;
+      }
+      this->_manifest_written = end;
+      // Rewrite the manifest whole once the parts pile up or outgrow it, so
+      // that it is mostly read at once.
+      if (this->_manifest_parts_written >= this->_manifest_parts ||
+          end - this->_manifest_whole > this->_manifest_whole)
+      {
+        ELLE_DEBUG_SCOPE("%s: write manifest of %s segments", *this, end);
+        // The parts it includes, that readers skip.
+        elle::Buffer data;
+        frete::encoding::put_uint64(data, this->_manifest_next);
+        auto segments = pack_manifest(this->_segments.begin(),
+                                      this->_segments.begin() + end);
+        data.append(segments.contents(), segments.size());
+        this->_s3_handler->put_object(data, "manifest");
+        this->_manifest_whole = end;
+        this->_manifest_parts_written = 0;
+      }
+    }
+
+    bool
+    S3TransferBufferer::_load_manifest()
+    {
+      ELLE_DEBUG_SCOPE("%s: fetch manifest", *this);
+      elle::Buffer data;
+      try
+      {
+        data = this->_s3_handler->get_object("manifest");
+      }
+      catch (aws::FileNotFound const&)
+      {
+        ELLE_DEBUG("%s: no manifest", *this);
+        return false;
+      }
+      std::size_t position = 0;
+      auto next = frete::encoding::get_uint64(data, position);
+      auto segments = unpack_manifest(
+        elle::ConstWeakBuffer(data.contents() + position,
+                              data.size() - position));
+      this->_index.clear();
+      this->_segments.clear();
+      for (auto& segment: segments)
+        this->_add_segment(segment.first, std::move(segment.second));
+      this->_manifest_whole = this->_segments.size();
+      this->_manifest_written = this->_segments.size();
+      this->_manifest_next = next;
+      this->_manifest_parts_written = 0;
+      this->_load_manifest_parts();
+      return true;
+    }
+
+    bool
+    S3TransferBufferer::_load_manifest_parts()
+    {
+      bool res = false;
+      while (true)
+      {
+        Segments segments;
+        try
+        {
+          segments = unpack_manifest(this->_s3_handler->get_object(
+            this->_manifest_part_name(this->_manifest_next)));
+        }
+        catch (aws::FileNotFound const&)
+        {
+          return res;
+        }
+        ELLE_DEBUG("%s: fetched manifest part %s of %s segments",
+                   *this, this->_manifest_next, segments.size());
+        for (auto& segment: segments)
+          this->_add_segment(segment.first, std::move(segment.second));
+        this->_manifest_written = this->_segments.size();
+        ++this->_manifest_next;
+        ++this->_manifest_parts_written;
+        res = true;
+      }
+    }
+
+    bool
+    S3TransferBufferer::_refresh_manifest()
+    {
+      reactor::Lock lock(this->_manifest_mutex);
+      // The manifest is written whole first.
+      if (this->_manifest_written == 0)
+        return this->_load_manifest();
+      else
+        return this->_load_manifest_parts();
+    }
+
+    void
+    S3TransferBufferer::_recover_manifest()
+    {
+      // Only list folders of transfers started by older senders.
+      try
+      {
+        this->_s3_handler->get_object("meta_data");
+      }
+      catch (aws::FileNotFound const&)
+      {
+        return;
+      }
+      ELLE_TRACE_SCOPE("%s: no manifest, list stored chunks", *this);
+      this->_stored = this->list();
+      ELLE_DEBUG("%s: %s chunks stored", *this, this->_stored.size());
+    }
+
+    void
+    S3TransferBufferer::_add_segment(uint64_t segment, List chunks)
+    {
+      // Chunks put again, when resuming, are found in the latest segment.
+      FileOffset position = 0;
+      for (auto const& chunk: chunks)
+      {
+        this->_index[std::make_pair(chunk.first, chunk.second.first)] =
+          Location{segment, position, chunk.second.second};
+        if (segment != no_segment)
+          position += chunk.second.second;
+      }
+      this->_segments.emplace_back(segment, std::move(chunks));
+      if (segment != no_segment)
+        this->_segment_next = std::max(this->_segment_next, segment + 1);
+    }
+
+    elle::Buffer
+    S3TransferBufferer::_get_segment(uint64_t segment,
+                                     FileOffset position,
+                                     FileSize size)
+    {
+      ELLE_DEBUG_SCOPE("%s: S3 get segment %s (offset: %s, size: %s)",
+                       *this, segment, position, size);
+      try
+      {
+        auto res = this->_read_range(
+          this->_segment_name(segment), position, size);
+        if (res.size() != size)
+          throw elle::Exception(
+            elle::sprintf("%s: got %s bytes of segment %s instead of %s",
+                          *this, res.size(), segment, size));
+        return res;
+      }
+      catch (aws::FileNotFound const& e)
+      {
+        ELLE_LOG("%s: segment %s not found on aws", *this, segment);
+        throw DataExhausted();
+      }
+    }
+
+    /*------.
+    | Reads |
+    `------*/
+
+    S3TransferBufferer::ReadPolicy
+    S3TransferBufferer::default_read_policy()
+    {
+      ReadPolicy res{95, 2 << 20, 4};
+      std::string percentile =
+        elle::os::getenv("INFINIT_CLOUD_HEDGE_PERCENTILE", "");
+      if (!percentile.empty())
+        res.hedge_percentile = boost::lexical_cast<int>(percentile);
+      std::string part_size = elle::os::getenv("INFINIT_CLOUD_PART_SIZE", "");
+      if (!part_size.empty())
+        res.part_size = boost::lexical_cast<FileSize>(part_size);
+      std::string max_parts = elle::os::getenv("INFINIT_CLOUD_MAX_PARTS", "");
+      if (!max_parts.empty())
+        res.max_parts = boost::lexical_cast<int>(max_parts);
+      return res;
+    }
+
+    S3TransferBufferer::ReadStats
+    S3TransferBufferer::take_read_stats()
+    {
+      auto res = this->_read_stats;
+      this->_read_stats =
+        ReadStats{0, 0, 0, 0, this->_read_stats.hedge_threshold};
+      return res;
+    }
+
+    elle::Buffer
+    S3TransferBufferer::_hedged_read(std::string const& name,
+                                     FileSize size,
+                                     std::function<elle::Buffer ()> const& read)
+    {
+      auto now = [] { return boost::posix_time::microsec_clock::universal_time(); };
+      auto& stats = this->_read_stats;
+      ++stats.requests;
+      auto hedge = this->_hedge_thresholds.find(size_class(size));
+      if (hedge == this->_hedge_thresholds.end() || hedge->second <= 0)
+      {
+        auto start = now();
+        auto res = read();
+        this->_read_sample(size, now() - start);
+        return res;
+      }
+      auto threshold = boost::posix_time::microseconds(
+        static_cast<int64_t>(hedge->second * 1e6));
+      boost::optional<elle::Buffer> res;
+      bool hedge_won = false;
+      std::exception_ptr error;
+      int running = 0;
+      // Opened once a request answered or all failed.
+      reactor::Barrier done;
+      elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+      {
+        auto request = [&] (bool hedge)
+          {
+            ++running;
+            scope.run_background(
+              hedge ? elle::sprintf("%s (hedge)", name) : name,
+              [&, hedge]
+              {
+                auto start = now();
+                try
+                {
+                  auto data = read();
+                  if (!res)
+                  {
+                    this->_read_sample(size, now() - start);
+                    res = std::move(data);
+                    hedge_won = hedge;
+                  }
+                }
+                catch (reactor::Terminate const&)
+                {
+                  throw;
+                }
+                catch (...)
+                {
+                  if (!error)
+                    error = std::current_exception();
+                }
+                if (--running == 0 || res)
+                  done.open();
+              });
+          };
+        request(false);
+        if (!done.wait(threshold))
+        {
+          ELLE_DEBUG("%s: %s slower than %s, hedge", *this, name, threshold);
+          ++stats.hedged;
+          request(true);
+          reactor::wait(done);
+        }
+        scope.terminate_now();
+      };
+      if (res)
+      {
+        if (hedge_won)
+          ++stats.hedge_wins;
+        return std::move(*res);
+      }
+      std::rethrow_exception(error);
+    }
+
+    elle::Buffer
+    S3TransferBufferer::_read_range(std::string const& object,
+                                    FileOffset position,
+                                    FileSize size)
+    {
+      auto read = [this, &object] (FileOffset position, FileSize size)
+        {
+          return this->_hedged_read(
+            elle::sprintf("%s at %s", object, position),
+            size,
+            [this, &object, position, size]
+            {
+              return this->_s3_handler->get_object_chunk(
+                object, position, size);
+            });
+        };
+      auto const& policy = this->_read_policy;
+      if (policy.part_size == 0 || policy.max_parts < 2 ||
+          size <= policy.part_size)
+        return read(position, size);
+      int parts = std::min<FileSize>(
+        policy.max_parts, (size + policy.part_size - 1) / policy.part_size);
+      FileSize part = (size + parts - 1) / parts;
+      ELLE_DEBUG("%s: read %s bytes of %s in %s parts",
+                 *this, size, object, parts);
+      ++this->_read_stats.split;
+      std::vector<elle::Buffer> buffers(parts);
+      elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+      {
+        for (int i = 0; i < parts && i * part < size; ++i)
+        {
+          FileOffset offset = i * part;
+          FileSize length = std::min(part, size - offset);
+          scope.run_background(
+            elle::sprintf("%s part %s", object, i),
+            [&, i, offset, length]
+            {
+              buffers[i] = read(position + offset, length);
+            });
+        }
+        reactor::wait(scope);
+      };
+      elle::Buffer res;
+      for (auto const& buffer: buffers)
+        res.append(buffer.contents(), buffer.size());
+      return res;
+    }
+
+    int
+    S3TransferBufferer::size_class(FileSize size)
+    {
+      int res = 0;
+      for (; size > 1; size >>= 1)
+        ++res;
+      return res;
+    }
+
+    void
+    S3TransferBufferer::_read_sample(FileSize size, reactor::Duration latency)
+    {
+      auto key = size_class(size);
+      auto& latencies = this->_latencies[key];
+      latencies.push_back(latency.total_microseconds() / 1e6);
+      if (latencies.size() > static_cast<unsigned>(hedge_max_samples))
+        latencies.pop_front();
+      auto percentile = this->_read_policy.hedge_percentile;
+      auto& threshold = this->_hedge_thresholds[key];
+      if (percentile <= 0 || percentile >= 100 ||
+          latencies.size() < static_cast<unsigned>(hedge_min_samples))
+        threshold = 0;
+      else
+      {
+        std::vector<double> sorted(latencies.begin(), latencies.end());
+        auto nth = sorted.begin() + (sorted.size() - 1) * percentile / 100;
+        std::nth_element(sorted.begin(), nth, sorted.end());
+        threshold = *nth;
+      }
+      this->_read_stats.hedge_threshold = threshold;
+    }
+
+    std::string
+    S3TransferBufferer::_segment_name(uint64_t segment)
+    {
+      return elle::sprintf("segment_%012s", segment);
+    }
+
+    std::string
+    S3TransferBufferer::_manifest_part_name(uint64_t part)
+    {
+      return elle::sprintf("manifest_%012s", part);
+    }
+
+    boost::optional<S3TransferBufferer::Location>
+    S3TransferBufferer::_locate(FileID file, FileOffset offset)
+    {
+      auto it = this->_index.find(std::make_pair(file, offset));
+      if (it == this->_index.end())
+        return {};
+      return it->second;
+    }
+
     /*----------.
     | Printable |
     `----------*/
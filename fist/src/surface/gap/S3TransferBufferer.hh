@@ -1,11 +1,21 @@
 #ifndef SURFACE_GAP_S3_TRANSFER_BUFFERER_HH
 # define SURFACE_GAP_S3_TRANSFER_BUFFERER_HH
 
+# include <deque>
+# include <functional>
+# include <map>
+# include <set>
+
 # include <boost/filesystem/path.hpp>
+# include <boost/optional.hpp>
 
 # include <elle/attribute.hh>
 # include <elle/json/json.hh>
 
+# include <reactor/duration.hh>
+# include <reactor/mutex.hh>
+# include <reactor/signal.hh>
+
 # include <surface/gap/TransferBufferer.hh>
 
 # include <aws/Credentials.hh>
@@ -39,6 +49,8 @@ namespace surface
 
       /// Sender constructor.
       /// The sender saves the meta-data for the transfer to the cloud.
+      /// Chunks are packed in segments of \a segment_size bytes, or stored
+      /// in their own object if zero, which older recipients expect.
       S3TransferBufferer(
         std::unique_ptr<aws::S3> s3,
         infinit::oracles::PeerTransaction& transaction,
@@ -46,7 +58,9 @@ namespace surface
         FileCount count,
         FileSize total_size,
         Files const& files,
-        infinit::cryptography::Code const& key);
+        infinit::cryptography::Code const& key,
+        bool compressed = false,
+        FileSize segment_size = 0);
 
       /// Recipient constructor from cloud archive.
       /// Expect just this file in folder and fetch it, no cloud metadata.
@@ -80,6 +94,14 @@ namespace surface
       virtual
       infinit::cryptography::Code
       encrypted_read(FileID f, FileOffset start, FileSize size) override;
+      /// Return strongly crypted chunks, reading those lying next to each
+      /// other in a segment at once.
+      virtual
+      std::vector<infinit::cryptography::Code>
+      encrypted_read_range(frete::Frete::Positions const& positions,
+                           FileSize size,
+                           FileSize progress,
+                           bool compress) override;
 
     /*----------.
     | Buffering |
@@ -106,6 +128,11 @@ namespace surface
       virtual
       void
       cleanup() override;
+      /// Upload the current segment and record the chunks stored in the
+      /// manifest.
+      virtual
+      void
+      flush() override;
 
     /*-----------.
     | Attributes |
@@ -114,6 +141,169 @@ namespace surface
       ELLE_ATTRIBUTE(std::function<aws::Credentials(bool)>, credentials);
       ELLE_ATTRIBUTE(std::unique_ptr<aws::S3>, s3_handler);
 
+    /*---------.
+    | Manifest |
+    `---------*/
+    public:
+      /// Where a chunk lies in the segments.
+      struct Location
+      {
+        uint64_t segment;
+        FileOffset position;
+        FileSize size;
+      };
+      typedef std::map<std::pair<FileID, FileOffset>, Location> Index;
+      /// Chunks of a segment, in the order they were packed.
+      typedef std::vector<std::pair<uint64_t, List>> Segments;
+      /// The segment of chunks stored in their own object.
+      static uint64_t const no_segment = uint64_t(-1);
+      /// Segment size when the recipients can read them:
+      /// INFINIT_CLOUD_SEGMENT_SIZE, 8MB by default. Zero stores each chunk
+      /// in its own object.
+      static
+      FileSize
+      default_segment_size();
+      /// Serialize the chunks of segments.
+      static
+      elle::Buffer
+      pack_manifest(Segments::const_iterator begin,
+                    Segments::const_iterator end);
+      static
+      Segments
+      unpack_manifest(elle::ConstWeakBuffer const& data);
+    private:
+      /// Upload the current segment.
+      void
+      _flush_segment();
+      /// Write the chunks stored since the last flush as a part, and with the
+      /// whole manifest from time to time.
+      void
+      _write_manifest();
+      /// Fetch the manifest, return whether there is one.
+      bool
+      _load_manifest();
+      /// Fetch the parts written since the manifest was loaded, return
+      /// whether there was any.
+      bool
+      _load_manifest_parts();
+      /// Fetch what was added to the manifest since it was read, return
+      /// whether anything was.
+      bool
+      _refresh_manifest();
+      /// Record chunks stored when there is no manifest, from the listing.
+      void
+      _recover_manifest();
+      void
+      _add_segment(uint64_t segment, List chunks);
+      /// Read size bytes at position of a segment.
+      elle::Buffer
+      _get_segment(uint64_t segment, FileOffset position, FileSize size);
+      std::string
+      _segment_name(uint64_t segment);
+      std::string
+      _manifest_part_name(uint64_t part);
+      boost::optional<Location>
+      _locate(FileID file, FileOffset offset);
+      /// Whether the sender records the chunks stored in a manifest,
+      /// advertised in the meta-data.
+      ELLE_ATTRIBUTE(bool, manifest);
+      /// Chunks stored.
+      ELLE_ATTRIBUTE(Index, index);
+      /// Chunks stored, by segment, in the order they were.
+      ELLE_ATTRIBUTE(Segments, segments);
+      /// The segment being packed, and its chunks.
+      ELLE_ATTRIBUTE(elle::Buffer, segment);
+      ELLE_ATTRIBUTE(List, segment_chunks);
+      ELLE_ATTRIBUTE(uint64_t, segment_next);
+      /// Chunks stored in their own object since the last flush.
+      ELLE_ATTRIBUTE(List, stored);
+      /// Segments being uploaded.
+      ELLE_ATTRIBUTE(std::set<uint64_t>, uploading);
+      ELLE_ATTRIBUTE(bool, upload_failed);
+      ELLE_ATTRIBUTE(reactor::Signal, uploaded);
+      /// Serialize the writes and reads of the manifest.
+      ELLE_ATTRIBUTE(reactor::Mutex, manifest_mutex);
+      /// Segments in the manifest object, and in the manifest as a whole.
+      ELLE_ATTRIBUTE(std::size_t, manifest_whole);
+      ELLE_ATTRIBUTE(std::size_t, manifest_written);
+      /// The next part of the manifest, and the parts since it was whole.
+      ELLE_ATTRIBUTE(uint64_t, manifest_next);
+      ELLE_ATTRIBUTE(int, manifest_parts_written);
+      /// Parts written before the manifest is rewritten whole, and read at
+      /// most along with it, 64 by default.
+      ELLE_ATTRIBUTE_RW(int, manifest_parts);
+
+    /*------.
+    | Reads |
+    `------*/
+    public:
+      /// How reads are spread over requests.
+      struct ReadPolicy
+      {
+        /// Percentile of the latency of recent requests past which a
+        /// duplicate one is sent, the first answer winning. Zero disables
+        /// it.
+        int hedge_percentile;
+        /// Reads bigger than this are split in parallel range requests.
+        /// Zero disables it.
+        FileSize part_size;
+        /// Most range requests a read is split in.
+        int max_parts;
+      };
+      /// INFINIT_CLOUD_HEDGE_PERCENTILE (95 by default),
+      /// INFINIT_CLOUD_PART_SIZE (2MB by default) and
+      /// INFINIT_CLOUD_MAX_PARTS (4 by default).
+      static
+      ReadPolicy
+      default_read_policy();
+      ELLE_ATTRIBUTE_RW(ReadPolicy, read_policy);
+      struct ReadStats
+      {
+        /// Requests sent, parts of split reads included, hedges excluded.
+        uint64_t requests;
+        /// Requests a duplicate was sent for, and that it answered first.
+        uint64_t hedged;
+        uint64_t hedge_wins;
+        /// Reads split in parallel range requests.
+        uint64_t split;
+        /// Latency past which requests of the size last measured are
+        /// hedged, in seconds, zero until enough are measured.
+        double hedge_threshold;
+      };
+      ELLE_ATTRIBUTE_R(ReadStats, read_stats);
+      /// The reads counted so far, starting over.
+      ReadStats
+      take_read_stats();
+      /// Requests of a size measured before any is hedged, and latencies
+      /// kept to compute the percentile.
+      static int const hedge_min_samples = 20;
+      static int const hedge_max_samples = 200;
+      /// Latencies are measured apart for each power of two of the size
+      /// requested, small requests answering faster than big ones.
+      static
+      int
+      size_class(FileSize size);
+    private:
+      /// Send a request, and a duplicate if it takes too long.
+      elle::Buffer
+      _hedged_read(std::string const& name,
+                   FileSize size,
+                   std::function<elle::Buffer ()> const& read);
+      /// Read size bytes at position of an object, in parallel range
+      /// requests if big.
+      elle::Buffer
+      _read_range(std::string const& object,
+                  FileOffset position,
+                  FileSize size);
+      void
+      _read_sample(FileSize size, reactor::Duration latency);
+      /// Latencies of the last requests, in seconds, and the resulting hedge
+      /// thresholds, by size class.
+      typedef std::map<int, std::deque<double>> Latencies;
+      ELLE_ATTRIBUTE(Latencies, latencies);
+      typedef std::map<int, double> Thresholds;
+      ELLE_ATTRIBUTE(Thresholds, hedge_thresholds);
+
     /*--------.
     | Helpers |
     `--------.*/
@@ -24,6 +24,12 @@
 
 #include <common/common.hh>
 
+#include <frete/BufferPool.hh>
+#include <frete/CryptoPool.hh>
+#include <frete/Dedup.hh>
+#include <frete/DiskWriter.hh>
+#include <frete/HandleCache.hh>
+
 #include <papier/Identity.hh>
 #include <papier/Passport.hh>
 #include <papier/Authority.hh>
@@ -174,6 +180,10 @@ namespace surface
       , _login_watcher_thread(nullptr)
       , _authority(local_config.authority())
     {
+      this->_frete_handles = std::make_shared<frete::HandleCache>();
+      this->_crypto_pool = std::make_shared<frete::CryptoPool>();
+      this->_disk_writer = std::make_shared<frete::DiskWriter>();
+      this->_buffer_pool = std::make_shared<frete::BufferPool>();
       this->_logged_out.open();
       ELLE_TRACE_SCOPE("%s: create state", *this);
       if (!this->_metrics_reporter)
@@ -983,6 +993,7 @@ namespace surface
             this->_user_indexes.clear();
             this->_swagger_indexes.clear();
             this->_users.clear();
+            this->_dedup_index.reset();
 
             this->_avatar_fetching_barrier.close();
             if (this->_avatar_fetcher_thread != nullptr)
@@ -1198,6 +1209,17 @@ namespace surface
       this->_metrics_reporter->user_changed_download_dir(fallback);
     }
 
+    std::shared_ptr<frete::dedup::Index> const&
+    State::dedup_index()
+    {
+      if (this->_dedup_index == nullptr)
+        this->_dedup_index = std::make_shared<frete::dedup::Index>(
+          boost::filesystem::path(
+            this->local_configuration().persistent_user_directory(
+              this->me().id)) / "dedup.index");
+      return this->_dedup_index;
+    }
+
     void
     State::synchronize()
     {
@@ -24,6 +24,8 @@
 
 # include <aws/S3.hh>
 
+# include <frete/fwd.hh>
+
 # include <papier/fwd.hh>
 
 # include <infinit/metrics/CompositeReporter.hh>
@@ -724,6 +726,20 @@ namespace surface
 
       ELLE_ATTRIBUTE_R(Transactions, transactions);
       Transactions& transactions() {  return this->_transactions; }
+      /// Open files shared by all sending transactions.
+      ELLE_ATTRIBUTE_R(std::shared_ptr<frete::HandleCache>, frete_handles);
+      /// Chunk encryption workers shared by all transactions.
+      ELLE_ATTRIBUTE_R(std::shared_ptr<frete::CryptoPool>, crypto_pool);
+      /// Disk writes of all receiving transactions, off the scheduler.
+      ELLE_ATTRIBUTE_R(std::shared_ptr<frete::DiskWriter>, disk_writer);
+      /// Memory budget of the buffers of all transactions.
+      ELLE_ATTRIBUTE_R(std::shared_ptr<frete::BufferPool>, buffer_pool);
+      /// Files received by the user, loaded on first use.
+      std::shared_ptr<frete::dedup::Index> const&
+      dedup_index();
+    private:
+      ELLE_ATTRIBUTE(std::shared_ptr<frete::dedup::Index>, dedup_index);
+    public:
 
       void
       transaction_pause(uint32_t id,
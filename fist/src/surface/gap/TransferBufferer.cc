@@ -16,7 +16,9 @@ namespace surface
 
     TransferBufferer::TransferBufferer(
       infinit::oracles::PeerTransaction& transaction):
-      _transaction(transaction)
+      _transaction(transaction),
+      _compressed(false),
+      _segment_size(0)
     {}
 
     void
@@ -38,6 +40,10 @@ namespace surface
     TransferBufferer::finish()
     {}
 
+    void
+    TransferBufferer::flush()
+    {}
+
     TransferBufferer::FileSize
     TransferBufferer::file_size(FileID f)
     {
@@ -72,5 +78,20 @@ namespace surface
       set_progress(progress);
       return encrypted_read(f, start, size);
     }
+
+    std::vector<infinit::cryptography::Code>
+    TransferBufferer::encrypted_read_range(
+      frete::Frete::Positions const& positions,
+      FileSize size,
+      FileSize progress,
+      bool)
+    {
+      set_progress(progress);
+      std::vector<infinit::cryptography::Code> res;
+      res.reserve(positions.size());
+      for (auto const& position: positions)
+        res.push_back(encrypted_read(position.first, position.second, size));
+      return res;
+    }
   }
 }
@@ -45,6 +45,11 @@ namespace surface
     public:
       TransferBufferer(infinit::oracles::PeerTransaction& transaction);
       ELLE_ATTRIBUTE_R(infinit::oracles::PeerTransaction&, transaction);
+      /// Whether chunks are stored framed through frete::compression::pack.
+      ELLE_ATTRIBUTE_RP(bool, compressed, protected:);
+      /// Size of the objects consecutive chunks are packed in, zero if each
+      /// chunk is stored alone.
+      ELLE_ATTRIBUTE_RP(FileSize, segment_size, protected:);
 
     /*------.
     | Frete |
@@ -79,6 +84,14 @@ namespace surface
       virtual
       infinit::cryptography::Code
       encrypted_read_acknowledge(FileID f, FileOffset start, FileSize size, FileSize progress);
+      /// Return strongly crypted chunks at each position, as stored: compress
+      /// is ignored, see compressed().
+      virtual
+      std::vector<infinit::cryptography::Code>
+      encrypted_read_range(frete::Frete::Positions const& positions,
+                           FileSize size,
+                           FileSize progress,
+                           bool compress);
       /// Get the key of the transfer.
       virtual
       infinit::cryptography::Code const&
@@ -113,6 +126,11 @@ namespace surface
       virtual
       List
       list() = 0;
+      /// Make sure the chunks put so far are stored and readable. Chunks
+      /// put are only guaranteed to be stored once flushed. no-op.
+      virtual
+      void
+      flush();
       // Request to clear buffered data when transfer is finished.
       virtual
       void
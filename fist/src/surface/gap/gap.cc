@@ -29,6 +29,8 @@
 
 #include <infinit/oracles/meta/Client.hh>
 
+#include <frete/BufferPool.hh>
+
 #include <surface/gap/Error.hh>
 #include <surface/gap/gap_bridge.hh>
 #include <surface/gap/Model.hh>
@@ -208,6 +210,27 @@ gap_session_id(gap_State* state, std::string& res)
     });
 }
 
+gap_Status
+gap_buffer_stats(gap_State* state,
+                 std::unordered_map<std::string, uint64_t>& res)
+{
+  ELLE_ASSERT(state != nullptr);
+  return run<gap_Status>(
+    state,
+    "buffer stats",
+    [&] (surface::gap::State& state) -> gap_Status
+    {
+      auto stats = state.buffer_pool()->stats();
+      res["capacity"] = stats.capacity;
+      res["used"] = stats.used;
+      res["peak"] = stats.peak;
+      res["cached"] = stats.cached;
+      res["reservations"] = stats.reservations;
+      res["waits"] = stats.waits;
+      return gap_ok;
+    });
+}
+
 gap_Status
 gap_web_login_token(gap_State* state, std::string& res)
 {
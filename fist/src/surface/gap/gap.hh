@@ -63,6 +63,12 @@ gap_unset_proxy(gap_State* state, gap_ProxyType type);
 void
 gap_clean_state(gap_State* state);
 
+/// Memory held by the transfer buffers: "capacity", "used", "peak" and
+/// "cached" bytes, "reservations" made and how many had to "wait".
+gap_Status
+gap_buffer_stats(gap_State* state,
+                 std::unordered_map<std::string, uint64_t>& res);
+
 /// Get current Meta session ID.
 gap_Status
 gap_session_id(gap_State* state, std::string& res);
@@ -1,9 +1,22 @@
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+#include <boost/filesystem/operations.hpp>
+
 #include <elle/filesystem/TemporaryFile.hh>
+#include <elle/finally.hh>
+#include <elle/json/json.hh>
 #include <elle/log.hh>
+#include <elle/memory.hh>
 #include <elle/test.hh>
+#include <elle/With.hh>
 
+#include <infinit/oracles/meta/Client.hh>
 #include <infinit/oracles/trophonius/Client.hh>
 #include <surface/gap/Exception.hh>
+#include <surface/gap/FilesystemTransferBufferer.hh>
+#include <surface/gap/S3TransferBufferer.hh>
 #include <surface/gap/State.hh>
 #include "server.hh"
 
@@ -319,6 +332,599 @@ ELLE_TEST_SCHEDULED(cloud_to_p2p)
   reactor::wait(sender_finished);
 }
 
+// Switch from a peer sending the manifest a page at a time to the cloud
+// mid transaction.
+ELLE_TEST_SCHEDULED(paged_p2p_to_cloud)
+{
+  tests::Server server;
+  elle::filesystem::TemporaryDirectory sender_home(
+    "cloud-buffer_sender_home_paged");
+  auto const& sender_user =
+    server.register_user("sender@infinit.io", "password");
+  elle::filesystem::TemporaryDirectory recipient_home(
+    "cloud-buffer_recipient_home_paged");
+  auto const& recipient_user =
+    server.register_user("recipient@infinit.io", "password");
+  int const size = 5 * 1024 * 1024;
+  elle::filesystem::TemporaryFile transfered("cloud-buffered");
+  {
+    boost::filesystem::ofstream f(transfered.path());
+    BOOST_CHECK(f.good());
+    for (int i = 0; i < size; ++i)
+    {
+      char c = i % 256;
+      f.write(&c, 1);
+    }
+  }
+  // The chunks buffered by the sender.
+  for (int offset = 0; offset < size; offset += 1 << 18)
+    server.register_s3_object(elle::sprintf("000000000000_%07s", offset));
+  tests::Client sender(server, sender_user, sender_home.path());
+  sender.login();
+  auto& sender_transaction = sender.state->transaction_peer_create(
+    recipient_user.email(),
+    std::vector<std::string>{transfered.path().string()},
+    "message");
+  reactor::Barrier cloud_buffered;
+  auto sender_conn = sender_transaction.status_changed().connect(
+    [&] (gap_TransactionStatus status, boost::optional<gap_Status>)
+    {
+      ELLE_LOG("new sender transaction status: %s", status);
+      if (status == gap_transaction_cloud_buffered)
+        cloud_buffered.open();
+    });
+  reactor::wait(cloud_buffered);
+  // Receive from the peer first.
+  ::setenv("INFINIT_NO_CLOUD_BUFFERING", "1", 1);
+  elle::SafeFinally restore([] { ::unsetenv("INFINIT_NO_CLOUD_BUFFERING"); });
+  tests::Client recipient(server, recipient_user, recipient_home.path());
+  recipient.login();
+  BOOST_CHECK_EQUAL(recipient.state->transactions().size(), 1);
+  auto& recipient_transaction =
+    *recipient.state->transactions().begin()->second;
+  reactor::Barrier transferring, paused, finished;
+  auto recipient_conn = recipient_transaction.status_changed().connect(
+    [&] (gap_TransactionStatus status, boost::optional<gap_Status>)
+    {
+      ELLE_LOG("new recipient transaction status: %s", status);
+      switch (status)
+      {
+        case gap_transaction_transferring:
+          transferring.open();
+          break;
+        case gap_transaction_paused:
+          paused.open();
+          break;
+        case gap_transaction_finished:
+          finished.open();
+          break;
+        case gap_transaction_failed:
+          BOOST_ERROR("recipient transaction failed");
+          break;
+        default:
+          break;
+      }
+    });
+  sender.state->_on_swagger_status_update(recipient.user.id,
+                                          true,
+                                          recipient.device_id,
+                                          true);
+  ELLE_LOG("accept")
+    recipient_transaction.accept();
+  reactor::wait(transferring);
+  // The transfer info was received from the peer once data flows.
+  while (recipient_transaction.progress() == 0)
+    reactor::sleep(10_ms);
+  BOOST_CHECK(!finished);
+  recipient.state->transaction_pause(recipient_transaction.id());
+  reactor::wait(paused);
+  // Only the cloud remains.
+  ::unsetenv("INFINIT_NO_CLOUD_BUFFERING");
+  recipient.state->_on_swagger_status_update(sender.user.id,
+                                             false,
+                                             sender.device_id,
+                                             false);
+  server.s3_gets().clear();
+  recipient.state->transaction_pause(recipient_transaction.id(), false);
+  reactor::wait(finished);
+  BOOST_CHECK(!server.s3_gets().empty());
+}
+
+static
+std::string
+chunk(int i)
+{
+  return elle::sprintf("chunk %s", i);
+}
+
+static
+std::string
+contents(elle::Buffer const& buffer)
+{
+  return std::string(reinterpret_cast<char const*>(buffer.contents()),
+                     buffer.size());
+}
+
+static
+std::unique_ptr<surface::gap::FilesystemTransferBufferer>
+filesystem_sender(infinit::oracles::PeerTransaction& transaction,
+                  boost::filesystem::path const& root)
+{
+  auto res = elle::make_unique<surface::gap::FilesystemTransferBufferer>(
+    transaction, root, 1, 1 << 20,
+    surface::gap::FilesystemTransferBufferer::Files{{"file", 1 << 20}},
+    infinit::cryptography::Code(elle::Buffer("key", 3)));
+  res->latency(reactor::Duration());
+  return res;
+}
+
+// Chunks buffered on disk survive a crash of the sender.
+ELLE_TEST_SCHEDULED(filesystem_bufferer)
+{
+  using surface::gap::FilesystemTransferBufferer;
+  elle::filesystem::TemporaryDirectory root("filesystem-bufferer");
+  infinit::oracles::PeerTransaction transaction;
+  transaction.id = "transaction";
+  auto segment = root.path() / transaction.id / "segment";
+  auto index = root.path() / transaction.id / "index";
+  auto put = [&] (FilesystemTransferBufferer& sender, int i)
+    {
+      auto data = chunk(i);
+      sender.put(0, i * 10, 10, elle::ConstWeakBuffer(data.data(), data.size()));
+    };
+  {
+    auto sender = filesystem_sender(transaction, root.path());
+    for (int i = 0; i < 3; ++i)
+      put(*sender, i);
+    FilesystemTransferBufferer recipient(transaction, root.path());
+    recipient.latency(reactor::Duration());
+    BOOST_CHECK_EQUAL(recipient.list().size(), 3);
+    for (int i = 0; i < 3; ++i)
+      BOOST_CHECK_EQUAL(contents(recipient.get(0, i * 10)), chunk(i));
+    BOOST_CHECK_THROW(recipient.get(0, 30),
+                      FilesystemTransferBufferer::DataExhausted);
+    // Chunks put since are found.
+    put(*sender, 3);
+    BOOST_CHECK_EQUAL(contents(recipient.get(0, 30)), chunk(3));
+  }
+  // Crash while writing a record, with the last entries lost.
+  auto segment_size = boost::filesystem::file_size(segment);
+  boost::filesystem::resize_file(
+    index, 2 * FilesystemTransferBufferer::entry_size - 8);
+  {
+    boost::filesystem::ofstream output(segment, std::ios::binary | std::ios::app);
+    output << "torn";
+  }
+  {
+    // Recipients find the records past the index.
+    FilesystemTransferBufferer recipient(transaction, root.path());
+    recipient.latency(reactor::Duration());
+    BOOST_CHECK_EQUAL(recipient.index().size(), 4);
+    BOOST_CHECK_EQUAL(contents(recipient.get(0, 30)), chunk(3));
+  }
+  {
+    // The sender repairs the index and the segment.
+    auto sender = filesystem_sender(transaction, root.path());
+    BOOST_CHECK_EQUAL(sender->index().size(), 4);
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(segment), segment_size);
+    BOOST_CHECK_EQUAL(boost::filesystem::file_size(index),
+                      4 * FilesystemTransferBufferer::entry_size);
+    put(*sender, 4);
+    FilesystemTransferBufferer recipient(transaction, root.path());
+    recipient.latency(reactor::Duration());
+    for (int i = 0; i < 5; ++i)
+      BOOST_CHECK_EQUAL(contents(recipient.get(0, i * 10)), chunk(i));
+  }
+}
+
+// Put and get throughput of the filesystem bufferer.
+ELLE_TEST_SCHEDULED(filesystem_bufferer_throughput)
+{
+  using surface::gap::FilesystemTransferBufferer;
+  elle::filesystem::TemporaryDirectory root("filesystem-bufferer-throughput");
+  infinit::oracles::PeerTransaction transaction;
+  transaction.id = "transaction";
+  int const count = 64;
+  FilesystemTransferBufferer::FileSize const size = 1 << 20;
+  elle::Buffer data(size);
+  for (unsigned i = 0; i < size; ++i)
+    data.mutable_contents()[i] = i % 251;
+  auto rate = [&] (boost::posix_time::time_duration const& duration)
+    {
+      return count * size / 1e6 /
+        std::max<double>(duration.total_microseconds() / 1e6, 1e-6);
+    };
+  auto start = boost::posix_time::microsec_clock::universal_time();
+  {
+    auto sender = filesystem_sender(transaction, root.path());
+    for (int i = 0; i < count; ++i)
+      sender->put(0, i * size, size, data);
+  }
+  auto put = boost::posix_time::microsec_clock::universal_time() - start;
+  start = boost::posix_time::microsec_clock::universal_time();
+  FilesystemTransferBufferer recipient(transaction, root.path());
+  recipient.latency(reactor::Duration());
+  for (int i = 0; i < count; ++i)
+    BOOST_CHECK(recipient.get(0, i * size) == data);
+  auto get = boost::posix_time::microsec_clock::universal_time() - start;
+  ELLE_LOG("put %s chunks of %s bytes: %s MB/s, get: %s MB/s",
+           count, size, rate(put), rate(get));
+}
+
+// The cloud buffer folder of a test server.
+class TestS3
+  : public aws::S3
+{
+public:
+  TestS3(tests::Server& server)
+    : aws::S3(
+      [] (bool)
+      {
+        auto now = boost::posix_time::second_clock::universal_time();
+        return aws::Credentials(
+          infinit::oracles::meta::CloudCredentialsAws(
+            "", "", "", "region", "bucket", "folder",
+            now + boost::posix_time::hours(24), now));
+      })
+    , _port(server.port())
+  {}
+
+  aws::URL
+  hostname(aws::Credentials const&) const override
+  {
+    return aws::URL{
+      "http://", elle::sprintf("localhost:%s", this->_port), "/s3"};
+  }
+
+  ELLE_ATTRIBUTE(int, port);
+};
+
+static
+void
+s3_error(aws::AWSException const&, bool)
+{}
+
+// A transaction of one 100 bytes file, whose chunks are stored in objects
+// named after their offset.
+static
+infinit::oracles::PeerTransaction
+s3_transaction(tests::Server& server)
+{
+  infinit::oracles::PeerTransaction res;
+  res.id = "transaction";
+  res.total_size = 100;
+  for (int i = 0; i < 10; ++i)
+    server.register_s3_object(elle::sprintf("000000000000_%03s", i * 10));
+  return res;
+}
+
+static
+std::unique_ptr<surface::gap::S3TransferBufferer>
+s3_sender(tests::Server& server,
+          infinit::oracles::PeerTransaction& transaction,
+          surface::gap::S3TransferBufferer::FileSize segment_size)
+{
+  return elle::make_unique<surface::gap::S3TransferBufferer>(
+    elle::make_unique<TestS3>(server), transaction, &s3_error, 1, 100,
+    surface::gap::S3TransferBufferer::Files{{"file", 100}},
+    infinit::cryptography::Code(elle::Buffer("key", 3)),
+    false, segment_size);
+}
+
+static
+std::unique_ptr<surface::gap::S3TransferBufferer>
+s3_recipient(tests::Server& server,
+             infinit::oracles::PeerTransaction& transaction)
+{
+  return elle::make_unique<surface::gap::S3TransferBufferer>(
+    elle::make_unique<TestS3>(server), transaction, &s3_error);
+}
+
+static
+void
+s3_put(surface::gap::S3TransferBufferer& sender, int i)
+{
+  auto data = chunk(i);
+  sender.put(0, i * 10, 10, elle::ConstWeakBuffer(data.data(), data.size()));
+}
+
+static
+int
+count_gets(tests::Server const& server, std::string const& name)
+{
+  return std::count_if(
+    server.s3_gets().begin(), server.s3_gets().end(),
+    [&] (std::string const& get) { return get.find(name) == 0; });
+}
+
+// Recipients follow the manifest parts as they are written, whole rewrites
+// included.
+ELLE_TEST_SCHEDULED(s3_manifest_parts)
+{
+  tests::Server server;
+  auto transaction = s3_transaction(server);
+  // One segment per chunk.
+  auto sender = s3_sender(server, transaction, 1);
+  sender->manifest_parts(2);
+  auto recipient = s3_recipient(server, transaction);
+  for (int i = 0; i < 8; ++i)
+  {
+    s3_put(*sender, i);
+    sender->flush();
+    BOOST_CHECK_EQUAL(contents(recipient->get(0, i * 10)), chunk(i));
+  }
+  BOOST_CHECK_EQUAL(recipient->list().size(), 8);
+  // A part per flush, the manifest rewritten whole every other one.
+  for (int i = 0; i < 8; ++i)
+    BOOST_CHECK_EQUAL(
+      server.s3_objects().count(elle::sprintf("manifest_%012s", i)), 1);
+  BOOST_CHECK_EQUAL(server.s3_objects().count("manifest_000000000008"), 0);
+  // Late recipients only read the parts past the whole manifest.
+  server.s3_gets().clear();
+  auto late = s3_recipient(server, transaction);
+  BOOST_CHECK_EQUAL(count_gets(server, "manifest_"), 2);
+  BOOST_CHECK_EQUAL(count_gets(server, "manifest_000000000007"), 1);
+  for (int i = 0; i < 8; ++i)
+    BOOST_CHECK_EQUAL(contents(late->get(0, i * 10)), chunk(i));
+  BOOST_CHECK_THROW(late->get(0, 80),
+                    surface::gap::S3TransferBufferer::DataExhausted);
+}
+
+// Senders resuming a transfer that left no manifest list the chunks stored.
+ELLE_TEST_SCHEDULED(s3_recover_manifest)
+{
+  tests::Server server;
+  auto transaction = s3_transaction(server);
+  {
+    // Interrupted before any flush.
+    auto sender = s3_sender(server, transaction, 0);
+    for (int i = 0; i < 3; ++i)
+      s3_put(*sender, i);
+  }
+  BOOST_CHECK_EQUAL(server.s3_objects().count("manifest"), 0);
+  auto sender = s3_sender(server, transaction, 0);
+  s3_put(*sender, 3);
+  sender->flush();
+  auto recipient = s3_recipient(server, transaction);
+  BOOST_CHECK_EQUAL(recipient->list().size(), 4);
+  for (int i = 0; i < 4; ++i)
+    BOOST_CHECK_EQUAL(contents(recipient->get(0, i * 10)), chunk(i));
+}
+
+// Chunks lying next to each other in a segment are read at once.
+ELLE_TEST_SCHEDULED(s3_segment_range)
+{
+  tests::Server server;
+  auto transaction = s3_transaction(server);
+  auto sender = s3_sender(server, transaction, 1 << 20);
+  for (int i = 0; i < 4; ++i)
+    s3_put(*sender, i);
+  sender->flush();
+  auto recipient = s3_recipient(server, transaction);
+  server.s3_gets().clear();
+  auto codes = recipient->encrypted_read_range(
+    frete::Frete::Positions{{0, 0}, {0, 10}, {0, 20}, {0, 30}}, 10, 0, false);
+  BOOST_CHECK_EQUAL(codes.size(), 4);
+  for (int i = 0; i < 4; ++i)
+    BOOST_CHECK_EQUAL(contents(codes[i].buffer()), chunk(i));
+  BOOST_CHECK_EQUAL(server.s3_gets().size(), 1);
+  BOOST_CHECK_EQUAL(count_gets(server, "segment_000000000000"), 1);
+  // Chunks apart are read separately.
+  server.s3_gets().clear();
+  codes = recipient->encrypted_read_range(
+    frete::Frete::Positions{{0, 0}, {0, 20}}, 10, 0, false);
+  BOOST_CHECK_EQUAL(contents(codes[0].buffer()), chunk(0));
+  BOOST_CHECK_EQUAL(contents(codes[1].buffer()), chunk(2));
+  BOOST_CHECK_EQUAL(count_gets(server, "segment_000000000000"), 2);
+}
+
+// Older senders store each chunk in its own object, without a manifest.
+ELLE_TEST_SCHEDULED(s3_legacy_chunks)
+{
+  tests::Server server;
+  auto transaction = s3_transaction(server);
+  {
+    auto sender = s3_sender(server, transaction, 0);
+    for (int i = 0; i < 3; ++i)
+      s3_put(*sender, i);
+  }
+  {
+    auto& meta_data = server.s3_objects()["meta_data"];
+    std::stringstream input(meta_data);
+    auto json = boost::any_cast<elle::json::Object>(elle::json::read(input));
+    json.erase("manifest");
+    std::stringstream output;
+    elle::json::write(output, json);
+    meta_data = output.str();
+  }
+  auto recipient = s3_recipient(server, transaction);
+  BOOST_CHECK_EQUAL(recipient->list().size(), 3);
+  server.s3_gets().clear();
+  auto codes = recipient->encrypted_read_range(
+    frete::Frete::Positions{{0, 0}, {0, 10}, {0, 20}}, 10, 0, false);
+  for (int i = 0; i < 3; ++i)
+    BOOST_CHECK_EQUAL(contents(codes[i].buffer()), chunk(i));
+  BOOST_CHECK_EQUAL(count_gets(server, "000000000000_"), 3);
+  BOOST_CHECK_THROW(recipient->get(0, 30),
+                    surface::gap::S3TransferBufferer::DataExhausted);
+}
+
+// Flushes record the segments still uploading once they are stored.
+ELLE_TEST_SCHEDULED(s3_flush_uploading)
+{
+  tests::Server server;
+  auto transaction = s3_transaction(server);
+  auto sender = s3_sender(server, transaction, 1);
+  auto& answers = server.s3_answers()["segment_000000000000"];
+  answers.emplace_back(boost::posix_time::milliseconds(200));
+  bool stored = false;
+  elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+  {
+    scope.run_background(
+      "put",
+      [&]
+      {
+        s3_put(*sender, 0);
+        stored = true;
+      });
+    // Wait for the first segment to be uploading.
+    for (int i = 0; i < 1000 && !answers.empty(); ++i)
+      reactor::sleep(boost::posix_time::milliseconds(5));
+    BOOST_CHECK(answers.empty());
+    s3_put(*sender, 1);
+    sender->flush();
+    BOOST_CHECK(stored);
+    reactor::wait(scope);
+  };
+  auto recipient = s3_recipient(server, transaction);
+  BOOST_CHECK_EQUAL(recipient->list().size(), 2);
+  for (int i = 0; i < 2; ++i)
+    BOOST_CHECK_EQUAL(contents(recipient->get(0, i * 10)), chunk(i));
+}
+
+// Chunks of a segment that failed to upload are never acknowledged.
+ELLE_TEST_SCHEDULED(s3_upload_failure)
+{
+  tests::Server server;
+  auto transaction = s3_transaction(server);
+  auto sender = s3_sender(server, transaction, 1);
+  server.s3_answers()["segment_000000000000"].emplace_back(
+    reactor::Duration(), true);
+  BOOST_CHECK_THROW(s3_put(*sender, 0), std::exception);
+  s3_put(*sender, 1);
+  BOOST_CHECK_EQUAL(server.s3_objects().count("segment_000000000001"), 1);
+  // The failure sticks.
+  BOOST_CHECK_THROW(sender->flush(), elle::Exception);
+  BOOST_CHECK_THROW(sender->flush(), elle::Exception);
+  BOOST_CHECK_EQUAL(server.s3_objects().count("manifest"), 0);
+}
+
+// Four chunks in one segment.
+static
+std::unique_ptr<surface::gap::S3TransferBufferer>
+s3_segment(tests::Server& server,
+           infinit::oracles::PeerTransaction& transaction)
+{
+  {
+    auto sender = s3_sender(server, transaction, 1 << 20);
+    for (int i = 0; i < 4; ++i)
+      s3_put(*sender, i);
+    sender->flush();
+  }
+  return s3_recipient(server, transaction);
+}
+
+// Reads slower than most are sent twice, the first answer winning.
+ELLE_TEST_SCHEDULED(s3_hedged_read)
+{
+  using surface::gap::S3TransferBufferer;
+  tests::Server server;
+  auto transaction = s3_transaction(server);
+  auto recipient = s3_segment(server, transaction);
+  recipient->read_policy(S3TransferBufferer::ReadPolicy{50, 0, 1});
+  auto& answers = server.s3_answers()["segment_000000000000"];
+  // Nothing is hedged until enough latencies are measured.
+  int const samples = S3TransferBufferer::hedge_min_samples;
+  for (int i = 0; i < samples; ++i)
+  {
+    BOOST_CHECK_EQUAL(recipient->read_stats().hedge_threshold, 0);
+    BOOST_CHECK_EQUAL(contents(recipient->get(0, i % 4 * 10)), chunk(i % 4));
+  }
+  auto stats = recipient->take_read_stats();
+  BOOST_CHECK_EQUAL(stats.requests, samples);
+  BOOST_CHECK_EQUAL(stats.hedged, 0);
+  BOOST_CHECK_GT(stats.hedge_threshold, 0);
+  ELLE_LOG("slow request")
+  {
+    // Abandoned once the hedge answers.
+    answers.emplace_back(boost::posix_time::seconds(10));
+    auto start = boost::posix_time::microsec_clock::universal_time();
+    BOOST_CHECK_EQUAL(contents(recipient->get(0, 10)), chunk(1));
+    BOOST_CHECK_LT(
+      boost::posix_time::microsec_clock::universal_time() - start,
+      boost::posix_time::seconds(5));
+    stats = recipient->take_read_stats();
+    BOOST_CHECK_EQUAL(stats.requests, 1);
+    BOOST_CHECK_EQUAL(stats.hedged, 1);
+    BOOST_CHECK_EQUAL(stats.hedge_wins, 1);
+  }
+  ELLE_LOG("failed hedge")
+  {
+    answers.emplace_back(boost::posix_time::milliseconds(300));
+    answers.emplace_back(reactor::Duration(), true);
+    BOOST_CHECK_EQUAL(contents(recipient->get(0, 20)), chunk(2));
+    stats = recipient->take_read_stats();
+    BOOST_CHECK_EQUAL(stats.hedged, 1);
+    BOOST_CHECK_EQUAL(stats.hedge_wins, 0);
+  }
+  ELLE_LOG("failed request and hedge")
+  {
+    answers.emplace_back(boost::posix_time::milliseconds(300), true);
+    answers.emplace_back(reactor::Duration(), true);
+    BOOST_CHECK_THROW(recipient->get(0, 30),
+                      S3TransferBufferer::DataExhausted);
+  }
+  ELLE_LOG("other size")
+  {
+    // Bigger reads are not hedged on the latency of smaller ones.
+    answers.emplace_back(boost::posix_time::milliseconds(300));
+    auto codes = recipient->encrypted_read_range(
+      frete::Frete::Positions{{0, 0}, {0, 10}}, 10, 0, false);
+    BOOST_CHECK_EQUAL(contents(codes[1].buffer()), chunk(1));
+    stats = recipient->take_read_stats();
+    BOOST_CHECK_EQUAL(stats.hedged, 0);
+    BOOST_CHECK_EQUAL(stats.hedge_threshold, 0);
+  }
+}
+
+// No read is hedged without a percentile.
+ELLE_TEST_SCHEDULED(s3_hedge_disabled)
+{
+  using surface::gap::S3TransferBufferer;
+  tests::Server server;
+  auto transaction = s3_transaction(server);
+  auto recipient = s3_segment(server, transaction);
+  recipient->read_policy(S3TransferBufferer::ReadPolicy{0, 0, 1});
+  for (int i = 0; i < 2 * S3TransferBufferer::hedge_min_samples; ++i)
+    recipient->get(0, i % 4 * 10);
+  server.s3_answers()["segment_000000000000"].emplace_back(
+    boost::posix_time::milliseconds(300));
+  BOOST_CHECK_EQUAL(contents(recipient->get(0, 0)), chunk(0));
+  auto stats = recipient->take_read_stats();
+  BOOST_CHECK_EQUAL(stats.hedged, 0);
+  BOOST_CHECK_EQUAL(stats.hedge_threshold, 0);
+}
+
+// Big reads are split in parallel range requests, put back in order.
+ELLE_TEST_SCHEDULED(s3_split_read)
+{
+  using surface::gap::S3TransferBufferer;
+  tests::Server server;
+  auto transaction = s3_transaction(server);
+  auto recipient = s3_segment(server, transaction);
+  frete::Frete::Positions all{{0, 0}, {0, 10}, {0, 20}, {0, 30}};
+  // The 28 bytes read in 4 parts of 7, the first answered last.
+  recipient->read_policy(S3TransferBufferer::ReadPolicy{0, 8, 4});
+  auto& answers = server.s3_answers()["segment_000000000000"];
+  for (int i = 3; i >= 0; --i)
+    answers.emplace_back(boost::posix_time::milliseconds(100 * i));
+  server.s3_gets().clear();
+  auto codes = recipient->encrypted_read_range(all, 10, 0, false);
+  for (int i = 0; i < 4; ++i)
+    BOOST_CHECK_EQUAL(contents(codes[i].buffer()), chunk(i));
+  BOOST_CHECK_EQUAL(count_gets(server, "segment_000000000000"), 4);
+  auto stats = recipient->take_read_stats();
+  BOOST_CHECK_EQUAL(stats.split, 1);
+  BOOST_CHECK_EQUAL(stats.requests, 4);
+  // No more than max_parts requests.
+  recipient->read_policy(S3TransferBufferer::ReadPolicy{0, 2, 3});
+  server.s3_gets().clear();
+  codes = recipient->encrypted_read_range(all, 10, 0, false);
+  for (int i = 0; i < 4; ++i)
+    BOOST_CHECK_EQUAL(contents(codes[i].buffer()), chunk(i));
+  BOOST_CHECK_EQUAL(count_gets(server, "segment_000000000000"), 3);
+}
+
 ELLE_TEST_SUITE()
 {
   auto timeout = valgrind(15);
@@ -326,4 +932,16 @@ ELLE_TEST_SUITE()
   suite.add(BOOST_TEST_CASE(cloud_buffer), 0, timeout);
   suite.add(BOOST_TEST_CASE(recipient_states), 0, timeout);
   suite.add(BOOST_TEST_CASE(cloud_to_p2p), 0, valgrind(30));
+  suite.add(BOOST_TEST_CASE(paged_p2p_to_cloud), 0, valgrind(30));
+  suite.add(BOOST_TEST_CASE(filesystem_bufferer), 0, timeout);
+  suite.add(BOOST_TEST_CASE(filesystem_bufferer_throughput), 0, valgrind(60));
+  suite.add(BOOST_TEST_CASE(s3_manifest_parts), 0, timeout);
+  suite.add(BOOST_TEST_CASE(s3_recover_manifest), 0, timeout);
+  suite.add(BOOST_TEST_CASE(s3_segment_range), 0, timeout);
+  suite.add(BOOST_TEST_CASE(s3_legacy_chunks), 0, timeout);
+  suite.add(BOOST_TEST_CASE(s3_flush_uploading), 0, timeout);
+  suite.add(BOOST_TEST_CASE(s3_upload_failure), 0, timeout);
+  suite.add(BOOST_TEST_CASE(s3_hedged_read), 0, timeout);
+  suite.add(BOOST_TEST_CASE(s3_hedge_disabled), 0, timeout);
+  suite.add(BOOST_TEST_CASE(s3_split_read), 0, timeout);
 }
@@ -1,5 +1,7 @@
 #include "server.hh"
 
+#include <cctype>
+
 #include <boost/lexical_cast.hpp>
 
 #include <elle/Buffer.hh>
@@ -456,63 +458,35 @@ namespace tests
       {
         return "";
       });
-    this->register_route(
-      "/s3/folder/meta_data",
-      reactor::http::Method::PUT,
-      [this] (Server::Headers const&,
-              Server::Cookies const&,
-              Server::Parameters const&,
-              elle::Buffer const& body)
-      {
-        ELLE_LOG("%s: store S3 metadata: %s", *this, body)
-        this->_s3_meta_data = body.string();
-        return "";
-      });
-    this->register_route(
-      "/s3/folder/meta_data",
-      reactor::http::Method::GET,
-      [this] (Server::Headers const&,
-              Server::Cookies const&,
-              Server::Parameters const&,
-              elle::Buffer const&)
-      {
-        if (!this->_s3_meta_data)
-          throw reactor::http::tests::Server::Exception(
-            "/s3/folder/meta_data",
-            reactor::http::StatusCode::Not_Found,
-            "no meta data");
-        else
-          return this->_s3_meta_data.get();
-      });
-    this->register_route(
-      "/s3/folder/000000000000_0000",
-      reactor::http::Method::PUT,
-      [this] (Server::Headers const&,
-              Server::Cookies const&,
-              Server::Parameters const&,
-              elle::Buffer const& body)
-      {
-        this->_maybe_sleep();
-        this->_cloud_buffered = true;
-        this->_s3_data = body.string();
-        return "";
-      });
-    this->register_route(
-      "/s3/folder/000000000000_0000",
-      reactor::http::Method::GET,
-      [this] (Server::Headers const&,
-              Server::Cookies const&,
-              Server::Parameters const&,
-              elle::Buffer const&)
+    // The cloud buffer folder, listed by senders resuming a transfer.
+    auto list = [this] (Server::Headers const&,
+                        Server::Cookies const&,
+                        Server::Parameters const& parameters,
+                        elle::Buffer const&)
       {
-        if (!this->_s3_data)
-          throw reactor::http::tests::Server::Exception(
-            "/s3/folder/000000000000_0000",
-            reactor::http::StatusCode::Not_Found,
-            "no data");
-        else
-          return this->_s3_data.get();
-      });
+        std::string marker;
+        auto it = parameters.find("marker");
+        if (it != parameters.end())
+          marker = it->second.substr(it->second.find('/') + 1);
+        std::string res = "<ListBucketResult>"
+          "<IsTruncated>false</IsTruncated>";
+        for (auto const& object: this->_s3_objects)
+          if (object.first > marker)
+            res += elle::sprintf(
+              "<Contents><Key>folder/%s</Key><Size>%s</Size></Contents>",
+              object.first, object.second.size());
+        res += "</ListBucketResult>";
+        return res;
+      };
+    this->register_route("/s3", reactor::http::Method::GET, list);
+    this->register_route("/s3/", reactor::http::Method::GET, list);
+    this->register_s3_object("meta_data");
+    this->register_s3_object("manifest");
+    this->register_s3_object("000000000000_0000");
+    for (int i = 0; i < 16; ++i)
+      this->register_s3_object(elle::sprintf("manifest_%012s", i));
+    for (int i = 0; i < 16; ++i)
+      this->register_s3_object(elle::sprintf("segment_%012s", i));
 
     this->register_route(
       "/transaction/update",
@@ -1201,6 +1175,84 @@ namespace tests
     this->_session_id = std::move(id);
   }
 
+  Server::S3Answer::S3Answer(reactor::Duration delay, bool fail)
+    : delay(delay)
+    , fail(fail)
+  {}
+
+  void
+  Server::register_s3_object(std::string const& name)
+  {
+    auto path = elle::sprintf("/s3/folder/%s", name);
+    // Chunks and segments hold the buffered data.
+    bool data = !name.empty() &&
+      (std::isdigit(name[0]) || name.find("segment_") == 0);
+    // Delay or fail the request as told.
+    auto answer = [this, name, path]
+      {
+        auto it = this->_s3_answers.find(name);
+        if (it == this->_s3_answers.end() || it->second.empty())
+          return;
+        auto answer = it->second.front();
+        it->second.pop_front();
+        if (answer.delay != reactor::Duration())
+          reactor::sleep(answer.delay);
+        if (answer.fail)
+          throw reactor::http::tests::Server::Exception(
+            path,
+            reactor::http::StatusCode::Not_Found,
+            "request failed");
+      };
+    this->register_route(
+      path,
+      reactor::http::Method::PUT,
+      [this, name, data, answer] (Server::Headers const&,
+                                  Server::Cookies const&,
+                                  Server::Parameters const&,
+                                  elle::Buffer const& body)
+      {
+        if (data)
+          this->_maybe_sleep();
+        answer();
+        if (data)
+          this->_cloud_buffered = true;
+        ELLE_LOG("%s: store S3 object %s of %s bytes",
+                 *this, name, body.size());
+        this->_s3_objects[name] = body.string();
+        return "";
+      });
+    this->register_route(
+      path,
+      reactor::http::Method::GET,
+      [this, name, path, answer] (Server::Headers const& headers,
+                                  Server::Cookies const&,
+                                  Server::Parameters const&,
+                                  elle::Buffer const&) -> std::string
+      {
+        auto range = headers.find("Range");
+        this->_s3_gets.push_back(
+          range == headers.end() ?
+          name : elle::sprintf("%s %s", name, range->second));
+        answer();
+        auto it = this->_s3_objects.find(name);
+        if (it == this->_s3_objects.end())
+          throw reactor::http::tests::Server::Exception(
+            path,
+            reactor::http::StatusCode::Not_Found,
+            "no such object");
+        if (range == headers.end())
+          return it->second;
+        // "bytes=first-last", last included.
+        auto const& value = range->second;
+        auto equal = value.find('=');
+        auto dash = value.find('-');
+        auto first = boost::lexical_cast<std::size_t>(
+          value.substr(equal + 1, dash - equal - 1));
+        auto last = boost::lexical_cast<std::size_t>(value.substr(dash + 1));
+        return it->second.substr(first, last - first + 1);
+      });
+  }
+
   void
   Server::_maybe_sleep()
   {
@@ -1,6 +1,9 @@
 #ifndef FIST_SURFACE_GAP_TESTS_SERVER_HH
 # define FIST_SURFACE_GAP_TESTS_SERVER_HH
 
+#include <deque>
+#include <map>
+
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/mem_fun.hpp>
 #include <boost/multi_index/hashed_index.hpp>
@@ -67,6 +70,22 @@ namespace tests
     Device const&
     device(Cookies const& cookies) const;
 
+    /// Store the S3 object \a name of the cloud buffer folder on PUT and
+    /// serve it, or the requested range of it, on GET.
+    void
+    register_s3_object(std::string const& name);
+
+    /// How the next request for an S3 object is answered: after a delay,
+    /// and with a 404 if it fails.
+    struct S3Answer
+    {
+      S3Answer(reactor::Duration delay = reactor::Duration(),
+               bool fail = false);
+      reactor::Duration delay;
+      bool fail;
+    };
+    typedef std::map<std::string, std::deque<S3Answer>> S3Answers;
+
   protected:
     virtual
     std::string
@@ -137,8 +156,11 @@ namespace tests
       > Transactions;
     ELLE_ATTRIBUTE_RX(Transactions, transactions);
     ELLE_ATTRIBUTE_R(bool, cloud_buffered);
-    ELLE_ATTRIBUTE(boost::optional<std::string>, s3_meta_data)
-    ELLE_ATTRIBUTE(boost::optional<std::string>, s3_data)
+    typedef std::map<std::string, std::string> S3Objects;
+    ELLE_ATTRIBUTE_RX(S3Objects, s3_objects);
+    ELLE_ATTRIBUTE_RX(S3Answers, s3_answers);
+    /// The objects fetched, followed by the range requested if any.
+    ELLE_ATTRIBUTE_RX(std::vector<std::string>, s3_gets);
   };
 
 class SleepyServer : public Server
@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+
+#include <reactor/scheduler.hh>
+#include <reactor/signal.hh>
+
+#include <frete/BufferPool.hh>
+
+ELLE_LOG_COMPONENT("frete.BufferPool");
+
+namespace frete
+{
+  struct BufferPool::Shared
+  {
+    Shared(reactor::Scheduler& scheduler, FileSize capacity)
+      : scheduler(scheduler)
+      , capacity(capacity)
+      , mutex()
+      , used(0)
+      , peak(0)
+      , cached(0)
+      , reservations(0)
+      , waits(0)
+      , slabs()
+      , released()
+    {}
+
+    reactor::Scheduler& scheduler;
+    FileSize capacity;
+    std::mutex mutex;
+    FileSize used;
+    FileSize peak;
+    FileSize cached;
+    uint64_t reservations;
+    uint64_t waits;
+    /// Released buffers by allocated size.
+    std::map<FileSize, std::vector<std::unique_ptr<elle::Buffer>>> slabs;
+    /// Signaled on the scheduler thread when bytes are given back.
+    reactor::Signal released;
+  };
+
+  // Released buffers kept for reuse, at most.
+  static
+  BufferPool::FileSize
+  max_cached(BufferPool::FileSize capacity)
+  {
+    return capacity / 4;
+  }
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+
+  BufferPool::FileSize const BufferPool::slab_size;
+
+  BufferPool::BufferPool(FileSize capacity)
+    : _capacity(capacity)
+    , _shared(std::make_shared<Shared>(*reactor::Scheduler::scheduler(),
+                                       capacity))
+  {
+    ELLE_TRACE("%s: construct", *this);
+  }
+
+  BufferPool::FileSize
+  BufferPool::default_capacity()
+  {
+    std::string capacity = elle::os::getenv("INFINIT_BUFFER_MEMORY", "");
+    if (!capacity.empty())
+      return boost::lexical_cast<FileSize>(capacity);
+    else
+      return 256 << 20;
+  }
+
+  /*------------.
+  | Reservation |
+  `------------*/
+
+  BufferPool::Reservation::Reservation(std::shared_ptr<Shared> shared,
+                                       FileSize size)
+    : _size(size)
+    , _shared(std::move(shared))
+  {}
+
+  BufferPool::Reservation::~Reservation()
+  {
+    auto shared = this->_shared;
+    {
+      std::unique_lock<std::mutex> lock(shared->mutex);
+      shared->used -= this->_size;
+    }
+    // Wake the waiters on the scheduler thread, whatever the releasing one.
+    shared->scheduler.io_service().post(
+      [shared]
+      {
+        shared->released.signal();
+      });
+  }
+
+  std::shared_ptr<BufferPool::Reservation>
+  BufferPool::reserve(FileSize size)
+  {
+    auto shared = this->_shared;
+    bool waited = false;
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> lock(shared->mutex);
+        if (shared->used == 0 || shared->used + size <= shared->capacity)
+        {
+          shared->used += size;
+          shared->peak = std::max(shared->peak, shared->used);
+          ++shared->reservations;
+          if (waited)
+            ++shared->waits;
+          break;
+        }
+      }
+      if (!waited)
+        ELLE_DEBUG("%s: budget exhausted, wait for %s bytes", *this, size);
+      waited = true;
+      reactor::wait(shared->released);
+    }
+    ELLE_DUMP("%s: reserve %s bytes", *this, size);
+    return std::shared_ptr<Reservation>(new Reservation(shared, size));
+  }
+
+  std::shared_ptr<elle::Buffer>
+  BufferPool::buffer(FileSize size)
+  {
+    auto reservation = this->reserve(size);
+    auto shared = this->_shared;
+    FileSize allocated = (size + slab_size - 1) / slab_size * slab_size;
+    std::unique_ptr<elle::Buffer> res;
+    {
+      std::unique_lock<std::mutex> lock(shared->mutex);
+      auto it = shared->slabs.find(allocated);
+      if (it != shared->slabs.end() && !it->second.empty())
+      {
+        res = std::move(it->second.back());
+        it->second.pop_back();
+        shared->cached -= allocated;
+      }
+    }
+    if (!res)
+      res.reset(new elle::Buffer(allocated));
+    res->size(size);
+    // The reservation ends once the buffer is back in the pool.
+    return std::shared_ptr<elle::Buffer>(
+      res.release(),
+      [shared, allocated, reservation] (elle::Buffer* buffer)
+      {
+        std::unique_ptr<elle::Buffer> released(buffer);
+        std::unique_lock<std::mutex> lock(shared->mutex);
+        if (shared->cached + allocated <= max_cached(shared->capacity))
+        {
+          shared->slabs[allocated].push_back(std::move(released));
+          shared->cached += allocated;
+        }
+      });
+  }
+
+  BufferPool::Stats
+  BufferPool::stats() const
+  {
+    std::unique_lock<std::mutex> lock(this->_shared->mutex);
+    return Stats{this->_shared->capacity,
+                 this->_shared->used,
+                 this->_shared->peak,
+                 this->_shared->cached,
+                 this->_shared->reservations,
+                 this->_shared->waits};
+  }
+
+  /*----------.
+  | Printable |
+  `----------*/
+
+  void
+  BufferPool::print(std::ostream& stream) const
+  {
+    auto stats = this->stats();
+    elle::fprintf(stream, "BufferPool(%s of %s bytes)",
+                  stats.used, stats.capacity);
+  }
+}
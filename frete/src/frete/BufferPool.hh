@@ -0,0 +1,107 @@
+#ifndef FRETE_BUFFER_POOL_HH
+# define FRETE_BUFFER_POOL_HH
+
+# include <cstdint>
+# include <memory>
+
+# include <elle/Buffer.hh>
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+
+# include <frete/Frete.hh>
+
+namespace frete
+{
+  /// Bound the memory of the transfers of a process.
+  ///
+  /// Transfers reserve the memory of the data they fetch, read or upload
+  /// before asking for it and give it back once it is written or sent.
+  /// Reservations over the budget wait for others to end, so that
+  /// concurrent transfers back off instead of piling up buffers. Buffers
+  /// can also be taken from the pool, their memory being kept for reuse by
+  /// slabs once released. Reservations and buffers can be released from
+  /// any thread.
+  class BufferPool:
+    public elle::Printable
+  {
+  /*------.
+  | Types |
+  `------*/
+  public:
+    typedef BufferPool Self;
+    typedef Frete::FileSize FileSize;
+    /// Usage of the budget.
+    struct Stats
+    {
+      FileSize capacity;
+      /// Bytes reserved.
+      FileSize used;
+      /// Most bytes ever reserved at once.
+      FileSize peak;
+      /// Bytes of released buffers kept for reuse.
+      FileSize cached;
+      /// Reservations made, and those that had to wait.
+      uint64_t reservations;
+      uint64_t waits;
+    };
+  private:
+    /// State shared with the reservations, that may end after the pool is
+    /// gone.
+    struct Shared;
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+  public:
+    /// Reserve at most capacity bytes. Must be constructed on the
+    /// scheduler thread.
+    BufferPool(FileSize capacity = default_capacity());
+    BufferPool(BufferPool const&) = delete;
+    /// INFINIT_BUFFER_MEMORY, 256MB by default.
+    static
+    FileSize
+    default_capacity();
+    /// Buffers are allocated by multiples of this size.
+    static FileSize const slab_size = 1 << 16;
+    ELLE_ATTRIBUTE_R(FileSize, capacity);
+  private:
+    ELLE_ATTRIBUTE(std::shared_ptr<Shared>, shared);
+
+  /*------------.
+  | Reservation |
+  `------------*/
+  public:
+    /// Bytes of the budget, given back when destroyed.
+    class Reservation
+    {
+    public:
+      Reservation(Reservation const&) = delete;
+      ~Reservation();
+      ELLE_ATTRIBUTE_R(FileSize, size);
+    private:
+      friend class BufferPool;
+      Reservation(std::shared_ptr<Shared> shared, FileSize size);
+      ELLE_ATTRIBUTE(std::shared_ptr<Shared>, shared);
+    };
+    /// Reserve size bytes, waiting while the budget is exhausted. A
+    /// reservation bigger than the budget is let through alone.
+    std::shared_ptr<Reservation>
+    reserve(FileSize size);
+    /// A reserved buffer of size bytes, its memory kept for reuse once the
+    /// last reference is gone.
+    std::shared_ptr<elle::Buffer>
+    buffer(FileSize size);
+    /// The current usage.
+    Stats
+    stats() const;
+
+  /*----------.
+  | Printable |
+  `----------*/
+  public:
+    void
+    print(std::ostream& stream) const override;
+  };
+}
+
+#endif
@@ -0,0 +1,80 @@
+#include <cstring>
+
+#include <boost/lexical_cast.hpp>
+
+#include <elle/Error.hh>
+#include <elle/os/environ.hh>
+
+#include <frete/Bundle.hh>
+#include <frete/Encoding.hh>
+
+namespace frete
+{
+  namespace bundle
+  {
+    static std::size_t const header_size = 8;
+
+    bool
+    enabled()
+    {
+      return elle::os::getenv("INFINIT_NO_BUNDLES", "").empty();
+    }
+
+    FileSize
+    max_file_size()
+    {
+      std::string size = elle::os::getenv("INFINIT_BUNDLE_FILE_SIZE", "");
+      if (!size.empty())
+        return boost::lexical_cast<FileSize>(size);
+      else
+        return 1 << 16;
+    }
+
+    FileSize
+    max_size()
+    {
+      std::string size = elle::os::getenv("INFINIT_BUNDLE_SIZE", "");
+      if (!size.empty())
+        return boost::lexical_cast<FileSize>(size);
+      else
+        return 1 << 20;
+    }
+
+    elle::Buffer
+    pack(std::vector<elle::ConstWeakBuffer> const& files)
+    {
+      std::size_t size = 0;
+      for (auto const& file: files)
+        size += header_size + file.size();
+      elle::Buffer res(size);
+      auto output = res.mutable_contents();
+      for (auto const& file: files)
+      {
+        encoding::put_uint64(output, file.size(), header_size);
+        output += header_size;
+        memcpy(output, file.contents(), file.size());
+        output += file.size();
+      }
+      return res;
+    }
+
+    std::vector<elle::ConstWeakBuffer>
+    unpack(elle::ConstWeakBuffer const& data)
+    {
+      std::vector<elle::ConstWeakBuffer> res;
+      std::size_t position = 0;
+      while (position != data.size())
+      {
+        FileSize size = encoding::get_uint64(data, position, header_size);
+        auto remaining = data.size() - position;
+        if (size > remaining)
+          throw elle::Exception(
+            elle::sprintf("truncated bundled file: %s bytes of %s",
+                          remaining, size));
+        res.emplace_back(data.contents() + position, size);
+        position += size;
+      }
+      return res;
+    }
+  }
+}
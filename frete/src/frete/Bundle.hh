@@ -0,0 +1,43 @@
+#ifndef FRETE_BUNDLE_HH
+# define FRETE_BUNDLE_HH
+
+# include <vector>
+
+# include <elle/Buffer.hh>
+
+# include <frete/Frete.hh>
+
+namespace frete
+{
+  /// Batches of whole small files sent as one payload.
+  ///
+  /// Fetching thousands of tiny files one chunk request each leaves the link
+  /// mostly idle. The recipient instead asks for consecutive small files in
+  /// one request, and the sender packs them together: each file is its 64
+  /// bits big endian size followed by its content.
+  namespace bundle
+  {
+    typedef Frete::FileSize FileSize;
+
+    /// Whether small files are bundled, unless INFINIT_NO_BUNDLES is set.
+    bool
+    enabled();
+    /// Files up to this size are bundled, from INFINIT_BUNDLE_FILE_SIZE.
+    FileSize
+    max_file_size();
+    /// Bytes of files requested at once, from INFINIT_BUNDLE_SIZE.
+    FileSize
+    max_size();
+    /// Files requested at once.
+    static std::size_t const max_files = 1024;
+
+    /// Pack the content of files.
+    elle::Buffer
+    pack(std::vector<elle::ConstWeakBuffer> const& files);
+    /// The content of packed files, pointing into data.
+    std::vector<elle::ConstWeakBuffer>
+    unpack(elle::ConstWeakBuffer const& data);
+  }
+}
+
+#endif
@@ -0,0 +1,135 @@
+#include <zlib.h>
+
+#include <boost/filesystem/fstream.hpp>
+
+#include <elle/Error.hh>
+#include <elle/log.hh>
+
+#include <frete/Checksum.hh>
+#include <frete/Encoding.hh>
+
+ELLE_LOG_COMPONENT("frete.Checksum");
+
+namespace frete
+{
+  namespace checksum
+  {
+    FileSize
+    blocks(FileSize size)
+    {
+      return (size + block_size - 1) / block_size;
+    }
+
+    Checksum
+    update(Checksum checksum, elle::ConstWeakBuffer const& data)
+    {
+      return ::crc32(checksum, data.contents(), data.size());
+    }
+
+    Checksum
+    combine(Checksum first, Checksum second, FileSize second_size)
+    {
+      return ::crc32_combine(first, second, second_size);
+    }
+
+    Parts
+    parts(FileSize offset, elle::ConstWeakBuffer const& data)
+    {
+      Parts res;
+      auto input = data.contents();
+      auto remaining = data.size();
+      while (remaining > 0)
+      {
+        auto size = std::min<FileSize>(
+          remaining, block_size - offset % block_size);
+        res.push_back(
+          Part{offset, size, update(0, elle::ConstWeakBuffer(input, size))});
+        input += size;
+        remaining -= size;
+        offset += size;
+      }
+      return res;
+    }
+
+    void
+    append(Checksums& checksums,
+           FileSize covered,
+           elle::ConstWeakBuffer const& data)
+    {
+      ELLE_ASSERT_EQ(checksums.size(), blocks(covered));
+      auto offset = covered % block_size;
+      auto input = data.contents();
+      auto remaining = data.size();
+      while (remaining > 0)
+      {
+        // Start a new block.
+        if (offset == 0)
+          checksums.push_back(0);
+        auto size = std::min<FileSize>(remaining, block_size - offset);
+        checksums.back() =
+          update(checksums.back(), elle::ConstWeakBuffer(input, size));
+        input += size;
+        remaining -= size;
+        offset = (offset + size) % block_size;
+      }
+    }
+
+    Checksums
+    file(boost::filesystem::path const& path,
+         FileSize offset,
+         FileSize size)
+    {
+      ELLE_ASSERT_EQ(offset % block_size, 0u);
+      ELLE_DEBUG_SCOPE("checksum %s bytes of %s at %s", size, path, offset);
+      boost::filesystem::ifstream input(path, std::ios::binary);
+      if (!input.good())
+        throw boost::filesystem::filesystem_error(
+          "unable to open file", path,
+          boost::system::errc::make_error_code(
+            boost::system::errc::no_such_file_or_directory));
+      input.seekg(offset);
+      Checksums res;
+      res.reserve(blocks(size));
+      elle::Buffer buffer(block_size);
+      while (size > 0 && input)
+      {
+        auto read = std::min(size, block_size);
+        input.read(reinterpret_cast<char*>(buffer.mutable_contents()), read);
+        if (input.gcount() == 0)
+          break;
+        res.push_back(
+          update(0, elle::ConstWeakBuffer(buffer.contents(), input.gcount())));
+        size -= input.gcount();
+      }
+      return res;
+    }
+
+    /*-------------.
+    | Transmission |
+    `-------------*/
+
+    elle::Buffer
+    pack(Checksums const& checksums)
+    {
+      elle::Buffer res;
+      for (auto checksum: checksums)
+        encoding::put_uint64(res, checksum, 4, encoding::Order::little);
+      return res;
+    }
+
+    Checksums
+    unpack(elle::ConstWeakBuffer const& data)
+    {
+      if (data.size() % 4 != 0)
+        throw elle::Exception(
+          elle::sprintf("invalid checksums of %s bytes", data.size()));
+      Checksums res;
+      res.reserve(data.size() / 4);
+      std::size_t position = 0;
+      while (position != data.size())
+        res.push_back(
+          encoding::get_uint64(data, position, 4, encoding::Order::little));
+      return res;
+    }
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef FRETE_CHECKSUM_HH
+# define FRETE_CHECKSUM_HH
+
+# include <cstdint>
+# include <vector>
+
+# include <boost/filesystem/path.hpp>
+
+# include <elle/Buffer.hh>
+
+# include <frete/Frete.hh>
+
+namespace frete
+{
+  /// CRC32 of fixed size blocks of a file content.
+  ///
+  /// The recipient records them as it writes, and the sender can compute
+  /// them for any prefix of a file, so content received before a resume can
+  /// be verified and only the corrupted blocks fetched again.
+  namespace checksum
+  {
+    typedef Frete::FileSize FileSize;
+    typedef uint32_t Checksum;
+    typedef std::vector<Checksum> Checksums;
+
+    /// Size of the checksummed blocks, both ends must agree on it.
+    static FileSize const block_size = 1 << 20;
+    /// Number of blocks covering size bytes, the last one being partial.
+    FileSize
+    blocks(FileSize size);
+    /// Extend checksum with data.
+    Checksum
+    update(Checksum checksum, elle::ConstWeakBuffer const& data);
+    /// The checksum of two consecutive data, from the checksum of each and
+    /// the size of the second one.
+    Checksum
+    combine(Checksum first, Checksum second, FileSize second_size);
+    /// The checksum of part of a block.
+    struct Part
+    {
+      FileSize offset;
+      FileSize size;
+      Checksum checksum;
+    };
+    typedef std::vector<Part> Parts;
+    /// The checksums of data at offset, split at block boundaries.
+    Parts
+    parts(FileSize offset, elle::ConstWeakBuffer const& data);
+    /// Extend the checksums of the first covered bytes with the following
+    /// data.
+    void
+    append(Checksums& checksums,
+           FileSize covered,
+           elle::ConstWeakBuffer const& data);
+    /// The checksums of the blocks of [offset, offset + size) of a file,
+    /// offset being a multiple of block_size. Blocking. Stops at the end of
+    /// the file.
+    Checksums
+    file(boost::filesystem::path const& path,
+         FileSize offset,
+         FileSize size);
+
+    /// Serialize checksums to be sent.
+    elle::Buffer
+    pack(Checksums const& checksums);
+    Checksums
+    unpack(elle::ConstWeakBuffer const& data);
+  }
+}
+
+#endif
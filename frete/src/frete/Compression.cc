@@ -0,0 +1,106 @@
+#include <zlib.h>
+
+#include <elle/Error.hh>
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+
+#include <frete/Compression.hh>
+#include <frete/Encoding.hh>
+
+ELLE_LOG_COMPONENT("frete.Compression");
+
+namespace frete
+{
+  namespace compression
+  {
+    // Favor speed, chunks are compressed on the fly.
+    static int const level = 1;
+    // Bytes compressed to decide whether a chunk is worth it.
+    static uLong const sample_size = 1 << 12;
+    // Maximum compressed to original size ratio worth the effort.
+    static double const worth_ratio = 0.9;
+    static elle::Buffer::Size const header_size = 5;
+
+    static
+    uLong
+    _compress(elle::ConstWeakBuffer const& data, Bytef* output, uLong capacity)
+    {
+      uLongf size = capacity;
+      if (::compress2(output, &size, data.contents(), data.size(), level)
+          != Z_OK)
+        return capacity;
+      return size;
+    }
+
+    bool
+    enabled()
+    {
+      return elle::os::getenv("INFINIT_NO_COMPRESSION", "").empty();
+    }
+
+    bool
+    worth(elle::ConstWeakBuffer const& data)
+    {
+      if (data.size() == 0)
+        return false;
+      uLong size = std::min<uLong>(data.size(), sample_size);
+      elle::Buffer output(::compressBound(size));
+      auto compressed = _compress(
+        elle::ConstWeakBuffer(data.contents(), size),
+        output.mutable_contents(), output.size());
+      return compressed < size * worth_ratio;
+    }
+
+    elle::Buffer
+    pack(elle::ConstWeakBuffer const& data)
+    {
+      if (enabled() && worth(data))
+      {
+        elle::Buffer res(header_size + ::compressBound(data.size()));
+        auto size = _compress(data,
+                              res.mutable_contents() + header_size,
+                              res.size() - header_size);
+        if (size < data.size())
+        {
+          res.mutable_contents()[0] = static_cast<uint8_t>(Flag::zlib);
+          encoding::put_uint64(res.mutable_contents() + 1, data.size(), 4);
+          res.size(header_size + size);
+          ELLE_DUMP("compressed chunk from %s to %s bytes",
+                    data.size(), res.size());
+          return res;
+        }
+      }
+      elle::Buffer res(1 + data.size());
+      res.mutable_contents()[0] = static_cast<uint8_t>(Flag::raw);
+      memcpy(res.mutable_contents() + 1, data.contents(), data.size());
+      return res;
+    }
+
+    elle::Buffer
+    unpack(elle::ConstWeakBuffer const& data)
+    {
+      if (data.size() < 1)
+        throw elle::Exception("empty compressed chunk");
+      switch (static_cast<Flag>(data.contents()[0]))
+      {
+        case Flag::raw:
+          return elle::Buffer(data.contents() + 1, data.size() - 1);
+        case Flag::zlib:
+        {
+          std::size_t position = 1;
+          uLongf size = encoding::get_uint64(data, position, 4);
+          elle::Buffer res(size);
+          if (::uncompress(res.mutable_contents(), &size,
+                           data.contents() + header_size,
+                           data.size() - header_size) != Z_OK
+              || size != res.size())
+            throw elle::Exception("invalid compressed chunk");
+          return res;
+        }
+      }
+      throw elle::Exception(
+        elle::sprintf("unknown chunk compression: %s",
+                      int(data.contents()[0])));
+    }
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef FRETE_COMPRESSION_HH
+# define FRETE_COMPRESSION_HH
+
+# include <elle/Buffer.hh>
+
+namespace frete
+{
+  /// Framing of possibly compressed chunks.
+  ///
+  /// A framed chunk starts with a flag byte. Raw chunks carry the data as
+  /// is. Compressed chunks carry the 32 bits big endian original size,
+  /// followed by the zlib stream.
+  namespace compression
+  {
+    enum class Flag: uint8_t
+    {
+      raw = 0,
+      zlib = 1,
+    };
+
+    /// Whether compression is enabled, i.e. INFINIT_NO_COMPRESSION is unset.
+    bool
+    enabled();
+    /// Whether a trial on a sample of data shrinks it enough to be worth
+    /// compressing the whole.
+    bool
+    worth(elle::ConstWeakBuffer const& data);
+    /// Frame data, compressed if enabled and worth it.
+    elle::Buffer
+    pack(elle::ConstWeakBuffer const& data);
+    /// The original data of a framed chunk.
+    elle::Buffer
+    unpack(elle::ConstWeakBuffer const& data);
+  }
+}
+
+#endif
@@ -0,0 +1,162 @@
+#include <thread>
+
+#include <boost/lexical_cast.hpp>
+
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+
+#include <reactor/Scope.hh>
+#include <reactor/lockable.hh>
+#include <reactor/scheduler.hh>
+
+#include <frete/Compression.hh>
+#include <frete/CryptoPool.hh>
+
+ELLE_LOG_COMPONENT("frete.CryptoPool");
+
+namespace frete
+{
+  /*-------------.
+  | Construction |
+  `-------------*/
+
+  CryptoPool::CryptoPool(int workers)
+    : _workers(std::max(workers, 1))
+    , _jobs(0)
+    , _slots(this->_workers)
+  {
+    ELLE_TRACE("%s: construct", *this);
+  }
+
+  int
+  CryptoPool::default_workers()
+  {
+    std::string workers = elle::os::getenv("INFINIT_CRYPTO_THREADS", "");
+    if (!workers.empty())
+      return boost::lexical_cast<int>(workers);
+    // hardware_concurrency may not be computable and return 0.
+    return std::max<int>(std::thread::hardware_concurrency(), 1);
+  }
+
+  /*-----------.
+  | Operations |
+  `-----------*/
+
+  infinit::cryptography::Code
+  CryptoPool::encrypt(infinit::cryptography::SecretKey const& key,
+                      elle::ConstWeakBuffer const& data,
+                      bool compress)
+  {
+    return this->_encrypt(key, data, compress, std::function<void ()>());
+  }
+
+  std::vector<infinit::cryptography::Code>
+  CryptoPool::encrypt(infinit::cryptography::SecretKey const& key,
+                      std::vector<elle::ConstWeakBuffer> const& data,
+                      bool compress,
+                      Inspect const& inspect)
+  {
+    std::vector<std::unique_ptr<infinit::cryptography::Code>> codes(
+      data.size());
+    auto encrypt = [&] (unsigned i)
+      {
+        std::function<void ()> before;
+        if (inspect)
+          before = [&, i] { inspect(i, data[i]); };
+        codes[i].reset(
+          new infinit::cryptography::Code(
+            this->_encrypt(key, data[i], compress, before)));
+      };
+    if (this->_workers == 1 || data.size() <= 1)
+      for (unsigned i = 0; i < data.size(); ++i)
+        encrypt(i);
+    else
+      elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+      {
+        for (unsigned i = 0; i < data.size(); ++i)
+          scope.run_background(
+            elle::sprintf("encrypt %s", i),
+            [&, i]
+            {
+              encrypt(i);
+            });
+        reactor::wait(scope);
+      };
+    std::vector<infinit::cryptography::Code> res;
+    res.reserve(codes.size());
+    for (auto& code: codes)
+      res.push_back(std::move(*code));
+    return res;
+  }
+
+  infinit::cryptography::Code
+  CryptoPool::_encrypt(infinit::cryptography::SecretKey const& key,
+                       elle::ConstWeakBuffer const& data,
+                       bool compress,
+                       std::function<void ()> const& before)
+  {
+    std::unique_ptr<infinit::cryptography::Code> res;
+    this->_run(
+      [&]
+      {
+        if (before)
+          before();
+        if (compress)
+          res.reset(
+            new infinit::cryptography::Code(
+              key.legacy_encrypt_buffer(compression::pack(data))));
+        else
+          res.reset(
+            new infinit::cryptography::Code(key.legacy_encrypt_buffer(data)));
+      });
+    return std::move(*res);
+  }
+
+  elle::Buffer
+  CryptoPool::decrypt(infinit::cryptography::SecretKey const& key,
+                      infinit::cryptography::Code const& code,
+                      bool compressed)
+  {
+    elle::Buffer res;
+    this->_run(
+      [&]
+      {
+        res = key.legacy_decrypt_buffer(code);
+        if (compressed)
+          res = compression::unpack(res);
+      });
+    return res;
+  }
+
+  void
+  CryptoPool::background(std::function<void ()> const& job)
+  {
+    ++this->_jobs;
+    reactor::Lock lock(this->_slots);
+    reactor::background(job);
+  }
+
+  void
+  CryptoPool::_run(std::function<void ()> const& job)
+  {
+    ++this->_jobs;
+    if (this->_workers == 1)
+      job();
+    else
+    {
+      reactor::Lock lock(this->_slots);
+      reactor::background(job);
+    }
+  }
+
+  /*----------.
+  | Printable |
+  `----------*/
+
+  void
+  CryptoPool::print(std::ostream& stream) const
+  {
+    elle::fprintf(stream, "CryptoPool(%s workers, %s jobs)",
+                  this->_workers, this->_jobs);
+  }
+}
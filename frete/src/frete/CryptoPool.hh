@@ -0,0 +1,96 @@
+#ifndef FRETE_CRYPTO_POOL_HH
+# define FRETE_CRYPTO_POOL_HH
+
+# include <functional>
+# include <vector>
+
+# include <elle/Buffer.hh>
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+
+# include <reactor/semaphore.hh>
+
+# include <cryptography/SecretKey.hh>
+# include <cryptography/_legacy/Code.hh>
+
+namespace frete
+{
+  /// Run chunk encryption and decryption on background threads.
+  ///
+  /// Callers are coroutines: they block until their own job is done, so
+  /// each one gets its results in the order it submitted them. At most
+  /// workers jobs run at once, by default one per core.
+  class CryptoPool:
+    public elle::Printable
+  {
+  /*------.
+  | Types |
+  `------*/
+  public:
+    typedef CryptoPool Self;
+    /// Look at a buffer from the job encrypting it, given its index.
+    typedef std::function<void (std::size_t, elle::ConstWeakBuffer const&)>
+      Inspect;
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+  public:
+    CryptoPool(int workers = default_workers());
+    CryptoPool(CryptoPool const&) = delete;
+    /// Number of cores, or INFINIT_CRYPTO_THREADS if set.
+    static
+    int
+    default_workers();
+    /// Maximum number of concurrent jobs. With one worker, jobs run inline
+    /// on the scheduler thread.
+    ELLE_ATTRIBUTE_R(int, workers);
+
+  /*-----------.
+  | Operations |
+  `-----------*/
+  public:
+    /// Encrypt data, first framed through compression::pack if compress.
+    infinit::cryptography::Code
+    encrypt(infinit::cryptography::SecretKey const& key,
+            elle::ConstWeakBuffer const& data,
+            bool compress = false);
+    /// Encrypt every buffer concurrently, results in the same order. Each
+    /// buffer is passed to inspect, if any, before being encrypted.
+    std::vector<infinit::cryptography::Code>
+    encrypt(infinit::cryptography::SecretKey const& key,
+            std::vector<elle::ConstWeakBuffer> const& data,
+            bool compress = false,
+            Inspect const& inspect = Inspect());
+    /// Decrypt code, then unframe it through compression::unpack if
+    /// compressed.
+    elle::Buffer
+    decrypt(infinit::cryptography::SecretKey const& key,
+            infinit::cryptography::Code const& code,
+            bool compressed = false);
+    /// Run a blocking job, such as hashing a file, on a worker thread even
+    /// with one worker. It shares the workers limit with the other jobs.
+    void
+    background(std::function<void ()> const& job);
+    /// Number of jobs run so far.
+    ELLE_ATTRIBUTE_R(uint64_t, jobs);
+  private:
+    infinit::cryptography::Code
+    _encrypt(infinit::cryptography::SecretKey const& key,
+             elle::ConstWeakBuffer const& data,
+             bool compress,
+             std::function<void ()> const& before);
+    void
+    _run(std::function<void ()> const& job);
+    ELLE_ATTRIBUTE(reactor::Semaphore, slots);
+
+  /*----------.
+  | Printable |
+  `----------*/
+  public:
+    void
+    print(std::ostream& stream) const override;
+  };
+}
+
+#endif
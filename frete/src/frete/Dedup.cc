@@ -0,0 +1,338 @@
+#ifdef INFINIT_LINUX
+# include <fcntl.h>
+# include <linux/fs.h>
+# include <sys/ioctl.h>
+# include <unistd.h>
+#endif
+
+#include <cstring>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <elle/AtomicFile.hh>
+#include <elle/Error.hh>
+#include <elle/finally.hh>
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+#include <elle/serialization/json/SerializerIn.hh>
+#include <elle/serialization/json/SerializerOut.hh>
+
+#include <frete/Dedup.hh>
+
+ELLE_LOG_COMPONENT("frete.Dedup");
+
+namespace frete
+{
+  namespace dedup
+  {
+    static std::size_t const hash_size = 2 * SHA256_DIGEST_LENGTH;
+    static std::size_t const read_size = 1 << 20;
+
+    bool
+    enabled()
+    {
+      return elle::os::getenv("INFINIT_NO_DEDUP", "").empty();
+    }
+
+    FileSize
+    min_size()
+    {
+      std::string size = elle::os::getenv("INFINIT_DEDUP_MIN_SIZE", "");
+      if (!size.empty())
+        return boost::lexical_cast<FileSize>(size);
+      else
+        return 1 << 16;
+    }
+
+    /*-------.
+    | Hasher |
+    `-------*/
+
+    Hasher::Hasher()
+      : _size(0)
+    {
+      if (SHA256_Init(&this->_context) == 0)
+        throw elle::Exception("unable to initialize SHA-256");
+    }
+
+    void
+    Hasher::update(elle::ConstWeakBuffer const& data)
+    {
+      if (SHA256_Update(&this->_context, data.contents(), data.size()) == 0)
+        throw elle::Exception("unable to hash");
+      this->_size += data.size();
+    }
+
+    Hash
+    Hasher::digest()
+    {
+      unsigned char digest[SHA256_DIGEST_LENGTH];
+      if (SHA256_Final(digest, &this->_context) == 0)
+        throw elle::Exception("unable to hash");
+      static char const* const digits = "0123456789abcdef";
+      Hash res;
+      res.reserve(hash_size);
+      for (auto byte: digest)
+      {
+        res.push_back(digits[byte >> 4]);
+        res.push_back(digits[byte & 0xf]);
+      }
+      return res;
+    }
+
+    Hash
+    hash(boost::filesystem::path const& path)
+    {
+      ELLE_DEBUG_SCOPE("hash %s", path);
+      boost::filesystem::ifstream input(path, std::ios::binary);
+      if (!input.good())
+        throw boost::filesystem::filesystem_error(
+          "unable to open file", path,
+          boost::system::errc::make_error_code(
+            boost::system::errc::no_such_file_or_directory));
+      Hasher hasher;
+      elle::Buffer buffer(read_size);
+      while (input)
+      {
+        input.read(reinterpret_cast<char*>(buffer.mutable_contents()),
+                   buffer.size());
+        hasher.update(elle::ConstWeakBuffer(buffer.contents(),
+                                            input.gcount()));
+      }
+      return hasher.digest();
+    }
+
+    /*-------------.
+    | Transmission |
+    `-------------*/
+
+    elle::Buffer
+    pack(Hashes const& hashes)
+    {
+      // Fixed size records, unknown hashes being all dashes.
+      elle::Buffer res(hashes.size() * hash_size);
+      auto output = res.mutable_contents();
+      for (auto const& hash: hashes)
+      {
+        if (hash.size() == hash_size)
+          memcpy(output, hash.data(), hash_size);
+        else
+          memset(output, '-', hash_size);
+        output += hash_size;
+      }
+      return res;
+    }
+
+    Hashes
+    unpack(elle::ConstWeakBuffer const& data)
+    {
+      if (data.size() % hash_size != 0)
+        throw elle::Exception(
+          elle::sprintf("invalid hashes of %s bytes", data.size()));
+      Hashes res;
+      res.reserve(data.size() / hash_size);
+      for (std::size_t i = 0; i < data.size(); i += hash_size)
+      {
+        auto begin = reinterpret_cast<char const*>(data.contents()) + i;
+        if (*begin == '-')
+          res.emplace_back();
+        else
+          res.emplace_back(begin, hash_size);
+      }
+      return res;
+    }
+
+    /*-----.
+    | Copy |
+    `-----*/
+
+    void
+    copy(boost::filesystem::path const& source,
+         boost::filesystem::path const& destination,
+         FileSize size)
+    {
+      if (boost::filesystem::file_size(source) != size)
+        throw boost::filesystem::filesystem_error(
+          elle::sprintf("duplicate changed, expected %s bytes", size),
+          source, destination,
+          boost::system::errc::make_error_code(
+            boost::system::errc::io_error));
+#if defined(INFINIT_LINUX) && defined(FICLONE)
+      {
+        int input = ::open(source.string().c_str(), O_RDONLY);
+        if (input >= 0)
+        {
+          elle::SafeFinally close_input([input] { ::close(input); });
+          int output = ::open(destination.string().c_str(),
+                              O_WRONLY | O_CREAT | O_TRUNC, 0644);
+          if (output >= 0)
+          {
+            elle::SafeFinally close_output([output] { ::close(output); });
+            if (::ioctl(output, FICLONE, input) == 0)
+            {
+              ELLE_DEBUG("reflink %s to %s", source, destination);
+              return;
+            }
+          }
+        }
+        // Not supported by the filesystem, copy.
+      }
+#endif
+      ELLE_DEBUG("copy %s to %s", source, destination);
+      boost::filesystem::copy_file(
+        source, destination,
+        boost::filesystem::copy_option::overwrite_if_exists);
+    }
+
+    /*------.
+    | Index |
+    `------*/
+
+    Index::Index(boost::filesystem::path const& path, std::size_t capacity)
+      : _path(path)
+      , _capacity(capacity)
+      , _entries()
+      , _index()
+      , _sizes()
+    {
+      if (!boost::filesystem::exists(path))
+        return;
+      try
+      {
+        std::vector<Entry> entries;
+        elle::AtomicFile file(path);
+        file.read() << [&] (elle::AtomicFile::Read& read)
+        {
+          elle::serialization::json::SerializerIn input(read.stream(), false);
+          input.serialize("entries", entries);
+        };
+        for (auto& entry: entries)
+        {
+          this->_erase(entry.hash);
+          ++this->_sizes[entry.size];
+          this->_entries.push_back(std::move(entry));
+          this->_index[this->_entries.back().hash] =
+            std::prev(this->_entries.end());
+        }
+        ELLE_TRACE("%s: loaded", *this);
+      }
+      catch (elle::Error const& e)
+      {
+        ELLE_WARN("%s: invalid index: %s", *this, e);
+        this->_entries.clear();
+        this->_index.clear();
+        this->_sizes.clear();
+      }
+    }
+
+    std::size_t
+    Index::default_capacity()
+    {
+      std::string capacity = elle::os::getenv("INFINIT_DEDUP_INDEX_SIZE", "");
+      if (!capacity.empty())
+        return boost::lexical_cast<std::size_t>(capacity);
+      else
+        return 1 << 14;
+    }
+
+    void
+    Index::add(Hash const& hash, boost::filesystem::path const& path)
+    {
+      Entry entry;
+      entry.hash = hash;
+      entry.path = path.string();
+      entry.size = boost::filesystem::file_size(path);
+      entry.mtime = boost::filesystem::last_write_time(path);
+      ELLE_DEBUG("%s: add %s (%s)", *this, path, hash);
+      this->_erase(hash);
+      ++this->_sizes[entry.size];
+      this->_entries.push_back(std::move(entry));
+      this->_index[hash] = std::prev(this->_entries.end());
+      while (this->_entries.size() > this->_capacity)
+      {
+        auto oldest = this->_entries.front().hash;
+        this->_erase(oldest);
+      }
+    }
+
+    void
+    Index::_erase(Hash const& hash)
+    {
+      auto it = this->_index.find(hash);
+      if (it == this->_index.end())
+        return;
+      auto size = this->_sizes.find(it->second->size);
+      if (--size->second == 0)
+        this->_sizes.erase(size);
+      this->_entries.erase(it->second);
+      this->_index.erase(it);
+    }
+
+    boost::optional<boost::filesystem::path>
+    Index::find(Hash const& hash, FileSize size) const
+    {
+      auto it = this->_index.find(hash);
+      if (it == this->_index.end() || it->second->size != size)
+        return boost::none;
+      auto const& entry = *it->second;
+      // Only trust files left as they were received.
+      boost::system::error_code error;
+      if (boost::filesystem::file_size(entry.path, error) != size || error)
+        return boost::none;
+      if (boost::filesystem::last_write_time(entry.path, error) !=
+          entry.mtime || error)
+        return boost::none;
+      return boost::filesystem::path(entry.path);
+    }
+
+    bool
+    Index::has_size(FileSize size) const
+    {
+      return this->_sizes.find(size) != this->_sizes.end();
+    }
+
+    std::size_t
+    Index::size() const
+    {
+      return this->_entries.size();
+    }
+
+    void
+    Index::save() const
+    {
+      ELLE_TRACE_SCOPE("%s: save", *this);
+      std::vector<Entry> entries(this->_entries.begin(),
+                                 this->_entries.end());
+      boost::filesystem::create_directories(this->_path.parent_path());
+      elle::AtomicFile file(this->_path);
+      file.write() << [&] (elle::AtomicFile::Write& write)
+      {
+        elle::serialization::json::SerializerOut output(write.stream(), false);
+        output.serialize("entries", entries);
+      };
+    }
+
+    Index::Entry::Entry(elle::serialization::SerializerIn& input)
+    {
+      this->serialize(input);
+    }
+
+    void
+    Index::Entry::serialize(elle::serialization::Serializer& s)
+    {
+      s.serialize("hash", this->hash);
+      s.serialize("path", this->path);
+      s.serialize("size", this->size);
+      s.serialize("mtime", this->mtime);
+    }
+
+    void
+    Index::print(std::ostream& stream) const
+    {
+      elle::fprintf(stream, "dedup::Index(%s, %s files)",
+                    this->_path, this->_entries.size());
+    }
+  }
+}
@@ -0,0 +1,134 @@
+#ifndef FRETE_DEDUP_HH
+# define FRETE_DEDUP_HH
+
+# include <list>
+# include <string>
+# include <unordered_map>
+# include <vector>
+
+# include <openssl/sha.h>
+
+# include <boost/filesystem/path.hpp>
+# include <boost/optional.hpp>
+
+# include <elle/Buffer.hh>
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+# include <elle/serialization/fwd.hh>
+
+# include <frete/Frete.hh>
+
+namespace frete
+{
+  /// Detect files whose content the recipient already has.
+  ///
+  /// Files are identified by the SHA-256 of their content, as hexadecimal.
+  /// The recipient asks the hash of files it may have, either because
+  /// another file of the transfer or a file received earlier has the same
+  /// size, and copies the duplicates locally instead of fetching them.
+  namespace dedup
+  {
+    typedef Frete::FileSize FileSize;
+    typedef std::string Hash;
+    typedef std::vector<Hash> Hashes;
+
+    /// Whether deduplication is enabled, unless INFINIT_NO_DEDUP is set.
+    bool
+    enabled();
+    /// Files smaller than this are always fetched, from
+    /// INFINIT_DEDUP_MIN_SIZE.
+    FileSize
+    min_size();
+
+    /// Hash a content incrementally.
+    class Hasher
+    {
+    public:
+      Hasher();
+      void
+      update(elle::ConstWeakBuffer const& data);
+      Hash
+      digest();
+      /// Bytes hashed so far.
+      ELLE_ATTRIBUTE_R(FileSize, size);
+    private:
+      ELLE_ATTRIBUTE(SHA256_CTX, context);
+    };
+
+    /// Hash the content of a file, blocking.
+    Hash
+    hash(boost::filesystem::path const& path);
+
+    /// Serialize hashes to be sent, unknown ones being empty.
+    elle::Buffer
+    pack(Hashes const& hashes);
+    Hashes
+    unpack(elle::ConstWeakBuffer const& data);
+
+    /// Copy a duplicate, as a reflink if the filesystem supports it.
+    /// Blocking. Throw if the source isn't size bytes long.
+    void
+    copy(boost::filesystem::path const& source,
+         boost::filesystem::path const& destination,
+         FileSize size);
+
+    /// The files received earlier, by hash.
+    class Index:
+      public elle::Printable
+    {
+    public:
+      typedef Index Self;
+      /// Load the index from path, if it exists.
+      Index(boost::filesystem::path const& path,
+            std::size_t capacity = default_capacity());
+      /// INFINIT_DEDUP_INDEX_SIZE, 16384 by default.
+      static
+      std::size_t
+      default_capacity();
+      ELLE_ATTRIBUTE_R(boost::filesystem::path, path);
+      ELLE_ATTRIBUTE_R(std::size_t, capacity);
+
+    public:
+      /// Record a file, evicting the oldest ones beyond capacity.
+      void
+      add(Hash const& hash, boost::filesystem::path const& path);
+      /// A file with this content, if it still exists unmodified.
+      boost::optional<boost::filesystem::path>
+      find(Hash const& hash, FileSize size) const;
+      /// Whether a file of this size was recorded.
+      bool
+      has_size(FileSize size) const;
+      std::size_t
+      size() const;
+      /// Write the index down.
+      void
+      save() const;
+
+    private:
+      struct Entry
+      {
+        Entry() = default;
+        Entry(elle::serialization::SerializerIn& input);
+        void
+        serialize(elle::serialization::Serializer& s);
+        Hash hash;
+        std::string path;
+        FileSize size;
+        int64_t mtime;
+      };
+      typedef std::list<Entry> Entries;
+      void
+      _erase(Hash const& hash);
+      /// Oldest first, for eviction.
+      ELLE_ATTRIBUTE(Entries, entries);
+      ELLE_ATTRIBUTE((std::unordered_map<Hash, Entries::iterator>), index);
+      ELLE_ATTRIBUTE((std::unordered_map<FileSize, int>), sizes);
+
+    public:
+      void
+      print(std::ostream& stream) const override;
+    };
+  }
+}
+
+#endif
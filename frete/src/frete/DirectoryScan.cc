@@ -0,0 +1,188 @@
+#include <algorithm>
+#include <deque>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <elle/Error.hh>
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+
+#include <reactor/Scope.hh>
+#include <reactor/scheduler.hh>
+#include <reactor/signal.hh>
+
+#include <frete/DirectoryScan.hh>
+
+ELLE_LOG_COMPONENT("frete.DirectoryScan");
+
+namespace frete
+{
+  namespace
+  {
+    /// A directory, absolute and relative to the parent of its scanned path.
+    typedef std::pair<boost::filesystem::path, boost::filesystem::path>
+      Directory;
+
+    struct Listing
+    {
+      std::vector<Directory> directories;
+      std::vector<DirectoryScan::File> files;
+      bool symlink;
+    };
+
+    /// Stat a file, blocking.
+    DirectoryScan::File
+    file(boost::filesystem::path const& path,
+         boost::filesystem::path const& root,
+         boost::filesystem::path const& relative)
+    {
+      auto size = boost::filesystem::file_size(path);
+      sparse::Extents holes;
+      if (size >= sparse::min_size && sparse::enabled())
+        holes = sparse::holes(path, size);
+      return DirectoryScan::File{root, relative, size, std::move(holes)};
+    }
+
+    /// Read a directory, blocking.
+    Listing
+    list(boost::filesystem::path const& root, Directory const& directory)
+    {
+      Listing res;
+      res.symlink = false;
+      boost::filesystem::directory_iterator end;
+      for (boost::filesystem::directory_iterator it(directory.first);
+           it != end;
+           ++it)
+      {
+        auto relative = directory.second / it->path().filename();
+        auto status = it->symlink_status();
+        if (boost::filesystem::is_symlink(status))
+        {
+          res.symlink = true;
+          // Symlinked directories are not followed, dangling links skipped.
+          status = it->status();
+          if (!boost::filesystem::exists(status) ||
+              boost::filesystem::is_directory(status))
+            continue;
+        }
+        if (boost::filesystem::is_directory(status))
+          res.directories.emplace_back(it->path(), relative);
+        else
+          res.files.push_back(file(it->path(), root, relative));
+      }
+      return res;
+    }
+  }
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+
+  DirectoryScan::DirectoryScan(
+    std::vector<boost::filesystem::path> const& paths,
+    int workers)
+    : _sources()
+    , _total_size(0)
+  {
+    ELLE_TRACE_SCOPE("%s: scan %s", *this, paths);
+    for (auto const& path: paths)
+    {
+      if (!boost::filesystem::exists(path))
+        throw elle::Exception(
+          elle::sprintf("given path %s doesn't exist", path));
+      Source source{path, boost::filesystem::is_directory(path), false, {}, 0};
+      if (source.directory)
+        this->_scan(source, std::max(workers, 1));
+      else
+        source.files.push_back(
+          file(path, path.parent_path(), path.filename()));
+      for (auto const& file: source.files)
+        source.size += file.size;
+      this->_total_size += source.size;
+      ELLE_DEBUG("%s: %s: %s files, %s bytes%s",
+                 *this, path, source.files.size(), source.size,
+                 source.symlink ? ", with symlinks" : "");
+      this->_sources.push_back(std::move(source));
+    }
+  }
+
+  int
+  DirectoryScan::default_workers()
+  {
+    std::string workers = elle::os::getenv("INFINIT_SCAN_THREADS", "");
+    if (!workers.empty())
+      return boost::lexical_cast<int>(workers);
+    else
+      return 8;
+  }
+
+  void
+  DirectoryScan::_scan(Source& source, int workers)
+  {
+    auto root = source.path.parent_path();
+    std::deque<Directory> pending{Directory(source.path,
+                                            source.path.filename())};
+    int active = 0;
+    reactor::Signal changed;
+    elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+    {
+      for (int i = 0; i < workers; ++i)
+        scope.run_background(
+          elle::sprintf("scan %s", i),
+          [&]
+          {
+            while (true)
+            {
+              if (pending.empty())
+              {
+                // Others may still find subdirectories.
+                if (active == 0)
+                {
+                  changed.signal();
+                  return;
+                }
+                reactor::wait(changed);
+                continue;
+              }
+              auto directory = std::move(pending.front());
+              pending.pop_front();
+              ++active;
+              Listing listing;
+              reactor::background(
+                [&]
+                {
+                  listing = list(root, directory);
+                });
+              --active;
+              pending.insert(pending.end(),
+                             listing.directories.begin(),
+                             listing.directories.end());
+              source.files.insert(source.files.end(),
+                                  listing.files.begin(),
+                                  listing.files.end());
+              source.symlink = source.symlink || listing.symlink;
+              changed.signal();
+            }
+          });
+      reactor::wait(scope);
+    };
+    // Be deterministic, whatever order directories were read in.
+    std::sort(source.files.begin(), source.files.end(),
+              [] (File const& a, File const& b)
+              {
+                return a.path < b.path;
+              });
+  }
+
+  /*----------.
+  | Printable |
+  `----------*/
+
+  void
+  DirectoryScan::print(std::ostream& stream) const
+  {
+    elle::fprintf(stream, "DirectoryScan(%s sources, %s bytes)",
+                  this->_sources.size(), this->_total_size);
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef FRETE_DIRECTORY_SCAN_HH
+# define FRETE_DIRECTORY_SCAN_HH
+
+# include <vector>
+
+# include <boost/filesystem/path.hpp>
+
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+
+# include <frete/Frete.hh>
+# include <frete/Sparse.hh>
+
+namespace frete
+{
+  /// The files to send under a set of paths, listed in a single pass.
+  ///
+  /// Directories are read and their entries stat'ed on background threads,
+  /// several directories at a time, which matters on network filesystems.
+  class DirectoryScan:
+    public elle::Printable
+  {
+  /*------.
+  | Types |
+  `------*/
+  public:
+    typedef DirectoryScan Self;
+    typedef Frete::FileSize FileSize;
+    /// A file, as a path relative to the parent of its scanned path.
+    struct File
+    {
+      boost::filesystem::path root;
+      boost::filesystem::path path;
+      FileSize size;
+      /// Its holes, if sparse.
+      sparse::Extents holes;
+    };
+    /// One of the scanned paths.
+    struct Source
+    {
+      boost::filesystem::path path;
+      bool directory;
+      /// Whether a symlink was found under the directory.
+      bool symlink;
+      /// The files under it, sorted by path, or itself if not a directory.
+      std::vector<File> files;
+      FileSize size;
+    };
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+  public:
+    /// Scan paths, with up to workers concurrent directory reads.
+    DirectoryScan(std::vector<boost::filesystem::path> const& paths,
+                  int workers = default_workers());
+    /// INFINIT_SCAN_THREADS, 8 by default.
+    static
+    int
+    default_workers();
+    ELLE_ATTRIBUTE_R(std::vector<Source>, sources);
+    /// Size of all the files.
+    ELLE_ATTRIBUTE_R(FileSize, total_size);
+  private:
+    void
+    _scan(Source& source, int workers);
+
+  /*----------.
+  | Printable |
+  `----------*/
+  public:
+    void
+    print(std::ostream& stream) const override;
+  };
+}
+
+#endif
@@ -0,0 +1,186 @@
+#include <boost/lexical_cast.hpp>
+
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+
+#include <reactor/scheduler.hh>
+
+#include <frete/Dedup.hh>
+#include <frete/DiskWriter.hh>
+#include <frete/FileWriter.hh>
+
+ELLE_LOG_COMPONENT("frete.DiskWriter");
+
+namespace frete
+{
+  /*-------------.
+  | Construction |
+  `-------------*/
+
+  DiskWriter::DiskWriter(FileSize capacity)
+    : _capacity(capacity)
+    , _scheduler(*reactor::Scheduler::scheduler())
+    , _tickets(0)
+    , _completions(std::make_shared<Completions>())
+    , _jobs()
+    , _stop(false)
+    , _mutex()
+    , _available()
+    , _thread()
+  {
+    ELLE_TRACE("%s: construct", *this);
+    this->_completions->written = 0;
+    this->_completions->queued = 0;
+    this->_thread = std::thread([this] { this->_work(); });
+  }
+
+  DiskWriter::~DiskWriter()
+  {
+    ELLE_TRACE_SCOPE("%s: destruct", *this);
+    {
+      std::unique_lock<std::mutex> lock(this->_mutex);
+      this->_stop = true;
+    }
+    this->_available.notify_one();
+    this->_thread.join();
+  }
+
+  DiskWriter::FileSize
+  DiskWriter::default_capacity()
+  {
+    std::string capacity = elle::os::getenv("INFINIT_DISK_QUEUE_SIZE", "");
+    if (!capacity.empty())
+      return boost::lexical_cast<FileSize>(capacity);
+    else
+      return 32 << 20;
+  }
+
+  /*------.
+  | Write |
+  `------*/
+
+  DiskWriter::Ticket
+  DiskWriter::write(std::shared_ptr<FileWriter> file,
+                    FileOffset offset,
+                    std::shared_ptr<elle::Buffer const> data,
+                    std::shared_ptr<dedup::Hasher> hasher)
+  {
+    auto completions = this->_completions;
+    // Let a block bigger than the queue through alone.
+    while (completions->queued > 0 &&
+           completions->queued + data->size() > this->_capacity)
+    {
+      ELLE_DEBUG("%s: queue full, wait", *this);
+      reactor::wait(completions->signal);
+    }
+    auto ticket = ++this->_tickets;
+    ELLE_DUMP("%s: queue write %s of %s bytes at %s in %s",
+              *this, ticket, data->size(), offset, file->path());
+    completions->queued += data->size();
+    {
+      std::unique_lock<std::mutex> lock(this->_mutex);
+      this->_jobs.push_back(
+        Job{ticket, std::move(file), offset, std::move(data),
+            std::move(hasher)});
+    }
+    this->_available.notify_one();
+    return ticket;
+  }
+
+  bool
+  DiskWriter::done(Ticket ticket) const
+  {
+    return this->_completions->written >= ticket;
+  }
+
+  void
+  DiskWriter::wait(Ticket ticket)
+  {
+    this->flush(ticket);
+    // The writer is shared by every transfer of the process, don't keep
+    // errors once reported.
+    auto completions = this->_completions;
+    auto it = completions->errors.find(ticket);
+    if (it != completions->errors.end())
+    {
+      auto error = it->second;
+      completions->errors.erase(it);
+      std::rethrow_exception(error);
+    }
+  }
+
+  void
+  DiskWriter::flush(Ticket ticket)
+  {
+    auto completions = this->_completions;
+    while (completions->written < ticket)
+      reactor::wait(completions->signal);
+  }
+
+  DiskWriter::FileSize
+  DiskWriter::queued() const
+  {
+    return this->_completions->queued;
+  }
+
+  DiskWriter::Ticket
+  DiskWriter::written() const
+  {
+    return this->_completions->written;
+  }
+
+  void
+  DiskWriter::_work()
+  {
+    while (true)
+    {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(this->_mutex);
+        this->_available.wait(
+          lock, [this] { return this->_stop || !this->_jobs.empty(); });
+        // Write everything queued before stopping.
+        if (this->_jobs.empty())
+          return;
+        job = std::move(this->_jobs.front());
+        this->_jobs.pop_front();
+      }
+      std::exception_ptr error;
+      try
+      {
+        job.file->write(job.offset, *job.data);
+        if (job.hasher)
+          job.hasher->update(*job.data);
+      }
+      catch (...)
+      {
+        error = std::current_exception();
+      }
+      auto ticket = job.ticket;
+      auto size = job.data->size();
+      // Release the file and data before the scheduler hears about it.
+      job = Job();
+      auto completions = this->_completions;
+      this->_scheduler.io_service().post(
+        [completions, ticket, size, error]
+        {
+          completions->written = ticket;
+          completions->queued -= size;
+          if (error)
+            completions->errors[ticket] = error;
+          completions->signal.signal();
+        });
+    }
+  }
+
+  /*----------.
+  | Printable |
+  `----------*/
+
+  void
+  DiskWriter::print(std::ostream& stream) const
+  {
+    elle::fprintf(stream, "DiskWriter(%s queued bytes)",
+                  this->_completions->queued);
+  }
+}
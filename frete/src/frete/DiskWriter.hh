@@ -0,0 +1,127 @@
+#ifndef FRETE_DISK_WRITER_HH
+# define FRETE_DISK_WRITER_HH
+
+# include <condition_variable>
+# include <deque>
+# include <exception>
+# include <memory>
+# include <mutex>
+# include <thread>
+# include <unordered_map>
+
+# include <elle/Buffer.hh>
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+
+# include <reactor/fwd.hh>
+# include <reactor/signal.hh>
+
+# include <frete/Frete.hh>
+# include <frete/fwd.hh>
+
+namespace frete
+{
+  /// Write files on a dedicated thread.
+  ///
+  /// Writes are queued and run in order by a worker thread, so a slow
+  /// filesystem stalls neither the scheduler nor the network transfers
+  /// until the queue is full. Completions are signaled back on the
+  /// scheduler thread. A single writer can be shared by every transfer of
+  /// a process.
+  class DiskWriter:
+    public elle::Printable
+  {
+  /*------.
+  | Types |
+  `------*/
+  public:
+    typedef DiskWriter Self;
+    typedef Frete::FileOffset FileOffset;
+    typedef Frete::FileSize FileSize;
+    /// Identifies a write, writes being numbered in the order queued.
+    typedef uint64_t Ticket;
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+  public:
+    /// Queue at most capacity bytes. Must be constructed on the scheduler
+    /// thread.
+    DiskWriter(FileSize capacity = default_capacity());
+    DiskWriter(DiskWriter const&) = delete;
+    /// Write what is queued, then stop the worker.
+    ~DiskWriter();
+    /// INFINIT_DISK_QUEUE_SIZE, 32MB by default.
+    static
+    FileSize
+    default_capacity();
+    ELLE_ATTRIBUTE_R(FileSize, capacity);
+  private:
+    ELLE_ATTRIBUTE(reactor::Scheduler&, scheduler);
+
+  /*------.
+  | Write |
+  `------*/
+  public:
+    /// Queue data to be written at offset of file, blocking only while the
+    /// queue is full. Once written, data is also fed to hasher if any, on
+    /// the worker thread and in the order queued.
+    Ticket
+    write(std::shared_ptr<FileWriter> file,
+          FileOffset offset,
+          std::shared_ptr<elle::Buffer const> data,
+          std::shared_ptr<dedup::Hasher> hasher = nullptr);
+    /// Whether a write is done.
+    bool
+    done(Ticket ticket) const;
+    /// Wait until a write is done, and throw if it failed. The error is
+    /// reported to the first waiter only, and forgotten then.
+    void
+    wait(Ticket ticket);
+    /// Wait until a write is done, leaving its error to wait.
+    void
+    flush(Ticket ticket);
+    /// Bytes queued and not written yet.
+    FileSize
+    queued() const;
+    /// Writes completed so far.
+    Ticket
+    written() const;
+  private:
+    struct Job
+    {
+      Ticket ticket;
+      std::shared_ptr<FileWriter> file;
+      FileOffset offset;
+      std::shared_ptr<elle::Buffer const> data;
+      std::shared_ptr<dedup::Hasher> hasher;
+    };
+    /// State shared with the completions posted to the scheduler, that may
+    /// run after the writer is gone.
+    struct Completions
+    {
+      Ticket written;
+      FileSize queued;
+      std::unordered_map<Ticket, std::exception_ptr> errors;
+      reactor::Signal signal;
+    };
+    void
+    _work();
+    ELLE_ATTRIBUTE(Ticket, tickets);
+    ELLE_ATTRIBUTE(std::shared_ptr<Completions>, completions);
+    ELLE_ATTRIBUTE(std::deque<Job>, jobs);
+    ELLE_ATTRIBUTE(bool, stop);
+    ELLE_ATTRIBUTE(std::mutex, mutex);
+    ELLE_ATTRIBUTE(std::condition_variable, available);
+    ELLE_ATTRIBUTE(std::thread, thread);
+
+  /*----------.
+  | Printable |
+  `----------*/
+  public:
+    void
+    print(std::ostream& stream) const override;
+  };
+}
+
+#endif
@@ -0,0 +1,61 @@
+#include <elle/Error.hh>
+#include <elle/printf.hh>
+
+#include <frete/Encoding.hh>
+
+namespace frete
+{
+  namespace encoding
+  {
+    void
+    put_uint64(unsigned char* output, uint64_t value, int bytes, Order order)
+    {
+      for (int i = 0; i < bytes; ++i)
+      {
+        int shift = order == Order::big ? bytes - 1 - i : i;
+        output[i] = (value >> (8 * shift)) & 0xff;
+      }
+    }
+
+    void
+    put_uint64(elle::Buffer& buffer, uint64_t value, int bytes, Order order)
+    {
+      unsigned char output[8];
+      put_uint64(output, value, bytes, order);
+      buffer.append(output, bytes);
+    }
+
+    uint64_t
+    get_uint64(elle::ConstWeakBuffer const& data,
+               std::size_t& position,
+               int bytes,
+               Order order)
+    {
+      if (position > data.size() || data.size() - position < unsigned(bytes))
+        throw elle::Exception(
+          elle::sprintf("truncated data: %s bytes at %s of %s",
+                        bytes, position, data.size()));
+      auto input = data.contents() + position;
+      uint64_t res = 0;
+      for (int i = 0; i < bytes; ++i)
+      {
+        int shift = order == Order::big ? bytes - 1 - i : i;
+        res |= uint64_t(input[i]) << (8 * shift);
+      }
+      position += bytes;
+      return res;
+    }
+
+    void
+    check_count(elle::ConstWeakBuffer const& data,
+                std::size_t position,
+                uint64_t count,
+                std::size_t size,
+                std::string const& what)
+    {
+      if (position > data.size() || count > (data.size() - position) / size)
+        throw elle::Exception(
+          elle::sprintf("invalid count of %s %s", count, what));
+    }
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef FRETE_ENCODING_HH
+# define FRETE_ENCODING_HH
+
+# include <cstddef>
+# include <cstdint>
+# include <string>
+
+# include <elle/Buffer.hh>
+
+namespace frete
+{
+  /// Fixed size unsigned integers of the wire and file formats, whatever
+  /// the host byte order.
+  namespace encoding
+  {
+    /// Byte order of an encoded integer.
+    enum class Order
+    {
+      big,
+      little,
+    };
+
+    /// Write the bytes lowest bytes of value at output.
+    void
+    put_uint64(unsigned char* output,
+               uint64_t value,
+               int bytes = 8,
+               Order order = Order::big);
+    /// Append the bytes lowest bytes of value to buffer.
+    void
+    put_uint64(elle::Buffer& buffer,
+               uint64_t value,
+               int bytes = 8,
+               Order order = Order::big);
+    /// Read an integer of bytes bytes at position in data, and move position
+    /// past it. Throw if data is too short.
+    uint64_t
+    get_uint64(elle::ConstWeakBuffer const& data,
+               std::size_t& position,
+               int bytes = 8,
+               Order order = Order::big);
+    /// Throw unless data holds count items of size bytes past position, so
+    /// that a count read from the data is not trusted for an allocation.
+    void
+    check_count(elle::ConstWeakBuffer const& data,
+                std::size_t position,
+                uint64_t count,
+                std::size_t size,
+                std::string const& what);
+  }
+}
+
+#endif
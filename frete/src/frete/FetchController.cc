@@ -0,0 +1,167 @@
+#include <algorithm>
+
+#include <boost/lexical_cast.hpp>
+
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+
+#include <frete/FetchController.hh>
+
+ELLE_LOG_COMPONENT("frete.FetchController");
+
+namespace frete
+{
+  // Intervals remembered to estimate the goodput.
+  static std::size_t const history = 8;
+  // Bytes kept in flight per byte of bandwidth-delay product.
+  static double const gain = 2;
+  // Requests in flight the chunk size is tuned to stay between.
+  static int const few_requests = 4;
+  static int const many_requests = 16;
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+
+  FetchController::FileSize const FetchController::min_chunk_size;
+  FetchController::FileSize const FetchController::max_chunk_size;
+  int const FetchController::min_depth;
+  int const FetchController::max_depth;
+
+  FetchController::FetchController(int depth,
+                                   FileSize chunk_size,
+                                   int blocks,
+                                   bool tune_chunk_size,
+                                   FileSize memory)
+    : _blocks(std::max(blocks, 1))
+    , _tune_chunk_size(tune_chunk_size)
+    , _memory(memory)
+    , _depth(std::max(depth, 1))
+    , _chunk_size(chunk_size)
+    , _adjustments(0)
+    , _rtt(boost::posix_time::pos_infin)
+    , _goodputs()
+    , _interval_start()
+    , _interval_bytes(0)
+  {
+    ELLE_TRACE("%s: construct", *this);
+  }
+
+  bool
+  FetchController::enabled()
+  {
+    return elle::os::getenv("INFINIT_NO_FETCH_TUNING", "").empty();
+  }
+
+  FetchController::FileSize
+  FetchController::default_memory()
+  {
+    std::string memory = elle::os::getenv("INFINIT_FETCH_MEMORY", "");
+    if (!memory.empty())
+      return boost::lexical_cast<FileSize>(memory);
+    else
+      return 64 << 20;
+  }
+
+  /*---------.
+  | Decision |
+  `---------*/
+
+  void
+  FetchController::_decide()
+  {
+    auto target = std::min<FileSize>(gain * this->bdp(), this->_memory);
+    auto requests = [&] (FileSize chunk_size)
+      {
+        return target / (chunk_size * this->_blocks);
+      };
+    auto chunk_size = this->_chunk_size;
+    if (this->_tune_chunk_size)
+    {
+      // Few big requests on long fat links, many small ones otherwise so
+      // that a slow one doesn't hold much.
+      while (requests(chunk_size) > many_requests &&
+             chunk_size < max_chunk_size)
+        chunk_size *= 2;
+      while (requests(chunk_size) < few_requests &&
+             chunk_size > min_chunk_size)
+        chunk_size /= 2;
+    }
+    auto request = chunk_size * this->_blocks;
+    int depth = (target + request - 1) / request;
+    // Move by a factor of two at most per interval.
+    depth = std::min(depth, 2 * this->_depth);
+    depth = std::max(depth, this->_depth / 2);
+    depth = std::max<int>(depth, min_depth);
+    depth = std::min<int>(depth, max_depth);
+    depth = std::max<int>(
+      std::min<FileSize>(depth, this->_memory / request), 1);
+    if (depth == this->_depth && chunk_size == this->_chunk_size)
+      return;
+    ELLE_TRACE("%s: BDP of %s bytes, use %s requests of %s bytes",
+               *this, this->bdp(), depth, chunk_size);
+    this->_depth = depth;
+    this->_chunk_size = chunk_size;
+    ++this->_adjustments;
+  }
+
+  /*------------.
+  | Measurement |
+  `------------*/
+
+  bool
+  FetchController::sample(FileSize bytes, Duration rtt, Time now)
+  {
+    ELLE_DUMP("%s: %s bytes in %s", *this, bytes, rtt);
+    if (!this->_interval_start)
+      // The first request gives no rate, the link was idle before it.
+      this->_interval_start = now - rtt;
+    this->_interval_bytes += bytes;
+    this->_rtt = std::min(this->_rtt, rtt);
+    auto elapsed = now - this->_interval_start.get();
+    // Close intervals after a few round trips, and not too often.
+    auto length = std::max(this->_rtt * 4,
+                           boost::posix_time::time_duration(
+                             boost::posix_time::milliseconds(250)));
+    if (elapsed < length)
+      return false;
+    this->_goodputs.push_back(
+      this->_interval_bytes / (elapsed.total_microseconds() / 1000000.));
+    if (this->_goodputs.size() > history)
+      this->_goodputs.pop_front();
+    this->_interval_start = now;
+    this->_interval_bytes = 0;
+    auto depth = this->_depth;
+    auto chunk_size = this->_chunk_size;
+    this->_decide();
+    return depth != this->_depth || chunk_size != this->_chunk_size;
+  }
+
+  double
+  FetchController::goodput() const
+  {
+    double res = 0;
+    for (auto goodput: this->_goodputs)
+      res = std::max(res, goodput);
+    return res;
+  }
+
+  FetchController::FileSize
+  FetchController::bdp() const
+  {
+    if (this->_rtt.is_special())
+      return 0;
+    return this->goodput() * (this->_rtt.total_microseconds() / 1000000.);
+  }
+
+  /*----------.
+  | Printable |
+  `----------*/
+
+  void
+  FetchController::print(std::ostream& stream) const
+  {
+    elle::fprintf(stream, "FetchController(%s x %s x %s bytes)",
+                  this->_depth, this->_blocks, this->_chunk_size);
+  }
+}
@@ -0,0 +1,111 @@
+#ifndef FRETE_FETCH_CONTROLLER_HH
+# define FRETE_FETCH_CONTROLLER_HH
+
+# include <deque>
+
+# include <boost/date_time/posix_time/posix_time.hpp>
+# include <boost/optional.hpp>
+
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+
+# include <frete/Frete.hh>
+
+namespace frete
+{
+  /// Size the fetch pipeline of a recipient after the link.
+  ///
+  /// The round trip time and goodput of requests are measured as they
+  /// complete. Their product, the bandwidth-delay product, is what must be
+  /// in flight to keep the link busy: the controller keeps twice that many
+  /// bytes requested, within a memory budget, by adjusting the number of
+  /// concurrent requests and, if allowed, the chunk size. Decisions are
+  /// taken once per measurement interval, at least a few round trips long.
+  class FetchController:
+    public elle::Printable
+  {
+  /*------.
+  | Types |
+  `------*/
+  public:
+    typedef FetchController Self;
+    typedef Frete::FileSize FileSize;
+    typedef boost::posix_time::ptime Time;
+    typedef boost::posix_time::time_duration Duration;
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+  public:
+    /// Start with depth concurrent requests of blocks chunks of chunk_size
+    /// bytes. The chunk size is only changed if tune_chunk_size.
+    FetchController(int depth,
+                    FileSize chunk_size,
+                    int blocks,
+                    bool tune_chunk_size,
+                    FileSize memory = default_memory());
+    /// Whether the pipeline is tuned, unless INFINIT_NO_FETCH_TUNING is set.
+    static
+    bool
+    enabled();
+    /// Bytes in flight at most, from INFINIT_FETCH_MEMORY, 64MB by default.
+    static
+    FileSize
+    default_memory();
+    static FileSize const min_chunk_size = 1 << 16;
+    static FileSize const max_chunk_size = 1 << 22;
+    static int const min_depth = 2;
+    static int const max_depth = 64;
+    ELLE_ATTRIBUTE_R(int, blocks);
+    ELLE_ATTRIBUTE_R(bool, tune_chunk_size);
+    ELLE_ATTRIBUTE_R(FileSize, memory);
+
+  /*---------.
+  | Decision |
+  `---------*/
+  public:
+    /// Number of concurrent requests.
+    ELLE_ATTRIBUTE_R(int, depth);
+    /// Size of the chunks requested.
+    ELLE_ATTRIBUTE_R(FileSize, chunk_size);
+    /// Number of decisions changing the depth or the chunk size.
+    ELLE_ATTRIBUTE_R(int, adjustments);
+  private:
+    void
+    _decide();
+
+  /*------------.
+  | Measurement |
+  `------------*/
+  public:
+    /// Record a request answered with bytes after rtt. Return whether the
+    /// depth or chunk size changed.
+    bool
+    sample(FileSize bytes,
+           Duration rtt,
+           Time now = boost::posix_time::microsec_clock::universal_time());
+    /// Best goodput of the recent intervals, in bytes per second.
+    double
+    goodput() const;
+    /// The bandwidth-delay product, in bytes.
+    FileSize
+    bdp() const;
+    /// Smallest round trip time measured. Deep pipelines queue requests at
+    /// the sender, so recent ones overestimate the link delay.
+    ELLE_ATTRIBUTE_R(Duration, rtt);
+  private:
+    /// Goodput of the last intervals, most recent last.
+    ELLE_ATTRIBUTE(std::deque<double>, goodputs);
+    ELLE_ATTRIBUTE(boost::optional<Time>, interval_start);
+    ELLE_ATTRIBUTE(FileSize, interval_bytes);
+
+  /*----------.
+  | Printable |
+  `----------*/
+  public:
+    void
+    print(std::ostream& stream) const override;
+  };
+}
+
+#endif
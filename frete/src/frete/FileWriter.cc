@@ -0,0 +1,160 @@
+#ifndef INFINIT_WINDOWS
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <cstring>
+
+#include <boost/filesystem.hpp>
+
+#include <elle/Error.hh>
+#include <elle/log.hh>
+
+#include <frete/FileWriter.hh>
+
+ELLE_LOG_COMPONENT("frete.FileWriter");
+
+namespace frete
+{
+  static
+  boost::filesystem::filesystem_error
+  write_error(std::string const& what, boost::filesystem::path const& path)
+  {
+    return boost::filesystem::filesystem_error(
+      what, path,
+      boost::system::error_code(errno, boost::system::system_category()));
+  }
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+
+  FileWriter::FileWriter(boost::filesystem::path const& path)
+    : _path(path)
+    , _failed(false)
+  {
+    ELLE_DEBUG_SCOPE("%s: open", *this);
+#ifdef INFINIT_WINDOWS
+    // Create the file without truncating it.
+    if (!boost::filesystem::exists(path))
+      boost::filesystem::ofstream(path, std::ios::binary);
+    this->_stream.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!this->_stream.good())
+      throw write_error("unable to open file", path);
+#else
+    this->_fd = ::open(path.string().c_str(), O_WRONLY | O_CREAT, 0644);
+    if (this->_fd < 0)
+      throw write_error("unable to open file", path);
+#endif
+  }
+
+  FileWriter::~FileWriter()
+  {
+#ifndef INFINIT_WINDOWS
+    ::close(this->_fd);
+#endif
+  }
+
+  /*------.
+  | Write |
+  `------*/
+
+  void
+  FileWriter::reserve(FileSize size)
+  {
+    ELLE_DEBUG_SCOPE("%s: reserve %s bytes", *this, size);
+#if defined(INFINIT_LINUX)
+    if (::fallocate(this->_fd, FALLOC_FL_KEEP_SIZE, 0, size) != 0)
+      // Not supported by the filesystem, let writes allocate.
+      ELLE_DEBUG("%s: unable to reserve space: %s",
+                 *this, ::strerror(errno));
+#elif defined(INFINIT_MACOSX)
+    fstore_t store = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0,
+                      static_cast<off_t>(size), 0};
+    if (::fcntl(this->_fd, F_PREALLOCATE, &store) != 0)
+    {
+      store.fst_flags = F_ALLOCATEALL;
+      if (::fcntl(this->_fd, F_PREALLOCATE, &store) != 0)
+        ELLE_DEBUG("%s: unable to reserve space: %s",
+                   *this, ::strerror(errno));
+    }
+#else
+    (void)size;
+#endif
+  }
+
+  void
+  FileWriter::extend(FileSize size)
+  {
+    ELLE_DEBUG_SCOPE("%s: extend to %s bytes", *this, size);
+#ifdef INFINIT_WINDOWS
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    if (boost::filesystem::file_size(this->_path) < size)
+      boost::filesystem::resize_file(this->_path, size);
+#else
+    struct stat st;
+    if (::fstat(this->_fd, &st) != 0)
+      throw write_error("unable to stat file", this->_path);
+    if (static_cast<FileSize>(st.st_size) < size &&
+        ::ftruncate(this->_fd, size) != 0)
+      throw write_error("unable to extend file", this->_path);
+#endif
+  }
+
+  void
+  FileWriter::preallocate(FileSize size)
+  {
+    this->extend(size);
+    this->reserve(size);
+  }
+
+  void
+  FileWriter::write(FileOffset offset, elle::ConstWeakBuffer const& data)
+  {
+    ELLE_DUMP("%s: write %s bytes at %s", *this, data.size(), offset);
+    if (this->_failed)
+      throw boost::filesystem::filesystem_error(
+        "previous write failed", this->_path,
+        boost::system::errc::make_error_code(boost::system::errc::io_error));
+    // Unset on success.
+    this->_failed = true;
+#ifdef INFINIT_WINDOWS
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_stream.seekp(offset);
+    this->_stream.write(reinterpret_cast<char const*>(data.contents()),
+                        data.size());
+    this->_stream.flush();
+    if (!this->_stream.good())
+      throw write_error("unable to write file", this->_path);
+#else
+    auto input = data.contents();
+    auto remaining = data.size();
+    while (remaining > 0)
+    {
+      auto written = ::pwrite(this->_fd, input, remaining, offset);
+      if (written < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        throw write_error("unable to write file", this->_path);
+      }
+      input += written;
+      remaining -= written;
+      offset += written;
+    }
+#endif
+    this->_failed = false;
+  }
+
+  /*----------.
+  | Printable |
+  `----------*/
+
+  void
+  FileWriter::print(std::ostream& stream) const
+  {
+    elle::fprintf(stream, "FileWriter(%s)", this->_path);
+  }
+}
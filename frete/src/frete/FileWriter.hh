@@ -0,0 +1,81 @@
+#ifndef FRETE_FILE_WRITER_HH
+# define FRETE_FILE_WRITER_HH
+
+# include <mutex>
+
+# include <boost/filesystem/fstream.hpp>
+# include <boost/filesystem/path.hpp>
+
+# include <elle/Buffer.hh>
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+
+# include <frete/Frete.hh>
+
+namespace frete
+{
+  /// Write blocks at any offset of a file.
+  ///
+  /// Writes don't share a file position, so blocks of the same file can be
+  /// written concurrently from several threads, in any order. Once a write
+  /// failed, the following ones fail too so that a file written in order
+  /// has no hole.
+  class FileWriter:
+    public elle::Printable
+  {
+  /*------.
+  | Types |
+  `------*/
+  public:
+    typedef FileWriter Self;
+    typedef Frete::FileOffset FileOffset;
+    typedef Frete::FileSize FileSize;
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+  public:
+    /// Open path for writing, creating it but not truncating it.
+    FileWriter(boost::filesystem::path const& path);
+    FileWriter(FileWriter const&) = delete;
+    ~FileWriter();
+    ELLE_ATTRIBUTE_R(boost::filesystem::path, path);
+  private:
+# ifdef INFINIT_WINDOWS
+    ELLE_ATTRIBUTE(boost::filesystem::fstream, stream);
+    ELLE_ATTRIBUTE(std::mutex, mutex);
+# else
+    ELLE_ATTRIBUTE(int, fd);
+# endif
+
+  /*------.
+  | Write |
+  `------*/
+  public:
+    /// Allocate disk space for size bytes without changing the file size,
+    /// where the filesystem supports it. Blocking.
+    void
+    reserve(FileSize size);
+    /// Extend the file to size, leaving it untouched if it's larger. The
+    /// extension is a hole where the filesystem supports it. Blocking.
+    void
+    extend(FileSize size);
+    /// Extend the file to size and allocate it. Blocking.
+    void
+    preallocate(FileSize size);
+    /// Write data at offset. Blocking.
+    void
+    write(FileOffset offset, elle::ConstWeakBuffer const& data);
+    /// Whether a write failed.
+    ELLE_ATTRIBUTE_R(bool, failed);
+
+  /*----------.
+  | Printable |
+  `----------*/
+  public:
+    void
+    print(std::ostream& stream) const override;
+  };
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <functional>
 #include <ios>
+#include <iterator>
 #include <limits>
 #include <algorithm>
 
@@ -13,16 +14,28 @@
 #include <elle/serialization/json/SerializerIn.hh>
 #include <elle/serialization/json/SerializerOut.hh>
 #include <elle/system/system.hh>
+#include <elle/With.hh>
 
 #include <cryptography/SecretKey.hh>
 #include <cryptography/rsa/KeyPair.hh>
 #include <cryptography/rsa/PrivateKey.hh>
 #include <cryptography/_legacy/Code.hh>
 
+#include <reactor/Scope.hh>
 #include <reactor/network/socket.hh>
 
+#include <frete/Bundle.hh>
+#include <frete/Checksum.hh>
+#include <frete/CryptoPool.hh>
+#include <frete/Dedup.hh>
+#include <frete/DirectoryScan.hh>
 #include <frete/Frete.hh>
+#include <frete/HandleCache.hh>
+#include <frete/MappedFile.hh>
+#include <frete/ReadAhead.hh>
+#include <frete/Sparse.hh>
 #include <frete/TransferSnapshot.hh>
+#include <frete/ZipStream.hh>
 
 #include <version.hh>
 
@@ -34,6 +47,11 @@ namespace frete
   | Construction |
   `-------------*/
 
+  // Bytes kept in memory by the read ahead, per transfer.
+  static Frete::FileSize const read_ahead_capacity = 1 << 24;
+  // Bytes hashed per deduplication request.
+  static Frete::FileSize const file_hashes_capacity = 1 << 30;
+
   class Frete::Impl
   {
   public:
@@ -64,9 +82,15 @@ namespace frete
     : _impl(new Impl(password))
     , _mirror_root(mirror_root)
     , _finished()
+    , _sent_checksums()
     , _progress_changed("progress changed signal")
     , _transfer_snapshot()
     , _snapshot_destination(snapshot_destination)
+    , _handles(std::make_shared<HandleCache>())
+    , _crypto(std::make_shared<CryptoPool>())
+    , _mapped_read(false)
+    , _mapped(-1, nullptr)
+    , _archives()
   {
     if (exists(this->_snapshot_destination))
     {
@@ -116,6 +140,14 @@ namespace frete
       // immediately save the snapshot so that key never changes
       this->save_snapshot();
     }
+    int depth = ReadAhead::default_depth();
+    if (depth > 0)
+      this->_read_ahead.reset(
+        new ReadAhead(*this->_transfer_snapshot,
+                      std::bind(&Frete::_local_path,
+                                this, std::placeholders::_1),
+                      depth,
+                      read_ahead_capacity));
   }
 
   void
@@ -140,30 +172,34 @@ namespace frete
   Frete::add(boost::filesystem::path const& path)
   {
     ELLE_TRACE("%s: add %s", *this, path);
+    DirectoryScan scan({path});
+    this->add(scan);
+  }
 
-    if (!boost::filesystem::exists(path))
-      throw elle::Exception(elle::sprintf("given path %s doesn't exist", path));
-
-    if (is_directory(path))
+  void
+  Frete::add(DirectoryScan const& scan)
+  {
+    for (auto const& source: scan.sources())
     {
-      bool has_symlink = false;
-      boost::filesystem::recursive_directory_iterator end;
-      for (auto it = boost::filesystem::recursive_directory_iterator(path);
-           it != end;
-           ++it)
-      {
-        if (boost::filesystem::is_symlink(it->path()))
-        {
-          has_symlink = true;
-          break;
-        }
-      }
-      if (has_symlink)
+      auto const& path = source.path;
+      if (source.directory && source.symlink)
       { // Replace with ziped version of itself
         boost::filesystem::path archive_name = path.filename();
         archive_name += ".zip";
         boost::filesystem::path archive_path =
          this->_snapshot_destination.parent_path() / "archive";
+        auto stream = std::make_shared<ZipStream>(path);
+        if (stream->streamable())
+        {
+          ELLE_TRACE("%s: add %s as a streamed archive of %s bytes",
+                     *this, path, stream->size());
+          this->_transfer_snapshot->add_archive(
+            path, archive_path, archive_name, stream->size());
+          this->_archives[this->count() - 1] = std::move(stream);
+          continue;
+        }
+        // Beyond zip limits, have the archive built with zip64 extensions.
+        ELLE_TRACE("%s: add %s as an archive", *this, path);
         boost::filesystem::create_directories(archive_path);
         boost::filesystem::path archive_full_path = archive_path / archive_name;
         reactor::background(
@@ -178,27 +214,17 @@ namespace frete
       }
       else
       {
-        for (auto it = boost::filesystem::recursive_directory_iterator(path);
-             it != end;
-             ++it)
+        ELLE_TRACE("%s: add %s files from %s",
+                   *this, source.files.size(), path);
+        for (auto const& file: source.files)
         {
-          auto parent = path.parent_path();
-          boost::filesystem::path relative;
-          auto rel = it->path().begin();
-          for (auto count = parent.begin(); count != parent.end(); ++count)
-            ++rel;
-          for (; rel != it->path().end(); ++rel)
-            relative /= *rel;
-          if (!boost::filesystem::is_directory(*it))
-            this->_add(parent, relative);
+          this->_add(file.root, file.path, file.size);
+          if (!file.holes.empty())
+            this->_transfer_snapshot->file(this->count() - 1).holes(
+              file.holes);
         }
       }
     }
-    else
-    {
-      ELLE_TRACE("%s: add %s / %s", *this, path.parent_path(), path.filename());
-      this->_add(path.parent_path(), path.filename());
-    }
   }
 
   void
@@ -210,9 +236,17 @@ namespace frete
     if (!boost::filesystem::exists(full_path))
       throw elle::Exception(
         elle::sprintf("given path %s doesn't exist", full_path));
-    this->_transfer_snapshot->add(root, path);
-    // Open the file by making a cache fetch
-    if (count() <= _max_count_for_full_cache)
+    this->_add(root, path, boost::filesystem::file_size(full_path));
+  }
+
+  void
+  Frete::_add(boost::filesystem::path const& root,
+              boost::filesystem::path const& path,
+              FileSize size)
+  {
+    this->_transfer_snapshot->add(root, path, size);
+    // Open the file by making a cache fetch, as long as it evicts nothing.
+    if (this->_handles->size() < this->_handles->capacity())
       _fetch_cache(count()-1);
   }
 
@@ -294,7 +328,16 @@ namespace frete
     this->_transfer_snapshot->file_progress_end(this->count() - 1);
     this->_progress_changed.signal();
     this->_finished.open();
-    this->_cache.clear();
+    for (FileID file_id = 0; file_id < this->count(); ++file_id)
+      this->_handles->close(this->_local_path(file_id));
+    ELLE_DEBUG("%s: %s", *this, *this->_handles);
+    this->_mapped.second.reset();
+    this->_archives.clear();
+    if (this->_read_ahead)
+    {
+      ELLE_TRACE("%s: %s", *this, *this->_read_ahead);
+      this->_read_ahead->clear();
+    }
   }
 
   frete::Frete::FileCount
@@ -320,9 +363,27 @@ namespace frete
   Frete::files_info()
   {
     Frete::FilesInfo res;
-    for (unsigned i = 0; i < this->count(); ++i)
+    auto const& files = this->_transfer_snapshot->files();
+    res.reserve(files.size());
+    for (auto const& file: files)
+      res.push_back(std::make_pair(file.path(), file.size()));
+    return res;
+  }
+
+  Frete::FileCount const Frete::files_info_page_size;
+
+  Frete::FilesInfo
+  Frete::files_info_page(FileID start, FileCount count)
+  {
+    Frete::FilesInfo res;
+    auto total = this->_transfer_snapshot->count();
+    if (start >= total)
+      return res;
+    auto end = start + std::min<FileCount>(count, total - start);
+    res.reserve(end - start);
+    for (auto i = start; i < end; ++i)
     {
-      auto& file = this->_transfer_snapshot->file(i);
+      auto const& file = this->_transfer_snapshot->file(i);
       res.push_back(std::make_pair(file.path(), file.size()));
     }
     return res;
@@ -374,7 +435,7 @@ namespace frete
       "%s: read and encrypt block %s of size %s at offset %s with key %s",
       *this, f, size, start, this->_impl->key());
 
-    auto code = this->_impl->key()->legacy_encrypt_buffer(this->cleartext_read(f, start, size));
+    auto code = this->_encrypt(*this->_impl->key(), f, start, size, true);
 
     ELLE_DUMP("encrypted data: %x", code);
     return code;
@@ -388,7 +449,101 @@ namespace frete
       "%s: read and encrypt block %s of size %s at offset %s with key %s",
       *this, f, size, start, this->_impl->key());
 
-    auto code = this->_impl->key()->legacy_encrypt_buffer(this->cleartext_read(f, start, size, false));
+    auto code = this->_encrypt(*this->_impl->key(), f, start, size, false);
+    this->_acknowledge(acknowledge);
+    ELLE_DUMP("encrypted data: %x", code);
+    return code;
+  }
+
+  std::vector<infinit::cryptography::Code>
+  Frete::encrypted_read_range(Positions const& positions,
+                              FileSize size,
+                              FileSize acknowledge,
+                              bool compress)
+  {
+    ELLE_DEBUG_SCOPE(
+      "%s: read and encrypt %s blocks of size %s starting at %s with key %s%s",
+      *this, positions.size(), size,
+      positions.empty() ? Position(0, 0) : positions.front(),
+      this->_impl->key(), compress ? " (compressed)" : "");
+    auto res =
+      this->_encrypt(*this->_impl->key(), positions, size, false, compress);
+    this->_acknowledge(acknowledge);
+    return res;
+  }
+
+  // Read the first size bytes of a file, blocking.
+  static
+  elle::Buffer
+  read_file(boost::filesystem::path const& path, Frete::FileSize size)
+  {
+    boost::filesystem::ifstream input(path, std::ios::binary);
+    if (!input.good())
+      throw boost::filesystem::filesystem_error(
+        "unable to open file", path,
+        boost::system::errc::make_error_code(
+          boost::system::errc::no_such_file_or_directory));
+    elle::Buffer res(size);
+    input.read(reinterpret_cast<char*>(res.mutable_contents()), size);
+    res.size(input.gcount());
+    return res;
+  }
+
+  infinit::cryptography::Code
+  Frete::encrypted_read_files(std::vector<FileID> const& files,
+                              FileSize acknowledge,
+                              bool compress)
+  {
+    ELLE_DEBUG_SCOPE(
+      "%s: read and encrypt %s files starting at %s with key %s%s",
+      *this, files.size(), files.empty() ? 0 : files.front(),
+      this->_impl->key(), compress ? " (compressed)" : "");
+    std::vector<elle::Buffer> contents(files.size());
+    // Read the files on disk all at once off the scheduler, archives are
+    // generated.
+    std::vector<std::tuple<std::size_t, boost::filesystem::path, FileSize>>
+      plain;
+    for (std::size_t i = 0; i < files.size(); ++i)
+    {
+      auto size = this->file_size(files[i]);
+      if (this->_archive(files[i]))
+        contents[i] = this->cleartext_read(files[i], 0, size, false);
+      else
+        plain.emplace_back(i, this->_local_path(files[i]), size);
+    }
+    // Read one more byte to catch files that grew since they were added,
+    // and checksum them on the way.
+    std::vector<checksum::Parts> parts(plain.size());
+    reactor::background(
+      [&]
+      {
+        for (std::size_t i = 0; i < plain.size(); ++i)
+        {
+          auto const& file = plain[i];
+          auto& content = contents[std::get<0>(file)];
+          content = read_file(std::get<1>(file), std::get<2>(file) + 1);
+          if (content.size() <= std::get<2>(file))
+            parts[i] = checksum::parts(0, content);
+        }
+      });
+    for (auto const& file: plain)
+      this->_check_read(files[std::get<0>(file)],
+                        contents[std::get<0>(file)].size());
+    for (std::size_t i = 0; i < plain.size(); ++i)
+      this->_checksum_sent(files[std::get<0>(plain[i])], parts[i]);
+    std::vector<elle::ConstWeakBuffer> views;
+    views.reserve(contents.size());
+    for (auto const& content: contents)
+      views.emplace_back(content.contents(), content.size());
+    auto res = this->_crypto->encrypt(
+      *this->_impl->key(), bundle::pack(views), compress);
+    this->_acknowledge(acknowledge);
+    return res;
+  }
+
+  void
+  Frete::_acknowledge(FileSize acknowledge)
+  {
     auto& snapshot = *this->_transfer_snapshot;
     /* Since we might be pushing both in a bufferer and directly, there
      * are actually two progress positions.
@@ -396,8 +551,177 @@ namespace frete
     */
     if (acknowledge > snapshot.progress())
       snapshot.progress_increment(acknowledge - snapshot.progress());
-    ELLE_DUMP("encrypted data: %x", code);
-    return code;
+  }
+
+  infinit::cryptography::Code
+  Frete::encrypted_file_hashes(std::vector<FileID> const& files)
+  {
+    ELLE_TRACE_SCOPE("%s: hash %s files", *this, files.size());
+    // Hash concurrently on the crypto workers, up to the budget of the call.
+    // Files past it are reported unknown and simply fetched.
+    FileSize budget = file_hashes_capacity;
+    elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+    {
+      for (auto file_id: files)
+      {
+        auto& file = this->_transfer_snapshot->file(file_id);
+        if (file.hash() || file.archive() || file.size() > budget)
+          continue;
+        budget -= file.size();
+        auto path = this->_local_path(file_id);
+        scope.run_background(
+          elle::sprintf("hash %s", file_id),
+          [this, &file, path]
+          {
+            dedup::Hash hash;
+            this->_crypto->background([&] { hash = dedup::hash(path); });
+            file.hash(hash);
+          });
+      }
+      reactor::wait(scope);
+    };
+    dedup::Hashes hashes;
+    hashes.reserve(files.size());
+    for (auto file_id: files)
+    {
+      auto& file = this->_transfer_snapshot->file(file_id);
+      hashes.push_back(file.hash() ? file.hash().get() : dedup::Hash());
+    }
+    return this->_crypto->encrypt(*this->_impl->key(), dedup::pack(hashes));
+  }
+
+  infinit::cryptography::Code
+  Frete::encrypted_file_checksums(FileID file_id, FileSize size)
+  {
+    ELLE_TRACE_SCOPE("%s: checksum %s bytes of file %s", *this, size, file_id);
+    size = std::min(size, this->file_size(file_id));
+    return this->_crypto->encrypt(
+      *this->_impl->key(), checksum::pack(this->_checksums(file_id, 0, size)));
+  }
+
+  infinit::cryptography::Code
+  Frete::encrypted_file_holes(std::vector<FileID> const& files)
+  {
+    ELLE_TRACE_SCOPE("%s: holes of %s files", *this, files.size());
+    std::vector<sparse::Extents> holes;
+    holes.reserve(files.size());
+    for (auto file_id: files)
+      holes.push_back(this->_transfer_snapshot->file(file_id).holes());
+    return this->_crypto->encrypt(*this->_impl->key(), sparse::pack(holes));
+  }
+
+  infinit::cryptography::Code
+  Frete::encrypted_sent_checksums(std::vector<FileID> const& files)
+  {
+    ELLE_TRACE_SCOPE("%s: checksum %s files as sent", *this, files.size());
+    checksum::Checksums res;
+    for (auto file_id: files)
+    {
+      auto size = this->file_size(file_id);
+      auto& sent = this->_sent_checksums[file_id];
+      auto count = checksum::blocks(size);
+      // Read again the blocks not read whole, by runs of consecutive ones.
+      for (FileSize block = 0; block < count;)
+      {
+        if (sent.blocks.find(block) != sent.blocks.end())
+        {
+          ++block;
+          continue;
+        }
+        FileSize end = block;
+        while (end < count && sent.blocks.find(end) == sent.blocks.end())
+          ++end;
+        FileOffset offset = block * checksum::block_size;
+        FileSize length =
+          std::min<FileSize>(end * checksum::block_size, size) - offset;
+        ELLE_DEBUG("%s: checksum %s bytes of file %s at %s",
+                   *this, length, file_id, offset);
+        auto checksums = this->_checksums(file_id, offset, length);
+        for (unsigned i = 0; i < checksums.size(); ++i)
+          sent.blocks[block + i] = checksums[i];
+        block = end;
+      }
+      sent.parts.clear();
+      for (auto const& block: sent.blocks)
+        if (block.first < count)
+          res.push_back(block.second);
+    }
+    return this->_crypto->encrypt(*this->_impl->key(), checksum::pack(res));
+  }
+
+  std::vector<uint32_t>
+  Frete::_checksums(FileID file_id, FileOffset offset, FileSize size)
+  {
+    checksum::Checksums checksums;
+    if (auto archive = this->_archive(file_id))
+      for (FileSize end = offset + size; offset < end;
+           offset += checksum::block_size)
+        checksums.push_back(
+          checksum::update(
+            0, archive->read(offset,
+                             std::min(checksum::block_size, end - offset))));
+    else
+    {
+      auto path = this->_local_path(file_id);
+      reactor::background(
+        [&]
+        {
+          checksums = checksum::file(path, offset, size);
+        });
+    }
+    return checksums;
+  }
+
+  void
+  Frete::_checksum_sent(FileID file_id, checksum::Parts const& read)
+  {
+    auto& sent = this->_sent_checksums[file_id];
+    auto& parts = sent.parts;
+    auto size = this->file_size(file_id);
+    // Merge parts of the same block read in any order.
+    for (auto const& part: read)
+    {
+      FileSize block = part.offset / checksum::block_size;
+      FileOffset block_start = block * checksum::block_size;
+      FileOffset block_end =
+        std::min<FileOffset>(block_start + checksum::block_size, size);
+      FileOffset start = part.offset;
+      FileSize length = part.size;
+      auto crc = part.checksum;
+      if (sent.blocks.find(block) != sent.blocks.end())
+        continue;
+      // Data read twice is skipped, the block is read again if need be.
+      auto next = parts.lower_bound(start);
+      if (next != parts.end() && next->first < start + length)
+        continue;
+      if (next != parts.begin() &&
+          std::prev(next)->first + std::prev(next)->second.first > start)
+        continue;
+      if (next != parts.begin())
+      {
+        auto previous = std::prev(next);
+        if (previous->first >= block_start &&
+            previous->first + previous->second.first == start)
+        {
+          crc = checksum::combine(previous->second.second, crc, length);
+          length += previous->second.first;
+          start = previous->first;
+          parts.erase(previous);
+        }
+      }
+      if (next != parts.end() &&
+          next->first == start + length &&
+          next->first < block_start + checksum::block_size)
+      {
+        crc = checksum::combine(crc, next->second.second, next->second.first);
+        length += next->second.first;
+        parts.erase(next);
+      }
+      if (start == block_start && start + length >= block_end)
+        sent.blocks[block] = crc;
+      else
+        parts[start] = std::make_pair(length, crc);
+    }
   }
 
   std::string
@@ -411,27 +735,68 @@ namespace frete
                 FileOffset offset,
                 FileSize const size,
                 bool update_progress)
+  {
+    auto result = this->_read(file_id, offset, size, update_progress);
+    checksum::Parts parts;
+    this->_crypto->background(
+      [&] { parts = checksum::parts(offset, result); });
+    this->_checksum_sent(file_id, parts);
+    return result;
+  }
+
+  elle::Buffer
+  Frete::_read(FileID file_id,
+               FileOffset offset,
+               FileSize size,
+               bool update_progress)
   {
     ELLE_DEBUG_SCOPE("%s: read %s bytes of file %s at offset %s",
                      *this, size,  file_id, offset);
-    auto& snapshot = *this->_transfer_snapshot;
     if (update_progress)
+      this->_read_progress(file_id, offset);
+    if (auto archive = this->_archive(file_id))
     {
-      if (offset != 0)
-        snapshot.file_progress_set(file_id, offset);
-      else if (file_id != 0)
-        snapshot.file_progress_end(file_id - 1);
-      this->_progress_changed.signal();
+      elle::Buffer result = archive->read(offset, size);
+      this->_check_read(file_id, offset + result.size());
+      // Record the entries streamed so far, to resume from them.
+      auto const& streamed = archive->checksums();
+      auto& checksums =
+        this->_transfer_snapshot->file(file_id).archive_checksums();
+      if (streamed.size() > checksums.size())
+        checksums.insert(checksums.end(),
+                         streamed.begin() + checksums.size(),
+                         streamed.end());
+      return result;
     }
-    elle::system::FileHandle& handle = _fetch_cache(file_id);
+    boost::optional<elle::Buffer> ahead;
+    if (this->_read_ahead)
+      ahead = this->_read_ahead->fetch(file_id, offset, size);
+    elle::Buffer result =
+      ahead ? std::move(ahead.get()) : _fetch_cache(file_id)->read(offset, size);
+    this->_check_read(file_id, offset + result.size());
+    return result;
+  }
+
+  void
+  Frete::_read_progress(FileID file_id, FileOffset offset)
+  {
+    auto& snapshot = *this->_transfer_snapshot;
+    if (offset != 0)
+      snapshot.file_progress_set(file_id, offset);
+    else if (file_id != 0)
+      snapshot.file_progress_end(file_id - 1);
+    this->_progress_changed.signal();
+  }
 
-    elle::Buffer result = handle.read(offset, size);
-    if (offset + result.size() > file_size(file_id))
+  void
+  Frete::_check_read(FileID file_id, FileOffset end)
+  {
+    if (end > file_size(file_id))
     {
       auto& file = this->_transfer_snapshot->file(file_id);
       std::string message = elle::sprintf(
         "File size inconsistency on %s: %s > %s",
-        file.path(), offset + result.size(), file.size());
+        file.path(), end, file.size());
       ELLE_ERR("%s", message);
       // The sender will reject it and fail the transfer, so throw on this
       // end, the error will be clearer
@@ -441,45 +806,124 @@ namespace frete
         boost::system::errc::make_error_code(boost::system::errc::file_too_large)
       );
     }
-    return result;
   }
 
-  unsigned int Frete::_max_count_for_full_cache = 20;
+  infinit::cryptography::Code
+  Frete::_encrypt(infinit::cryptography::SecretKey const& key,
+                  FileID file_id,
+                  FileOffset offset,
+                  FileSize size,
+                  bool update_progress)
+  {
+    auto codes =
+      this->_encrypt(key, Positions{Position(file_id, offset)},
+                     size, update_progress);
+    return std::move(codes.front());
+  }
 
-  elle::system::FileHandle&
-  Frete::_fetch_cache(FileID file_id)
+  std::vector<infinit::cryptography::Code>
+  Frete::_encrypt(infinit::cryptography::SecretKey const& key,
+                  Positions const& positions,
+                  FileSize size,
+                  bool update_progress,
+                  bool compress)
   {
-    auto it = _cache.find(file_id);
-    if (it == _cache.end())
+    // Read in order on the scheduler thread, encrypt concurrently.
+    std::vector<elle::Buffer> buffers;
+    std::vector<std::unique_ptr<MappedFile::Window>> windows;
+    std::vector<elle::ConstWeakBuffer> views;
+    buffers.reserve(positions.size());
+    views.reserve(positions.size());
+    for (auto const& position: positions)
     {
-      auto handle = elle::make_unique<elle::system::FileHandle>(
-        this->_local_path(file_id), elle::system::FileHandle::READ);
-      _cache[file_id].first = std::move(handle);
-    }
-    if (count() > _max_count_for_full_cache)
-    { // partial cache only, cleanup check
-      // kill all entries that got unused more than x times in a row.
-      std::vector<int> to_kill;
-      for (auto& e: _cache)
+      FileID file_id = position.first;
+      FileOffset offset = position.second;
+      std::unique_ptr<MappedFile::Window> window;
+      if (auto mapping = this->_mapping(file_id))
+        window = mapping->map(offset, size);
+      if (window)
       {
-        if (e.first == file_id)
-        {
-          e.second.second=0;
-        }
-        else
-        {
-          e.second.second++;
-          if (e.second.second > 10)
-            to_kill.push_back(e.first);
-        }
+        ELLE_DEBUG("%s: encrypt %s bytes of file %s at offset %s mapped",
+                   *this, size, file_id, offset);
+        if (update_progress)
+          this->_read_progress(file_id, offset);
+        auto view = window->view();
+        this->_check_read(file_id, offset + view.size());
+        // Encrypt straight from the mapped pages, no intermediate copy. Keep
+        // the window mapped until then.
+        windows.push_back(std::move(window));
+        views.push_back(view);
       }
-      for(int i: to_kill)
+      else
       {
-        _cache.erase(i);
+        buffers.push_back(
+          this->_read(file_id, offset, size, update_progress));
+        views.push_back(elle::ConstWeakBuffer(buffers.back().contents(),
+                                              buffers.back().size()));
       }
     }
-    // we might have moved things that modified the element address. Fetch again.
-    return *_cache[file_id].first.get();
+    // Checksum the data sent in the jobs encrypting it, so that mapped pages
+    // are faulted in by the workers.
+    std::vector<checksum::Parts> parts(positions.size());
+    auto codes = this->_crypto->encrypt(
+      key, views, compress,
+      [&] (std::size_t i, elle::ConstWeakBuffer const& data)
+      {
+        parts[i] = checksum::parts(positions[i].second, data);
+      });
+    for (std::size_t i = 0; i < positions.size(); ++i)
+      this->_checksum_sent(positions[i].first, parts[i]);
+    return codes;
+  }
+
+  static Frete::FileSize const mapped_read_min_size = 1 << 22;
+
+  std::shared_ptr<MappedFile>
+  Frete::_mapping(FileID file_id)
+  {
+    if (!this->_mapped_read || !MappedFile::supported())
+      return nullptr;
+    if (this->_transfer_snapshot->file(file_id).archive())
+      return nullptr;
+    if (this->file_size(file_id) < mapped_read_min_size)
+      return nullptr;
+    if (this->_mapped.second == nullptr || this->_mapped.first != file_id)
+    {
+      this->_mapped.second.reset();
+      this->_mapped.second =
+        std::make_shared<MappedFile>(this->_local_path(file_id));
+      this->_mapped.first = file_id;
+    }
+    return this->_mapped.second;
+  }
+
+  std::shared_ptr<ZipStream>
+  Frete::_archive(FileID file_id)
+  {
+    auto it = this->_archives.find(file_id);
+    if (it != this->_archives.end())
+      return it->second;
+    auto const& file = this->_transfer_snapshot->file(file_id);
+    if (!file.archive())
+      return nullptr;
+    // Reloaded from the snapshot, list the directory again.
+    ELLE_TRACE_SCOPE("%s: resume archive of %s from entry %s",
+                     *this, file.archive().get(),
+                     file.archive_checksums().size());
+    auto stream = std::make_shared<ZipStream>(file.archive().get(),
+                                              file.archive_checksums());
+    if (stream->size() != file.size())
+      throw elle::Exception(
+        elle::sprintf("archived directory %s changed since the transfer "
+                      "started: %s bytes instead of %s",
+                      file.archive().get(), stream->size(), file.size()));
+    return this->_archives.emplace(file_id, stream).first->second;
+  }
+
+  HandleCache::Handle
+  Frete::_fetch_cache(FileID file_id)
+  {
+    return this->_handles->open(this->_local_path(file_id));
   }
 
   infinit::cryptography::Code
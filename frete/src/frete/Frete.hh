@@ -2,6 +2,7 @@
 # define FRETE_FRETE_HH
 
 # include <ios>
+# include <map>
 # include <stdint.h>
 # include <tuple>
 # include <algorithm>
@@ -48,6 +49,8 @@ namespace frete
     typedef Frete Self;
     typedef std::pair<std::string, FileSize> FileInfo;
     typedef std::vector<FileInfo> FilesInfo;
+    typedef std::pair<FileID, FileOffset> Position;
+    typedef std::vector<Position> Positions;
   /*-------------.
   | Construction |
   `-------------*/
@@ -80,10 +83,17 @@ namespace frete
     /// Register a file.
     void
     add(boost::filesystem::path const& path);
+    /// Register the files of a scan.
+    void
+    add(DirectoryScan const& scan);
   private:
     void
     _add(boost::filesystem::path const& root,
          boost::filesystem::path const& path);
+    void
+    _add(boost::filesystem::path const& root,
+         boost::filesystem::path const& path,
+         FileSize size);
 
   public:
     struct TransferInfo
@@ -119,6 +129,12 @@ namespace frete
     /// The path and size of all files.
     FilesInfo
     files_info();
+    /// The path and size of at most count files from start, so that big
+    /// transfers are described a page at a time.
+    FilesInfo
+    files_info_page(FileID start, FileCount count);
+    /// The number of files per page of files_info_page.
+    static FileCount const files_info_page_size = 1024;
     /// Get all the info of the transfer.
     TransferInfo
     transfer_info();
@@ -147,6 +163,39 @@ namespace frete
     /// acknowledge_progress starting from the beginning of the whole frete data
     infinit::cryptography::Code
     encrypted_read_acknowledge(FileID f, FileOffset start, FileSize size, FileSize acknowledge_progress);
+    /// Strongly crypted chunks of size bytes at each position, in one call.
+    /// Acknowledge overall progress like encrypted_read_acknowledge. If
+    /// compress, chunks are framed through compression::pack before being
+    /// encrypted.
+    std::vector<infinit::cryptography::Code>
+    encrypted_read_range(Positions const& positions,
+                         FileSize size,
+                         FileSize acknowledge_progress,
+                         bool compress);
+    /// The whole content of files, packed by bundle::pack and strongly
+    /// crypted, framed through compression::pack first if compress.
+    /// Acknowledge overall progress like encrypted_read_acknowledge.
+    infinit::cryptography::Code
+    encrypted_read_files(std::vector<FileID> const& files,
+                         FileSize acknowledge_progress,
+                         bool compress);
+    /// The content hashes of files, as packed by dedup::pack and strongly
+    /// crypted. Files that can't be hashed have an empty one.
+    infinit::cryptography::Code
+    encrypted_file_hashes(std::vector<FileID> const& files);
+    /// The checksums of the first size bytes of a file, as packed by
+    /// checksum::pack and strongly crypted.
+    infinit::cryptography::Code
+    encrypted_file_checksums(FileID file_id, FileSize size);
+    /// The holes of files, as packed by sparse::pack and strongly crypted.
+    infinit::cryptography::Code
+    encrypted_file_holes(std::vector<FileID> const& files);
+    /// The checksums of the whole content of files, one after the other,
+    /// as packed by checksum::pack and strongly crypted. They are those of
+    /// the data sent, computed as it was read, and of the files for the
+    /// blocks not read whole.
+    infinit::cryptography::Code
+    encrypted_sent_checksums(std::vector<FileID> const& files);
     elle::Buffer cleartext_read(FileID f, FileOffset start, FileSize size, bool increment_progress = true);
     /// Whether we're done.
     ELLE_ATTRIBUTE_RX(reactor::Barrier, finished);
@@ -154,6 +203,57 @@ namespace frete
     /// The path of a file on the local filesystem.
     boost::filesystem::path
     _local_path(FileID file_id);
+    /// Account a chunk being read in the progress.
+    void
+    _read_progress(FileID file_id, FileOffset offset);
+    /// Move the progress up to acknowledge, if ahead of it.
+    void
+    _acknowledge(FileSize acknowledge);
+    /// Read a chunk, without recording its checksums.
+    elle::Buffer
+    _read(FileID file_id,
+          FileOffset offset,
+          FileSize size,
+          bool update_progress);
+    /// Throw if a read ended past the size registered for the file.
+    void
+    _check_read(FileID file_id, FileOffset end);
+    /// Read and encrypt a chunk, from the mapping if enabled.
+    infinit::cryptography::Code
+    _encrypt(infinit::cryptography::SecretKey const& key,
+             FileID file_id,
+             FileOffset offset,
+             FileSize size,
+             bool update_progress);
+    /// Read chunks in order and encrypt them in parallel.
+    std::vector<infinit::cryptography::Code>
+    _encrypt(infinit::cryptography::SecretKey const& key,
+             Positions const& positions,
+             FileSize size,
+             bool update_progress,
+             bool compress = false);
+
+  /*----------.
+  | Checksums |
+  `----------*/
+  private:
+    /// The checksums of size bytes of a file from offset, a multiple of
+    /// checksum::block_size.
+    std::vector<uint32_t>
+    _checksums(FileID file_id, FileOffset offset, FileSize size);
+    /// Record the checksums of parts of a file read, as computed by
+    /// checksum::parts off the scheduler, whatever the order of the reads.
+    void
+    _checksum_sent(FileID file_id, std::vector<checksum::Part> const& parts);
+    struct SentChecksums
+    {
+      /// Checksums of the blocks read whole, by index.
+      std::map<FileSize, uint32_t> blocks;
+      /// Checksums of the parts of blocks read so far, by offset, with their
+      /// size.
+      std::map<FileOffset, std::pair<FileSize, uint32_t>> parts;
+    };
+    ELLE_ATTRIBUTE((std::map<FileID, SentChecksums>), sent_checksums);
 
   /*---------.
   | Progress |
@@ -181,15 +281,51 @@ namespace frete
     void
     print(std::ostream& stream) const override;
 
+  /*--------.
+  | Handles |
+  `--------*/
+  public:
+    /// The cache of open files, possibly shared with other transfers.
+    ELLE_ATTRIBUTE_RW(std::shared_ptr<HandleCache>, handles);
+  private:
+    /// The read handle of a file, opened if needed.
+    std::shared_ptr<elle::system::FileHandle>
+    _fetch_cache(FileID id);
+
+  /*-------.
+  | Crypto |
+  `-------*/
+  public:
+    /// The pool running encryption, possibly shared with other transfers.
+    ELLE_ATTRIBUTE_RW(std::shared_ptr<CryptoPool>, crypto);
+
+  /*------------.
+  | Mapped read |
+  `------------*/
+  public:
+    /// Whether large files are memory mapped and encrypted in place.
+    ELLE_ATTRIBUTE_RW(bool, mapped_read);
+  private:
+    /// The file being read through mappings, null if not mapped.
+    std::shared_ptr<MappedFile>
+    _mapping(FileID file_id);
+    ELLE_ATTRIBUTE((std::pair<FileID, std::shared_ptr<MappedFile>>), mapped);
+
+  /*---------.
+  | Archives |
+  `---------*/
   private:
-    // Keep a cache of opened file for each id. Entries get removed after
-    // 'x' successive cache miss
-    elle::system::FileHandle& _fetch_cache(FileID id);
-    // If file count is below this number, kepp a cache FileHandle for all files
-    static unsigned int _max_count_for_full_cache;
-    typedef std::pair<std::unique_ptr<elle::system::FileHandle>, int> HandleCounter;
-    typedef std::map<unsigned int, HandleCounter> Cache;
-    Cache _cache;
+    /// The stream generating a file if it is an archive, null otherwise.
+    std::shared_ptr<ZipStream>
+    _archive(FileID file_id);
+    ELLE_ATTRIBUTE((std::map<FileID, std::shared_ptr<ZipStream>>), archives);
+
+  /*-----------.
+  | Read ahead |
+  `-----------*/
+  public:
+    /// The chunk prefetcher, null if disabled.
+    ELLE_ATTRIBUTE_R(std::unique_ptr<ReadAhead>, read_ahead);
   };
 }
 
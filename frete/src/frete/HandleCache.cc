@@ -0,0 +1,123 @@
+#ifndef INFINIT_WINDOWS
+# include <sys/resource.h>
+#endif
+
+#include <algorithm>
+
+#include <boost/lexical_cast.hpp>
+
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+
+#include <frete/HandleCache.hh>
+
+ELLE_LOG_COMPONENT("frete.HandleCache");
+
+namespace frete
+{
+  /*-------------.
+  | Construction |
+  `-------------*/
+
+  HandleCache::HandleCache(unsigned int capacity)
+    : _capacity(std::max(capacity, 1u))
+    , _hits(0)
+    , _opened(0)
+    , _evicted(0)
+    , _entries()
+    , _index()
+  {
+    ELLE_TRACE("%s: construct", *this);
+  }
+
+  unsigned int
+  HandleCache::default_capacity()
+  {
+    std::string max = elle::os::getenv("INFINIT_FRETE_MAX_OPEN_FILES", "");
+    if (!max.empty())
+      return boost::lexical_cast<unsigned int>(max);
+#ifdef INFINIT_WINDOWS
+    // The C runtime defaults to 512 descriptors.
+    return 128;
+#else
+    struct rlimit limit;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) != 0 ||
+        limit.rlim_cur == RLIM_INFINITY)
+      return 1024;
+    // Keep three quarters of the descriptors for sockets, snapshots and the
+    // receiving side.
+    return std::max<unsigned int>(
+      16, std::min<rlim_t>(limit.rlim_cur / 4, 1024));
+#endif
+  }
+
+  /*------.
+  | Cache |
+  `------*/
+
+  HandleCache::Handle
+  HandleCache::open(boost::filesystem::path const& path)
+  {
+    auto key = path.string();
+    auto it = this->_index.find(key);
+    if (it != this->_index.end())
+    {
+      ++this->_hits;
+      // Move to the front without invalidating iterators.
+      this->_entries.splice(this->_entries.begin(),
+                            this->_entries, it->second);
+      return it->second->second;
+    }
+    ELLE_DEBUG("%s: open %s", *this, path);
+    auto handle = std::make_shared<elle::system::FileHandle>(
+      path, elle::system::FileHandle::READ);
+    ++this->_opened;
+    if (this->_entries.size() >= this->_capacity)
+    {
+      auto& last = this->_entries.back();
+      ELLE_DEBUG("%s: evict %s", *this, last.first);
+      this->_index.erase(last.first);
+      this->_entries.pop_back();
+      ++this->_evicted;
+    }
+    this->_entries.emplace_front(key, handle);
+    this->_index[key] = this->_entries.begin();
+    return handle;
+  }
+
+  void
+  HandleCache::close(boost::filesystem::path const& path)
+  {
+    auto it = this->_index.find(path.string());
+    if (it == this->_index.end())
+      return;
+    this->_entries.erase(it->second);
+    this->_index.erase(it);
+  }
+
+  void
+  HandleCache::clear()
+  {
+    this->_entries.clear();
+    this->_index.clear();
+  }
+
+  unsigned int
+  HandleCache::size() const
+  {
+    return this->_index.size();
+  }
+
+  /*----------.
+  | Printable |
+  `----------*/
+
+  void
+  HandleCache::print(std::ostream& stream) const
+  {
+    elle::fprintf(stream,
+                  "HandleCache(%s/%s, %s hits, %s opened, %s evicted)",
+                  this->_index.size(), this->_capacity,
+                  this->_hits, this->_opened, this->_evicted);
+  }
+}
@@ -0,0 +1,84 @@
+#ifndef FRETE_HANDLE_CACHE_HH
+# define FRETE_HANDLE_CACHE_HH
+
+# include <list>
+# include <memory>
+# include <unordered_map>
+
+# include <boost/filesystem/path.hpp>
+
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+# include <elle/system/system.hh>
+
+namespace frete
+{
+  /// A bounded cache of read handles, evicting the least recently used one.
+  ///
+  /// Handles are indexed by path so that a single cache can be shared by
+  /// every transfer of a process. Both lookups and evictions are constant
+  /// time. Evicted handles are closed once their last user releases them.
+  class HandleCache:
+    public elle::Printable
+  {
+  /*------.
+  | Types |
+  `------*/
+  public:
+    typedef HandleCache Self;
+    typedef std::shared_ptr<elle::system::FileHandle> Handle;
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+  public:
+    /// Keep at most capacity handles open.
+    HandleCache(unsigned int capacity = default_capacity());
+    HandleCache(HandleCache const&) = delete;
+    /// A capacity leaving room for sockets and other descriptors, derived
+    /// from the process file descriptor limit. INFINIT_FRETE_MAX_OPEN_FILES
+    /// overrides it.
+    static
+    unsigned int
+    default_capacity();
+    ELLE_ATTRIBUTE_R(unsigned int, capacity);
+
+  /*------.
+  | Cache |
+  `------*/
+  public:
+    /// The handle on path, opened if needed.
+    Handle
+    open(boost::filesystem::path const& path);
+    /// Close the handle on path, if any.
+    void
+    close(boost::filesystem::path const& path);
+    /// Close every handle.
+    void
+    clear();
+    /// Number of handles currently cached.
+    unsigned int
+    size() const;
+    /// Number of lookups served from the cache.
+    ELLE_ATTRIBUTE_R(uint64_t, hits);
+    /// Number of files opened.
+    ELLE_ATTRIBUTE_R(uint64_t, opened);
+    /// Number of handles evicted to honor the capacity.
+    ELLE_ATTRIBUTE_R(uint64_t, evicted);
+  private:
+    typedef std::pair<std::string, Handle> Entry;
+    typedef std::list<Entry> Entries;
+    /// Most recently used first.
+    ELLE_ATTRIBUTE(Entries, entries);
+    ELLE_ATTRIBUTE((std::unordered_map<std::string, Entries::iterator>), index);
+
+  /*----------.
+  | Printable |
+  `----------*/
+  public:
+    void
+    print(std::ostream& stream) const override;
+  };
+}
+
+#endif
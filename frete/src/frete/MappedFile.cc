@@ -0,0 +1,148 @@
+#ifndef INFINIT_WINDOWS
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <boost/filesystem.hpp>
+
+#include <elle/Error.hh>
+#include <elle/log.hh>
+#include <elle/memory.hh>
+
+#include <frete/MappedFile.hh>
+
+ELLE_LOG_COMPONENT("frete.MappedFile");
+
+namespace frete
+{
+#ifndef INFINIT_WINDOWS
+  static
+  boost::filesystem::filesystem_error
+  mapping_error(std::string const& what, boost::filesystem::path const& path)
+  {
+    return boost::filesystem::filesystem_error(
+      what, path,
+      boost::system::error_code(errno, boost::system::system_category()));
+  }
+#endif
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+
+  MappedFile::MappedFile(boost::filesystem::path const& path)
+    : _path(path)
+    , _size(0)
+    , _fd(-1)
+  {
+    ELLE_TRACE_SCOPE("%s: open", *this);
+#ifdef INFINIT_WINDOWS
+    throw elle::Exception("memory mapped files are not supported");
+#else
+    this->_fd = ::open(path.string().c_str(), O_RDONLY);
+    if (this->_fd < 0)
+      throw mapping_error("unable to open file", path);
+    struct stat st;
+    if (::fstat(this->_fd, &st) != 0)
+    {
+      auto error = mapping_error("unable to stat file", path);
+      ::close(this->_fd);
+      throw error;
+    }
+    this->_size = st.st_size;
+#endif
+  }
+
+  MappedFile::~MappedFile()
+  {
+#ifndef INFINIT_WINDOWS
+    if (this->_fd >= 0)
+      ::close(this->_fd);
+#endif
+  }
+
+  bool
+  MappedFile::supported()
+  {
+#ifdef INFINIT_WINDOWS
+    return false;
+#else
+    return true;
+#endif
+  }
+
+  /*-------.
+  | Access |
+  `-------*/
+
+  MappedFile::Window::Window(void* data,
+                             std::size_t length,
+                             elle::ConstWeakBuffer view)
+    : _view(view)
+    , _data(data)
+    , _length(length)
+  {}
+
+  MappedFile::Window::~Window()
+  {
+#ifndef INFINIT_WINDOWS
+    if (this->_data)
+      ::munmap(this->_data, this->_length);
+#endif
+  }
+
+  std::unique_ptr<MappedFile::Window>
+  MappedFile::map(FileOffset offset, FileSize size) const
+  {
+#ifdef INFINIT_WINDOWS
+    return nullptr;
+#else
+    if (offset >= this->_size)
+      return elle::make_unique<Window>(nullptr, 0, elle::ConstWeakBuffer());
+    size = std::min(size, this->_size - offset);
+    // Pages past the end of a truncated file fault when touched.
+    struct stat st;
+    if (::fstat(this->_fd, &st) != 0)
+      return nullptr;
+    if (static_cast<FileSize>(st.st_size) < this->_size)
+    {
+      ELLE_DEBUG("%s: file shrank to %s bytes, don't map it",
+                 *this, st.st_size);
+      return nullptr;
+    }
+    // Mappings start on a page boundary.
+    static FileOffset const page = ::sysconf(_SC_PAGESIZE);
+    FileOffset start = offset - offset % page;
+    std::size_t length = offset - start + size;
+    void* data = ::mmap(nullptr, length, PROT_READ, MAP_SHARED,
+                        this->_fd, start);
+    if (data == MAP_FAILED)
+    {
+      ELLE_WARN("%s: unable to map %s bytes at %s: %s",
+                *this, length, start, ::strerror(errno));
+      return nullptr;
+    }
+    ::madvise(data, length, MADV_SEQUENTIAL);
+    return elle::make_unique<Window>(
+      data, length,
+      elle::ConstWeakBuffer(
+        static_cast<unsigned char const*>(data) + (offset - start), size));
+#endif
+  }
+
+  /*----------.
+  | Printable |
+  `----------*/
+
+  void
+  MappedFile::print(std::ostream& stream) const
+  {
+    elle::fprintf(stream, "MappedFile(%s, %s bytes)", this->_path, this->_size);
+  }
+}
@@ -0,0 +1,78 @@
+#ifndef FRETE_MAPPED_FILE_HH
+# define FRETE_MAPPED_FILE_HH
+
+# include <memory>
+
+# include <boost/filesystem/path.hpp>
+
+# include <elle/Buffer.hh>
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+
+# include <frete/Frete.hh>
+
+namespace frete
+{
+  /// A file read through read only memory mappings of the windows read.
+  class MappedFile:
+    public elle::Printable
+  {
+  /*------.
+  | Types |
+  `------*/
+  public:
+    typedef MappedFile Self;
+    typedef Frete::FileOffset FileOffset;
+    typedef Frete::FileSize FileSize;
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+  public:
+    MappedFile(boost::filesystem::path const& path);
+    MappedFile(MappedFile const&) = delete;
+    ~MappedFile();
+    /// Whether memory mapping is available on this platform.
+    static
+    bool
+    supported();
+    ELLE_ATTRIBUTE_R(boost::filesystem::path, path);
+    /// The size of the file when it was opened.
+    ELLE_ATTRIBUTE_R(FileSize, size);
+  private:
+    ELLE_ATTRIBUTE(int, fd);
+
+  /*-------.
+  | Access |
+  `-------*/
+  public:
+    /// A mapped window of the file, unmapped on destruction.
+    class Window
+    {
+    public:
+      Window(void* data, std::size_t length, elle::ConstWeakBuffer view);
+      Window(Window const&) = delete;
+      ~Window();
+      /// The bytes requested.
+      ELLE_ATTRIBUTE_R(elle::ConstWeakBuffer, view);
+    private:
+      ELLE_ATTRIBUTE(void*, data);
+      ELLE_ATTRIBUTE(std::size_t, length);
+    };
+    /// Map the bytes in [offset, offset + size), truncated at the end of
+    /// the file. Null if the file shrank since it was opened, as touching
+    /// pages past its end would fault, or if mapping failed: read it
+    /// otherwise then.
+    std::unique_ptr<Window>
+    map(FileOffset offset, FileSize size) const;
+
+  /*----------.
+  | Printable |
+  `----------*/
+  public:
+    void
+    print(std::ostream& stream) const override;
+  };
+}
+
+#endif
@@ -25,7 +25,14 @@ namespace frete
     _rpc_finish("finish", this->_rpc),
     _rpc_files_info("files_info", this->_rpc),
     _rpc_encrypted_read_acknowledge("encrypted_read_acknowledge", this->_rpc),
-    _rpc_transfer_info("transfer_info", this->_rpc)
+    _rpc_transfer_info("transfer_info", this->_rpc),
+    _rpc_encrypted_read_range("encrypted_read_range", this->_rpc),
+    _rpc_encrypted_read_files("encrypted_read_files", this->_rpc),
+    _rpc_encrypted_file_hashes("encrypted_file_hashes", this->_rpc),
+    _rpc_encrypted_file_checksums("encrypted_file_checksums", this->_rpc),
+    _rpc_encrypted_sent_checksums("encrypted_sent_checksums", this->_rpc),
+    _rpc_encrypted_file_holes("encrypted_file_holes", this->_rpc),
+    _rpc_files_info_page("files_info_page", this->_rpc)
   {
     this->_rpc_count = std::bind(&Frete::count,
                                  &frete);
@@ -76,6 +83,37 @@ namespace frete
                                                      std::placeholders::_4
                                                      );
     this->_rpc_transfer_info = std::bind(&Frete::transfer_info, &frete);
+    this->_rpc_encrypted_read_range = std::bind(&Frete::encrypted_read_range,
+                                                &frete,
+                                                std::placeholders::_1,
+                                                std::placeholders::_2,
+                                                std::placeholders::_3,
+                                                std::placeholders::_4);
+    this->_rpc_encrypted_read_files = std::bind(&Frete::encrypted_read_files,
+                                                &frete,
+                                                std::placeholders::_1,
+                                                std::placeholders::_2,
+                                                std::placeholders::_3);
+    this->_rpc_encrypted_file_hashes = std::bind(&Frete::encrypted_file_hashes,
+                                                 &frete,
+                                                 std::placeholders::_1);
+    this->_rpc_encrypted_file_checksums =
+      std::bind(&Frete::encrypted_file_checksums,
+                &frete,
+                std::placeholders::_1,
+                std::placeholders::_2);
+    this->_rpc_encrypted_sent_checksums =
+      std::bind(&Frete::encrypted_sent_checksums,
+                &frete,
+                std::placeholders::_1);
+    this->_rpc_encrypted_file_holes =
+      std::bind(&Frete::encrypted_file_holes,
+                &frete,
+                std::placeholders::_1);
+    this->_rpc_files_info_page = std::bind(&Frete::files_info_page,
+                                           &frete,
+                                           std::placeholders::_1,
+                                           std::placeholders::_2);
   }
 
   RPCFrete::RPCFrete(infinit::protocol::ChanneledStream& channels):
@@ -92,7 +130,14 @@ namespace frete
     _rpc_finish("finish", this->_rpc),
     _rpc_files_info("files_info", this->_rpc),
     _rpc_encrypted_read_acknowledge("encrypted_read_acknowledge", this->_rpc),
-    _rpc_transfer_info("transfer_info", this->_rpc)
+    _rpc_transfer_info("transfer_info", this->_rpc),
+    _rpc_encrypted_read_range("encrypted_read_range", this->_rpc),
+    _rpc_encrypted_read_files("encrypted_read_files", this->_rpc),
+    _rpc_encrypted_file_hashes("encrypted_file_hashes", this->_rpc),
+    _rpc_encrypted_file_checksums("encrypted_file_checksums", this->_rpc),
+    _rpc_encrypted_sent_checksums("encrypted_sent_checksums", this->_rpc),
+    _rpc_encrypted_file_holes("encrypted_file_holes", this->_rpc),
+    _rpc_files_info_page("files_info_page", this->_rpc)
   {
     this->_rpc_version = []
       {
@@ -45,6 +45,9 @@ namespace frete
     typedef RPC::RemoteProcedure<Frete::FileSize> FullSizeRPC;
     typedef RPC::RemoteProcedure<Frete::FileSize, Frete::FileID> FileSizeRPC;
     typedef RPC::RemoteProcedure<std::vector<std::pair<std::string, Frete::FileSize>>> FilesInfoRPC;
+    typedef RPC::RemoteProcedure<std::vector<std::pair<std::string, Frete::FileSize>>,
+                                 Frete::FileID,
+                                 Frete::FileCount> FilesInfoPageRPC;
     typedef RPC::RemoteProcedure<std::string, Frete::FileID> FilePathRPC;
     typedef RPC::RemoteProcedure<infinit::cryptography::Code,
                                  Frete::FileID,
@@ -61,6 +64,27 @@ namespace frete
                                  Frete::FileSize,
                                  Frete::FileSize> EncryptedReadAcknowledgeRPC;
     typedef RPC::RemoteProcedure<Frete::TransferInfo> TransferInfoRPC;
+    typedef RPC::RemoteProcedure<std::vector<infinit::cryptography::Code>,
+                                 Frete::Positions,
+                                 Frete::FileSize,
+                                 Frete::FileSize,
+                                 bool> EncryptedReadRangeRPC;
+    typedef RPC::RemoteProcedure<infinit::cryptography::Code,
+                                 std::vector<Frete::FileID>,
+                                 Frete::FileSize,
+                                 bool> EncryptedReadFilesRPC;
+    typedef RPC::RemoteProcedure<infinit::cryptography::Code,
+                                 std::vector<Frete::FileID>>
+      EncryptedFileHashesRPC;
+    typedef RPC::RemoteProcedure<infinit::cryptography::Code,
+                                 Frete::FileID,
+                                 Frete::FileSize> EncryptedFileChecksumsRPC;
+    typedef RPC::RemoteProcedure<infinit::cryptography::Code,
+                                 std::vector<Frete::FileID>>
+      EncryptedSentChecksumsRPC;
+    typedef RPC::RemoteProcedure<infinit::cryptography::Code,
+                                 std::vector<Frete::FileID>>
+      EncryptedFileHolesRPC;
   /*-------------.
   | Construction |
   `-------------*/
@@ -97,6 +121,13 @@ namespace frete
     RPC_WRAPPER(FilesInfoRPC, files_info);
     RPC_WRAPPER(EncryptedReadAcknowledgeRPC, encrypted_read_acknowledge);
     RPC_WRAPPER(TransferInfoRPC, transfer_info);
+    RPC_WRAPPER(EncryptedReadRangeRPC, encrypted_read_range);
+    RPC_WRAPPER(EncryptedReadFilesRPC, encrypted_read_files);
+    RPC_WRAPPER(EncryptedFileHashesRPC, encrypted_file_hashes);
+    RPC_WRAPPER(EncryptedFileChecksumsRPC, encrypted_file_checksums);
+    RPC_WRAPPER(EncryptedSentChecksumsRPC, encrypted_sent_checksums);
+    RPC_WRAPPER(EncryptedFileHolesRPC, encrypted_file_holes);
+    RPC_WRAPPER(FilesInfoPageRPC, files_info_page);
   };
 }
 
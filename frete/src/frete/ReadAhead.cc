@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+
+#include <elle/finally.hh>
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+
+#include <reactor/scheduler.hh>
+
+#include <frete/ReadAhead.hh>
+#include <frete/TransferSnapshot.hh>
+
+ELLE_LOG_COMPONENT("frete.ReadAhead");
+
+namespace frete
+{
+  /*-------------.
+  | Construction |
+  `-------------*/
+
+  ReadAhead::ReadAhead(TransferSnapshot const& snapshot,
+                       PathResolver path,
+                       int depth,
+                       FileSize capacity)
+    : _depth(depth)
+    , _capacity(capacity)
+    , _snapshot(snapshot)
+    , _path(std::move(path))
+    , _hits(0)
+    , _misses(0)
+    , _idle("read ahead idle")
+    , _pool()
+    , _pool_size(0)
+    , _wanted()
+    , _loading()
+    , _wake("read ahead wake")
+    , _loaded("read ahead loaded")
+    , _handle_file(-1)
+    , _handle()
+    , _thread()
+  {
+    this->_idle.open();
+  }
+
+  ReadAhead::~ReadAhead()
+  {
+    if (this->_thread)
+      this->_thread->terminate_now();
+  }
+
+  int
+  ReadAhead::default_depth()
+  {
+    std::string depth = elle::os::getenv("INFINIT_FRETE_READ_AHEAD", "");
+    if (!depth.empty())
+      return boost::lexical_cast<int>(depth);
+    else
+      return 4;
+  }
+
+  /*-----.
+  | Read |
+  `-----*/
+
+  boost::optional<elle::Buffer>
+  ReadAhead::fetch(FileID file, FileOffset offset, FileSize size)
+  {
+    if (this->_thread == nullptr)
+      this->_thread.reset(
+        new reactor::Thread(
+          *reactor::Scheduler::scheduler(),
+          "read ahead",
+          [this]
+          {
+            this->_prefetch();
+          }));
+    Position position(file, offset);
+    // The window is being read right now, it will be cheaper to wait for it.
+    while (this->_loading && this->_loading.get() == position)
+      reactor::wait(this->_loaded);
+    boost::optional<elle::Buffer> res;
+    auto it = this->_pool.find(position);
+    if (it != this->_pool.end())
+    {
+      this->_pool_size -= it->second.buffer.size();
+      if (it->second.size == size)
+        res = std::move(it->second.buffer);
+      this->_pool.erase(it);
+    }
+    this->_wanted.erase(position);
+    if (res)
+    {
+      ++this->_hits;
+      ELLE_DEBUG("%s: hit on %s/%s", *this, file, offset);
+    }
+    else
+    {
+      ++this->_misses;
+      ELLE_DEBUG("%s: miss on %s/%s", *this, file, offset);
+    }
+    if (size != 0)
+      this->_schedule(file, offset + size, size);
+    return res;
+  }
+
+  void
+  ReadAhead::clear()
+  {
+    ELLE_TRACE("%s: clear %s prefetched chunks", *this, this->_pool.size());
+    this->_pool.clear();
+    this->_pool_size = 0;
+    this->_wanted.clear();
+    this->_idle.open();
+  }
+
+  void
+  ReadAhead::_schedule(FileID file, FileOffset offset, FileSize size)
+  {
+    Position current(file, offset);
+    this->_wanted.erase(this->_wanted.begin(),
+                        this->_wanted.lower_bound(current));
+    // The windows the reader will request next, following the snapshot order.
+    std::vector<Position> windows;
+    for (int i = 0; i < this->_depth; ++i)
+    {
+      // Skip to the next non empty file.
+      while (file < this->_snapshot.count() &&
+             offset >= this->_snapshot.file(file).size())
+      {
+        ++file;
+        offset = 0;
+      }
+      if (file >= this->_snapshot.count())
+        break;
+      // Archives are generated as they are read, there's nothing to load.
+      if (this->_snapshot.file(file).archive())
+        break;
+      windows.emplace_back(file, offset);
+      offset += size;
+    }
+    // Make room by evicting the windows farthest from the reader, behind or
+    // ahead of it, so a backward seek does not stall prefetching.
+    if (this->_pool_size >= this->_capacity)
+    {
+      auto distance = [&] (Position const& p)
+        {
+          auto diff = [] (uint64_t a, uint64_t b)
+            {
+              return a < b ? b - a : a - b;
+            };
+          return std::make_pair(diff(p.first, current.first),
+                                diff(p.second, current.second));
+        };
+      std::vector<Position> candidates;
+      for (auto const& chunk: this->_pool)
+        if (std::find(windows.begin(), windows.end(), chunk.first) ==
+            windows.end())
+          candidates.push_back(chunk.first);
+      std::sort(candidates.begin(), candidates.end(),
+                [&] (Position const& a, Position const& b)
+                {
+                  return distance(a) > distance(b);
+                });
+      for (auto const& position: candidates)
+      {
+        if (this->_pool_size < this->_capacity)
+          break;
+        auto it = this->_pool.find(position);
+        this->_pool_size -= it->second.buffer.size();
+        this->_pool.erase(it);
+      }
+    }
+    for (auto const& position: windows)
+      if (this->_pool.find(position) == this->_pool.end() &&
+          !(this->_loading && this->_loading.get() == position))
+        this->_wanted.emplace(position, size);
+    // Evictions may also have made room for windows still pending.
+    if (!this->_wanted.empty() && this->_pool_size < this->_capacity)
+    {
+      this->_idle.close();
+      this->_wake.signal();
+    }
+  }
+
+  void
+  ReadAhead::_prefetch()
+  {
+    while (true)
+    {
+      if (this->_wanted.empty() || this->_pool_size >= this->_capacity)
+      {
+        this->_idle.open();
+        reactor::wait(this->_wake);
+        continue;
+      }
+      this->_idle.close();
+      auto it = this->_wanted.begin();
+      Position position = it->first;
+      FileSize size = it->second;
+      this->_wanted.erase(it);
+      this->_loading = position;
+      elle::SafeFinally loaded([this]
+        {
+          this->_loading.reset();
+          this->_loaded.signal();
+        });
+      try
+      {
+        auto& handle = this->_open(position.first);
+        elle::Buffer buffer;
+        ELLE_DUMP("%s: prefetch %s/%s", *this, position.first, position.second)
+          reactor::background(
+            [&]
+            {
+              buffer = handle.read(position.second, size);
+            });
+        this->_pool_size += buffer.size();
+        this->_pool[position] = Chunk{size, std::move(buffer)};
+      }
+      catch (reactor::Terminate const&)
+      {
+        throw;
+      }
+      catch (std::exception const&)
+      {
+        // The reader will hit the same error and report it properly.
+        ELLE_TRACE("%s: unable to prefetch %s/%s: %s",
+                   *this, position.first, position.second,
+                   elle::exception_string());
+        this->_handle.reset();
+        this->_handle_file = FileID(-1);
+      }
+    }
+  }
+
+  elle::system::FileHandle&
+  ReadAhead::_open(FileID file)
+  {
+    if (this->_handle == nullptr || this->_handle_file != file)
+    {
+      this->_handle.reset();
+      this->_handle = elle::make_unique<elle::system::FileHandle>(
+        this->_path(file), elle::system::FileHandle::READ);
+      this->_handle_file = file;
+    }
+    return *this->_handle;
+  }
+
+  /*----------.
+  | Printable |
+  `----------*/
+
+  void
+  ReadAhead::print(std::ostream& stream) const
+  {
+    elle::fprintf(stream, "ReadAhead(%s hits, %s misses)",
+                  this->_hits, this->_misses);
+  }
+}
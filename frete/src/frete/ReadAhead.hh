@@ -0,0 +1,114 @@
+#ifndef FRETE_READ_AHEAD_HH
+# define FRETE_READ_AHEAD_HH
+
+# include <functional>
+# include <map>
+# include <memory>
+
+# include <boost/filesystem/path.hpp>
+# include <boost/optional.hpp>
+
+# include <elle/Buffer.hh>
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+# include <elle/system/system.hh>
+
+# include <reactor/Barrier.hh>
+# include <reactor/signal.hh>
+# include <reactor/thread.hh>
+
+# include <frete/Frete.hh>
+# include <frete/fwd.hh>
+
+namespace frete
+{
+  /// Prefetch the chunks a sequential reader is about to request.
+  ///
+  /// Every chunk served schedules the following windows of the same size, in
+  /// the file order of the TransferSnapshot. Windows are read off the reactor
+  /// thread and kept in a bounded pool until they are requested.
+  class ReadAhead:
+    public elle::Printable
+  {
+  /*------.
+  | Types |
+  `------*/
+  public:
+    typedef ReadAhead Self;
+    typedef Frete::FileID FileID;
+    typedef Frete::FileOffset FileOffset;
+    typedef Frete::FileSize FileSize;
+    typedef Frete::Position Position;
+    /// Resolve the local path of a file.
+    typedef std::function<boost::filesystem::path (FileID)> PathResolver;
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+  public:
+    /// Prefetch up to depth windows, keeping at most capacity bytes.
+    ReadAhead(TransferSnapshot const& snapshot,
+              PathResolver path,
+              int depth,
+              FileSize capacity);
+    ~ReadAhead();
+    /// Number of windows to prefetch, from INFINIT_FRETE_READ_AHEAD.
+    static
+    int
+    default_depth();
+    ELLE_ATTRIBUTE_R(int, depth);
+    ELLE_ATTRIBUTE_R(FileSize, capacity);
+  private:
+    ELLE_ATTRIBUTE(TransferSnapshot const&, snapshot);
+    ELLE_ATTRIBUTE(PathResolver, path);
+
+  /*-----.
+  | Read |
+  `-----*/
+  public:
+    /// Take a prefetched chunk and schedule the following ones.
+    /// Return none if the chunk was not prefetched.
+    boost::optional<elle::Buffer>
+    fetch(FileID file, FileOffset offset, FileSize size);
+    /// Drop every prefetched chunk.
+    void
+    clear();
+    /// Requests served from the pool.
+    ELLE_ATTRIBUTE_R(uint64_t, hits);
+    /// Requests that had to read from disk.
+    ELLE_ATTRIBUTE_R(uint64_t, misses);
+    /// Opened when no window is left to prefetch, or the pool is full.
+    ELLE_ATTRIBUTE_RX(reactor::Barrier, idle);
+  private:
+    void
+    _schedule(FileID file, FileOffset offset, FileSize size);
+    void
+    _prefetch();
+    elle::system::FileHandle&
+    _open(FileID file);
+    struct Chunk
+    {
+      FileSize size;
+      elle::Buffer buffer;
+    };
+    typedef std::map<Position, Chunk> Pool;
+    ELLE_ATTRIBUTE(Pool, pool);
+    ELLE_ATTRIBUTE(FileSize, pool_size);
+    ELLE_ATTRIBUTE((std::map<Position, FileSize>), wanted);
+    ELLE_ATTRIBUTE(boost::optional<Position>, loading);
+    ELLE_ATTRIBUTE(reactor::Signal, wake);
+    ELLE_ATTRIBUTE(reactor::Signal, loaded);
+    ELLE_ATTRIBUTE(FileID, handle_file);
+    ELLE_ATTRIBUTE(std::unique_ptr<elle::system::FileHandle>, handle);
+    ELLE_ATTRIBUTE(std::unique_ptr<reactor::Thread>, thread);
+
+  /*----------.
+  | Printable |
+  `----------*/
+  public:
+    void
+    print(std::ostream& stream) const override;
+  };
+}
+
+#endif
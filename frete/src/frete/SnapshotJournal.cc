@@ -0,0 +1,319 @@
+#ifdef INFINIT_WINDOWS
+# include <io.h>
+#else
+# include <unistd.h>
+#endif
+
+#include <cerrno>
+
+#include <zlib.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <elle/AtomicFile.hh>
+#include <elle/Error.hh>
+#include <elle/finally.hh>
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+#include <elle/serialization/json/SerializerIn.hh>
+#include <elle/serialization/json/SerializerOut.hh>
+
+#include <reactor/scheduler.hh>
+
+#include <frete/Encoding.hh>
+#include <frete/SnapshotJournal.hh>
+
+ELLE_LOG_COMPONENT("frete.SnapshotJournal");
+
+namespace frete
+{
+  /* A record is, little endian: the file id (4 bytes), its progress (8
+   * bytes), the checksums of its last two blocks (2 * 4 bytes) and the
+   * CRC32 of all that (4 bytes). Chunks received out of order are flagged
+   * in the file id, followed by their offset and size.
+   */
+  static std::size_t const record_size = 24;
+  static uint32_t const chunk_flag = 1u << 31;
+
+  static
+  boost::filesystem::filesystem_error
+  journal_error(std::string const& what, boost::filesystem::path const& path)
+  {
+    return boost::filesystem::filesystem_error(
+      what, path,
+      boost::system::error_code(errno, boost::system::system_category()));
+  }
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+
+  SnapshotJournal::SnapshotJournal(
+    boost::filesystem::path const& path,
+    Sync sync,
+    boost::posix_time::time_duration sync_period,
+    int compaction_records)
+    : _path(path)
+    , _journal_path(path.string() + ".journal")
+    , _sync(sync)
+    , _sync_period(sync_period)
+    , _compaction_records(compaction_records)
+    , _records(0)
+    , _compactions(0)
+    , _syncs(0)
+    , _journal(nullptr)
+    , _synced(boost::posix_time::microsec_clock::universal_time())
+    , _syncing(false)
+  {}
+
+  SnapshotJournal::~SnapshotJournal()
+  {
+    this->_close();
+  }
+
+  SnapshotJournal::Sync
+  SnapshotJournal::default_sync()
+  {
+    std::string sync = elle::os::getenv("INFINIT_SNAPSHOT_SYNC", "");
+    if (sync == "always")
+      return Sync::always;
+    else if (sync == "never")
+      return Sync::never;
+    else
+      return Sync::periodic;
+  }
+
+  boost::posix_time::time_duration
+  SnapshotJournal::default_sync_period()
+  {
+    std::string sync = elle::os::getenv("INFINIT_SNAPSHOT_SYNC", "");
+    if (default_sync() == Sync::periodic && !sync.empty())
+      return boost::posix_time::milliseconds(
+        boost::lexical_cast<int>(sync));
+    else
+      return boost::posix_time::seconds(1);
+  }
+
+  int
+  SnapshotJournal::default_compaction_records()
+  {
+    std::string records = elle::os::getenv("INFINIT_SNAPSHOT_COMPACTION", "");
+    if (!records.empty())
+      return std::max(1, boost::lexical_cast<int>(records));
+    else
+      return 4096;
+  }
+
+  /*--------.
+  | Storage |
+  `--------*/
+
+  std::unique_ptr<TransferSnapshot>
+  SnapshotJournal::load()
+  {
+    if (!boost::filesystem::exists(this->_path))
+      return nullptr;
+    std::unique_ptr<TransferSnapshot> res;
+    elle::AtomicFile file(this->_path);
+    file.read() << [&] (elle::AtomicFile::Read& read)
+    {
+      elle::serialization::json::SerializerIn input(read.stream(), false);
+      res.reset(new TransferSnapshot(input));
+    };
+    boost::filesystem::ifstream input(this->_journal_path, std::ios::binary);
+    if (!input.good())
+      return res;
+    int replayed = 0;
+    unsigned char record[record_size];
+    while (input.read(reinterpret_cast<char*>(record), record_size))
+    {
+      elle::ConstWeakBuffer data(record, record_size);
+      std::size_t position = 0;
+      auto get = [&] (int bytes)
+        {
+          return encoding::get_uint64(
+            data, position, bytes, encoding::Order::little);
+        };
+      auto file = get(4);
+      auto value = get(8);
+      auto first = get(4);
+      auto second = get(4);
+      if (get(4) != ::crc32(0, record, 20))
+      {
+        ELLE_WARN("%s: drop corrupted record %s", *this, replayed);
+        break;
+      }
+      FileID file_id = file & ~chunk_flag;
+      bool chunk = file & chunk_flag;
+      if (!res->has(file_id) ||
+          (chunk && res->file(file_id).chunk_size() == 0))
+      {
+        ELLE_WARN("%s: drop record %s of unknown file %s",
+                  *this, replayed, file_id);
+        break;
+      }
+      if (chunk)
+        res->file_chunk_received(file_id, value, first);
+      else
+        res->file_progress_restore(file_id, value, first, second);
+      ++replayed;
+    }
+    input.close();
+    ELLE_TRACE("%s: replayed %s records", *this, replayed);
+    // Fold the journal in the base right away, so that records are appended
+    // after valid ones only.
+    this->save(*res);
+    return res;
+  }
+
+  void
+  SnapshotJournal::save(TransferSnapshot& snapshot)
+  {
+    ELLE_DEBUG_SCOPE("%s: save %s", *this, snapshot);
+    // Empty the journal first: should we crash before the base is written,
+    // the previous one only lacks progress, which is safe.
+    this->_close();
+    boost::filesystem::remove(this->_journal_path);
+    this->_records = 0;
+    elle::AtomicFile file(this->_path.string());
+    file.write() << [&] (elle::AtomicFile::Write& write)
+    {
+      elle::serialization::json::SerializerOut output(write.stream(), false);
+      snapshot.serialize(output);
+    };
+  }
+
+  void
+  SnapshotJournal::progress(TransferSnapshot& snapshot, FileID file_id)
+  {
+    auto const& file = snapshot.file(file_id);
+    auto const& checksums = file.checksums();
+    this->_append(
+      snapshot, file_id, file.progress(),
+      checksums.size() < 2 ? 0 : checksums[checksums.size() - 2],
+      checksums.empty() ? 0 : checksums.back());
+  }
+
+  void
+  SnapshotJournal::chunk(TransferSnapshot& snapshot,
+                         FileID file_id,
+                         Frete::FileOffset offset,
+                         Frete::FileSize size)
+  {
+    this->_append(snapshot, file_id | chunk_flag, offset, size, 0);
+  }
+
+  void
+  SnapshotJournal::_append(TransferSnapshot& snapshot,
+                           uint32_t file,
+                           uint64_t value,
+                           uint32_t first,
+                           uint32_t second)
+  {
+    if (this->_records >= this->_compaction_records)
+    {
+      ELLE_TRACE("%s: compact %s records", *this, this->_records);
+      ++this->_compactions;
+      this->save(snapshot);
+      return;
+    }
+    elle::Buffer record;
+    auto put = [&] (uint64_t value, int bytes)
+      {
+        encoding::put_uint64(record, value, bytes, encoding::Order::little);
+      };
+    put(file, 4);
+    put(value, 8);
+    put(first, 4);
+    put(second, 4);
+    put(::crc32(0, record.contents(), 20), 4);
+    if (!this->_journal)
+    {
+      this->_journal = std::fopen(this->_journal_path.string().c_str(), "ab");
+      if (!this->_journal)
+        throw journal_error("unable to open journal", this->_journal_path);
+    }
+    // Flush every record, so only a system crash can lose them.
+    if (std::fwrite(record.contents(), record_size, 1, this->_journal) != 1 ||
+        std::fflush(this->_journal) != 0)
+      throw journal_error("unable to write journal", this->_journal_path);
+    ++this->_records;
+    auto now = boost::posix_time::microsec_clock::universal_time();
+    if (this->_sync == Sync::always ||
+        (this->_sync == Sync::periodic &&
+         now - this->_synced >= this->_sync_period))
+      this->_sync();
+  }
+
+  void
+  SnapshotJournal::remove()
+  {
+    ELLE_TRACE_SCOPE("%s: remove", *this);
+    this->_close();
+    this->_records = 0;
+    boost::filesystem::remove(this->_journal_path);
+    boost::filesystem::remove(this->_path);
+  }
+
+  void
+  SnapshotJournal::_close()
+  {
+    if (this->_journal)
+    {
+      std::fclose(this->_journal);
+      this->_journal = nullptr;
+    }
+  }
+
+  void
+  SnapshotJournal::_sync()
+  {
+    if (this->_syncing)
+      return;
+    ELLE_DUMP("%s: sync", *this);
+    // Sync a duplicate of the descriptor: other appends run meanwhile, and
+    // may close the journal on compaction.
+#ifdef INFINIT_WINDOWS
+    int fd = ::_dup(_fileno(this->_journal));
+#else
+    int fd = ::dup(fileno(this->_journal));
+#endif
+    if (fd < 0)
+      throw journal_error("unable to sync journal", this->_journal_path);
+    this->_syncing = true;
+    elle::SafeFinally synced([this] { this->_syncing = false; });
+    int error = 0;
+    reactor::background(
+      [fd, &error]
+      {
+#ifdef INFINIT_WINDOWS
+        if (::_commit(fd) != 0)
+          error = errno;
+        ::_close(fd);
+#else
+        if (::fsync(fd) != 0)
+          error = errno;
+        ::close(fd);
+#endif
+      });
+    if (error != 0)
+      throw boost::filesystem::filesystem_error(
+        "unable to sync journal", this->_journal_path,
+        boost::system::error_code(error, boost::system::system_category()));
+    ++this->_syncs;
+    this->_synced = boost::posix_time::microsec_clock::universal_time();
+  }
+
+  /*----------.
+  | Printable |
+  `----------*/
+
+  void
+  SnapshotJournal::print(std::ostream& stream) const
+  {
+    elle::fprintf(stream, "SnapshotJournal(%s, %s records)",
+                  this->_path, this->_records);
+  }
+}
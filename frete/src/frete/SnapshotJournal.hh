@@ -0,0 +1,124 @@
+#ifndef FRETE_SNAPSHOT_JOURNAL_HH
+# define FRETE_SNAPSHOT_JOURNAL_HH
+
+# include <cstdio>
+# include <memory>
+
+# include <boost/date_time/posix_time/posix_time.hpp>
+# include <boost/filesystem/path.hpp>
+
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+
+# include <frete/Frete.hh>
+# include <frete/TransferSnapshot.hh>
+
+namespace frete
+{
+  /// A TransferSnapshot saved as a base file and an append-only journal of
+  /// progress updates.
+  ///
+  /// Recording progress appends a small fixed size record instead of
+  /// rewriting the whole snapshot. The journal is folded back into the base
+  /// every compaction_records records, and synced to disk according to the
+  /// sync policy, which bounds the progress lost on a crash. Records torn by
+  /// a crash are detected and dropped on load.
+  class SnapshotJournal:
+    public elle::Printable
+  {
+  /*------.
+  | Types |
+  `------*/
+  public:
+    typedef SnapshotJournal Self;
+    typedef Frete::FileID FileID;
+    /// When to sync the journal to disk.
+    enum class Sync
+    {
+      never,
+      periodic,
+      always,
+    };
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+  public:
+    SnapshotJournal(
+      boost::filesystem::path const& path,
+      Sync sync = default_sync(),
+      boost::posix_time::time_duration sync_period = default_sync_period(),
+      int compaction_records = default_compaction_records());
+    ~SnapshotJournal();
+    /// From INFINIT_SNAPSHOT_SYNC: "always", "never" or a period in
+    /// milliseconds, periodic every second by default.
+    static
+    Sync
+    default_sync();
+    static
+    boost::posix_time::time_duration
+    default_sync_period();
+    /// INFINIT_SNAPSHOT_COMPACTION, 4096 by default.
+    static
+    int
+    default_compaction_records();
+    ELLE_ATTRIBUTE_R(boost::filesystem::path, path);
+    ELLE_ATTRIBUTE_R(boost::filesystem::path, journal_path);
+    ELLE_ATTRIBUTE_R(Sync, sync);
+    ELLE_ATTRIBUTE_R(boost::posix_time::time_duration, sync_period);
+    ELLE_ATTRIBUTE_R(int, compaction_records);
+
+  /*--------.
+  | Storage |
+  `--------*/
+  public:
+    /// The saved snapshot with the journal replayed, if any.
+    std::unique_ptr<TransferSnapshot>
+    load();
+    /// Save the whole snapshot and empty the journal.
+    void
+    save(TransferSnapshot& snapshot);
+    /// Record the progress of a file, compacting if the journal is long
+    /// enough.
+    void
+    progress(TransferSnapshot& snapshot, FileID file);
+    /// Record a chunk of a file received out of order.
+    void
+    chunk(TransferSnapshot& snapshot,
+          FileID file,
+          Frete::FileOffset offset,
+          Frete::FileSize size);
+    /// Remove the snapshot and its journal.
+    void
+    remove();
+    /// Records in the journal.
+    ELLE_ATTRIBUTE_R(int, records);
+    ELLE_ATTRIBUTE_R(int, compactions);
+    ELLE_ATTRIBUTE_R(int, syncs);
+  private:
+    /// Append a record, compacting instead if the journal is long enough.
+    void
+    _append(TransferSnapshot& snapshot,
+            uint32_t file,
+            uint64_t value,
+            uint32_t first,
+            uint32_t second);
+    void
+    _close();
+    void
+    _sync();
+    ELLE_ATTRIBUTE(std::FILE*, journal);
+    ELLE_ATTRIBUTE(boost::posix_time::ptime, synced);
+    /// Whether a sync is running, appends meanwhile don't start another.
+    ELLE_ATTRIBUTE(bool, syncing);
+
+  /*----------.
+  | Printable |
+  `----------*/
+  public:
+    void
+    print(std::ostream& stream) const override;
+  };
+}
+
+#endif
@@ -0,0 +1,199 @@
+#include <elle/assert.hh>
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+
+#include <frete/SourceScheduler.hh>
+
+ELLE_LOG_COMPONENT("frete.SourceScheduler");
+
+namespace frete
+{
+  /*-------------.
+  | Construction |
+  `-------------*/
+
+  SourceScheduler::SourceScheduler(FileSize window)
+    : _window(window)
+    , _sources()
+    , _given_back()
+  {
+    ELLE_TRACE("%s: construct", *this);
+  }
+
+  bool
+  SourceScheduler::enabled()
+  {
+    return elle::os::getenv("INFINIT_NO_MULTI_SOURCE", "").empty();
+  }
+
+  /*--------.
+  | Sources |
+  `--------*/
+
+  SourceScheduler::Source
+  SourceScheduler::add(std::string name)
+  {
+    ELLE_TRACE("%s: add source %s", *this, name);
+    this->_sources.push_back(
+      Entry{std::move(name), true, 0, 0, Duration(0, 0, 0), Time()});
+    return this->_sources.size() - 1;
+  }
+
+  void
+  SourceScheduler::stop(Source source)
+  {
+    auto& entry = this->_sources.at(source);
+    ELLE_TRACE("%s: stop %s after %s bytes", *this, entry.name, entry.delivered);
+    entry.active = false;
+  }
+
+  bool
+  SourceScheduler::active(Source source) const
+  {
+    return this->_sources.at(source).active;
+  }
+
+  SourceScheduler::FileSize
+  SourceScheduler::delivered(Source source) const
+  {
+    return this->_sources.at(source).delivered;
+  }
+
+  SourceScheduler::FileSize
+  SourceScheduler::in_flight(Source source) const
+  {
+    return this->_sources.at(source).in_flight;
+  }
+
+  double
+  SourceScheduler::goodput(Source source) const
+  {
+    auto const& entry = this->_sources.at(source);
+    auto busy = entry.busy.total_microseconds();
+    if (busy <= 0)
+      return 0;
+    return entry.delivered * 1e6 / busy;
+  }
+
+  double
+  SourceScheduler::share(Source source) const
+  {
+    if (!this->active(source))
+      return 0;
+    int active = 0;
+    int measured = 0;
+    double total = 0;
+    for (unsigned i = 0; i < this->_sources.size(); ++i)
+      if (this->_sources[i].active)
+      {
+        ++active;
+        auto goodput = this->goodput(i);
+        if (goodput > 0)
+        {
+          ++measured;
+          total += goodput;
+        }
+      }
+    if (measured == 0)
+      return 1. / active;
+    auto average = total / measured;
+    auto goodput = this->goodput(source);
+    if (goodput <= 0)
+      goodput = average;
+    return goodput / (total + (active - measured) * average);
+  }
+
+  /*---------.
+  | Requests |
+  `---------*/
+
+  bool
+  SourceScheduler::admit(Source source, FileSize size) const
+  {
+    auto const& entry = this->_sources.at(source);
+    if (!entry.active)
+      return false;
+    if (entry.in_flight == 0)
+      return true;
+    int active = 0;
+    for (auto const& source: this->_sources)
+      if (source.active)
+        ++active;
+    if (active == 1)
+      return true;
+    return entry.in_flight + size <= this->share(source) * this->_window;
+  }
+
+  void
+  SourceScheduler::start(Source source, FileSize size, Time now)
+  {
+    auto& entry = this->_sources.at(source);
+    if (entry.in_flight == 0)
+      entry.busy_since = now;
+    entry.in_flight += size;
+  }
+
+  void
+  SourceScheduler::end(Source source,
+                       FileSize size,
+                       FileSize delivered,
+                       Time now)
+  {
+    auto& entry = this->_sources.at(source);
+    ELLE_ASSERT_GTE(entry.in_flight, size);
+    entry.in_flight -= size;
+    entry.delivered += delivered;
+    entry.busy += now - entry.busy_since;
+    entry.busy_since = now;
+  }
+
+  /*-----------.
+  | Given back |
+  `-----------*/
+
+  void
+  SourceScheduler::give_back(Positions const& positions)
+  {
+    ELLE_DEBUG("%s: %s blocks given back", *this, positions.size());
+    this->_given_back.insert(
+      this->_given_back.end(), positions.begin(), positions.end());
+  }
+
+  boost::optional<SourceScheduler::Position>
+  SourceScheduler::take_back()
+  {
+    if (this->_given_back.empty())
+      return {};
+    auto res = this->_given_back.front();
+    this->_given_back.pop_front();
+    return res;
+  }
+
+  bool
+  SourceScheduler::pending(Source source) const
+  {
+    for (unsigned i = 0; i < this->_sources.size(); ++i)
+      if (static_cast<Source>(i) != source && this->_sources[i].in_flight > 0)
+        return true;
+    return false;
+  }
+
+  /*----------.
+  | Printable |
+  `----------*/
+
+  void
+  SourceScheduler::print(std::ostream& stream) const
+  {
+    stream << "SourceScheduler(";
+    for (unsigned i = 0; i < this->_sources.size(); ++i)
+    {
+      if (i > 0)
+        stream << ", ";
+      auto const& entry = this->_sources[i];
+      elle::fprintf(stream, "%s: %s%%, %s B/s",
+                    entry.name, int(this->share(i) * 100), this->goodput(i));
+    }
+    stream << ")";
+  }
+}
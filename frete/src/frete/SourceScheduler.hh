@@ -0,0 +1,142 @@
+#ifndef FRETE_SOURCE_SCHEDULER_HH
+# define FRETE_SOURCE_SCHEDULER_HH
+
+# include <deque>
+# include <string>
+# include <vector>
+
+# include <boost/date_time/posix_time/posix_time.hpp>
+# include <boost/optional.hpp>
+
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+
+# include <frete/Frete.hh>
+
+namespace frete
+{
+  /// Share the blocks to fetch among concurrent sources.
+  ///
+  /// A recipient can fetch from the peer and from the cloud buffer at the
+  /// same time. Blocks are written in order, so a source holding many of
+  /// them while slower than the others stalls the writer: each source is
+  /// allowed the part of the bytes in flight matching its part of the
+  /// goodput, so that they all deliver what they hold in about the same
+  /// time. A source is credited with the bytes it delivers per second it
+  /// has requests in flight. Blocks a source can't serve, such as those a
+  /// cloud buffer doesn't hold yet, are given back to the others.
+  class SourceScheduler:
+    public elle::Printable
+  {
+  /*------.
+  | Types |
+  `------*/
+  public:
+    typedef SourceScheduler Self;
+    typedef Frete::FileSize FileSize;
+    typedef Frete::Position Position;
+    typedef Frete::Positions Positions;
+    typedef boost::posix_time::ptime Time;
+    typedef boost::posix_time::time_duration Duration;
+    /// Identifies a source.
+    typedef int Source;
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+  public:
+    /// Keep at most window bytes requested among the sources.
+    SourceScheduler(FileSize window);
+    /// Whether the cloud buffer is fetched from along with the peer,
+    /// unless INFINIT_NO_MULTI_SOURCE is set.
+    static
+    bool
+    enabled();
+    ELLE_ATTRIBUTE_RW(FileSize, window);
+
+  /*--------.
+  | Sources |
+  `--------*/
+  public:
+    /// Add a source to fetch from.
+    Source
+    add(std::string name);
+    /// Request nothing more from a source, its share going to the others.
+    void
+    stop(Source source);
+    /// Whether a source is still fetched from.
+    bool
+    active(Source source) const;
+    /// Bytes a source delivered.
+    FileSize
+    delivered(Source source) const;
+    /// Bytes requested from a source and not delivered yet.
+    FileSize
+    in_flight(Source source) const;
+    /// Bytes per second a source delivers while it has requests in flight,
+    /// zero until measured.
+    double
+    goodput(Source source) const;
+    /// The part of the window a source is allowed. Sources not measured yet
+    /// are assumed as fast as the average.
+    double
+    share(Source source) const;
+  private:
+    struct Entry
+    {
+      std::string name;
+      bool active;
+      FileSize in_flight;
+      FileSize delivered;
+      Duration busy;
+      Time busy_since;
+    };
+    ELLE_ATTRIBUTE(std::vector<Entry>, sources);
+
+  /*---------.
+  | Requests |
+  `---------*/
+  public:
+    /// Whether a source may request size more bytes. A source can always
+    /// have one request in flight, and a single source as many as it wants.
+    bool
+    admit(Source source, FileSize size) const;
+    /// Record a request of size bytes to a source.
+    void
+    start(Source source,
+          FileSize size,
+          Time now = boost::posix_time::microsec_clock::universal_time());
+    /// Record the end of a request of size bytes, that delivered bytes.
+    void
+    end(Source source,
+        FileSize size,
+        FileSize delivered,
+        Time now = boost::posix_time::microsec_clock::universal_time());
+
+  /*-----------.
+  | Given back |
+  `-----------*/
+  public:
+    /// Hand blocks a source could not serve to the others.
+    void
+    give_back(Positions const& positions);
+    /// The first block given back, if any.
+    boost::optional<Position>
+    take_back();
+    /// Whether sources other than source have requests in flight, whose
+    /// blocks may be given back.
+    bool
+    pending(Source source) const;
+  private:
+    ELLE_ATTRIBUTE(std::deque<Position>, given_back);
+
+  /*----------.
+  | Printable |
+  `----------*/
+  public:
+    void
+    print(std::ostream& stream) const override;
+  };
+}
+
+#endif
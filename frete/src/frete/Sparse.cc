@@ -0,0 +1,125 @@
+#ifndef INFINIT_WINDOWS
+# include <fcntl.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include <elle/Error.hh>
+#include <elle/finally.hh>
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+
+#include <frete/Encoding.hh>
+#include <frete/Sparse.hh>
+
+ELLE_LOG_COMPONENT("frete.Sparse");
+
+namespace frete
+{
+  namespace sparse
+  {
+    bool
+    enabled()
+    {
+      return elle::os::getenv("INFINIT_NO_SPARSE", "").empty();
+    }
+
+    Extents
+    holes(boost::filesystem::path const& path, FileSize size)
+    {
+      Extents res;
+#if !defined(INFINIT_WINDOWS) && defined(SEEK_HOLE) && defined(SEEK_DATA)
+      int fd = ::open(path.string().c_str(), O_RDONLY);
+      if (fd < 0)
+        return res;
+      elle::SafeFinally close([fd] { ::close(fd); });
+      struct stat st;
+      // Fully allocated files have no hole, spare the seeks.
+      if (::fstat(fd, &st) != 0 ||
+          static_cast<FileSize>(st.st_blocks) * 512 >= size)
+        return res;
+      FileOffset offset = 0;
+      while (offset < size)
+      {
+        auto hole = ::lseek(fd, offset, SEEK_HOLE);
+        if (hole < 0 || static_cast<FileSize>(hole) >= size)
+          break;
+        auto data = ::lseek(fd, hole, SEEK_DATA);
+        // No data past the hole, it spans the end of the file.
+        FileOffset end = data < 0 ? size : std::min<FileSize>(data, size);
+        if (end - hole >= min_hole)
+          res.emplace_back(hole, end - hole);
+        offset = end;
+      }
+      ELLE_DEBUG("%s: %s holes", path, res.size());
+#else
+      (void)path;
+      (void)size;
+#endif
+      return res;
+    }
+
+    boost::optional<Extent>
+    find(Extents const& holes, FileOffset offset)
+    {
+      // The last hole starting at or before offset.
+      auto it = std::upper_bound(
+        holes.begin(), holes.end(), offset,
+        [] (FileOffset offset, Extent const& hole)
+        {
+          return offset < hole.first;
+        });
+      if (it == holes.begin())
+        return boost::none;
+      --it;
+      if (offset < it->first + it->second)
+        return *it;
+      return boost::none;
+    }
+
+    /*--------------.
+    | Serialization |
+    `--------------*/
+
+    elle::Buffer
+    pack(std::vector<Extents> const& files)
+    {
+      // For each file, the number of holes then their offset and size.
+      elle::Buffer res;
+      for (auto const& holes: files)
+      {
+        encoding::put_uint64(res, holes.size());
+        for (auto const& hole: holes)
+        {
+          encoding::put_uint64(res, hole.first);
+          encoding::put_uint64(res, hole.second);
+        }
+      }
+      return res;
+    }
+
+    std::vector<Extents>
+    unpack(elle::ConstWeakBuffer const& data)
+    {
+      std::size_t position = 0;
+      std::vector<Extents> res;
+      while (position != data.size())
+      {
+        auto count = encoding::get_uint64(data, position);
+        encoding::check_count(data, position, count, 16, "holes");
+        Extents holes;
+        holes.reserve(count);
+        for (uint64_t i = 0; i < count; ++i)
+        {
+          auto offset = encoding::get_uint64(data, position);
+          auto size = encoding::get_uint64(data, position);
+          holes.emplace_back(offset, size);
+        }
+        res.push_back(std::move(holes));
+      }
+      return res;
+    }
+  }
+}
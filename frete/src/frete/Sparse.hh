@@ -0,0 +1,54 @@
+#ifndef FRETE_SPARSE_HH
+# define FRETE_SPARSE_HH
+
+# include <cstdint>
+# include <utility>
+# include <vector>
+
+# include <boost/filesystem/path.hpp>
+# include <boost/optional.hpp>
+
+# include <elle/Buffer.hh>
+
+namespace frete
+{
+  /// Holes of sparse files.
+  ///
+  /// The sender lists the holes of big files when scanning them, with
+  /// SEEK_HOLE and SEEK_DATA where supported. The recipient asks for them
+  /// and neither fetches nor writes the chunks lying in a hole, which it
+  /// recreates by extending the file past them.
+  namespace sparse
+  {
+    typedef uint64_t FileOffset;
+    typedef uint64_t FileSize;
+    /// A hole, as its offset and size.
+    typedef std::pair<FileOffset, FileSize> Extent;
+    /// Holes sorted by offset.
+    typedef std::vector<Extent> Extents;
+
+    /// Whether holes are skipped, unless INFINIT_NO_SPARSE is set.
+    bool
+    enabled();
+    /// Files smaller than this are not checked for holes.
+    static FileSize const min_size = 1 << 20;
+    /// Holes smaller than this are sent as data.
+    static FileSize const min_hole = 1 << 16;
+    /// The holes of the first size bytes of a file, blocking. None if the
+    /// file has no allocated block less than its size or the platform can't
+    /// tell.
+    Extents
+    holes(boost::filesystem::path const& path, FileSize size);
+    /// The hole containing offset, if any.
+    boost::optional<Extent>
+    find(Extents const& holes, FileOffset offset);
+
+    /// Serialize the holes of files to be sent.
+    elle::Buffer
+    pack(std::vector<Extents> const& files);
+    std::vector<Extents>
+    unpack(elle::ConstWeakBuffer const& data);
+  }
+}
+
+#endif
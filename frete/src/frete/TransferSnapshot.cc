@@ -1,13 +1,28 @@
+#include <algorithm>
+
 #include <frete/TransferSnapshot.hh>
 
 #include <elle/log.hh>
 #include <elle/serialization/SerializerIn.hh>
 #include <elle/serialization/SerializerOut.hh>
 
+#include <frete/Checksum.hh>
+
 ELLE_LOG_COMPONENT("frete.Snapshot");
 
 namespace frete
 {
+  static
+  int
+  hex_digit(char c)
+  {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    throw elle::Exception(elle::sprintf("invalid hexadecimal digit: %s", c));
+  }
+
   // Recipient.
   TransferSnapshot::TransferSnapshot(Frete::FileCount count,
                                      Frete::FileSize total_size,
@@ -39,6 +54,125 @@ namespace frete
     file._progress += increment;
     ELLE_ASSERT_LTE(file._progress, file._size);
     this->_progress += increment;
+    this->_remaining.add(file_id, -increment);
+  }
+
+  void
+  TransferSnapshot::file_progress_increment(FileID file_id,
+                                            elle::ConstWeakBuffer const& data)
+  {
+    auto& file = this->file(file_id);
+    // Progress made without data leaves the checksums behind for good.
+    if (file._checksums.size() == checksum::blocks(file._progress))
+      checksum::append(file._checksums, file._progress, data);
+    else
+      file._checksums.clear();
+    this->file_progress_increment(file_id, data.size());
+  }
+
+  void
+  TransferSnapshot::file_progress_verified(FileID file_id,
+                                           FileSize progress,
+                                           std::vector<uint32_t> checksums)
+  {
+    ELLE_TRACE("%s: file %s verified up to %s", *this, file_id, progress);
+    auto& file = this->file(file_id);
+    ELLE_ASSERT_LTE(progress, file._progress);
+    ELLE_ASSERT_EQ(checksums.size(), checksum::blocks(progress));
+    this->_progress -= file._progress - progress;
+    this->_remaining.add(file_id, file._progress - progress);
+    file._progress = progress;
+    file._checksums = std::move(checksums);
+  }
+
+  bool
+  TransferSnapshot::file_chunks(FileID file_id, FileSize chunk_size)
+  {
+    auto& file = this->file(file_id);
+    if (file._chunk_size == chunk_size)
+      return false;
+    // Keep the prefix already received.
+    FileSize kept = file._progress;
+    if (file._chunk_size)
+    {
+      auto leading = std::find(file._received.begin(),
+                               file._received.end(),
+                               false) - file._received.begin();
+      kept = std::min(leading * file._chunk_size, file._size);
+    }
+    if (chunk_size && kept < file._size)
+      kept -= kept % chunk_size;
+    ELLE_TRACE("%s: receive file %s by chunks of %s, keeping %s bytes",
+               *this, file_id, chunk_size, kept);
+    if (kept != file._progress)
+    {
+      this->_progress -= file._progress - kept;
+      this->_remaining.add(file_id, file._progress - kept);
+      file._progress = kept;
+      file._checksums.clear();
+    }
+    file._chunk_size = chunk_size;
+    file._received.clear();
+    if (chunk_size)
+    {
+      file._received.resize((file._size + chunk_size - 1) / chunk_size);
+      std::fill(file._received.begin(),
+                file._received.begin() + (kept + chunk_size - 1) / chunk_size,
+                true);
+    }
+    return true;
+  }
+
+  bool
+  TransferSnapshot::file_chunk_received(FileID file_id,
+                                        FileSize offset,
+                                        FileSize size)
+  {
+    auto& file = this->file(file_id);
+    ELLE_ASSERT_NEQ(file._chunk_size, 0u);
+    ELLE_ASSERT_EQ(offset % file._chunk_size, 0u);
+    ELLE_ASSERT_EQ(size, std::min(file._chunk_size, file._size - offset));
+    auto chunk = offset / file._chunk_size;
+    if (file._received.at(chunk))
+      return false;
+    file._received[chunk] = true;
+    // Checksums only follow sequential writes.
+    file._checksums.clear();
+    this->file_progress_increment(file_id, size);
+    return true;
+  }
+
+  bool
+  TransferSnapshot::File::chunk_received(FileSize offset) const
+  {
+    return this->_chunk_size && this->_received.at(offset / this->_chunk_size);
+  }
+
+  void
+  TransferSnapshot::file_progress_restore(FileID file_id,
+                                          FileSize progress,
+                                          uint32_t previous,
+                                          uint32_t last)
+  {
+    auto& file = this->file(file_id);
+    auto& checksums = file._checksums;
+    auto blocks = checksum::blocks(progress);
+    // The last two blocks are enough to follow progress made by at most a
+    // block at a time.
+    if (checksums.size() == checksum::blocks(file._progress) &&
+        blocks >= checksums.size() && blocks <= checksums.size() + 1)
+    {
+      checksums.resize(blocks);
+      if (blocks >= 1)
+        checksums[blocks - 1] = last;
+      if (blocks >= 2)
+        checksums[blocks - 2] = previous;
+    }
+    else
+      checksums.clear();
+    this->_progress = this->_progress - file._progress + progress;
+    this->_remaining.add(file_id, file._progress - progress);
+    file._progress = progress;
   }
 
   void
@@ -72,32 +206,46 @@ namespace frete
     if (!boost::filesystem::exists(file))
       throw elle::Exception(elle::sprintf("file %s doesn't exist", file));
 
+    this->add(root, path, boost::filesystem::file_size(file));
+  }
+
+  void
+  TransferSnapshot::add(boost::filesystem::path const& root,
+                        boost::filesystem::path const& path,
+                        FileSize size)
+  {
     auto index = this->_files.size();
-    auto size = boost::filesystem::file_size(file);
-    this->_files.insert(std::make_pair(index, File(index, root, path, size)));
+    this->_files.push_back(File(index, root, path, size));
+    this->_sizes.push_back(size);
+    this->_remaining.push_back(size);
     this->_total_size += size;
     this->_count = this->_files.size();
     ELLE_DEBUG("Adding file %s/%s of size %s at index %s to snapshot",
                root, path, size, this->_count - 1);
   }
 
+  void
+  TransferSnapshot::add_archive(boost::filesystem::path const& source,
+                                boost::filesystem::path const& root,
+                                boost::filesystem::path const& path,
+                                FileSize size)
+  {
+    this->add(root, path, size);
+    this->_files.back()._archive = source.generic_string();
+  }
+
   TransferSnapshot::File&
   TransferSnapshot::file(FileID file_id)
   {
-    try
-    {
-      return this->_files.at(file_id);
-    }
-    catch (std::exception const&)
-    {
+    if (file_id >= this->_files.size())
       throw elle::Exception(elle::sprintf("file id out of range: %s", file_id));
-    }
+    return this->_files[file_id];
   }
 
   bool
   TransferSnapshot::has(FileID file_id) const
   {
-    return this->_files.find(file_id) != this->_files.end();
+    return file_id < this->_files.size();
   }
 
   void
@@ -106,8 +254,15 @@ namespace frete
                         boost::filesystem::path const& path,
                         FileSize size)
   {
-    this->_files.insert(
-      std::make_pair(file_id, File(file_id, root, path, size)));
+    if (this->has(file_id))
+      return;
+    if (file_id != this->_files.size())
+      throw elle::Exception(
+        elle::sprintf("file %s added before file %s",
+                      file_id, this->_files.size()));
+    this->_files.push_back(File(file_id, root, path, size));
+    this->_sizes.push_back(size);
+    this->_remaining.push_back(size);
   }
 
   TransferSnapshot::File const&
@@ -122,6 +277,7 @@ namespace frete
     return ((this->_count == rh._count) &&
             (this->_total_size == rh._total_size) &&
             (this->_progress == rh._progress) &&
+            (this->_files.size() == rh._files.size()) &&
             std::equal(this->_files.begin(),
                        this->_files.end(),
                        rh._files.begin()));
@@ -164,7 +320,14 @@ namespace frete
     , _path(path.generic_string())
     , _full_path(root / path)
     , _size(size)
+    , _archive()
+    , _archive_checksums()
+    , _hash()
+    , _holes()
     , _progress(0)
+    , _checksums()
+    , _chunk_size(0)
+    , _received()
   {}
 
   bool
@@ -201,13 +364,19 @@ namespace frete
   {
     ELLE_DUMP_SCOPE("Incrementing progress of %s", increment);
     FileSize remain = increment;
-    for (FileCount i = 0; i < count() && remain; ++i)
+    while (remain)
     {
-      File& f = file(i);
+      // The first file with something left to transfer.
+      FileSize offset = 0;
+      auto i = this->_remaining.find(offset);
+      if (i >= this->_files.size())
+        break;
+      File& f = this->_files[i];
       FileSize take = std::min(remain, f.size() - f.progress());
       ELLE_DUMP("Took %s from file %s at %s/%s", take, i, f.progress(), f.size());
       remain -= take;
       f._progress += take;
+      this->_remaining.add(i, -take);
     }
     _progress += increment - remain;
     if (remain)
@@ -228,8 +397,103 @@ namespace frete
   TransferSnapshot::_recompute_progress()
   {
     _progress = 0;
+    this->_sizes.clear();
+    this->_remaining.clear();
     for (auto const& f: _files)
-      _progress += f.second.progress();
+    {
+      _progress += f.progress();
+      this->_sizes.push_back(f.size());
+      this->_remaining.push_back(f.size() - f.progress());
+    }
+  }
+
+  /*----------.
+  | Positions |
+  `----------*/
+
+  TransferSnapshot::FileSize
+  TransferSnapshot::position(FileID file_id, FileSize offset) const
+  {
+    ELLE_ASSERT_LTE(file_id, this->_files.size());
+    return this->_sizes.prefix(file_id) + offset;
+  }
+
+  std::pair<TransferSnapshot::FileID, TransferSnapshot::FileSize>
+  TransferSnapshot::file_position(FileSize position) const
+  {
+    auto file_id = this->_sizes.find(position);
+    return std::make_pair(file_id, position);
+  }
+
+  void
+  TransferSnapshot::Sums::push_back(FileSize value)
+  {
+    // Node i covers (i - lowbit(i), i].
+    auto i = this->_tree.size() + 1;
+    auto low = i & -i;
+    this->_tree.push_back(value + this->prefix(i - 1) - this->prefix(i - low));
+  }
+
+  void
+  TransferSnapshot::Sums::add(FileID index, FileSize delta)
+  {
+    for (auto i = index + 1; i <= this->_tree.size(); i += i & -i)
+      this->_tree[i - 1] += delta;
+  }
+
+  TransferSnapshot::FileSize
+  TransferSnapshot::Sums::prefix(FileID end) const
+  {
+    FileSize res = 0;
+    for (auto i = end; i > 0; i -= i & -i)
+      res += this->_tree[i - 1];
+    return res;
+  }
+
+  TransferSnapshot::FileID
+  TransferSnapshot::Sums::find(FileSize& offset) const
+  {
+    std::size_t size = this->_tree.size();
+    std::size_t step = 1;
+    while (step * 2 <= size)
+      step *= 2;
+    std::size_t res = 0;
+    for (; step > 0; step /= 2)
+      if (res + step <= size && this->_tree[res + step - 1] <= offset)
+      {
+        res += step;
+        offset -= this->_tree[res - 1];
+      }
+    return res;
+  }
+
+  void
+  TransferSnapshot::Sums::clear()
+  {
+    this->_tree.clear();
+  }
+
+  TransferSnapshot::FileMap
+  TransferSnapshot::_file_map() const
+  {
+    FileMap res;
+    for (auto const& file: this->_files)
+      res.emplace(file.file_id(), file);
+    return res;
+  }
+
+  void
+  TransferSnapshot::_file_map(FileMap files)
+  {
+    this->_files.clear();
+    this->_files.reserve(files.size());
+    for (FileID i = 0; i < files.size(); ++i)
+    {
+      auto it = files.find(i);
+      if (it == files.end())
+        throw elle::Exception(elle::sprintf("missing file %s in snapshot", i));
+      this->_files.push_back(std::move(it->second));
+    }
   }
 
   /*--------------.
@@ -246,7 +510,12 @@ namespace frete
   {
     s.serialize("relative_folder", this->_relative_folder);
     s.serialize("mirrored", this->_mirrored);
-    s.serialize("transfers", this->_files);
+    FileMap files;
+    if (!s.in())
+      files = this->_file_map();
+    s.serialize("transfers", files);
+    if (s.in())
+      this->_file_map(std::move(files));
     s.serialize("count", this->_count);
     s.serialize("total_size", this->_total_size);
     s.serialize("progress", this->_progress);
@@ -270,6 +539,68 @@ namespace frete
     s.serialize("path", this->_path);
     s.serialize("file_size", this->_size);
     s.serialize("progress", this->_progress);
+    s.serialize("archive", this->_archive);
+    if (this->_archive)
+      s.serialize("archive_checksums", this->_archive_checksums);
+    s.serialize("hash", this->_hash);
+    // Holes as offset and size pairs, absent if none.
+    boost::optional<std::vector<FileSize>> holes;
+    if (!s.in() && !this->_holes.empty())
+    {
+      holes = std::vector<FileSize>();
+      for (auto const& hole: this->_holes)
+      {
+        holes->push_back(hole.first);
+        holes->push_back(hole.second);
+      }
+    }
+    s.serialize("holes", holes);
+    if (s.in())
+    {
+      this->_holes.clear();
+      if (holes)
+      {
+        if (holes->size() % 2 != 0)
+          throw elle::Exception("invalid holes");
+        for (unsigned i = 0; i < holes->size(); i += 2)
+          this->_holes.emplace_back((*holes)[i], (*holes)[i + 1]);
+      }
+    }
+    // Absent from older snapshots.
+    boost::optional<std::vector<uint32_t>> checksums;
+    if (!s.in() && !this->_checksums.empty())
+      checksums = this->_checksums;
+    s.serialize("checksums", checksums);
+    if (s.in() && checksums)
+      this->_checksums = std::move(checksums.get());
+    // Chunks received out of order, as hexadecimal bitmap.
+    boost::optional<FileSize> chunk_size;
+    boost::optional<std::string> received;
+    if (!s.in() && this->_chunk_size)
+    {
+      chunk_size = this->_chunk_size;
+      received = std::string((this->_received.size() + 3) / 4, '0');
+      for (unsigned i = 0; i < this->_received.size(); ++i)
+        if (this->_received[i])
+          received.get()[i / 4] =
+            "0123456789abcdef"[hex_digit(received.get()[i / 4]) | 1 << i % 4];
+    }
+    s.serialize("chunk_size", chunk_size);
+    s.serialize("received", received);
+    if (s.in())
+    {
+      this->_chunk_size = chunk_size ? chunk_size.get() : 0;
+      this->_received.clear();
+      if (this->_chunk_size)
+      {
+        this->_received.resize(
+          (this->_size + this->_chunk_size - 1) / this->_chunk_size);
+        if (!received || received->size() * 4 < this->_received.size())
+          throw elle::Exception("invalid received chunks");
+        for (unsigned i = 0; i < this->_received.size(); ++i)
+          this->_received[i] = hex_digit(received.get()[i / 4]) >> i % 4 & 1;
+      }
+    }
     if (s.in())
       this->_full_path = boost::filesystem::path(this->_root) / this->_path;
   }
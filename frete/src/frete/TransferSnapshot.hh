@@ -1,12 +1,18 @@
 #ifndef FRETE_TRANSFERSNAPSHOT_HH
 # define FRETE_TRANSFERSNAPSHOT_HH
 
+# include <unordered_map>
+# include <utility>
+# include <vector>
+
 # include <boost/filesystem.hpp>
+# include <boost/optional.hpp>
 
 # include <elle/Printable.hh>
 # include <elle/serialization/fwd.hh>
 
 # include <frete/Frete.hh>
+# include <frete/Sparse.hh>
 
 namespace frete
 {
@@ -56,6 +62,15 @@ namespace frete
       ELLE_ATTRIBUTE_R(boost::filesystem::path, full_path);
       /// Total file size
       ELLE_ATTRIBUTE_R(FileSize, size);
+      /// The directory this file is a streamed zip archive of, if any.
+      ELLE_ATTRIBUTE_R(boost::optional<std::string>, archive);
+      /// Checksums of the leading archive entries already streamed, to
+      /// resume the archive from.
+      ELLE_ATTRIBUTE_RX(std::vector<uint32_t>, archive_checksums);
+      /// Content hash, once computed for deduplication.
+      ELLE_ATTRIBUTE_RW(boost::optional<std::string>, hash);
+      /// Holes of the file if sparse, on the sender.
+      ELLE_ATTRIBUTE_RW(sparse::Extents, holes);
 
     /*-------.
     | Status |
@@ -72,6 +87,17 @@ namespace frete
     public:
       /// Current file size or amount transmitted (depending if sender/recipient)
       ELLE_ATTRIBUTE_R(FileSize, progress);
+      /// Checksums of the received content by checksum::block_size blocks,
+      /// the last one being partial. Only valid if they cover progress.
+      ELLE_ATTRIBUTE_R(std::vector<uint32_t>, checksums);
+      /// Size of the chunks received out of order, 0 if the file is
+      /// received sequentially, progress being the size of its prefix.
+      ELLE_ATTRIBUTE_R(FileSize, chunk_size);
+      /// Which chunks were written, if received out of order.
+      ELLE_ATTRIBUTE_R(std::vector<bool>, received);
+      /// Whether the chunk at offset was written.
+      bool
+      chunk_received(FileSize offset) const;
 
     /*-----------.
     | Comparison |
@@ -110,12 +136,24 @@ namespace frete
     void
     add(boost::filesystem::path const& root,
         boost::filesystem::path const& path);
+    /// Add a file whose size is already known.
+    void
+    add(boost::filesystem::path const& root,
+        boost::filesystem::path const& path,
+        FileSize size);
+    /// Add a zip archive of source, generated while it is read.
+    void
+    add_archive(boost::filesystem::path const& source,
+                boost::filesystem::path const& root,
+                boost::filesystem::path const& path,
+                FileSize size);
     File&
     file(FileID file_id);
     File const&
     file(FileID file_id) const;
     bool
     has(FileID file_id) const;
+    /// Add the file file_id, files being added in order.
     void
     add(FileID file_id,
         boost::filesystem::path const& root,
@@ -125,10 +163,57 @@ namespace frete
     /// Can only be called once.
     void
     set_key_code(infinit::cryptography::Code const& code);
-  private:
-    typedef std::unordered_map<FileID, File> Files;
+    /// Files added so far, by id.
+    typedef std::vector<File> Files;
     ELLE_ATTRIBUTE_R(Files, files);
+  private:
     ELLE_ATTRIBUTE_R(std::unique_ptr<infinit::cryptography::Code>, key_code);
+    /// Files are serialized as a map by id.
+    typedef std::unordered_map<FileID, File> FileMap;
+    FileMap
+    _file_map() const;
+    void
+    _file_map(FileMap files);
+
+  /*----------.
+  | Positions |
+  `----------*/
+  public:
+    /// The offset of a file position in the whole transfer, files being
+    /// concatenated by id.
+    FileSize
+    position(FileID file_id, FileSize offset) const;
+    /// The file and offset at a position in the whole transfer, skipping
+    /// empty files.
+    std::pair<FileID, FileSize>
+    file_position(FileSize position) const;
+  private:
+    /// Prefix sums over files, updated and searched in O(log n).
+    class Sums
+    {
+    public:
+      void
+      push_back(FileSize value);
+      /// Add delta, modulo 2^64, to the value at index.
+      void
+      add(FileID index, FileSize delta);
+      /// The sum of values in [0, end).
+      FileSize
+      prefix(FileID end) const;
+      /// The first index whose value contains offset, offset becoming
+      /// relative to it. The size if there is none.
+      FileID
+      find(FileSize& offset) const;
+      void
+      clear();
+    private:
+      /// One based Fenwick tree.
+      ELLE_ATTRIBUTE((std::vector<FileSize>), tree);
+    };
+    /// File sizes.
+    ELLE_ATTRIBUTE(Sums, sizes);
+    /// What's left to transfer of each file.
+    ELLE_ATTRIBUTE(Sums, remaining);
 
   /*-----------.
   | Attributes |
@@ -145,6 +230,29 @@ namespace frete
   public:
     void
     file_progress_increment(FileID file, FileSize increment);
+    /// Increment progress with the data written, extending its checksums.
+    void
+    file_progress_increment(FileID file, elle::ConstWeakBuffer const& data);
+    /// Move progress back to the verified prefix of a file and its checksums.
+    void
+    file_progress_verified(FileID file,
+                           FileSize progress,
+                           std::vector<uint32_t> checksums);
+    /// Receive a file by chunks of chunk_size in any order, or sequentially
+    /// if 0. The leading chunks already received are kept, the rest of the
+    /// progress is dropped. Return whether anything changed.
+    bool
+    file_chunks(FileID file, FileSize chunk_size);
+    /// Record a chunk written at offset, return whether it is a new one.
+    bool
+    file_chunk_received(FileID file, FileSize offset, FileSize size);
+    /// Restore the progress of a file and the checksums of its last two
+    /// blocks, as journaled.
+    void
+    file_progress_restore(FileID file,
+                          FileSize progress,
+                          uint32_t previous,
+                          uint32_t last);
     void
     file_progress_set(FileID file, FileSize progress);
     void
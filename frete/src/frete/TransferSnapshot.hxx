@@ -34,7 +34,12 @@ ELLE_SERIALIZE_SIMPLE(frete::TransferSnapshot,
   ELLE_LOG_COMPONENT("frete.Snapshot");
   ELLE_DEBUG_SCOPE("%sserializing TransferSnapshot archive (version %s)",
                    (ar.mode == ArchiveMode::input ? "de": ""), version);
-  ar & named("transfers", res._files);
+  {
+    auto files = res._file_map();
+    ar & named("transfers", files);
+    if (ar.mode == ArchiveMode::input)
+      res._file_map(std::move(files));
+  }
   ar & named("count", res._count);
   ar & named("total_size", res._total_size);
   ar & named("progress", res._progress);
@@ -0,0 +1,461 @@
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <limits>
+
+#include <zlib.h>
+
+#include <boost/filesystem.hpp>
+
+#include <elle/Error.hh>
+#include <elle/log.hh>
+
+#include <reactor/scheduler.hh>
+
+#include <frete/ZipStream.hh>
+
+ELLE_LOG_COMPONENT("frete.ZipStream");
+
+namespace frete
+{
+  /*--------.
+  | Records |
+  `--------*/
+
+  static uint32_t const local_header_signature = 0x04034b50;
+  static uint32_t const descriptor_signature = 0x08074b50;
+  static uint32_t const central_header_signature = 0x02014b50;
+  static uint32_t const end_signature = 0x06054b50;
+  static ZipStream::FileSize const local_header_size = 30;
+  static ZipStream::FileSize const descriptor_size = 16;
+  static ZipStream::FileSize const central_header_size = 46;
+  static ZipStream::FileSize const end_size = 22;
+  // Zip 2.0, needed for data descriptors.
+  static uint16_t const version = 20;
+  // Made on unix, so the external attributes carry the file mode.
+  static uint16_t const version_made_by = (3 << 8) | version;
+  // Checksum in a data descriptor, UTF-8 names.
+  static uint16_t const flags = 0x0008 | 0x0800;
+  static uint32_t const mode_directory = 0040000;
+  static uint32_t const mode_file = 0100000;
+  static uint32_t const mode_symlink = 0120000;
+  static uint32_t const dos_directory = 0x10;
+  // Checksums of entries not read yet are computed in chunks of this size.
+  static ZipStream::FileSize const rehash_chunk = 1 << 20;
+
+  static
+  void
+  put(unsigned char*& output, uint16_t value)
+  {
+    *output++ = value & 0xff;
+    *output++ = (value >> 8) & 0xff;
+  }
+
+  static
+  void
+  put(unsigned char*& output, uint32_t value)
+  {
+    put(output, uint16_t(value & 0xffff));
+    put(output, uint16_t(value >> 16));
+  }
+
+  static
+  void
+  put(unsigned char*& output, std::string const& value)
+  {
+    memcpy(output, value.data(), value.size());
+    output += value.size();
+  }
+
+  static
+  void
+  dos_timestamp(std::time_t timestamp, uint16_t& time, uint16_t& date)
+  {
+    struct tm tm;
+#ifdef INFINIT_WINDOWS
+    localtime_s(&tm, &timestamp);
+#else
+    localtime_r(&timestamp, &tm);
+#endif
+    // DOS dates start in 1980.
+    if (tm.tm_year < 80)
+    {
+      time = 0;
+      date = (1 << 5) | 1;
+      return;
+    }
+    time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+    date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+  }
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+
+  ZipStream::ZipStream(boost::filesystem::path const& path,
+                       Checksums const& checksums)
+    : _path(path)
+    , _size(0)
+    , _streamable(true)
+    , _entries()
+    , _central()
+    , _checksums()
+    , _rehashed(0)
+    , _handle_entry(0)
+    , _handle()
+  {
+    ELLE_TRACE_SCOPE("%s: list", *this);
+    if (!boost::filesystem::is_directory(path))
+      throw elle::Exception(
+        elle::sprintf("given path %s is not a directory", path));
+    reactor::background(
+      [this, &path]
+      {
+        this->_list(path,
+                    path.filename().generic_string(),
+                    boost::filesystem::status(path));
+      });
+    static FileSize const max = std::numeric_limits<uint32_t>::max();
+    if (this->_entries.size() >= std::numeric_limits<uint16_t>::max())
+      this->_streamable = false;
+    for (auto& entry: this->_entries)
+    {
+      entry.offset = this->_size;
+      this->_size += this->_header_size(entry) + entry.size + descriptor_size;
+      if (entry.size >= max ||
+          entry.name.size() >= std::numeric_limits<uint16_t>::max())
+        this->_streamable = false;
+    }
+    this->_central.reserve(this->_entries.size() + 1);
+    for (auto const& entry: this->_entries)
+    {
+      this->_central.push_back(this->_size);
+      this->_size += central_header_size + entry.name.size();
+    }
+    this->_central.push_back(this->_size);
+    this->_size += end_size;
+    if (this->_size >= max)
+      this->_streamable = false;
+    auto known = std::min(checksums.size(), this->_entries.size());
+    for (std::size_t i = 0; i < known; ++i)
+    {
+      auto& entry = this->_entries[i];
+      entry.checksum = checksums[i];
+      entry.hashed = entry.size;
+    }
+    this->_advance();
+    ELLE_DEBUG("%s: %s checksums known", *this, this->_checksums.size());
+  }
+
+  ZipStream::~ZipStream()
+  {}
+
+  /*-------.
+  | Layout |
+  `-------*/
+
+  void
+  ZipStream::_list(boost::filesystem::path const& path,
+                   std::string const& name,
+                   boost::filesystem::file_status const& status)
+  {
+    Entry entry;
+    entry.source = path;
+    entry.size = 0;
+    entry.mode = status.permissions() & 07777;
+    entry.offset = 0;
+    entry.checksum = 0;
+    entry.hashed = 0;
+    boost::system::error_code error;
+    auto mtime = boost::filesystem::last_write_time(path, error);
+    dos_timestamp(error ? 0 : mtime, entry.time, entry.date);
+    if (boost::filesystem::is_symlink(status))
+    {
+      entry.name = name;
+      entry.mode |= mode_symlink;
+      entry.target = boost::filesystem::read_symlink(path).generic_string();
+      entry.size = entry.target.size();
+      entry.checksum = ::crc32(
+        0, reinterpret_cast<Bytef const*>(entry.target.data()),
+        entry.target.size());
+      entry.hashed = entry.size;
+      this->_entries.push_back(std::move(entry));
+    }
+    else if (boost::filesystem::is_directory(status))
+    {
+      entry.name = name + "/";
+      entry.mode |= mode_directory;
+      this->_entries.push_back(std::move(entry));
+      std::vector<boost::filesystem::directory_entry> children{
+        boost::filesystem::directory_iterator(path),
+        boost::filesystem::directory_iterator()};
+      // Sorted, so the layout is the same when listed again to resume.
+      std::sort(children.begin(), children.end());
+      for (auto const& child: children)
+        this->_list(child.path(),
+                    name + "/" + child.path().filename().generic_string(),
+                    child.symlink_status());
+    }
+    else if (boost::filesystem::is_regular_file(status))
+    {
+      entry.name = name;
+      entry.mode |= mode_file;
+      entry.size = boost::filesystem::file_size(path);
+      this->_entries.push_back(std::move(entry));
+    }
+    else
+      ELLE_TRACE("%s: skip special file %s", *this, path);
+  }
+
+  ZipStream::FileSize
+  ZipStream::_header_size(Entry const& entry) const
+  {
+    return local_header_size + entry.name.size();
+  }
+
+  elle::Buffer
+  ZipStream::_local_header(Entry const& entry) const
+  {
+    elle::Buffer res(this->_header_size(entry));
+    auto output = res.mutable_contents();
+    put(output, local_header_signature);
+    put(output, version);
+    put(output, flags);
+    put(output, uint16_t(0)); // Stored.
+    put(output, entry.time);
+    put(output, entry.date);
+    // The checksum follows the content, sizes are already known.
+    put(output, uint32_t(0));
+    put(output, uint32_t(entry.size));
+    put(output, uint32_t(entry.size));
+    put(output, uint16_t(entry.name.size()));
+    put(output, uint16_t(0));
+    put(output, entry.name);
+    return res;
+  }
+
+  elle::Buffer
+  ZipStream::_descriptor(Entry& entry)
+  {
+    elle::Buffer res(descriptor_size);
+    auto output = res.mutable_contents();
+    put(output, descriptor_signature);
+    put(output, this->_checksum(entry));
+    put(output, uint32_t(entry.size));
+    put(output, uint32_t(entry.size));
+    return res;
+  }
+
+  elle::Buffer
+  ZipStream::_central_header(Entry& entry)
+  {
+    elle::Buffer res(central_header_size + entry.name.size());
+    auto output = res.mutable_contents();
+    put(output, central_header_signature);
+    put(output, version_made_by);
+    put(output, version);
+    put(output, flags);
+    put(output, uint16_t(0)); // Stored.
+    put(output, entry.time);
+    put(output, entry.date);
+    put(output, this->_checksum(entry));
+    put(output, uint32_t(entry.size));
+    put(output, uint32_t(entry.size));
+    put(output, uint16_t(entry.name.size()));
+    put(output, uint16_t(0)); // Extra field.
+    put(output, uint16_t(0)); // Comment.
+    put(output, uint16_t(0)); // Disk.
+    put(output, uint16_t(0)); // Internal attributes.
+    bool directory = (entry.mode & 0170000) == mode_directory;
+    put(output, uint32_t(entry.mode << 16 | (directory ? dos_directory : 0)));
+    put(output, uint32_t(entry.offset));
+    put(output, entry.name);
+    return res;
+  }
+
+  elle::Buffer
+  ZipStream::_end() const
+  {
+    elle::Buffer res(end_size);
+    auto output = res.mutable_contents();
+    put(output, end_signature);
+    put(output, uint16_t(0)); // Disk.
+    put(output, uint16_t(0)); // Central directory disk.
+    put(output, uint16_t(this->_entries.size()));
+    put(output, uint16_t(this->_entries.size()));
+    put(output, uint32_t(this->_central.back() - this->_central.front()));
+    put(output, uint32_t(this->_central.front()));
+    put(output, uint16_t(0)); // Comment.
+    return res;
+  }
+
+  /*-----.
+  | Read |
+  `-----*/
+
+  elle::Buffer
+  ZipStream::read(FileOffset offset, FileSize size)
+  {
+    ELLE_DEBUG_SCOPE("%s: read %s bytes at %s", *this, size, offset);
+    if (offset >= this->_size)
+      return elle::Buffer();
+    FileOffset end = offset + std::min(size, this->_size - offset);
+    elle::Buffer res(end - offset);
+    auto output = res.mutable_contents();
+    // Copy the part of a generated record overlapping the read.
+    auto copy = [&] (elle::Buffer const& record, FileOffset record_offset)
+      {
+        auto skip = offset - record_offset;
+        auto count = std::min<FileSize>(record.size() - skip, end - offset);
+        memcpy(output, record.contents() + skip, count);
+        return count;
+      };
+    while (offset < end)
+    {
+      FileSize count = 0;
+      if (offset < this->_central.front())
+      {
+        auto it = std::upper_bound(
+          this->_entries.begin(), this->_entries.end(), offset,
+          [] (FileOffset offset, Entry const& entry)
+          {
+            return offset < entry.offset;
+          });
+        auto& entry = *(it - 1);
+        auto content = entry.offset + this->_header_size(entry);
+        if (offset < content)
+          count = copy(this->_local_header(entry), entry.offset);
+        else if (offset < content + entry.size)
+        {
+          count = std::min(content + entry.size, end) - offset;
+          this->_content(entry, offset - content, count, output);
+        }
+        else
+          count = copy(this->_descriptor(entry), content + entry.size);
+      }
+      else
+      {
+        auto it = std::upper_bound(
+          this->_central.begin(), this->_central.end(), offset);
+        auto index = it - 1 - this->_central.begin();
+        if (std::size_t(index) < this->_entries.size())
+          count = copy(this->_central_header(this->_entries[index]),
+                       this->_central[index]);
+        else
+          count = copy(this->_end(), this->_central.back());
+      }
+      offset += count;
+      output += count;
+    }
+    return res;
+  }
+
+  void
+  ZipStream::_content(Entry& entry,
+                      FileOffset offset,
+                      FileSize size,
+                      unsigned char* output)
+  {
+    if ((entry.mode & 0170000) != mode_file)
+    {
+      memcpy(output, entry.target.data() + offset, size);
+      return;
+    }
+    auto buffer = this->_open(entry).read(offset, size);
+    if (buffer.size() != size)
+      throw boost::filesystem::filesystem_error(
+        elle::sprintf("file size changed while archiving: %s bytes read "
+                      "at offset %s, %s expected",
+                      buffer.size(), offset, size),
+        entry.source,
+        boost::system::errc::make_error_code(
+          boost::system::errc::file_too_large));
+    memcpy(output, buffer.contents(), size);
+    // Sequential reads hash the content on the fly.
+    if (offset == entry.hashed)
+      this->_hash(entry, buffer.contents(), size);
+  }
+
+  ZipStream::Checksum
+  ZipStream::_checksum(Entry& entry)
+  {
+    if (entry.hashed < entry.size)
+    {
+      ELLE_TRACE("%s: read %s again to compute its checksum from %s",
+                 *this, entry.source, entry.hashed);
+      // Use a handle of our own, the shared one may be reopened by
+      // another read while this one is in the background.
+      elle::system::FileHandle handle(
+        entry.source, elle::system::FileHandle::READ);
+      while (entry.hashed < entry.size)
+      {
+        auto size = std::min(entry.size - entry.hashed, rehash_chunk);
+        auto offset = entry.hashed;
+        elle::Buffer buffer;
+        reactor::background(
+          [&]
+          {
+            buffer = handle.read(offset, size);
+          });
+        if (buffer.size() != size)
+          throw boost::filesystem::filesystem_error(
+            "file size changed while archiving",
+            entry.source,
+            boost::system::errc::make_error_code(
+              boost::system::errc::file_too_large));
+        // Someone else may have hashed it meanwhile.
+        if (entry.hashed != offset)
+          continue;
+        this->_rehashed += size;
+        this->_hash(entry, buffer.contents(), size);
+      }
+    }
+    return entry.checksum;
+  }
+
+  void
+  ZipStream::_hash(Entry& entry, unsigned char const* data, FileSize size)
+  {
+    entry.checksum = ::crc32(entry.checksum, data, size);
+    entry.hashed += size;
+    if (entry.hashed == entry.size)
+      this->_advance();
+  }
+
+  void
+  ZipStream::_advance()
+  {
+    while (this->_checksums.size() < this->_entries.size())
+    {
+      auto const& entry = this->_entries[this->_checksums.size()];
+      if (entry.hashed != entry.size)
+        break;
+      this->_checksums.push_back(entry.checksum);
+    }
+  }
+
+  elle::system::FileHandle&
+  ZipStream::_open(Entry const& entry)
+  {
+    std::size_t index = &entry - this->_entries.data();
+    if (this->_handle == nullptr || this->_handle_entry != index)
+    {
+      this->_handle.reset();
+      this->_handle = elle::make_unique<elle::system::FileHandle>(
+        entry.source, elle::system::FileHandle::READ);
+      this->_handle_entry = index;
+    }
+    return *this->_handle;
+  }
+
+  /*----------.
+  | Printable |
+  `----------*/
+
+  void
+  ZipStream::print(std::ostream& stream) const
+  {
+    elle::fprintf(stream, "ZipStream(%s, %s entries, %s bytes)",
+                  this->_path, this->_entries.size(), this->_size);
+  }
+}
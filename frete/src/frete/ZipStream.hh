@@ -0,0 +1,135 @@
+#ifndef FRETE_ZIP_STREAM_HH
+# define FRETE_ZIP_STREAM_HH
+
+# include <memory>
+# include <string>
+# include <vector>
+
+# include <boost/filesystem/operations.hpp>
+# include <boost/filesystem/path.hpp>
+
+# include <elle/Buffer.hh>
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+# include <elle/system/system.hh>
+
+# include <frete/Frete.hh>
+
+namespace frete
+{
+  /// An uncompressed zip archive of a directory, generated as it is read.
+  ///
+  /// The layout is computed from a listing of the directory, so the size and
+  /// any range of the archive are known without writing it anywhere. Symlinks
+  /// are stored as links. Entry checksums are only known once their data was
+  /// read, so they follow each entry in a data descriptor; the checksums of
+  /// the leading entries can be given back to resume a partial read.
+  class ZipStream:
+    public elle::Printable
+  {
+  /*------.
+  | Types |
+  `------*/
+  public:
+    typedef ZipStream Self;
+    typedef Frete::FileOffset FileOffset;
+    typedef Frete::FileSize FileSize;
+    typedef uint32_t Checksum;
+    typedef std::vector<Checksum> Checksums;
+
+  /*-------------.
+  | Construction |
+  `-------------*/
+  public:
+    /// List path, entries being named relative to its parent. The checksums
+    /// of the first entries, as previously returned by checksums(), spare
+    /// reading them again.
+    ZipStream(boost::filesystem::path const& path,
+              Checksums const& checksums = Checksums());
+    ~ZipStream();
+    ELLE_ATTRIBUTE_R(boost::filesystem::path, path);
+    /// The size of the whole archive.
+    ELLE_ATTRIBUTE_R(FileSize, size);
+    /// Whether the archive fits in zip limits without the zip64 extensions.
+    ELLE_ATTRIBUTE_R(bool, streamable);
+
+  /*-------.
+  | Layout |
+  `-------*/
+  private:
+    struct Entry
+    {
+      /// Name in the archive, directories ending with a slash.
+      std::string name;
+      boost::filesystem::path source;
+      /// Target of a symlink, stored as its content.
+      std::string target;
+      FileSize size;
+      uint32_t mode;
+      uint16_t time;
+      uint16_t date;
+      /// Offset of the local header in the archive.
+      FileOffset offset;
+      /// Checksum of the first hashed bytes of the content.
+      Checksum checksum;
+      FileSize hashed;
+    };
+    void
+    _list(boost::filesystem::path const& path,
+          std::string const& name,
+          boost::filesystem::file_status const& status);
+    FileSize
+    _header_size(Entry const& entry) const;
+    elle::Buffer
+    _local_header(Entry const& entry) const;
+    elle::Buffer
+    _descriptor(Entry& entry);
+    elle::Buffer
+    _central_header(Entry& entry);
+    elle::Buffer
+    _end() const;
+    ELLE_ATTRIBUTE(std::vector<Entry>, entries);
+    /// Offset of each central directory header, then of the end record.
+    ELLE_ATTRIBUTE(std::vector<FileOffset>, central);
+
+  /*-----.
+  | Read |
+  `-----*/
+  public:
+    /// The bytes of the archive in [offset, offset + size).
+    elle::Buffer
+    read(FileOffset offset, FileSize size);
+    /// Checksums of the leading entries whose content was fully read.
+    ELLE_ATTRIBUTE_R(Checksums, checksums);
+    /// Bytes read again only to compute a checksum.
+    ELLE_ATTRIBUTE_R(FileSize, rehashed);
+  private:
+    /// Copy [offset, offset + size) of the entry content into output.
+    void
+    _content(Entry& entry,
+             FileOffset offset,
+             FileSize size,
+             unsigned char* output);
+    /// The checksum of the whole content, reading what's missing.
+    Checksum
+    _checksum(Entry& entry);
+    void
+    _hash(Entry& entry, unsigned char const* data, FileSize size);
+    /// Extend checksums with the entries completely hashed.
+    void
+    _advance();
+    elle::system::FileHandle&
+    _open(Entry const& entry);
+    ELLE_ATTRIBUTE(std::size_t, handle_entry);
+    ELLE_ATTRIBUTE(std::unique_ptr<elle::system::FileHandle>, handle);
+
+  /*----------.
+  | Printable |
+  `----------*/
+  public:
+    void
+    print(std::ostream& stream) const override;
+  };
+}
+
+#endif
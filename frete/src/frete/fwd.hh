@@ -3,9 +3,32 @@
 
 namespace frete
 {
+  class BufferPool;
+  class CryptoPool;
+  class DirectoryScan;
+  class DiskWriter;
+  class FetchController;
+  class FileWriter;
   class Frete;
+  class HandleCache;
+  class MappedFile;
+  class ReadAhead;
   class RPCFrete;
+  class SnapshotJournal;
+  class SourceScheduler;
   class TransferSnapshot;
+  class ZipStream;
+
+  namespace checksum
+  {
+    struct Part;
+  }
+
+  namespace dedup
+  {
+    class Hasher;
+    class Index;
+  }
 }
 
 #endif
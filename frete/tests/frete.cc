@@ -1,9 +1,13 @@
+#include <map>
+
 #include <boost/filesystem/fstream.hpp>
 
 #include <elle/Buffer.hh>
 #include <elle/filesystem/TemporaryFile.hh>
 #include <elle/finally.hh>
 #include <elle/log.hh>
+#include <elle/serialization/json/SerializerIn.hh>
+#include <elle/serialization/json/SerializerOut.hh>
 #include <elle/test.hh>
 
 #include <reactor/Barrier.hh>
@@ -18,8 +22,26 @@
 #include <protocol/ChanneledStream.hh>
 #include <protocol/Serializer.hh>
 
+#include <frete/BufferPool.hh>
+#include <frete/Bundle.hh>
+#include <frete/Checksum.hh>
+#include <frete/Compression.hh>
+#include <frete/CryptoPool.hh>
+#include <frete/Dedup.hh>
+#include <frete/DirectoryScan.hh>
+#include <frete/DiskWriter.hh>
+#include <frete/Encoding.hh>
+#include <frete/FetchController.hh>
+#include <frete/FileWriter.hh>
 #include <frete/Frete.hh>
+#include <frete/HandleCache.hh>
+#include <frete/ReadAhead.hh>
 #include <frete/RPCFrete.hh>
+#include <frete/SnapshotJournal.hh>
+#include <frete/SourceScheduler.hh>
+#include <frete/Sparse.hh>
+#include <frete/TransferSnapshot.hh>
+#include <frete/ZipStream.hh>
 
 ELLE_LOG_COMPONENT("frete.tests");
 
@@ -206,6 +228,17 @@ ELLE_TEST_SCHEDULED(connection)
       auto infos = rpcs.transfer_info();
       BOOST_CHECK_EQUAL(rpcs.count(), infos.count());
       BOOST_CHECK_EQUAL(rpcs.files_info(), infos.files_info());
+      {
+        ELLE_DEBUG("read the files a page at a time");
+        frete::Frete::FilesInfo pages;
+        for (frete::Frete::FileID start = 0; start < 8; start += 4)
+        {
+          auto page = rpcs.files_info_page(start, 4);
+          pages.insert(pages.end(), page.begin(), page.end());
+        }
+        BOOST_CHECK_EQUAL(pages, infos.files_info());
+        BOOST_CHECK(rpcs.files_info_page(6, 4).empty());
+      }
       BOOST_CHECK_EQUAL(rpcs.full_size(), infos.full_size());
       BOOST_CHECK_EQUAL(rpcs.count(), 6);
       {
@@ -290,6 +323,34 @@ ELLE_TEST_SCHEDULED(connection)
           BOOST_CHECK_EQUAL(buffer, elle::ConstWeakBuffer("stuff again\n"));
         }
       }
+      ELLE_DEBUG("read blocks across files in one request")
+      {
+        frete::Frete::Positions positions{{1, 0}, {1, 4}, {4, 0}, {5, 4}};
+        auto codes = rpcs.encrypted_read_range(positions, 4, 0, false);
+        BOOST_CHECK_EQUAL(codes.size(), 4);
+        BOOST_CHECK_EQUAL(key.legacy_decrypt_buffer(codes[0]),
+                          elle::ConstWeakBuffer("cont"));
+        BOOST_CHECK_EQUAL(key.legacy_decrypt_buffer(codes[1]),
+                          elle::ConstWeakBuffer("ent\n"));
+        BOOST_CHECK_EQUAL(key.legacy_decrypt_buffer(codes[2]),
+                          elle::ConstWeakBuffer("stuf"));
+        BOOST_CHECK_EQUAL(key.legacy_decrypt_buffer(codes[3]),
+                          elle::ConstWeakBuffer("f ag"));
+      }
+      ELLE_DEBUG("read whole files in one request")
+      {
+        auto payload = key.legacy_decrypt_buffer(
+          rpcs.encrypted_read_files({1, 4, 5}, 0, false));
+        auto files = frete::bundle::unpack(payload);
+        BOOST_CHECK_EQUAL(files.size(), 3);
+        BOOST_CHECK_EQUAL(files[0], elle::ConstWeakBuffer("content\n"));
+        BOOST_CHECK_EQUAL(files[1], elle::ConstWeakBuffer("stuff\n"));
+        BOOST_CHECK_EQUAL(files[2], elle::ConstWeakBuffer("stuff again\n"));
+        BOOST_CHECK_THROW(
+          frete::bundle::unpack(
+            elle::ConstWeakBuffer(payload.contents(), payload.size() - 1)),
+          elle::Exception);
+      }
       ELLE_DEBUG("check errors")
       {
         BOOST_CHECK_THROW(rpcs.path(6), std::runtime_error);
@@ -324,10 +385,1034 @@ ELLE_TEST_SCHEDULED(invalid_snapshot)
   frete.key_code();
 }
 
+// Bundled files that grew since they were added are rejected.
+ELLE_TEST_SCHEDULED(read_files_grown)
+{
+  auto keys = infinit::cryptography::rsa::keypair::generate(2048);
+  elle::filesystem::TemporaryFile snapshot("frete.snapshot");
+  elle::filesystem::TemporaryFile content("content");
+  {
+    boost::filesystem::ofstream output(content.path());
+    output << "content";
+  }
+  frete::Frete frete("password", keys, snapshot.path(), "", false);
+  frete.add(content.path());
+  frete.encrypted_read_files({0}, 0, false);
+  {
+    boost::filesystem::ofstream output(content.path(), std::ios::app);
+    output << " grew";
+  }
+  BOOST_CHECK_THROW(frete.encrypted_read_files({0}, 0, false),
+                    boost::filesystem::filesystem_error);
+}
+
+ELLE_TEST_SCHEDULED(read_ahead)
+{
+  auto keys = infinit::cryptography::rsa::keypair::generate(2048);
+  elle::filesystem::TemporaryFile snapshot("frete.snapshot");
+  elle::filesystem::TemporaryFile content("content");
+  {
+    boost::filesystem::ofstream output(content.path(), std::ios::binary);
+    for (int i = 0; i < 64; ++i)
+      output << std::string(16, 'a' + i % 26);
+  }
+  frete::Frete frete("password", keys, snapshot.path(), "", false);
+  BOOST_REQUIRE(frete.read_ahead());
+  frete.add(content.path());
+  for (int i = 0; i < 64; ++i)
+  {
+    auto buffer = frete.cleartext_read(0, i * 16, 16);
+    BOOST_CHECK_EQUAL(buffer,
+                      elle::ConstWeakBuffer(std::string(16, 'a' + i % 26)));
+    // Let the prefetcher load the following windows.
+    reactor::wait(frete.read_ahead()->idle());
+  }
+  BOOST_CHECK_EQUAL(frete.read_ahead()->hits() + frete.read_ahead()->misses(),
+                    64);
+  BOOST_CHECK_EQUAL(frete.read_ahead()->hits(), 63);
+}
+
+// A full pool does not stall prefetching after a backward seek.
+ELLE_TEST_SCHEDULED(read_ahead_seek_back)
+{
+  auto keys = infinit::cryptography::rsa::keypair::generate(2048);
+  elle::filesystem::TemporaryFile snapshot("frete.snapshot");
+  elle::filesystem::TemporaryFile content("content");
+  {
+    boost::filesystem::ofstream output(content.path(), std::ios::binary);
+    for (int i = 0; i < 16; ++i)
+      output << std::string(16, 'a' + i);
+  }
+  frete::Frete frete("password", keys, snapshot.path(), "", false);
+  frete.add(content.path());
+  // Room for exactly the two windows ahead of the reader.
+  frete::ReadAhead read_ahead(
+    *frete.transfer_snapshot(),
+    [&] (frete::Frete::FileID) { return content.path(); },
+    2, 32);
+  auto fetch = [&] (int i)
+    {
+      auto res = read_ahead.fetch(0, i * 16, 16);
+      reactor::wait(read_ahead.idle());
+      return res;
+    };
+  for (int i = 0; i < 8; ++i)
+    fetch(i);
+  BOOST_CHECK_EQUAL(read_ahead.hits(), 7);
+  BOOST_CHECK(!fetch(0));
+  auto buffer = fetch(1);
+  BOOST_REQUIRE(buffer);
+  BOOST_CHECK_EQUAL(buffer.get(), elle::ConstWeakBuffer(std::string(16, 'b')));
+  BOOST_CHECK(fetch(2));
+}
+
+ELLE_TEST_SCHEDULED(mapped_read)
+{
+  auto keys = infinit::cryptography::rsa::keypair::generate(2048);
+  auto peer_keys = infinit::cryptography::rsa::keypair::generate(2048);
+  elle::filesystem::TemporaryFile snapshot("frete.snapshot");
+  elle::filesystem::TemporaryFile content("content");
+  int const chunk = 1 << 18;
+  int const chunks = 64;
+  {
+    boost::filesystem::ofstream output(content.path(), std::ios::binary);
+    for (int i = 0; i < chunks; ++i)
+      output << std::string(chunk, 'a' + i % 26);
+  }
+  frete::Frete frete("password", keys, snapshot.path(), "", false);
+  frete.set_peer_key(peer_keys.K());
+  frete.add(content.path());
+  auto key = peer_keys.k().decrypt<infinit::cryptography::SecretKey>(
+    frete.key_code());
+  // Compare both read paths, and log their throughput.
+  for (bool mapped: {false, true})
+  {
+    frete.mapped_read(mapped);
+    auto start = boost::posix_time::microsec_clock::universal_time();
+    for (int i = 0; i < chunks; ++i)
+    {
+      auto buffer =
+        key.legacy_decrypt_buffer(frete.encrypted_read(0, i * chunk, chunk));
+      BOOST_CHECK_EQUAL(
+        buffer, elle::ConstWeakBuffer(std::string(chunk, 'a' + i % 26)));
+    }
+    auto duration = boost::posix_time::microsec_clock::universal_time() - start;
+    ELLE_LOG("%s read: %s MiB in %s",
+             mapped ? "mapped" : "buffered", chunks * chunk >> 20, duration);
+  }
+}
+
+// Files truncated while sent are read without mapping past their end.
+ELLE_TEST_SCHEDULED(mapped_read_truncated)
+{
+  auto keys = infinit::cryptography::rsa::keypair::generate(2048);
+  auto peer_keys = infinit::cryptography::rsa::keypair::generate(2048);
+  elle::filesystem::TemporaryFile snapshot("frete.snapshot");
+  elle::filesystem::TemporaryFile content("content");
+  int const chunk = 1 << 18;
+  int const chunks = 32;
+  {
+    boost::filesystem::ofstream output(content.path(), std::ios::binary);
+    for (int i = 0; i < chunks; ++i)
+      output << std::string(chunk, 'a' + i % 26);
+  }
+  frete::Frete frete("password", keys, snapshot.path(), "", false);
+  frete.set_peer_key(peer_keys.K());
+  frete.add(content.path());
+  frete.mapped_read(true);
+  auto key = peer_keys.k().decrypt<infinit::cryptography::SecretKey>(
+    frete.key_code());
+  auto read = [&] (int i)
+    {
+      return key.legacy_decrypt_buffer(
+        frete.encrypted_read(0, i * chunk, chunk));
+    };
+  BOOST_CHECK_EQUAL(read(0), elle::ConstWeakBuffer(std::string(chunk, 'a')));
+  boost::filesystem::resize_file(content.path(), chunks / 2 * chunk);
+  // Chunks still there are read, those truncated are empty.
+  BOOST_CHECK_EQUAL(read(1), elle::ConstWeakBuffer(std::string(chunk, 'b')));
+  BOOST_CHECK_EQUAL(read(chunks - 1).size(), 0);
+}
+
+ELLE_TEST_SCHEDULED(handle_cache)
+{
+  std::vector<std::unique_ptr<elle::filesystem::TemporaryFile>> files;
+  for (int i = 0; i < 4; ++i)
+  {
+    files.emplace_back(new elle::filesystem::TemporaryFile("content"));
+    boost::filesystem::ofstream output(files.back()->path());
+    output << i;
+  }
+  frete::HandleCache cache(2);
+  auto first = cache.open(files[0]->path());
+  cache.open(files[1]->path());
+  // Touch the first file so the second one is the least recently used.
+  BOOST_CHECK_EQUAL(cache.open(files[0]->path()), first);
+  BOOST_CHECK_EQUAL(cache.hits(), 1);
+  cache.open(files[2]->path());
+  BOOST_CHECK_EQUAL(cache.size(), 2);
+  BOOST_CHECK_EQUAL(cache.evicted(), 1);
+  BOOST_CHECK_EQUAL(cache.open(files[0]->path()), first);
+  cache.open(files[1]->path());
+  BOOST_CHECK_EQUAL(cache.opened(), 4);
+  BOOST_CHECK_EQUAL(cache.evicted(), 2);
+  // Evicted handles stay usable by their holders.
+  cache.open(files[3]->path());
+  BOOST_CHECK_EQUAL(first->read(0, 1), elle::ConstWeakBuffer("0"));
+}
+
+ELLE_TEST_SCHEDULED(crypto_pool)
+{
+  auto key = infinit::cryptography::secretkey::generate(
+    2048,
+    infinit::cryptography::Cipher::aes256,
+    infinit::cryptography::Mode::cbc);
+  int const chunk = 1 << 18;
+  int const chunks = 32;
+  std::vector<elle::Buffer> buffers;
+  std::vector<elle::ConstWeakBuffer> views;
+  for (int i = 0; i < chunks; ++i)
+  {
+    buffers.emplace_back(chunk);
+    memset(buffers.back().mutable_contents(), 'a' + i % 26, chunk);
+    views.emplace_back(buffers.back().contents(), buffers.back().size());
+  }
+  // Log throughput against the number of workers.
+  int const max = std::max(frete::CryptoPool::default_workers(), 2);
+  for (int workers = 1; workers <= max; workers *= 2)
+  {
+    frete::CryptoPool pool(workers);
+    auto start = boost::posix_time::microsec_clock::universal_time();
+    auto codes = pool.encrypt(key, views);
+    auto duration = boost::posix_time::microsec_clock::universal_time() - start;
+    ELLE_LOG("%s workers: encrypted %s MiB in %s",
+             workers, chunks * chunk >> 20, duration);
+    BOOST_CHECK_EQUAL(pool.jobs(), chunks);
+    BOOST_REQUIRE_EQUAL(codes.size(), chunks);
+    // Results come back in submission order.
+    for (int i = 0; i < chunks; ++i)
+      BOOST_CHECK_EQUAL(pool.decrypt(key, codes[i]), buffers[i]);
+  }
+}
+
+ELLE_TEST_SCHEDULED(compression)
+{
+  int const chunk = 1 << 18;
+  // Text compresses well and is sent compressed.
+  elle::Buffer text;
+  while (text.size() < chunk)
+    text.append("time,level,message\n", 20);
+  auto packed = frete::compression::pack(text);
+  BOOST_CHECK_EQUAL(packed[0], uint8_t(frete::compression::Flag::zlib));
+  BOOST_CHECK_LT(packed.size(), text.size() / 4);
+  BOOST_CHECK_EQUAL(frete::compression::unpack(packed), text);
+  // Random data is detected as incompressible and sent raw.
+  elle::Buffer noise(chunk);
+  for (int i = 0; i < chunk; ++i)
+    noise.mutable_contents()[i] = std::rand();
+  BOOST_CHECK(!frete::compression::worth(noise));
+  packed = frete::compression::pack(noise);
+  BOOST_CHECK_EQUAL(packed[0], uint8_t(frete::compression::Flag::raw));
+  BOOST_CHECK_EQUAL(packed.size(), noise.size() + 1);
+  BOOST_CHECK_EQUAL(frete::compression::unpack(packed), noise);
+  BOOST_CHECK_EQUAL(
+    frete::compression::unpack(frete::compression::pack(elle::Buffer())),
+    elle::Buffer());
+}
+
+ELLE_TEST_SCHEDULED(directory_scan)
+{
+  DummyHierarchy hierarchy;
+  {
+    frete::DirectoryScan scan({hierarchy.root(), hierarchy.content()}, 4);
+    BOOST_REQUIRE_EQUAL(scan.sources().size(), 2);
+    auto const& root = scan.sources()[0];
+    BOOST_CHECK(root.directory);
+    BOOST_CHECK(!root.symlink);
+    BOOST_REQUIRE_EQUAL(root.files.size(), 6);
+    BOOST_CHECK_EQUAL(root.size, 28);
+    for (auto const& file: root.files)
+    {
+      BOOST_CHECK_EQUAL(file.root, hierarchy.root().parent_path());
+      BOOST_CHECK_EQUAL(file.size,
+                        boost::filesystem::file_size(file.root / file.path));
+    }
+    BOOST_CHECK_EQUAL(root.files[0].path,
+                      hierarchy.root().filename() / "content");
+    auto const& content = scan.sources()[1];
+    BOOST_CHECK(!content.directory);
+    BOOST_REQUIRE_EQUAL(content.files.size(), 1);
+    BOOST_CHECK_EQUAL(content.files[0].path, "content");
+    BOOST_CHECK_EQUAL(scan.total_size(), 36);
+  }
+#ifndef INFINIT_WINDOWS
+  boost::filesystem::create_symlink(hierarchy.content(),
+                                    hierarchy.dir() / "link");
+  {
+    frete::DirectoryScan scan({hierarchy.root()});
+    BOOST_CHECK(scan.sources()[0].symlink);
+  }
+#endif
+  BOOST_CHECK_THROW(frete::DirectoryScan({hierarchy.root() / "nope"}),
+                    elle::Exception);
+}
+
+ELLE_TEST_SCHEDULED(zip_stream)
+{
+  DummyHierarchy hierarchy;
+  int entries = 8;
+#ifndef INFINIT_WINDOWS
+  boost::filesystem::create_symlink("../content", hierarchy.dir() / "link");
+  ++entries;
+#endif
+  auto read_backward = [] (frete::ZipStream& stream,
+                           frete::ZipStream::FileSize chunk)
+    {
+      elle::Buffer res(stream.size());
+      for (auto end = stream.size(); end > 0;)
+      {
+        auto offset = end > chunk ? end - chunk : 0;
+        auto buffer = stream.read(offset, end - offset);
+        BOOST_REQUIRE_EQUAL(buffer.size(), end - offset);
+        memcpy(res.mutable_contents() + offset, buffer.contents(),
+               buffer.size());
+        end = offset;
+      }
+      return res;
+    };
+  frete::ZipStream stream(hierarchy.root());
+  BOOST_CHECK(stream.streamable());
+  auto archive = stream.read(0, stream.size() + 16);
+  BOOST_REQUIRE_EQUAL(archive.size(), stream.size());
+  BOOST_CHECK_EQUAL(elle::ConstWeakBuffer(archive.contents(), 4),
+                    elle::ConstWeakBuffer("PK\x03\x04", 4));
+  auto end = archive.contents() + archive.size() - 22;
+  BOOST_CHECK_EQUAL(elle::ConstWeakBuffer(end, 4),
+                    elle::ConstWeakBuffer("PK\x05\x06", 4));
+  BOOST_CHECK_EQUAL(end[10] | end[11] << 8, entries);
+  // Read sequentially, every checksum was computed on the fly.
+  BOOST_CHECK_EQUAL(stream.checksums().size(), entries);
+  BOOST_CHECK_EQUAL(stream.rehashed(), 0);
+  {
+    // The central directory comes first, files are read again.
+    frete::ZipStream backward(hierarchy.root());
+    BOOST_CHECK_EQUAL(read_backward(backward, 7), archive);
+    BOOST_CHECK_EQUAL(backward.rehashed(), 28);
+  }
+  {
+    // Resuming with the checksums spares that.
+    frete::ZipStream resumed(hierarchy.root(), stream.checksums());
+    BOOST_CHECK_EQUAL(read_backward(resumed, 7), archive);
+    BOOST_CHECK_EQUAL(resumed.rehashed(), 0);
+  }
+#ifndef INFINIT_WINDOWS
+  // Served by frete as a single file, resumed from its snapshot.
+  auto keys = infinit::cryptography::rsa::keypair::generate(2048);
+  elle::filesystem::TemporaryFile snapshot("frete.snapshot");
+  auto half = archive.size() / 2;
+  elle::Buffer served;
+  {
+    frete::Frete frete("password", keys, snapshot.path(), "", false);
+    frete.add(hierarchy.root());
+    BOOST_REQUIRE_EQUAL(frete.count(), 1);
+    BOOST_CHECK_EQUAL(frete.path(0),
+                      hierarchy.root().filename().string() + ".zip");
+    BOOST_CHECK_EQUAL(frete.file_size(0), archive.size());
+    served.append(frete.cleartext_read(0, 0, half).contents(), half);
+    frete.save_snapshot();
+  }
+  {
+    frete::Frete frete("password", keys, snapshot.path(), "", false);
+    BOOST_REQUIRE_EQUAL(frete.count(), 1);
+    auto rest = frete.cleartext_read(0, half, archive.size() - half);
+    served.append(rest.contents(), rest.size());
+  }
+  BOOST_CHECK_EQUAL(served, archive);
+#endif
+}
+
+// Senders hash the files the recipient may have.
+ELLE_TEST_SCHEDULED(file_hashes)
+{
+  auto keys = infinit::cryptography::rsa::keypair::generate(2048);
+  auto peer_keys = infinit::cryptography::rsa::keypair::generate(2048);
+  elle::filesystem::TemporaryFile snapshot("frete.snapshot");
+  elle::filesystem::TemporaryFile first("first");
+  elle::filesystem::TemporaryFile second("second");
+  elle::filesystem::TemporaryFile third("third");
+  for (auto const& path: {first.path(), second.path()})
+  {
+    boost::filesystem::ofstream output(path);
+    output << "duplicated content";
+  }
+  {
+    boost::filesystem::ofstream output(third.path());
+    output << "different content";
+  }
+  frete::Frete frete("password", keys, snapshot.path(), "", false);
+  frete.set_peer_key(peer_keys.K());
+  for (auto const& path: {first.path(), second.path(), third.path()})
+    frete.add(path);
+  auto key = peer_keys.k().decrypt<infinit::cryptography::SecretKey>(
+    frete.key_code());
+  auto hashes = frete::dedup::unpack(
+    key.legacy_decrypt_buffer(frete.encrypted_file_hashes({0, 1, 2})));
+  BOOST_CHECK_EQUAL(hashes.size(), 3);
+  BOOST_CHECK_EQUAL(hashes[0], frete::dedup::hash(first.path()));
+  BOOST_CHECK_EQUAL(hashes[1], hashes[0]);
+  BOOST_CHECK_NE(hashes[2], hashes[0]);
+  // Hashes are kept in the snapshot.
+  BOOST_CHECK(frete.transfer_snapshot()->file(2).hash());
+}
+
+ELLE_TEST_SCHEDULED(dedup)
+{
+  elle::filesystem::TemporaryFile first("first");
+  elle::filesystem::TemporaryFile second("second");
+  for (auto const& path: {first.path(), second.path()})
+  {
+    boost::filesystem::ofstream output(path);
+    output << "duplicated content";
+  }
+  auto hash = frete::dedup::hash(first.path());
+  BOOST_CHECK_EQUAL(hash.size(), 64);
+  BOOST_CHECK_EQUAL(frete::dedup::hash(second.path()), hash);
+  {
+    frete::dedup::Hasher hasher;
+    hasher.update(elle::ConstWeakBuffer("duplicated "));
+    hasher.update(elle::ConstWeakBuffer("content"));
+    BOOST_CHECK_EQUAL(hasher.size(), 18);
+    BOOST_CHECK_EQUAL(hasher.digest(), hash);
+  }
+  frete::dedup::Hashes hashes{hash, "", hash};
+  BOOST_CHECK(frete::dedup::unpack(frete::dedup::pack(hashes)) == hashes);
+  BOOST_CHECK_THROW(frete::dedup::unpack(elle::ConstWeakBuffer("abc")),
+                    elle::Exception);
+  // Copy duplicates.
+  elle::filesystem::TemporaryFile copy("copy");
+  frete::dedup::copy(first.path(), copy.path(), 18);
+  BOOST_CHECK(compare_files(first.path(), copy.path(), false));
+  BOOST_CHECK_THROW(frete::dedup::copy(first.path(), copy.path(), 17),
+                    boost::filesystem::filesystem_error);
+  // Remember received files across sessions.
+  elle::filesystem::TemporaryFile index_path("dedup.index");
+  {
+    frete::dedup::Index index(index_path.path());
+    index.add(hash, first.path());
+    BOOST_CHECK(index.has_size(18));
+    BOOST_CHECK(!index.has_size(17));
+    BOOST_CHECK_EQUAL(index.find(hash, 18).get(), first.path());
+    BOOST_CHECK(!index.find(hash, 17));
+    index.save();
+  }
+  {
+    frete::dedup::Index index(index_path.path());
+    BOOST_CHECK_EQUAL(index.size(), 1);
+    BOOST_CHECK_EQUAL(index.find(hash, 18).get(), first.path());
+    // Modified files are not trusted anymore.
+    {
+      boost::filesystem::ofstream output(first.path());
+      output << "modified";
+    }
+    BOOST_CHECK(!index.find(hash, 18));
+  }
+  {
+    // The oldest files are evicted.
+    frete::dedup::Index index(index_path.path(), 1);
+    index.add(hash, second.path());
+    index.add(frete::dedup::hash(copy.path()) + "-", copy.path());
+    BOOST_CHECK_EQUAL(index.size(), 1);
+    BOOST_CHECK(!index.find(hash, 18));
+  }
+}
+
+ELLE_TEST_SCHEDULED(checksums)
+{
+  namespace checksum = frete::checksum;
+  auto keys = infinit::cryptography::rsa::keypair::generate(2048);
+  auto peer_keys = infinit::cryptography::rsa::keypair::generate(2048);
+  elle::filesystem::TemporaryFile snapshot("frete.snapshot");
+  elle::filesystem::TemporaryFile content("content");
+  auto const size = 3 * checksum::block_size + 1234;
+  elle::Buffer data(size);
+  for (unsigned i = 0; i < size; ++i)
+    data.mutable_contents()[i] = std::rand();
+  {
+    boost::filesystem::ofstream output(content.path(), std::ios::binary);
+    output.write(reinterpret_cast<char const*>(data.contents()), size);
+  }
+  auto expected = checksum::file(content.path(), 0, size);
+  BOOST_CHECK_EQUAL(expected.size(), 4);
+  BOOST_CHECK_EQUAL(checksum::blocks(size), 4);
+  // Spans of blocks checksum the same.
+  auto tail = checksum::file(content.path(), 2 * checksum::block_size, size);
+  BOOST_REQUIRE_EQUAL(tail.size(), 2);
+  BOOST_CHECK_EQUAL(tail[0], expected[2]);
+  BOOST_CHECK_EQUAL(tail[1], expected[3]);
+  BOOST_CHECK(checksum::unpack(checksum::pack(expected)) == expected);
+  // The recipient extends them as it writes, whatever the chunk size.
+  frete::TransferSnapshot received(1, size);
+  received.add(0, "root", "content", size);
+  unsigned const chunk = 300000;
+  for (unsigned offset = 0; offset < size; offset += chunk)
+    received.file_progress_increment(
+      0, elle::ConstWeakBuffer(data.contents() + offset,
+                               std::min<unsigned>(chunk, size - offset)));
+  BOOST_CHECK(received.file(0).checksums() == expected);
+  received.file_progress_verified(
+    0, checksum::block_size, checksum::Checksums{expected[0]});
+  BOOST_CHECK_EQUAL(received.file(0).progress(), checksum::block_size);
+  BOOST_CHECK_EQUAL(received.progress(), checksum::block_size);
+  // Progress without data loses them.
+  received.file_progress_increment(0, 1);
+  received.file_progress_increment(0, elle::ConstWeakBuffer("x", 1));
+  BOOST_CHECK(received.file(0).checksums().empty());
+  // The sender computes them for any prefix.
+  frete::Frete frete("password", keys, snapshot.path(), "", false);
+  frete.set_peer_key(peer_keys.K());
+  frete.add(content.path());
+  auto key = peer_keys.k().decrypt<infinit::cryptography::SecretKey>(
+    frete.key_code());
+  frete::CryptoPool pool(1);
+  auto remote = checksum::unpack(
+    pool.decrypt(key, frete.encrypted_file_checksums(0, size)));
+  BOOST_CHECK(remote == expected);
+  remote = checksum::unpack(
+    pool.decrypt(key, frete.encrypted_file_checksums(0, 1234)));
+  BOOST_REQUIRE_EQUAL(remote.size(), 1);
+  BOOST_CHECK_EQUAL(remote[0],
+                    checksum::update(0, elle::ConstWeakBuffer(data.contents(),
+                                                              1234)));
+}
+
+ELLE_TEST_SCHEDULED(sent_checksums)
+{
+  namespace checksum = frete::checksum;
+  auto keys = infinit::cryptography::rsa::keypair::generate(2048);
+  auto peer_keys = infinit::cryptography::rsa::keypair::generate(2048);
+  elle::filesystem::TemporaryFile snapshot("frete.snapshot");
+  elle::filesystem::TemporaryFile first("first");
+  elle::filesystem::TemporaryFile second("second");
+  elle::filesystem::TemporaryFile third("third");
+  auto const size = 2 * checksum::block_size + 1234;
+  elle::Buffer data(size);
+  for (unsigned i = 0; i < size; ++i)
+    data.mutable_contents()[i] = std::rand();
+  for (auto const& path: {first.path(), second.path(), third.path()})
+  {
+    boost::filesystem::ofstream output(path, std::ios::binary);
+    output.write(reinterpret_cast<char const*>(data.contents()), size);
+  }
+  frete::Frete frete("password", keys, snapshot.path(), "", false);
+  frete.set_peer_key(peer_keys.K());
+  frete.add(first.path());
+  frete.add(second.path());
+  frete.add(third.path());
+  auto key = peer_keys.k().decrypt<infinit::cryptography::SecretKey>(
+    frete.key_code());
+  // The first file is read in order, the second one skipping a chunk, the
+  // third one backward.
+  unsigned const chunk = 300000;
+  for (unsigned offset = 0; offset < size; offset += chunk)
+    frete.encrypted_read_acknowledge(0, offset, chunk, 0);
+  frete.encrypted_read_acknowledge(1, 0, chunk, 0);
+  frete.encrypted_read_acknowledge(1, 2 * chunk, chunk, 0);
+  for (int offset = (size - 1) / chunk * chunk; offset >= 0; offset -= chunk)
+    frete.encrypted_read_acknowledge(2, offset, chunk, 0);
+  // Modified after being read, the first and third files keep the sent
+  // checksums.
+  for (auto const& path: {first.path(), third.path()})
+  {
+    boost::filesystem::ofstream output(path, std::ios::binary);
+    output.write(reinterpret_cast<char const*>(data.contents()), size);
+    output.seekp(0);
+    output.write("x", 1);
+  }
+  frete::CryptoPool pool(1);
+  auto sent = checksum::unpack(
+    pool.decrypt(key, frete.encrypted_sent_checksums({0, 1, 2})));
+  auto expected = checksum::file(second.path(), 0, size);
+  BOOST_REQUIRE_EQUAL(sent.size(), 3 * expected.size());
+  for (int i = 0; i < 3; ++i)
+    BOOST_CHECK(
+      checksum::Checksums(sent.begin() + i * expected.size(),
+                          sent.begin() + (i + 1) * expected.size()) ==
+      expected);
+}
+
+ELLE_TEST_SCHEDULED(snapshot_journal)
+{
+  namespace checksum = frete::checksum;
+  elle::filesystem::TemporaryFile path("frete.snapshot");
+  auto const size = 3 * checksum::block_size;
+  elle::Buffer data(size);
+  for (unsigned i = 0; i < size; ++i)
+    data.mutable_contents()[i] = std::rand();
+  frete::TransferSnapshot snapshot(2, size + 10);
+  snapshot.add(0, "root", "big", size);
+  snapshot.add(1, "root", "small", 10);
+  unsigned const chunk = 300000;
+  {
+    frete::SnapshotJournal journal(
+      path.path(), frete::SnapshotJournal::Sync::always,
+      boost::posix_time::seconds(1), 16);
+    journal.save(snapshot);
+    for (unsigned offset = 0; offset < size; offset += chunk)
+    {
+      snapshot.file_progress_increment(
+        0, elle::ConstWeakBuffer(data.contents() + offset,
+                                 std::min<unsigned>(chunk, size - offset)));
+      journal.progress(snapshot, 0);
+    }
+    BOOST_CHECK_EQUAL(journal.compactions(), 0);
+    BOOST_CHECK_EQUAL(journal.records(), 11);
+    BOOST_CHECK_EQUAL(journal.syncs(), 11);
+  }
+  {
+    // A crash tore the last record.
+    boost::filesystem::ofstream output(path.path().string() + ".journal",
+                                       std::ios::binary | std::ios::app);
+    output << "torn";
+  }
+  {
+    frete::SnapshotJournal journal(path.path());
+    auto loaded = journal.load();
+    BOOST_REQUIRE(loaded);
+    BOOST_CHECK_EQUAL(loaded->progress(), size);
+    BOOST_CHECK_EQUAL(loaded->file(0).progress(), size);
+    BOOST_CHECK(loaded->file(0).checksums() == snapshot.file(0).checksums());
+    BOOST_CHECK_EQUAL(journal.records(), 0);
+  }
+  {
+    // The journal is folded in the base periodically.
+    frete::SnapshotJournal journal(
+      path.path(), frete::SnapshotJournal::Sync::never,
+      boost::posix_time::seconds(1), 4);
+    for (int i = 0; i < 10; ++i)
+    {
+      snapshot.file_progress_increment(1, elle::ConstWeakBuffer("x", 1));
+      journal.progress(snapshot, 1);
+    }
+    BOOST_CHECK_EQUAL(journal.compactions(), 2);
+    BOOST_CHECK_EQUAL(journal.records(), 0);
+    BOOST_CHECK_EQUAL(journal.syncs(), 0);
+    auto loaded = frete::SnapshotJournal(path.path()).load();
+    BOOST_CHECK_EQUAL(loaded->file(1).progress(), 10);
+    journal.remove();
+    BOOST_CHECK(!boost::filesystem::exists(path.path()));
+    BOOST_CHECK(!frete::SnapshotJournal(path.path()).load());
+  }
+  {
+    // Concurrent appends compact while a sync runs, and share it.
+    frete::SnapshotJournal journal(
+      path.path(), frete::SnapshotJournal::Sync::always,
+      boost::posix_time::seconds(1), 4);
+    journal.save(snapshot);
+    int const writers = 8;
+    int const appends = 16;
+    elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+    {
+      for (int i = 0; i < writers; ++i)
+        scope.run_background(
+          elle::sprintf("writer %s", i),
+          [&]
+          {
+            for (int j = 0; j < appends; ++j)
+              journal.progress(snapshot, 1);
+          });
+      reactor::wait(scope);
+    };
+    BOOST_CHECK_GT(journal.compactions(), 0);
+    BOOST_CHECK_LT(journal.syncs(),
+                   writers * appends - journal.compactions());
+    journal.remove();
+  }
+}
+
+ELLE_TEST_SCHEDULED(snapshot_positions)
+{
+  // Files of 0 to 9 bytes, in order.
+  frete::TransferSnapshot snapshot(false);
+  frete::TransferSnapshot::FileSize total = 0;
+  for (int i = 0; i < 100; ++i)
+  {
+    snapshot.add("root", elle::sprintf("file-%s", i), i % 10);
+    total += i % 10;
+  }
+  BOOST_CHECK_EQUAL(snapshot.total_size(), total);
+  frete::TransferSnapshot::FileSize position = 0;
+  for (int i = 0; i < 100; ++i)
+  {
+    BOOST_CHECK_EQUAL(snapshot.position(i, 0), position);
+    for (int offset = 0; offset < i % 10; ++offset)
+    {
+      auto p = snapshot.file_position(position + offset);
+      BOOST_CHECK_EQUAL(p.first, i);
+      BOOST_CHECK_EQUAL(p.second, offset);
+    }
+    position += i % 10;
+  }
+  BOOST_CHECK_EQUAL(snapshot.file_position(total).first, 100);
+  // Progress fills files in order, skipping complete ones.
+  snapshot.file_progress_end(2);
+  snapshot.progress_increment(4);
+  BOOST_CHECK_EQUAL(snapshot.file(1).progress(), 1);
+  BOOST_CHECK_EQUAL(snapshot.file(3).progress(), 3);
+  BOOST_CHECK_EQUAL(snapshot.file(4).progress(), 0);
+  snapshot.progress_increment(total - 6);
+  BOOST_CHECK_EQUAL(snapshot.progress(), total);
+  BOOST_CHECK_THROW(snapshot.progress_increment(1), elle::Exception);
+  // Files survive serialization in order.
+  std::stringstream stream;
+  {
+    elle::serialization::json::SerializerOut output(stream, false);
+    snapshot.serialize(output);
+  }
+  elle::serialization::json::SerializerIn input(stream, false);
+  frete::TransferSnapshot loaded(input);
+  BOOST_CHECK(loaded == snapshot);
+  BOOST_CHECK_EQUAL(loaded.file(42).path(), "file-42");
+  BOOST_CHECK_EQUAL(loaded.position(42, 1), snapshot.position(42, 1));
+  // Recipients add files in order.
+  frete::TransferSnapshot received(3, 10);
+  received.add(0, "root", "a", 5);
+  BOOST_CHECK_THROW(received.add(2, "root", "c", 5), elle::Exception);
+  received.add(1, "root", "b", 5);
+  BOOST_CHECK_EQUAL(received.file_count(), 2);
+}
+
+ELLE_TEST_SCHEDULED(out_of_order)
+{
+  elle::filesystem::TemporaryFile path("out-of-order");
+  unsigned const chunk = 4;
+  std::string const content = "0123456789";
+  frete::TransferSnapshot snapshot(1, content.size());
+  snapshot.add(0, "root", "file", content.size());
+  snapshot.file_progress_increment(0, elle::ConstWeakBuffer("01", 2));
+  // Switching to chunks keeps the whole chunks received.
+  BOOST_CHECK(snapshot.file_chunks(0, chunk));
+  BOOST_CHECK(!snapshot.file_chunks(0, chunk));
+  BOOST_CHECK_EQUAL(snapshot.file(0).progress(), 0);
+  {
+    frete::FileWriter writer(path.path());
+    writer.preallocate(content.size());
+    for (int offset = 8; offset >= 0; offset -= chunk)
+    {
+      auto size = std::min<unsigned>(chunk, content.size() - offset);
+      writer.write(offset,
+                   elle::ConstWeakBuffer(content.data() + offset, size));
+      BOOST_CHECK(snapshot.file_chunk_received(0, offset, size));
+      if (offset == 8)
+      {
+        BOOST_CHECK(snapshot.file(0).chunk_received(8));
+        BOOST_CHECK(!snapshot.file(0).chunk_received(4));
+        // Snapshots remember the chunks received.
+        std::stringstream stream;
+        {
+          elle::serialization::json::SerializerOut output(stream, false);
+          snapshot.serialize(output);
+        }
+        elle::serialization::json::SerializerIn input(stream, false);
+        frete::TransferSnapshot loaded(input);
+        BOOST_CHECK_EQUAL(loaded.file(0).chunk_size(), chunk);
+        BOOST_CHECK(loaded.file(0).received() == snapshot.file(0).received());
+        BOOST_CHECK_EQUAL(loaded.file(0).progress(), 2);
+      }
+    }
+    BOOST_CHECK(!snapshot.file_chunk_received(0, 4, chunk));
+  }
+  BOOST_CHECK(snapshot.file(0).complete());
+  BOOST_CHECK_EQUAL(boost::filesystem::file_size(path.path()), content.size());
+  boost::filesystem::ifstream input(path.path(), std::ios::binary);
+  std::string written{std::istreambuf_iterator<char>(input),
+                      std::istreambuf_iterator<char>()};
+  BOOST_CHECK_EQUAL(written, content);
+  // Back to sequential, the received prefix is kept.
+  snapshot.file_chunks(0, 0);
+  BOOST_CHECK_EQUAL(snapshot.file(0).progress(), content.size());
+}
+
+// Fetch over a link of some bandwidth, in bytes per second, and delay for
+// some time, keeping as many requests in flight as the controller says.
+static
+void
+simulate_fetch(frete::FetchController& controller,
+               double bandwidth,
+               boost::posix_time::time_duration delay,
+               boost::posix_time::time_duration duration)
+{
+  typedef boost::posix_time::ptime Time;
+  auto start = boost::posix_time::microsec_clock::universal_time();
+  auto now = start;
+  // Requests are sent back to back by the link.
+  auto link = start;
+  std::multimap<Time, std::pair<Time, frete::FetchController::FileSize>>
+    in_flight;
+  while (now < start + duration)
+  {
+    while (in_flight.size() < static_cast<unsigned>(controller.depth()))
+    {
+      auto size = controller.chunk_size() * controller.blocks();
+      link = std::max(link, now + delay) + boost::posix_time::microseconds(
+        static_cast<int64_t>(size / bandwidth * 1000000));
+      in_flight.emplace(link, std::make_pair(now, size));
+    }
+    auto next = in_flight.begin();
+    now = next->first;
+    controller.sample(next->second.second, now - next->second.first, now);
+    in_flight.erase(next);
+  }
+}
+
+ELLE_TEST_SCHEDULED(fetch_controller)
+{
+  auto const chunk_size = 1 << 18;
+  {
+    // Long fat links need bigger requests in flight.
+    frete::FetchController controller(8, chunk_size, 1, true, 64 << 20);
+    simulate_fetch(controller, 100e6, boost::posix_time::milliseconds(200),
+                   boost::posix_time::seconds(20));
+    BOOST_CHECK_GT(controller.adjustments(), 0);
+    BOOST_CHECK_GT(controller.chunk_size(), chunk_size);
+    BOOST_CHECK_GE(controller.depth() * controller.chunk_size(), 20e6);
+    BOOST_CHECK_GT(controller.goodput(), 90e6);
+    BOOST_CHECK_LE(controller.depth() * controller.chunk_size(), 64 << 20);
+  }
+  {
+    // Local links need little in flight.
+    frete::FetchController controller(8, chunk_size, 1, true, 64 << 20);
+    simulate_fetch(controller, 100e6, boost::posix_time::microseconds(500),
+                   boost::posix_time::seconds(20));
+    BOOST_CHECK_LT(controller.chunk_size(), chunk_size);
+    BOOST_CHECK_LT(controller.depth() * controller.chunk_size(), 8 * chunk_size);
+    BOOST_CHECK_GT(controller.goodput(), 90e6);
+  }
+  {
+    // Without chunk size tuning, only the depth changes.
+    frete::FetchController controller(8, chunk_size, 4, false, 64 << 20);
+    simulate_fetch(controller, 100e6, boost::posix_time::milliseconds(200),
+                   boost::posix_time::seconds(20));
+    BOOST_CHECK_EQUAL(controller.chunk_size(), chunk_size);
+    BOOST_CHECK_GT(controller.depth(), 8);
+  }
+}
+
+ELLE_TEST_SCHEDULED(disk_writer)
+{
+  elle::filesystem::TemporaryFile path("disk-writer");
+  std::string const content = "0123456789";
+  // A queue smaller than the content holds writers back.
+  frete::DiskWriter disk(4);
+  auto file = std::make_shared<frete::FileWriter>(path.path());
+  file->preallocate(content.size());
+  std::vector<frete::DiskWriter::Ticket> tickets;
+  // Data is hashed in the order queued.
+  auto hasher = std::make_shared<frete::dedup::Hasher>();
+  frete::dedup::Hasher expected;
+  for (int offset = 8; offset >= 0; offset -= 2)
+  {
+    tickets.push_back(
+      disk.write(file, offset,
+                 std::make_shared<elle::Buffer const>(
+                   content.data() + offset, 2),
+                 hasher));
+    expected.update(elle::ConstWeakBuffer(content.data() + offset, 2));
+    BOOST_CHECK_LE(disk.queued(), 4);
+  }
+  disk.wait(tickets.back());
+  BOOST_CHECK_EQUAL(hasher->size(), content.size());
+  BOOST_CHECK_EQUAL(hasher->digest(), expected.digest());
+  for (auto ticket: tickets)
+    BOOST_CHECK(disk.done(ticket));
+  BOOST_CHECK_EQUAL(disk.queued(), 0);
+  boost::filesystem::ifstream input(path.path(), std::ios::binary);
+  std::string written{std::istreambuf_iterator<char>(input),
+                      std::istreambuf_iterator<char>()};
+  BOOST_CHECK_EQUAL(written, content);
+#ifdef INFINIT_LINUX
+  // Failures are reported to whoever waits for the write.
+  auto full = std::make_shared<frete::FileWriter>("/dev/full");
+  auto failed = disk.write(full, 0, std::make_shared<elle::Buffer const>(
+                             content.data(), content.size()));
+  disk.flush(failed);
+  BOOST_CHECK_THROW(disk.wait(failed), boost::filesystem::filesystem_error);
+  // Errors are reported once.
+  disk.wait(failed);
+  BOOST_CHECK(full->failed());
+#endif
+}
+
+ELLE_TEST_SCHEDULED(encoding)
+{
+  using frete::encoding::Order;
+  elle::Buffer data;
+  frete::encoding::put_uint64(data, 0x0102030405060708);
+  frete::encoding::put_uint64(data, 0x0a0b0c0d, 4, Order::little);
+  BOOST_CHECK_EQUAL(data.size(), 12);
+  BOOST_CHECK_EQUAL(data[0], 0x01);
+  BOOST_CHECK_EQUAL(data[8], 0x0d);
+  std::size_t position = 0;
+  BOOST_CHECK_EQUAL(frete::encoding::get_uint64(data, position),
+                    0x0102030405060708);
+  BOOST_CHECK_EQUAL(
+    frete::encoding::get_uint64(data, position, 4, Order::little),
+    0x0a0b0c0d);
+  BOOST_CHECK_EQUAL(position, 12);
+  BOOST_CHECK_THROW(frete::encoding::get_uint64(data, position, 1),
+                    elle::Exception);
+  BOOST_CHECK_EQUAL(position, 12);
+  BOOST_CHECK_NO_THROW(frete::encoding::check_count(data, 4, 2, 4, "items"));
+  BOOST_CHECK_THROW(frete::encoding::check_count(data, 4, 3, 4, "items"),
+                    elle::Exception);
+}
+
+ELLE_TEST_SCHEDULED(sparse)
+{
+  frete::sparse::Extents holes{{1 << 16, 1 << 16}, {1 << 20, 1 << 18}};
+  BOOST_CHECK(!frete::sparse::find(holes, 0));
+  BOOST_CHECK(!frete::sparse::find(holes, (1 << 16) - 1));
+  BOOST_CHECK(frete::sparse::find(holes, 1 << 16) == holes[0]);
+  BOOST_CHECK(frete::sparse::find(holes, (1 << 17) - 1) == holes[0]);
+  BOOST_CHECK(!frete::sparse::find(holes, 1 << 17));
+  BOOST_CHECK(frete::sparse::find(holes, (1 << 20) + 1) == holes[1]);
+  BOOST_CHECK(!frete::sparse::find(holes, (1 << 20) + (1 << 18)));
+  std::vector<frete::sparse::Extents> files{holes, {}};
+  BOOST_CHECK(frete::sparse::unpack(frete::sparse::pack(files)) == files);
+  BOOST_CHECK_THROW(frete::sparse::unpack(elle::ConstWeakBuffer("abc", 3)),
+                    elle::Exception);
+#ifdef INFINIT_LINUX
+  // A file extended past its data ends with a hole, where supported.
+  elle::filesystem::TemporaryFile path("sparse");
+  frete::sparse::FileSize const size = 4 << 20;
+  {
+    frete::FileWriter file(path.path());
+    file.write(0, elle::ConstWeakBuffer("data", 4));
+    file.extend(size);
+  }
+  auto found = frete::sparse::holes(path.path(), size);
+  BOOST_CHECK_LE(found.size(), 1);
+  for (auto const& hole: found)
+  {
+    BOOST_CHECK_GE(hole.first, 4);
+    BOOST_CHECK_EQUAL(hole.first + hole.second, size);
+  }
+#endif
+}
+
+ELLE_TEST_SCHEDULED(buffer_pool)
+{
+  frete::BufferPool pool(1000);
+  auto first = pool.reserve(600);
+  BOOST_CHECK_EQUAL(pool.stats().used, 600);
+  bool reserved = false;
+  elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+  {
+    scope.run_background(
+      "waiter",
+      [&]
+      {
+        // Over the budget until the first reservation ends.
+        auto second = pool.reserve(600);
+        reserved = true;
+      });
+    reactor::yield();
+    reactor::yield();
+    BOOST_CHECK(!reserved);
+    first.reset();
+    reactor::wait(scope);
+  };
+  BOOST_CHECK(reserved);
+  auto stats = pool.stats();
+  BOOST_CHECK_EQUAL(stats.used, 0);
+  BOOST_CHECK_EQUAL(stats.peak, 600);
+  BOOST_CHECK_EQUAL(stats.reservations, 2);
+  BOOST_CHECK_EQUAL(stats.waits, 1);
+  // A reservation bigger than the budget goes through alone.
+  pool.reserve(2000);
+  // Released buffers are reused.
+  frete::BufferPool buffers(1 << 20);
+  auto buffer = buffers.buffer(100);
+  BOOST_CHECK_EQUAL(buffer->size(), 100);
+  auto contents = buffer->contents();
+  buffer.reset();
+  BOOST_CHECK_EQUAL(buffers.stats().cached, frete::BufferPool::slab_size);
+  buffer = buffers.buffer(200);
+  BOOST_CHECK_EQUAL(buffer->size(), 200);
+  BOOST_CHECK_EQUAL(buffer->contents(), contents);
+  BOOST_CHECK_EQUAL(buffers.stats().cached, 0);
+  BOOST_CHECK_EQUAL(buffers.stats().used, 200);
+}
+
+ELLE_TEST_SCHEDULED(source_scheduler)
+{
+  frete::SourceScheduler scheduler(1000);
+  auto peer = scheduler.add("peer");
+  auto cloud = scheduler.add("cloud");
+  // Unmeasured sources share the window evenly.
+  BOOST_CHECK_EQUAL(scheduler.share(peer), 0.5);
+  auto now = boost::posix_time::microsec_clock::universal_time();
+  auto second = boost::posix_time::seconds(1);
+  scheduler.start(peer, 100, now);
+  scheduler.start(cloud, 300, now);
+  scheduler.end(peer, 100, 100, now + second);
+  scheduler.end(cloud, 300, 300, now + second);
+  BOOST_CHECK_EQUAL(scheduler.goodput(peer), 100);
+  BOOST_CHECK_EQUAL(scheduler.goodput(cloud), 300);
+  // Shares follow the goodput.
+  BOOST_CHECK_EQUAL(scheduler.share(peer), 0.25);
+  BOOST_CHECK_EQUAL(scheduler.share(cloud), 0.75);
+  // A source can always have one request in flight.
+  BOOST_CHECK(scheduler.admit(peer, 2000));
+  scheduler.start(peer, 200, now);
+  BOOST_CHECK(!scheduler.admit(peer, 100));
+  scheduler.start(cloud, 500, now);
+  BOOST_CHECK(scheduler.admit(cloud, 200));
+  BOOST_CHECK(!scheduler.admit(cloud, 300));
+  // Blocks given back go to the others, first given first taken.
+  BOOST_CHECK(!scheduler.take_back());
+  scheduler.give_back({{0, 10}, {1, 20}});
+  scheduler.stop(cloud);
+  BOOST_CHECK(!scheduler.admit(cloud, 100));
+  BOOST_CHECK_EQUAL(scheduler.share(peer), 1);
+  BOOST_CHECK(scheduler.admit(peer, 2000));
+  BOOST_CHECK(scheduler.pending(peer));
+  BOOST_CHECK(!scheduler.pending(cloud));
+  BOOST_CHECK(*scheduler.take_back() == frete::Frete::Position(0, 10));
+  BOOST_CHECK(*scheduler.take_back() == frete::Frete::Position(1, 20));
+  BOOST_CHECK(!scheduler.take_back());
+  scheduler.end(cloud, 500, 0, now + second);
+  BOOST_CHECK(!scheduler.pending(peer));
+  BOOST_CHECK_EQUAL(scheduler.delivered(cloud), 300);
+  BOOST_CHECK_EQUAL(scheduler.in_flight(peer), 200);
+}
+
 ELLE_TEST_SUITE()
 {
   auto timeout = valgrind(20);
   auto& suite = boost::unit_test::framework::master_test_suite();
   suite.add(BOOST_TEST_CASE(connection), 0, timeout);
   suite.add(BOOST_TEST_CASE(invalid_snapshot), 0, timeout);
+  suite.add(BOOST_TEST_CASE(read_files_grown), 0, timeout);
+  suite.add(BOOST_TEST_CASE(read_ahead), 0, timeout);
+  suite.add(BOOST_TEST_CASE(read_ahead_seek_back), 0, timeout);
+  suite.add(BOOST_TEST_CASE(mapped_read), 0, timeout);
+  suite.add(BOOST_TEST_CASE(mapped_read_truncated), 0, timeout);
+  suite.add(BOOST_TEST_CASE(handle_cache), 0, timeout);
+  suite.add(BOOST_TEST_CASE(crypto_pool), 0, timeout);
+  suite.add(BOOST_TEST_CASE(compression), 0, timeout);
+  suite.add(BOOST_TEST_CASE(directory_scan), 0, timeout);
+  suite.add(BOOST_TEST_CASE(zip_stream), 0, timeout);
+  suite.add(BOOST_TEST_CASE(file_hashes), 0, timeout);
+  suite.add(BOOST_TEST_CASE(dedup), 0, timeout);
+  suite.add(BOOST_TEST_CASE(checksums), 0, timeout);
+  suite.add(BOOST_TEST_CASE(sent_checksums), 0, timeout);
+  suite.add(BOOST_TEST_CASE(snapshot_journal), 0, timeout);
+  suite.add(BOOST_TEST_CASE(snapshot_positions), 0, timeout);
+  suite.add(BOOST_TEST_CASE(out_of_order), 0, timeout);
+  suite.add(BOOST_TEST_CASE(fetch_controller), 0, timeout);
+  suite.add(BOOST_TEST_CASE(disk_writer), 0, timeout);
+  suite.add(BOOST_TEST_CASE(encoding), 0, timeout);
+  suite.add(BOOST_TEST_CASE(sparse), 0, timeout);
+  suite.add(BOOST_TEST_CASE(buffer_pool), 0, timeout);
+  suite.add(BOOST_TEST_CASE(source_scheduler), 0, timeout);
 }
@@ -222,6 +222,50 @@ namespace infinit
                                 bytes_transfered, reason, message, attempt));
     }
 
+    void
+    CompositeReporter::_transaction_deduplication(
+      std::string const& transaction_id,
+      uint64_t file_count,
+      uint64_t total_size,
+      uint64_t duplicate_count,
+      uint64_t duplicate_size)
+    {
+      this->_dispatch(std::bind(&Reporter::_transaction_deduplication,
+                                std::placeholders::_1,
+                                transaction_id, file_count, total_size,
+                                duplicate_count, duplicate_size));
+    }
+
+    void
+    CompositeReporter::_transaction_transfer_tuning(
+      std::string const& transaction_id,
+      int pipeline_depth,
+      uint64_t chunk_size,
+      float rtt,
+      float goodput,
+      uint64_t bdp)
+    {
+      this->_dispatch(std::bind(&Reporter::_transaction_transfer_tuning,
+                                std::placeholders::_1,
+                                transaction_id, pipeline_depth, chunk_size,
+                                rtt, goodput, bdp));
+    }
+
+    void
+    CompositeReporter::_transaction_cloud_reads(
+      std::string const& transaction_id,
+      uint64_t requests,
+      uint64_t hedged,
+      uint64_t hedge_wins,
+      uint64_t split,
+      float hedge_threshold)
+    {
+      this->_dispatch(std::bind(&Reporter::_transaction_cloud_reads,
+                                std::placeholders::_1,
+                                transaction_id, requests, hedged, hedge_wins,
+                                split, hedge_threshold));
+    }
+
     void
     CompositeReporter::_aws_error(std::string const& transaction_id,
                                   std::string const& operation,
@@ -95,6 +95,29 @@ namespace infinit
                                std::string const& message,
                                int attempt) override;
       void
+      _transaction_deduplication(std::string const& transaction_id,
+                                 uint64_t file_count,
+                                 uint64_t total_size,
+                                 uint64_t duplicate_count,
+                                 uint64_t duplicate_size) override;
+
+      void
+      _transaction_transfer_tuning(std::string const& transaction_id,
+                                   int pipeline_depth,
+                                   uint64_t chunk_size,
+                                   float rtt,
+                                   float goodput,
+                                   uint64_t bdp) override;
+
+      void
+      _transaction_cloud_reads(std::string const& transaction_id,
+                               uint64_t requests,
+                               uint64_t hedged,
+                               uint64_t hedge_wins,
+                               uint64_t split,
+                               float hedge_threshold) override;
+
+      void
       _aws_error(std::string const& transaction_id,
                  std::string const& operation,
                  std::string const& url,
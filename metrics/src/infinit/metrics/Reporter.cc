@@ -256,6 +256,44 @@ namespace infinit
                                           reason, message, attempt));
     }
 
+    void
+    Reporter::transaction_deduplication(std::string const& transaction_id,
+                                        uint64_t file_count,
+                                        uint64_t total_size,
+                                        uint64_t duplicate_count,
+                                        uint64_t duplicate_size)
+    {
+      this->_push(std::bind(&Reporter::_transaction_deduplication,
+                            this, transaction_id, file_count, total_size,
+                            duplicate_count, duplicate_size));
+    }
+
+    void
+    Reporter::transaction_transfer_tuning(std::string const& transaction_id,
+                                          int pipeline_depth,
+                                          uint64_t chunk_size,
+                                          float rtt,
+                                          float goodput,
+                                          uint64_t bdp)
+    {
+      this->_push(std::bind(&Reporter::_transaction_transfer_tuning,
+                            this, transaction_id, pipeline_depth, chunk_size,
+                            rtt, goodput, bdp));
+    }
+
+    void
+    Reporter::transaction_cloud_reads(std::string const& transaction_id,
+                                      uint64_t requests,
+                                      uint64_t hedged,
+                                      uint64_t hedge_wins,
+                                      uint64_t split,
+                                      float hedge_threshold)
+    {
+      this->_push(std::bind(&Reporter::_transaction_cloud_reads,
+                            this, transaction_id, requests, hedged, hedge_wins,
+                            split, hedge_threshold));
+    }
+
     void
     Reporter::aws_error(std::string const& transaction_id,
                         std::string const& operation,
@@ -601,6 +639,32 @@ namespace infinit
                                         int attempt)
     {}
 
+    void
+    Reporter::_transaction_deduplication(std::string const& transaction_id,
+                                         uint64_t file_count,
+                                         uint64_t total_size,
+                                         uint64_t duplicate_count,
+                                         uint64_t duplicate_size)
+    {}
+
+    void
+    Reporter::_transaction_transfer_tuning(std::string const& transaction_id,
+                                           int pipeline_depth,
+                                           uint64_t chunk_size,
+                                           float rtt,
+                                           float goodput,
+                                           uint64_t bdp)
+    {}
+
+    void
+    Reporter::_transaction_cloud_reads(std::string const& transaction_id,
+                                       uint64_t requests,
+                                       uint64_t hedged,
+                                       uint64_t hedge_wins,
+                                       uint64_t split,
+                                       float hedge_threshold)
+    {}
+
     void
     Reporter:: _aws_error(std::string const& transaction_id,
                           std::string const& operation,
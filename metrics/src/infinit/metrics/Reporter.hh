@@ -158,6 +158,43 @@ namespace infinit
                                std::string const& message,
                                int attempt=0);
 
+      /// Files of a transaction copied locally instead of being transfered.
+      void
+      transaction_deduplication(std::string const& transaction_id,
+                                uint64_t file_count,
+                                uint64_t total_size,
+                                uint64_t duplicate_count,
+                                uint64_t duplicate_size);
+
+      /** The fetch pipeline of a transfer was resized.
+      * @param rtt: smallest round trip time of requests, in seconds
+      * @param goodput: bytes received per second
+      * @param bdp: bandwidth-delay product, in bytes
+      */
+      void
+      transaction_transfer_tuning(std::string const& transaction_id,
+                                  int pipeline_depth,
+                                  uint64_t chunk_size,
+                                  float rtt,
+                                  float goodput,
+                                  uint64_t bdp);
+
+      /** Cloud buffer reads of a transfer.
+      * @param requests: requests sent, parts of split reads included
+      * @param hedged: requests a duplicate was sent for
+      * @param hedge_wins: hedged requests the duplicate answered first
+      * @param split: reads split in parallel range requests
+      * @param hedge_threshold: latency past which requests are hedged, in
+      *                         seconds, zero if not yet measured
+      */
+      void
+      transaction_cloud_reads(std::string const& transaction_id,
+                              uint64_t requests,
+                              uint64_t hedged,
+                              uint64_t hedge_wins,
+                              uint64_t split,
+                              float hedge_threshold);
+
       void
       aws_error(std::string const& transaction_id,
                 std::string const& operation,
@@ -233,6 +270,32 @@ namespace infinit
                                std::string const& message,
                                int attempt);
 
+      virtual
+      void
+      _transaction_deduplication(std::string const& transaction_id,
+                                 uint64_t file_count,
+                                 uint64_t total_size,
+                                 uint64_t duplicate_count,
+                                 uint64_t duplicate_size);
+
+      virtual
+      void
+      _transaction_transfer_tuning(std::string const& transaction_id,
+                                   int pipeline_depth,
+                                   uint64_t chunk_size,
+                                   float rtt,
+                                   float goodput,
+                                   uint64_t bdp);
+
+      virtual
+      void
+      _transaction_cloud_reads(std::string const& transaction_id,
+                               uint64_t requests,
+                               uint64_t hedged,
+                               uint64_t hedge_wins,
+                               uint64_t split,
+                               float hedge_threshold);
+
       virtual
       void
       _aws_error(std::string const& transaction_id,
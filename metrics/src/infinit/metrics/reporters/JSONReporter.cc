@@ -184,6 +184,65 @@ namespace infinit
       this->_send(this->_transaction_dest, data);
     }
 
+    void
+    JSONReporter::_transaction_deduplication(std::string const& transaction_id,
+                                             uint64_t file_count,
+                                             uint64_t total_size,
+                                             uint64_t duplicate_count,
+                                             uint64_t duplicate_size)
+    {
+      elle::json::Object data;
+      data[this->_key_str(JSONKey::event)] = std::string("deduplication");
+      data[this->_key_str(JSONKey::transaction_id)] = transaction_id;
+      data[this->_key_str(JSONKey::file_count)] = file_count;
+      data[this->_key_str(JSONKey::total_size)] = total_size;
+      data[this->_key_str(JSONKey::duplicate_count)] = duplicate_count;
+      data[this->_key_str(JSONKey::duplicate_size)] = duplicate_size;
+      data[this->_key_str(JSONKey::duplicate_ratio)] =
+        total_size ? float(duplicate_size) / total_size : 0.0f;
+      this->_send(this->_transaction_dest, data);
+    }
+
+    void
+    JSONReporter::_transaction_transfer_tuning(
+      std::string const& transaction_id,
+      int pipeline_depth,
+      uint64_t chunk_size,
+      float rtt,
+      float goodput,
+      uint64_t bdp)
+    {
+      elle::json::Object data;
+      data[this->_key_str(JSONKey::event)] = std::string("transfer_tuning");
+      data[this->_key_str(JSONKey::transaction_id)] = transaction_id;
+      data[this->_key_str(JSONKey::pipeline_depth)] = pipeline_depth;
+      data[this->_key_str(JSONKey::chunk_size)] = chunk_size;
+      data[this->_key_str(JSONKey::rtt)] = rtt;
+      data[this->_key_str(JSONKey::goodput)] = goodput;
+      data[this->_key_str(JSONKey::bdp)] = bdp;
+      this->_send(this->_transaction_dest, data);
+    }
+
+    void
+    JSONReporter::_transaction_cloud_reads(
+      std::string const& transaction_id,
+      uint64_t requests,
+      uint64_t hedged,
+      uint64_t hedge_wins,
+      uint64_t split,
+      float hedge_threshold)
+    {
+      elle::json::Object data;
+      data[this->_key_str(JSONKey::event)] = std::string("cloud_reads");
+      data[this->_key_str(JSONKey::transaction_id)] = transaction_id;
+      data[this->_key_str(JSONKey::requests)] = requests;
+      data[this->_key_str(JSONKey::hedged)] = hedged;
+      data[this->_key_str(JSONKey::hedge_wins)] = hedge_wins;
+      data[this->_key_str(JSONKey::split)] = split;
+      data[this->_key_str(JSONKey::hedge_threshold)] = hedge_threshold;
+      this->_send(this->_transaction_dest, data);
+    }
+
     void
     JSONReporter::_aws_error(std::string const& transaction_id,
                              std::string const& operation,
@@ -673,6 +732,32 @@ namespace infinit
           return "used_storage";
         case JSONKey::extensions:
           return "extensions";
+        case JSONKey::duplicate_count:
+          return "duplicate_count";
+        case JSONKey::duplicate_size:
+          return "duplicate_size";
+        case JSONKey::duplicate_ratio:
+          return "duplicate_ratio";
+        case JSONKey::pipeline_depth:
+          return "pipeline_depth";
+        case JSONKey::chunk_size:
+          return "chunk_size";
+        case JSONKey::rtt:
+          return "rtt";
+        case JSONKey::goodput:
+          return "goodput";
+        case JSONKey::bdp:
+          return "bdp";
+        case JSONKey::requests:
+          return "requests";
+        case JSONKey::hedged:
+          return "hedged";
+        case JSONKey::hedge_wins:
+          return "hedge_wins";
+        case JSONKey::split:
+          return "split";
+        case JSONKey::hedge_threshold:
+          return "hedge_threshold";
         default:
           ELLE_ABORT("invalid metrics JSON key: %s", k);
       }